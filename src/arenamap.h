@@ -0,0 +1,307 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ARENAMAP_H
+#define BITCOIN_ARENAMAP_H
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <iterator>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Hash map with open addressing whose values live in a chunked arena.
+ *
+ * The table itself is a flat array of 8-byte slots (32 bits of the hash and
+ * the index of the node), probed linearly, so a lookup touches one cache line
+ * of the table before reaching the node. Nodes are carved out of fixed-size
+ * chunks and recycled through a free list instead of being allocated one by
+ * one, which saves the per-node malloc overhead and keeps nodes close in
+ * memory.
+ *
+ * Like std::unordered_map, references to values stay valid until the value
+ * is erased (nodes never move), while iterators are invalidated by inserts
+ * that grow the table. Erasing does not move other entries, so iterating and
+ * erasing at the same time works as with std::unordered_map.
+ *
+ * Erased nodes go to the free list; memory is only given back by clear().
+ */
+template <typename K, typename T, typename Hash>
+class arenamap
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t node;
+    };
+    typedef typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type Storage;
+
+    static constexpr uint32_t SLOT_EMPTY = 0xffffffff;
+    static constexpr uint32_t SLOT_DELETED = 0xfffffffe;
+    static constexpr uint32_t CHUNK_SHIFT = 8;
+    static constexpr uint32_t CHUNK_NODES = 1 << CHUNK_SHIFT;
+
+    std::vector<Slot> slots;
+    std::vector<std::unique_ptr<Storage[]>> chunks;
+    //! Nodes handed out from the chunks so far, including those on the free list
+    uint32_t nodes_used;
+    //! Head of the list of erased nodes, or SLOT_EMPTY
+    uint32_t free_head;
+    size_t entries;
+    //! Number of SLOT_DELETED slots
+    size_t deleted;
+    Hash hasher;
+
+    value_type* node(uint32_t index) const
+    {
+        return reinterpret_cast<value_type*>(&chunks[index >> CHUNK_SHIFT][index & (CHUNK_NODES - 1)]);
+    }
+
+    static bool live(const Slot& slot) { return slot.node < SLOT_DELETED; }
+
+    template <typename... Args>
+    uint32_t alloc_node(Args&&... args)
+    {
+        uint32_t index;
+        if (free_head != SLOT_EMPTY) {
+            index = free_head;
+            free_head = *reinterpret_cast<uint32_t*>(node(index));
+        } else {
+            assert(nodes_used < SLOT_DELETED);
+            if ((nodes_used >> CHUNK_SHIFT) == chunks.size()) {
+                chunks.emplace_back(new Storage[CHUNK_NODES]);
+            }
+            index = nodes_used++;
+        }
+        try {
+            new (node(index)) value_type(std::forward<Args>(args)...);
+        } catch (...) {
+            free_node_storage(index);
+            throw;
+        }
+        return index;
+    }
+
+    void free_node_storage(uint32_t index)
+    {
+        new (node(index)) uint32_t(free_head);
+        free_head = index;
+    }
+
+    void free_node(uint32_t index)
+    {
+        node(index)->~value_type();
+        free_node_storage(index);
+    }
+
+    /** Position of key in slots, or slots.size() if absent. */
+    size_t find_pos(const K& key, uint32_t hash) const
+    {
+        if (slots.empty()) return 0;
+        const size_t mask = slots.size() - 1;
+        for (size_t pos = hash & mask; ; pos = (pos + 1) & mask) {
+            const Slot& slot = slots[pos];
+            if (slot.node == SLOT_EMPTY) return slots.size();
+            if (live(slot) && slot.hash == hash && node(slot.node)->first == key) return pos;
+        }
+    }
+
+    /** Put a node into the first free slot of its probe sequence. The key must be absent. */
+    size_t insert_slot(uint32_t hash, uint32_t index)
+    {
+        const size_t mask = slots.size() - 1;
+        size_t pos = hash & mask;
+        while (live(slots[pos])) {
+            pos = (pos + 1) & mask;
+        }
+        if (slots[pos].node == SLOT_DELETED) deleted--;
+        slots[pos].hash = hash;
+        slots[pos].node = index;
+        return pos;
+    }
+
+    /** Make room for one more entry, keeping the table at most 3/4 full (erased slots included). */
+    void reserve_one()
+    {
+        if ((entries + deleted + 1) * 4 <= slots.size() * 3) return;
+        // Rehash to at most half full; if mostly erased slots were in the way this keeps the size.
+        size_t new_size = 16;
+        while (new_size < (entries + 1) * 2) new_size *= 2;
+        std::vector<Slot> old_slots(new_size, Slot{0, SLOT_EMPTY});
+        old_slots.swap(slots);
+        deleted = 0;
+        for (const Slot& slot : old_slots) {
+            if (live(slot)) insert_slot(slot.hash, slot.node);
+        }
+    }
+
+    uint32_t hash_key(const K& key) const { return static_cast<uint32_t>(hasher(key)); }
+
+    void destroy()
+    {
+        for (const Slot& slot : slots) {
+            if (live(slot)) node(slot.node)->~value_type();
+        }
+    }
+
+public:
+    template <bool Const>
+    class iter
+    {
+        friend class arenamap;
+        typedef typename std::conditional<Const, const arenamap*, arenamap*>::type map_ptr;
+        map_ptr map;
+        size_t pos;
+
+        void skip()
+        {
+            while (pos < map->slots.size() && !live(map->slots[pos])) ++pos;
+        }
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename arenamap::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename std::conditional<Const, const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<Const, const value_type&, value_type&>::type reference;
+
+        iter() : map(nullptr), pos(0) {}
+        iter(map_ptr map_, size_t pos_) : map(map_), pos(pos_) {}
+        template <bool C = Const, typename = typename std::enable_if<C>::type>
+        iter(const iter<false>& other) : map(other.map), pos(other.pos) {}
+
+        reference operator*() const { return *map->node(map->slots[pos].node); }
+        pointer operator->() const { return map->node(map->slots[pos].node); }
+        iter& operator++() { ++pos; skip(); return *this; }
+        iter operator++(int) { iter copy(*this); ++(*this); return copy; }
+        bool operator==(const iter& other) const { return pos == other.pos; }
+        bool operator!=(const iter& other) const { return pos != other.pos; }
+
+        friend class iter<!Const>;
+    };
+    typedef iter<false> iterator;
+    typedef iter<true> const_iterator;
+
+    explicit arenamap(const Hash& hasher_ = Hash()) : nodes_used(0), free_head(SLOT_EMPTY), entries(0), deleted(0), hasher(hasher_) {}
+    arenamap(arenamap&& other) : slots(std::move(other.slots)), chunks(std::move(other.chunks)), nodes_used(other.nodes_used), free_head(other.free_head), entries(other.entries), deleted(other.deleted), hasher(other.hasher)
+    {
+        other.slots.clear();
+        other.chunks.clear();
+        other.nodes_used = 0;
+        other.free_head = SLOT_EMPTY;
+        other.entries = 0;
+        other.deleted = 0;
+    }
+    arenamap(const arenamap&) = delete;
+    arenamap& operator=(const arenamap&) = delete;
+    ~arenamap() { destroy(); }
+
+    iterator begin() { iterator it(this, 0); it.skip(); return it; }
+    const_iterator begin() const { const_iterator it(this, 0); it.skip(); return it; }
+    iterator end() { return iterator(this, slots.size()); }
+    const_iterator end() const { return const_iterator(this, slots.size()); }
+
+    size_type size() const { return entries; }
+    bool empty() const { return entries == 0; }
+
+    iterator find(const K& key) { return iterator(this, find_pos(key, hash_key(key))); }
+    const_iterator find(const K& key) const { return const_iterator(this, find_pos(key, hash_key(key))); }
+    size_type count(const K& key) const { return find(key) != end(); }
+
+    /** Construct a value_type from args and insert it unless its key is present. */
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args)
+    {
+        uint32_t index = alloc_node(std::forward<Args>(args)...);
+        const uint32_t hash = hash_key(node(index)->first);
+        size_t pos = find_pos(node(index)->first, hash);
+        if (pos != slots.size()) {
+            free_node(index);
+            return std::make_pair(iterator(this, pos), false);
+        }
+        // Only an actual insert may grow the table and invalidate iterators
+        reserve_one();
+        entries++;
+        return std::make_pair(iterator(this, insert_slot(hash, index)), true);
+    }
+
+    T& operator[](const K& key)
+    {
+        const uint32_t hash = hash_key(key);
+        size_t pos = find_pos(key, hash);
+        if (pos != slots.size()) return node(slots[pos].node)->second;
+        reserve_one();
+        uint32_t index = alloc_node(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>());
+        entries++;
+        return node(slots[insert_slot(hash, index)].node)->second;
+    }
+
+    /** Erase the entry at it and return an iterator to the next one. */
+    iterator erase(iterator it)
+    {
+        Slot& slot = slots[it.pos];
+        free_node(slot.node);
+        slot.node = SLOT_DELETED;
+        entries--;
+        deleted++;
+        ++it;
+        return it;
+    }
+
+    size_type erase(const K& key)
+    {
+        iterator it = find(key);
+        if (it == end()) return 0;
+        erase(it);
+        return 1;
+    }
+
+    /** Remove all entries and give the table and the arena back. */
+    void clear()
+    {
+        destroy();
+        std::vector<Slot>().swap(slots);
+        std::vector<std::unique_ptr<Storage[]>>().swap(chunks);
+        nodes_used = 0;
+        free_head = SLOT_EMPTY;
+        entries = 0;
+        deleted = 0;
+    }
+
+    /** Exchange the contents with other, which must have been built with an equal hasher. */
+    void swap(arenamap& other)
+    {
+        slots.swap(other.slots);
+        chunks.swap(other.chunks);
+        std::swap(nodes_used, other.nodes_used);
+        std::swap(free_head, other.free_head);
+        std::swap(entries, other.entries);
+        std::swap(deleted, other.deleted);
+    }
+
+    Hash hash_function() const { return hasher; }
+
+    //! For memusage: number of slots in the table
+    size_t bucket_count() const { return slots.capacity(); }
+    //! For memusage: number of arena chunks, and capacity of the chunk list
+    size_t chunk_count() const { return chunks.size(); }
+    size_t chunk_capacity() const { return chunks.capacity(); }
+
+    static constexpr size_t SLOT_BYTES = sizeof(Slot);
+    static constexpr size_t CHUNK_BYTES = sizeof(Storage) * CHUNK_NODES;
+    static constexpr size_t CHUNK_POINTER_BYTES = sizeof(std::unique_ptr<Storage[]>);
+};
+
+#endif // BITCOIN_ARENAMAP_H
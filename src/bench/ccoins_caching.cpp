@@ -84,4 +84,32 @@ static void CCoinsCaching(benchmark::State& state)
     }
 }
 
+// Add a block's worth of coins to an empty cache, look all of them up again
+// and spend them, which is how ConnectBlock uses pcoinsTip during IBD.
+static void CCoinsCacheFill(benchmark::State& state)
+{
+    CCoinsView coinsDummy;
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 10000; i++) {
+        outpoints.emplace_back(Hash(BEGIN(i), END(i)), i % 4);
+    }
+    const CTxOut txout(1 * CENT, CScript() << OP_TRUE);
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache coins(&coinsDummy);
+        for (const COutPoint& outpoint : outpoints) {
+            coins.AddCoin(outpoint, Coin(txout, 1, false), false);
+        }
+        for (const COutPoint& outpoint : outpoints) {
+            bool have = coins.HaveCoin(outpoint);
+            assert(have);
+        }
+        for (const COutPoint& outpoint : outpoints) {
+            coins.SpendCoin(outpoint);
+        }
+        assert(coins.GetCacheSize() == 0);
+    }
+}
+
 BENCHMARK(CCoinsCaching, 170 * 1000);
+BENCHMARK(CCoinsCacheFill, 100);
@@ -6,7 +6,10 @@
 #include <util.h>
 #include <validation.h>
 #include <checkqueue.h>
+#include <key.h>
 #include <prevector.h>
+#include <pubkey.h>
+#include <script/sigcache.h>
 #include <vector>
 #include <boost/thread/thread.hpp>
 #include <random.h>
@@ -60,3 +63,64 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.join_all();
 }
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+
+// This Benchmark tests the contention of the CheckQueue workers on the
+// signature cache, with checks that all look up a signature it holds, as
+// when connecting a block of transactions accepted to the mempool.
+static void CCheckQueueSignatureCacheHits(benchmark::State& state)
+{
+    struct CachedSignature {
+        std::vector<unsigned char> vchSig;
+        CPubKey pubkey;
+        uint256 hash;
+    };
+    struct SigCacheJob {
+        const CachingTransactionSignatureChecker* checker;
+        const CachedSignature* sig;
+        SigCacheJob() : checker(nullptr), sig(nullptr) {}
+        SigCacheJob(const CachingTransactionSignatureChecker* checkerIn, const CachedSignature* sigIn) : checker(checkerIn), sig(sigIn) {}
+        bool operator()()
+        {
+            return checker->VerifySignature(sig->vchSig, sig->pubkey, sig->hash);
+        }
+        void swap(SigCacheJob& x){std::swap(checker, x.checker); std::swap(sig, x.sig);};
+    };
+
+    ECCVerifyHandle verifyHandle;
+    InitSignatureCache();
+    const CTransaction txTo;
+    PrecomputedTransactionData txdata(txTo);
+    const CachingTransactionSignatureChecker checker(&txTo, 0, 0, true, txdata);
+    FastRandomContext insecure_rand(true);
+    CKey key;
+    key.MakeNewKey(true);
+    std::vector<CachedSignature> vSigs(BATCHES * BATCH_SIZE);
+    for (CachedSignature& sig : vSigs) {
+        sig.hash = insecure_rand.rand256();
+        key.Sign(sig.hash, sig.vchSig);
+        sig.pubkey = key.GetPubKey();
+        // Verified once, and stored in the cache
+        assert(checker.VerifySignature(sig.vchSig, sig.pubkey, sig.hash));
+    }
+
+    CCheckQueue<SigCacheJob> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (auto x = 0; x < std::max(MIN_CORES, GetNumCores()); ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<SigCacheJob> control(&queue);
+        std::vector<std::vector<SigCacheJob>> vBatches(BATCHES);
+        for (size_t i = 0; i < BATCHES; ++i) {
+            vBatches[i].reserve(BATCH_SIZE);
+            for (size_t x = 0; x < BATCH_SIZE; ++x)
+                vBatches[i].emplace_back(&checker, &vSigs[i * BATCH_SIZE + x]);
+            control.Add(vBatches[i]);
+        }
+        bool success = control.Wait();
+        assert(success);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+BENCHMARK(CCheckQueueSignatureCacheHits, 300);
@@ -111,4 +111,54 @@ static void MempoolEviction(benchmark::State& state)
     }
 }
 
+// Fill a mempool with packages of linked transactions, each a parent with two
+// children and a grandchild spending both, under a limit on its memory usage
+// that keeps it trimming, as a full mempool does. The pool's memory usage per
+// entry sets how many of the packages fit.
+static void MempoolFill(benchmark::State& state)
+{
+    std::vector<CTransactionRef> txs;
+    for (uint32_t i = 0; i < 1000; i++) {
+        CMutableTransaction parent;
+        parent.vin.resize(1);
+        parent.vin[0].scriptSig = CScript() << CScriptNum(i);
+        parent.vout.resize(2);
+        for (CTxOut& txout : parent.vout) {
+            txout.scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+            txout.nValue = 10 * COIN;
+        }
+        txs.push_back(MakeTransactionRef(parent));
+
+        CMutableTransaction grandchild;
+        grandchild.vout.resize(1);
+        grandchild.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        grandchild.vout[0].nValue = 10 * COIN;
+        for (uint32_t n = 0; n < 2; n++) {
+            CMutableTransaction child;
+            child.vin.resize(1);
+            child.vin[0].prevout = COutPoint(txs.back()->GetHash(), n);
+            child.vin[0].scriptSig = CScript() << OP_1;
+            child.vout.resize(1);
+            child.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+            child.vout[0].nValue = 10 * COIN;
+            const CTransaction childTx(child);
+            grandchild.vin.emplace_back(COutPoint(childTx.GetHash(), 0));
+            grandchild.vin.back().scriptSig = CScript() << OP_1;
+            txs.push_back(MakeTransactionRef(childTx));
+        }
+        txs.push_back(MakeTransactionRef(grandchild));
+    }
+
+    while (state.KeepRunning()) {
+        CTxMemPool pool;
+        for (size_t i = 0; i < txs.size(); i++) {
+            AddTx(*txs[i], 1000 + (i * 7919) % 10000, pool);
+            if (i % 4 == 3)
+                pool.TrimToSize(1 << 20);
+        }
+        assert(pool.size() > 0);
+    }
+}
+
 BENCHMARK(MempoolEviction, 41000);
+BENCHMARK(MempoolFill, 30);
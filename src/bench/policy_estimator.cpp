@@ -0,0 +1,99 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <policy/fees.h>
+#include <txmempool.h>
+
+#include <vector>
+
+static const unsigned int TXS_PER_BLOCK = 200;
+//! Fee of the i-th transaction of a block
+static CAmount Fee(unsigned int i) { return 1000 + 2500 * i; }
+//! Fees of the transactions left for a block more
+static const CAmount LOW_FEE = Fee(TXS_PER_BLOCK / 4);
+
+// Two blocks' worth, as the transactions of a block may be in the mempool
+// until the block after the next
+static std::vector<CTransactionRef> CreateTransactions()
+{
+    std::vector<CTransactionRef> txs;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx.vout[0].nValue = 10 * COIN;
+    for (unsigned int i = 0; i < 2 * TXS_PER_BLOCK; i++) {
+        tx.vin[0].prevout.n = i;
+        txs.push_back(MakeTransactionRef(tx));
+    }
+    return txs;
+}
+
+// Track a block's worth of transactions, and have the next block confirm all
+// but the lowest fee quarter of them, which the block after that confirms.
+static void ProcessBlock(CBlockPolicyEstimator& feeEst, const std::vector<CTransactionRef>& txs, unsigned int nHeight,
+                         std::vector<CTxMemPoolEntry>& entries, std::vector<CTxMemPoolEntry>& leftOver)
+{
+    std::vector<const CTxMemPoolEntry*> block;
+    for (const CTxMemPoolEntry& entry : leftOver) {
+        block.push_back(&entry);
+    }
+    for (const CTxMemPoolEntry& entry : entries) {
+        if (entry.GetFee() >= LOW_FEE)
+            block.push_back(&entry);
+    }
+    feeEst.processBlock(nHeight, block);
+
+    leftOver.clear();
+    for (const CTxMemPoolEntry& entry : entries) {
+        if (entry.GetFee() < LOW_FEE)
+            leftOver.push_back(entry);
+    }
+    entries.clear();
+    LockPoints lp;
+    for (unsigned int i = 0; i < TXS_PER_BLOCK; i++) {
+        entries.emplace_back(txs[(nHeight % 2) * TXS_PER_BLOCK + i], Fee(i), 0, nHeight, false, 4, lp);
+    }
+    for (const CTxMemPoolEntry& entry : entries) {
+        feeEst.processTransaction(entry, true);
+    }
+}
+
+// Record the transactions of a block and recalculate the estimates, as done
+// for every block connected.
+static void PolicyEstimatorProcessBlock(benchmark::State& state)
+{
+    const std::vector<CTransactionRef> txs = CreateTransactions();
+    std::vector<CTxMemPoolEntry> entries, leftOver;
+    CBlockPolicyEstimator feeEst;
+    unsigned int nHeight = 0;
+    while (state.KeepRunning()) {
+        ProcessBlock(feeEst, txs, ++nHeight, entries, leftOver);
+    }
+}
+
+// Look up the estimates for every target, as wallets and the RPC do.
+static void PolicyEstimatorEstimateSmartFee(benchmark::State& state)
+{
+    const std::vector<CTransactionRef> txs = CreateTransactions();
+    std::vector<CTxMemPoolEntry> entries, leftOver;
+    CBlockPolicyEstimator feeEst;
+    unsigned int nHeight = 0;
+    while (nHeight < 200) {
+        ProcessBlock(feeEst, txs, ++nHeight, entries, leftOver);
+    }
+
+    FeeCalculation feeCalc;
+    while (state.KeepRunning()) {
+        for (int confTarget = 1; confTarget <= 100; confTarget++) {
+            feeEst.estimateSmartFee(confTarget, &feeCalc, false);
+            feeEst.estimateSmartFee(confTarget, &feeCalc, true);
+        }
+    }
+}
+
+BENCHMARK(PolicyEstimatorProcessBlock, 1000);
+BENCHMARK(PolicyEstimatorEstimateSmartFee, 20 * 1000);
@@ -105,4 +105,46 @@ static void VerifyScriptBench(benchmark::State& state)
     }
 }
 
+// Microbenchmark for verification of a P2PKH spend, the kind of script most
+// inputs, coinstakes included, have to verify.
+static void VerifyScriptP2PKHBench(benchmark::State& state)
+{
+    const int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_LOW_S |
+                      SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK | SCRIPT_VERIFY_NULLFAIL;
+
+    // Keypair.
+    CKey key;
+    static const std::array<unsigned char, 32> vchKey = {
+        {
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1
+        }
+    };
+    key.Set(vchKey.begin(), vchKey.end(), true);
+    CPubKey pubkey = key.GetPubKey();
+
+    // Script.
+    CScript scriptPubKey = CScript() << OP_DUP << OP_HASH160 << ToByteVector(pubkey.GetID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+    CTransaction txCredit = BuildCreditingTransaction(scriptPubKey);
+    CMutableTransaction txSpend = BuildSpendingTransaction(CScript(), txCredit);
+    std::vector<unsigned char> vchSig;
+    key.Sign(SignatureHash(scriptPubKey, txSpend, 0, SIGHASH_ALL, txCredit.vout[0].nValue, SIGVERSION_BASE), vchSig, 0);
+    vchSig.push_back(static_cast<unsigned char>(SIGHASH_ALL));
+    txSpend.vin[0].scriptSig = CScript() << vchSig << ToByteVector(pubkey);
+
+    // Benchmark.
+    while (state.KeepRunning()) {
+        ScriptError err;
+        bool success = VerifyScript(
+            txSpend.vin[0].scriptSig,
+            txCredit.vout[0].scriptPubKey,
+            &txSpend.vin[0].scriptWitness,
+            flags,
+            MutableTransactionSignatureChecker(&txSpend, 0, txCredit.vout[0].nValue),
+            &err);
+        assert(err == SCRIPT_ERR_OK);
+        assert(success);
+    }
+}
+
 BENCHMARK(VerifyScriptBench, 6300);
+BENCHMARK(VerifyScriptP2PKHBench, 6300);
@@ -144,6 +144,9 @@ protected:
 
 public:
     CBlockHeader header;
+    // DeepOnion: the block signature is not covered by the header or the
+    // short ids, so it has to travel with the compact block.
+    std::vector<unsigned char> vchBlockSig;
 
     // Dummy for deserialization
     CBlockHeaderAndShortTxIDs() {}
@@ -185,6 +188,7 @@ public:
         }
 
         READWRITE(prefilledtxn);
+        READWRITE(vchBlockSig);
 
         if (ser_action.ForRead())
             FillShortTxIDSelector();
@@ -198,6 +202,7 @@ protected:
     CTxMemPool* pool;
 public:
     CBlockHeader header;
+    std::vector<unsigned char> vchBlockSig;
     explicit PartiallyDownloadedBlock(CTxMemPool* poolIn) : pool(poolIn) {}
 
     // extra_txn is a list of extra transactions to look at, in <witness hash, reference> form
@@ -0,0 +1,216 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfile.h>
+
+#include <crypto/common.h>
+#include <fs.h>
+#include <util.h>
+#include <validation.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/** An open block or undo file, kept alive by the readers using it. */
+class CBlockFileHandle
+{
+private:
+    FILE* file;
+#ifdef WIN32
+    //! Reads have to seek the shared FILE
+    std::mutex cs;
+#else
+    void* pMap;
+    size_t nMapSize;
+#endif
+
+public:
+    explicit CBlockFileHandle(FILE* fileIn) : file(fileIn)
+#ifndef WIN32
+        , pMap(nullptr), nMapSize(0)
+#endif
+    {
+    }
+
+    ~CBlockFileHandle()
+    {
+#ifndef WIN32
+        if (pMap) munmap(pMap, nMapSize);
+#endif
+        fclose(file);
+    }
+
+    CBlockFileHandle(const CBlockFileHandle&) = delete;
+    CBlockFileHandle& operator=(const CBlockFileHandle&) = delete;
+
+    //! Map the whole file into memory; only for files that no longer change
+    void Map()
+    {
+#ifndef WIN32
+        struct stat st;
+        if (fstat(fileno(file), &st) != 0 || st.st_size <= 0) return;
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fileno(file), 0);
+        if (p == MAP_FAILED) return;
+        pMap = p;
+        nMapSize = st.st_size;
+#endif
+    }
+
+    size_t Read(uint64_t nPos, char* pch, size_t nSize)
+    {
+#ifdef WIN32
+        std::lock_guard<std::mutex> lock(cs);
+        if (fseek(file, nPos, SEEK_SET)) return 0;
+        return fread(pch, 1, nSize, file);
+#else
+        if (pMap && nPos + nSize <= nMapSize) {
+            memcpy(pch, (const char*)pMap + nPos, nSize);
+            return nSize;
+        }
+        size_t nRead = 0;
+        while (nRead < nSize) {
+            ssize_t n = pread(fileno(file), pch + nRead, nSize - nRead, nPos + nRead);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            nRead += n;
+        }
+        return nRead;
+#endif
+    }
+};
+
+CBlockFileCache::CBlockFileCache(size_t nMaxOpenIn) : nMaxOpen(nMaxOpenIn), fMmap(DEFAULT_BLOCKFILE_MMAP), nLastFile(0)
+{
+}
+
+CBlockFileCache::~CBlockFileCache()
+{
+}
+
+std::shared_ptr<CBlockFileHandle> CBlockFileCache::Get(const CDiskBlockPos& pos, const char* prefix)
+{
+    if (pos.IsNull())
+        return nullptr;
+    const FileKey key(prefix[0], pos.nFile);
+
+    std::lock_guard<std::mutex> lock(cs);
+    auto it = mapFiles.find(key);
+    if (it != mapFiles.end()) {
+        lruFiles.splice(lruFiles.begin(), lruFiles, it->second);
+        return it->second->second;
+    }
+
+    fs::path path = GetBlockPosFilename(pos, prefix);
+    FILE* file = fsbridge::fopen(path, "rb");
+    if (!file) {
+        LogPrintf("Unable to open file %s\n", path.string());
+        return nullptr;
+    }
+    std::shared_ptr<CBlockFileHandle> handle = std::make_shared<CBlockFileHandle>(file);
+    // Undo data is appended to older files as blocks are connected, so
+    // only block files are safe to map
+    if (fMmap && key.first == 'b' && pos.nFile < nLastFile) {
+        handle->Map();
+    }
+    lruFiles.emplace_front(key, handle);
+    mapFiles[key] = lruFiles.begin();
+    if (lruFiles.size() > nMaxOpen) {
+        // Readers still holding the evicted file close it when done
+        mapFiles.erase(lruFiles.back().first);
+        lruFiles.pop_back();
+    }
+    return handle;
+}
+
+size_t CBlockFileCache::Read(const CDiskBlockPos& pos, const char* prefix, char* pch, size_t nSize)
+{
+    std::shared_ptr<CBlockFileHandle> handle = Get(pos, prefix);
+    if (!handle) return 0;
+    return handle->Read(pos.nPos, pch, nSize);
+}
+
+bool CBlockFileCache::ReadRecordSize(const CDiskBlockPos& pos, const char* prefix, unsigned int& nSize)
+{
+    if (pos.nPos < sizeof(nSize)) return false;
+    unsigned char buf[sizeof(nSize)];
+    if (Read(CDiskBlockPos(pos.nFile, pos.nPos - sizeof(nSize)), prefix, (char*)buf, sizeof(buf)) != sizeof(buf)) return false;
+    nSize = ReadLE32(buf);
+    return true;
+}
+
+void CBlockFileCache::SetLastFile(int nFile)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    nLastFile = nFile;
+    // A reindex can go back to an earlier file, which may have been mapped
+    // while a later one was written to
+    auto it = mapFiles.find(FileKey('b', nFile));
+    if (it != mapFiles.end()) {
+        lruFiles.erase(it->second);
+        mapFiles.erase(it);
+    }
+}
+
+void CBlockFileCache::Close(int nFile)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    for (char c : {'b', 'r'}) {
+        auto it = mapFiles.find(FileKey(c, nFile));
+        if (it != mapFiles.end()) {
+            lruFiles.erase(it->second);
+            mapFiles.erase(it);
+        }
+    }
+}
+
+void CBlockFileCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(cs);
+    mapFiles.clear();
+    lruFiles.clear();
+}
+
+bool CBlockFileReader::Fill(size_t nSize)
+{
+    size_t nAvail = vchBuf.size() - nBufPos;
+    if (nAvail >= nSize) return true;
+    // Keep the unread bytes and read the rest after them
+    posBuf.nPos += nBufPos;
+    vchBuf.erase(vchBuf.begin(), vchBuf.begin() + nBufPos);
+    nBufPos = 0;
+    size_t nWant = std::max(nSize, nAvail + BLOCKFILE_READ_AHEAD) - nAvail;
+    vchBuf.resize(nAvail + nWant);
+    size_t nRead = cache.Read(CDiskBlockPos(posBuf.nFile, posBuf.nPos + nAvail), prefix, vchBuf.data() + nAvail, nWant);
+    vchBuf.resize(nAvail + nRead);
+    return vchBuf.size() >= nSize;
+}
+
+void CBlockFileReader::read(char* pch, size_t nSize)
+{
+    if (!Fill(nSize))
+        throw std::ios_base::failure("CBlockFileReader::read: end of file");
+    memcpy(pch, vchBuf.data() + nBufPos, nSize);
+    nBufPos += nSize;
+}
+
+void CBlockFileReader::ignore(size_t nSize)
+{
+    size_t nAvail = vchBuf.size() - nBufPos;
+    if (nSize <= nAvail) {
+        nBufPos += nSize;
+        return;
+    }
+    // Skip past the buffer without reading what is in between
+    posBuf.nPos += vchBuf.size() + (nSize - nAvail);
+    vchBuf.clear();
+    nBufPos = 0;
+}
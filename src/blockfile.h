@@ -0,0 +1,115 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILE_H
+#define BITCOIN_BLOCKFILE_H
+
+#include <chain.h>
+#include <serialize.h>
+
+#include <atomic>
+#include <ios>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+class CBlockFileHandle;
+
+//! Maximum number of block and undo files kept open for reading
+static const size_t MAX_BLOCKFILE_FDS = 16;
+//! -blockfilemmap default
+static const bool DEFAULT_BLOCKFILE_MMAP = false;
+//! Bytes a CBlockFileReader reads ahead when it runs out of data
+static const size_t BLOCKFILE_READ_AHEAD = 4096;
+
+/**
+ * Read access to the block (blk?????.dat) and undo (rev?????.dat) files.
+ *
+ * Files are opened once and kept in a bounded LRU, and read by position with
+ * pread, so concurrent readers neither reopen nor seek them. Block files that
+ * are no longer written to can also be mapped into memory (-blockfilemmap).
+ * Writing still goes through OpenBlockFile.
+ */
+class CBlockFileCache
+{
+private:
+    //! First letter of the prefix, and file number
+    typedef std::pair<char, int> FileKey;
+    typedef std::list<std::pair<FileKey, std::shared_ptr<CBlockFileHandle>>> FileList;
+
+    std::mutex cs;
+    //! Open files, most recently used first
+    FileList lruFiles;
+    std::map<FileKey, FileList::iterator> mapFiles;
+    const size_t nMaxOpen;
+    std::atomic<bool> fMmap;
+    //! Block file being written to, never mapped; the ones before it no longer change
+    int nLastFile;
+
+    std::shared_ptr<CBlockFileHandle> Get(const CDiskBlockPos& pos, const char* prefix);
+
+public:
+    explicit CBlockFileCache(size_t nMaxOpenIn = MAX_BLOCKFILE_FDS);
+    ~CBlockFileCache();
+
+    void SetMmap(bool fMmapIn) { fMmap = fMmapIn; }
+    /** Set the block file written to from now on, dropping it from the cache in case it is mapped. */
+    void SetLastFile(int nFile);
+
+    /** Read up to nSize bytes at pos. Returns the number of bytes read. */
+    size_t Read(const CDiskBlockPos& pos, const char* prefix, char* pch, size_t nSize);
+    /** Read the size the writers store in front of the block or undo data at pos. */
+    bool ReadRecordSize(const CDiskBlockPos& pos, const char* prefix, unsigned int& nSize);
+    /** Close file nFile, before it is deleted. */
+    void Close(int nFile);
+    /** Close all files. */
+    void Clear();
+};
+
+/** Stream reading a block or undo file from a position, through a CBlockFileCache. */
+class CBlockFileReader
+{
+private:
+    CBlockFileCache& cache;
+    const char* const prefix;
+    const int nType;
+    const int nVersion;
+    //! Position in the file of vchBuf[0]
+    CDiskBlockPos posBuf;
+    std::vector<char> vchBuf;
+    //! Next unread byte in vchBuf
+    size_t nBufPos;
+
+    //! Make sure at least nSize unread bytes are in vchBuf, reading ahead if possible
+    bool Fill(size_t nSize);
+
+public:
+    CBlockFileReader(CBlockFileCache& cacheIn, const CDiskBlockPos& pos, const char* prefixIn, int nTypeIn, int nVersionIn) :
+        cache(cacheIn), prefix(prefixIn), nType(nTypeIn), nVersion(nVersionIn), posBuf(pos), nBufPos(0) {}
+
+    CBlockFileReader(const CBlockFileReader&) = delete;
+    CBlockFileReader& operator=(const CBlockFileReader&) = delete;
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+
+    /** Read the next nSize bytes with a single call, e.g. a whole block. */
+    bool Prefetch(size_t nSize) { return Fill(nSize); }
+
+    void read(char* pch, size_t nSize);
+    void ignore(size_t nSize);
+
+    template<typename T>
+    CBlockFileReader& operator>>(T&& obj)
+    {
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
+#endif // BITCOIN_BLOCKFILE_H
@@ -0,0 +1,341 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockindexfile.h>
+
+#include <chain.h>
+#include <crypto/common.h>
+#include <util.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <unordered_map>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+const unsigned char BLOCKINDEX_FILE_MAGIC[8] = {'b', 'l', 'k', 'i', 'n', 'd', 'e', 'x'};
+const uint32_t BLOCKINDEX_FILE_VERSION = 1;
+
+// Record layout; all integers little endian
+enum {
+    REC_HASH = 0,
+    REC_MERKLE = 32,
+    REC_PROOF = 64,
+    REC_STAKE_HASH = 96,
+    REC_STAKE_N = 128,
+    REC_PREV = 132,
+    REC_HEIGHT = 136,
+    REC_STATUS = 140,
+    REC_TX = 144,
+    REC_FILE = 148,
+    REC_DATA_POS = 152,
+    REC_UNDO_POS = 156,
+    REC_FLAGS = 160,
+    REC_STAKE_MODIFIER = 164,
+    REC_STAKE_TIME = 172,
+    REC_VERSION = 176,
+    REC_TIME = 180,
+    REC_BITS = 184,
+    REC_NONCE = 188,
+};
+static_assert(REC_NONCE + 4 == BLOCKINDEX_RECORD_SIZE, "block index record layout doesn't add up");
+
+uint256 ReadHash(const unsigned char* p)
+{
+    uint256 hash;
+    memcpy(hash.begin(), p, 32);
+    return hash;
+}
+
+uint64_t RecordPos(uint64_t n)
+{
+    return BLOCKINDEX_HEADER_SIZE + n * BLOCKINDEX_RECORD_SIZE;
+}
+
+bool ReadAt(FILE* file, uint64_t nPos, unsigned char* p, size_t nSize)
+{
+    return fseek(file, nPos, SEEK_SET) == 0 && fread(p, 1, nSize, file) == nSize;
+}
+
+/** Record number of pindex among the first nCount records of file, or -1. */
+int64_t FindRecord(FILE* file, uint64_t nCount, const CBlockIndex* pindex)
+{
+    // Binary search for the first record at its height
+    unsigned char buf[REC_HEIGHT + 4];
+    uint64_t nLow = 0, nHigh = nCount;
+    while (nLow < nHigh) {
+        const uint64_t nMid = nLow + (nHigh - nLow) / 2;
+        if (!ReadAt(file, RecordPos(nMid) + REC_HEIGHT, buf, 4))
+            return -1;
+        if ((int)ReadLE32(buf) < pindex->nHeight)
+            nLow = nMid + 1;
+        else
+            nHigh = nMid;
+    }
+    for (uint64_t n = nLow; n < nCount; n++) {
+        if (!ReadAt(file, RecordPos(n), buf, sizeof(buf)) || (int)ReadLE32(buf + REC_HEIGHT) != pindex->nHeight)
+            break;
+        if (ReadHash(buf + REC_HASH) == pindex->GetBlockHash())
+            return n;
+    }
+    return -1;
+}
+
+void EncodeRecord(unsigned char* p, const CBlockIndex* pindex, uint32_t nPrev)
+{
+    const uint32_t nStatus = pindex->nStatus;
+    const bool fPoS = pindex->IsProofOfStake();
+    // Store what CDiskBlockIndex would, so loading either gives the same index
+    memcpy(p + REC_HASH, pindex->GetBlockHash().begin(), 32);
+    memcpy(p + REC_MERKLE, pindex->hashMerkleRoot.begin(), 32);
+    memcpy(p + REC_PROOF, (fPoS ? pindex->hashProofOfStake : uint256()).begin(), 32);
+    memcpy(p + REC_STAKE_HASH, (fPoS ? pindex->prevoutStake.hash : uint256()).begin(), 32);
+    WriteLE32(p + REC_STAKE_N, fPoS ? pindex->prevoutStake.n : (uint32_t)-1);
+    WriteLE32(p + REC_PREV, nPrev);
+    WriteLE32(p + REC_HEIGHT, pindex->nHeight);
+    WriteLE32(p + REC_STATUS, nStatus);
+    WriteLE32(p + REC_TX, pindex->nTx);
+    WriteLE32(p + REC_FILE, (nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO)) ? pindex->nFile : 0);
+    WriteLE32(p + REC_DATA_POS, (nStatus & BLOCK_HAVE_DATA) ? pindex->nDataPos : 0);
+    WriteLE32(p + REC_UNDO_POS, (nStatus & BLOCK_HAVE_UNDO) ? pindex->nUndoPos : 0);
+    WriteLE32(p + REC_FLAGS, pindex->nFlags);
+    WriteLE64(p + REC_STAKE_MODIFIER, pindex->nStakeModifier);
+    WriteLE32(p + REC_STAKE_TIME, fPoS ? pindex->nStakeTime : 0);
+    WriteLE32(p + REC_VERSION, pindex->nVersion);
+    WriteLE32(p + REC_TIME, pindex->nTime);
+    WriteLE32(p + REC_BITS, pindex->nBits);
+    WriteLE32(p + REC_NONCE, pindex->nNonce);
+}
+
+} // namespace
+
+CBlockIndexFile::CBlockIndexFile() : file(nullptr), pData(nullptr), nDataSize(0), nCount(0)
+{
+}
+
+CBlockIndexFile::~CBlockIndexFile()
+{
+    Close();
+}
+
+void CBlockIndexFile::Close()
+{
+#ifndef WIN32
+    if (pData && vData.empty()) munmap((void*)pData, nDataSize);
+#endif
+    if (file) fclose(file);
+    file = nullptr;
+    pData = nullptr;
+    nDataSize = 0;
+    vData.clear();
+    vData.shrink_to_fit();
+    nCount = 0;
+}
+
+bool CBlockIndexFile::Open(const fs::path& path, const uint256& nonce, uint64_t nCountIn)
+{
+    Close();
+    file = fsbridge::fopen(path, "rb");
+    if (!file)
+        return error("%s: unable to open %s", __func__, path.string());
+
+    const uint64_t nExpectedSize = BLOCKINDEX_HEADER_SIZE + nCountIn * BLOCKINDEX_RECORD_SIZE;
+#ifndef WIN32
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0 || (uint64_t)st.st_size != nExpectedSize) {
+        Close();
+        return error("%s: %s has the wrong size", __func__, path.string());
+    }
+    void* p = mmap(nullptr, nExpectedSize, PROT_READ, MAP_SHARED, fileno(file), 0);
+    if (p != MAP_FAILED) {
+        pData = (const unsigned char*)p;
+        nDataSize = nExpectedSize;
+    }
+#endif
+    if (!pData) {
+        // No mmap; read the whole file
+        try {
+            vData.resize(nExpectedSize + 1);
+        } catch (const std::bad_alloc&) {
+            Close();
+            return error("%s: not enough memory to read %s", __func__, path.string());
+        }
+        if (fread(vData.data(), 1, vData.size(), file) != nExpectedSize) {
+            Close();
+            return error("%s: %s has the wrong size", __func__, path.string());
+        }
+        vData.pop_back();
+        pData = vData.data();
+        nDataSize = vData.size();
+    }
+
+    if (memcmp(pData, BLOCKINDEX_FILE_MAGIC, sizeof(BLOCKINDEX_FILE_MAGIC)) != 0 ||
+        ReadLE32(pData + 8) != BLOCKINDEX_FILE_VERSION || ReadLE32(pData + 12) != BLOCKINDEX_RECORD_SIZE ||
+        ReadLE64(pData + 16) != nCountIn || ReadHash(pData + 24) != nonce) {
+        Close();
+        return error("%s: %s doesn't belong to the block index database", __func__, path.string());
+    }
+    nCount = nCountIn;
+    for (uint64_t n = 0; n < nCount; n++) {
+        if (GetPrev(n) >= (int64_t)n) {
+            Close();
+            return error("%s: %s is corrupt at entry %u", __func__, path.string(), n);
+        }
+    }
+    return true;
+}
+
+uint256 CBlockIndexFile::GetHash(uint64_t n) const
+{
+    return ReadHash(Record(n) + REC_HASH);
+}
+
+int64_t CBlockIndexFile::GetPrev(uint64_t n) const
+{
+    uint32_t nPrev = ReadLE32(Record(n) + REC_PREV);
+    return nPrev == (uint32_t)-1 ? -1 : (int64_t)nPrev;
+}
+
+void CBlockIndexFile::Get(uint64_t n, CBlockIndex& index) const
+{
+    const unsigned char* p = Record(n);
+    index.nHeight = ReadLE32(p + REC_HEIGHT);
+    index.nStatus = ReadLE32(p + REC_STATUS);
+    index.nTx = ReadLE32(p + REC_TX);
+    index.nFile = ReadLE32(p + REC_FILE);
+    index.nDataPos = ReadLE32(p + REC_DATA_POS);
+    index.nUndoPos = ReadLE32(p + REC_UNDO_POS);
+    index.nVersion = ReadLE32(p + REC_VERSION);
+    index.hashMerkleRoot = ReadHash(p + REC_MERKLE);
+    index.nTime = ReadLE32(p + REC_TIME);
+    index.nBits = ReadLE32(p + REC_BITS);
+    index.nNonce = ReadLE32(p + REC_NONCE);
+
+    // DeepOnion: the PoS data
+    index.nFlags = ReadLE32(p + REC_FLAGS);
+    index.nStakeModifier = ReadLE64(p + REC_STAKE_MODIFIER);
+    index.prevoutStake = COutPoint(ReadHash(p + REC_STAKE_HASH), ReadLE32(p + REC_STAKE_N));
+    index.nStakeTime = ReadLE32(p + REC_STAKE_TIME);
+    index.hashProofOfStake = ReadHash(p + REC_PROOF);
+}
+
+bool WriteBlockIndexFile(const fs::path& path, const uint256& nonce, const std::vector<const CBlockIndex*>& vIndex)
+{
+    std::unordered_map<const CBlockIndex*, uint32_t> mapRecord;
+    mapRecord.reserve(vIndex.size());
+
+    fs::path pathTmp = path;
+    pathTmp += ".new";
+    FILE* file = fsbridge::fopen(pathTmp, "wb");
+    if (!file)
+        return error("%s: unable to create %s", __func__, pathTmp.string());
+
+    unsigned char header[BLOCKINDEX_HEADER_SIZE];
+    memcpy(header, BLOCKINDEX_FILE_MAGIC, sizeof(BLOCKINDEX_FILE_MAGIC));
+    WriteLE32(header + 8, BLOCKINDEX_FILE_VERSION);
+    WriteLE32(header + 12, BLOCKINDEX_RECORD_SIZE);
+    WriteLE64(header + 16, vIndex.size());
+    memcpy(header + 24, nonce.begin(), 32);
+    bool fOk = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+
+    unsigned char record[BLOCKINDEX_RECORD_SIZE];
+    for (size_t n = 0; fOk && n < vIndex.size(); n++) {
+        const CBlockIndex* pindex = vIndex[n];
+        uint32_t nPrev = (uint32_t)-1;
+        if (pindex->pprev) {
+            auto it = mapRecord.find(pindex->pprev);
+            if (it == mapRecord.end()) {
+                fOk = error("%s: parent of %s not written before it", __func__, pindex->GetBlockHash().ToString());
+                break;
+            }
+            nPrev = it->second;
+        }
+        mapRecord.emplace(pindex, n);
+        EncodeRecord(record, pindex, nPrev);
+        fOk = fwrite(record, 1, sizeof(record), file) == sizeof(record);
+    }
+    if (fOk) {
+        FileCommit(file);
+    }
+    fclose(file);
+    if (!fOk || !RenameOver(pathTmp, path)) {
+        return error("%s: unable to write %s", __func__, path.string());
+    }
+    return true;
+}
+
+bool UpdateBlockIndexFile(const fs::path& path, const uint256& nonce, uint64_t nCount, std::vector<const CBlockIndex*> vChanged, uint64_t& nCountNew)
+{
+    FILE* file = fsbridge::fopen(path, "r+b");
+    if (!file)
+        return error("%s: unable to open %s", __func__, path.string());
+
+    unsigned char header[BLOCKINDEX_HEADER_SIZE];
+    bool fOk = ReadAt(file, 0, header, sizeof(header)) &&
+        memcmp(header, BLOCKINDEX_FILE_MAGIC, sizeof(BLOCKINDEX_FILE_MAGIC)) == 0 &&
+        ReadLE32(header + 8) == BLOCKINDEX_FILE_VERSION && ReadLE32(header + 12) == BLOCKINDEX_RECORD_SIZE &&
+        ReadLE64(header + 16) == nCount && ReadHash(header + 24) == nonce &&
+        fs::file_size(path) == RecordPos(nCount);
+    if (!fOk) {
+        fclose(file);
+        return error("%s: %s doesn't belong to the block index database", __func__, path.string());
+    }
+
+    int nLastHeight = 0;
+    unsigned char record[BLOCKINDEX_RECORD_SIZE];
+    if (nCount > 0) {
+        fOk = ReadAt(file, RecordPos(nCount - 1) + REC_HEIGHT, record, 4);
+        nLastHeight = ReadLE32(record);
+    }
+
+    // In height order, parents are appended before their children
+    std::sort(vChanged.begin(), vChanged.end(), [](const CBlockIndex* a, const CBlockIndex* b) { return a->nHeight < b->nHeight; });
+    std::unordered_map<const CBlockIndex*, uint32_t> mapAppended;
+    nCountNew = nCount;
+    for (const CBlockIndex* pindex : vChanged) {
+        if (!fOk)
+            break;
+        int64_t nPrev = -1;
+        if (pindex->pprev) {
+            auto it = mapAppended.find(pindex->pprev);
+            nPrev = it != mapAppended.end() ? it->second : FindRecord(file, nCount, pindex->pprev);
+            if (nPrev < 0) {
+                fOk = error("%s: parent of %s not found", __func__, pindex->GetBlockHash().ToString());
+                break;
+            }
+        }
+        int64_t n = FindRecord(file, nCount, pindex);
+        if (n < 0) {
+            if (pindex->nHeight < nLastHeight) {
+                LogPrintf("%s: %s is below the last entry of %s\n", __func__, pindex->GetBlockHash().ToString(), path.string());
+                fOk = false;
+                break;
+            }
+            n = nCountNew++;
+            nLastHeight = pindex->nHeight;
+            mapAppended.emplace(pindex, n);
+        }
+        EncodeRecord(record, pindex, nPrev);
+        fOk = fseek(file, RecordPos(n), SEEK_SET) == 0 && fwrite(record, 1, sizeof(record), file) == sizeof(record);
+    }
+
+    // The records are on disk before the header counts them
+    if (fOk) {
+        FileCommit(file);
+        WriteLE64(header + 16, nCountNew);
+        fOk = fseek(file, 16, SEEK_SET) == 0 && fwrite(header + 16, 1, 8, file) == 8;
+    }
+    if (fOk) {
+        FileCommit(file);
+    }
+    fclose(file);
+    return fOk;
+}
@@ -0,0 +1,86 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKINDEXFILE_H
+#define BITCOIN_BLOCKINDEXFILE_H
+
+#include <fs.h>
+#include <uint256.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+class CBlockIndex;
+
+//! -blockindexsnapshot default
+static const bool DEFAULT_BLOCKINDEX_SNAPSHOT = true;
+//! Size of a block index entry in the snapshot file
+static const size_t BLOCKINDEX_RECORD_SIZE = 192;
+//! Size of the snapshot file header
+static const size_t BLOCKINDEX_HEADER_SIZE = 56;
+
+/**
+ * Flat-file copy of the block index database, read at startup instead of it.
+ *
+ * Every entry is stored as a fixed-size record in height order, with its
+ * parent given by record number instead of by hash. Loading still creates a
+ * CBlockIndex for every entry, but reads them in order from the mapped file
+ * rather than walking the database, and links parents by position rather
+ * than looking them up by hash. The nonce ties the file to the database it
+ * was written from; see CBlockTreeDB.
+ */
+class CBlockIndexFile
+{
+private:
+    FILE* file;
+    const unsigned char* pData;
+    size_t nDataSize;
+    //! Contents read into memory where the file can't be mapped
+    std::vector<unsigned char> vData;
+    uint64_t nCount;
+
+    const unsigned char* Record(uint64_t n) const { return pData + BLOCKINDEX_HEADER_SIZE + n * BLOCKINDEX_RECORD_SIZE; }
+
+public:
+    CBlockIndexFile();
+    ~CBlockIndexFile();
+
+    CBlockIndexFile(const CBlockIndexFile&) = delete;
+    CBlockIndexFile& operator=(const CBlockIndexFile&) = delete;
+
+    /**
+     * Open the file written with nonce, holding nCountIn entries. Fails if it
+     * doesn't, or if an entry's parent doesn't come before it.
+     */
+    bool Open(const fs::path& path, const uint256& nonce, uint64_t nCountIn);
+    void Close();
+
+    uint64_t size() const { return nCount; }
+    uint256 GetHash(uint64_t n) const;
+    //! Record number of the parent of entry n, or -1 for the genesis block
+    int64_t GetPrev(uint64_t n) const;
+    //! Copy the fields stored in the block index database of entry n to index
+    void Get(uint64_t n, CBlockIndex& index) const;
+};
+
+/**
+ * Write vIndex to path, through a temporary file. Parents have to come
+ * before their children.
+ */
+bool WriteBlockIndexFile(const fs::path& path, const uint256& nonce, const std::vector<const CBlockIndex*>& vIndex);
+
+/**
+ * Bring the file at path, written with nonce and holding nCount entries, up
+ * to date with the entries of vChanged: the records of those it holds are
+ * rewritten in place and the others are appended, and nCountNew is set to
+ * the new number of entries. Fails if an entry would be appended below the
+ * height of the last one, as lookups rely on the height order; the file
+ * then has to be written whole.
+ */
+bool UpdateBlockIndexFile(const fs::path& path, const uint256& nonce, uint64_t nCount, std::vector<const CBlockIndex*> vChanged, uint64_t& nCountNew);
+
+#endif // BITCOIN_BLOCKINDEXFILE_H
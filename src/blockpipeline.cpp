@@ -0,0 +1,201 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockpipeline.h>
+
+#include <consensus/validation.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <algorithm>
+#include <functional>
+
+CBlockPipeline::CBlockPipeline(const Consensus::Params& paramsIn, int nThreads) :
+    params(paramsIn), nQueuedBytes(0), fFinished(false), fInterrupt(false), stats()
+{
+    for (int i = 0; i < std::max(nThreads, 1); i++) {
+        threads.emplace_back(std::bind(&CBlockPipeline::ThreadWork, this));
+    }
+}
+
+CBlockPipeline::~CBlockPipeline()
+{
+    Interrupt();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+void CBlockPipeline::ThreadWork()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        condWork.wait(lock, [this] { return fInterrupt || !queueTodo.empty(); });
+        if (fInterrupt) return;
+        std::shared_ptr<Job> job = std::move(queueTodo.front());
+        queueTodo.pop_front();
+
+        lock.unlock();
+        Process(*job);
+        lock.lock();
+        job->fDone = true;
+        condDone.notify_all();
+    }
+}
+
+void CBlockPipeline::Process(Job& job)
+{
+    std::shared_ptr<CBlock> pblock;
+    try {
+        if (job.fRead) {
+            pblock = std::make_shared<CBlock>();
+            if (!ReadBlockFromDisk(*pblock, job.result.pos, params, job.fProofOfStake)) {
+                pblock.reset();
+            }
+        } else {
+            // Hashing the transactions is most of the work of deserializing them
+            pblock = std::make_shared<CBlock>(job.block.header);
+            pblock->vtx.reserve(job.block.vtx.size());
+            for (CMutableTransaction& mtx : job.block.vtx) {
+                pblock->vtx.push_back(MakeTransactionRef(std::move(mtx)));
+            }
+            pblock->vchBlockSig = std::move(job.block.vchBlockSig);
+            job.block = CUnhashedBlock();
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        pblock.reset();
+    }
+    if (!pblock)
+        return;
+
+    job.result.hash = pblock->GetHash();
+    if (job.fRead && job.result.hash != job.hashExpected) {
+        LogPrintf("%s: block at %s doesn't hash to %s\n", __func__, job.result.pos.ToString(), job.hashExpected.ToString());
+        return;
+    }
+    // Only a block that passed is marked as checked; validation repeats
+    // the checks of one that didn't, to reject it.
+    CValidationState state;
+    if (!CheckBlock(*pblock, state, params))
+        pblock->fChecked = false;
+    job.result.pblock = std::move(pblock);
+}
+
+bool CBlockPipeline::Push(std::shared_ptr<Job> job)
+{
+    job->fDone = false;
+    std::unique_lock<std::mutex> lock(cs);
+    auto full = [this, &job] {
+        return !queueJobs.empty() && (queueJobs.size() >= BLOCK_PIPELINE_QUEUE || nQueuedBytes + job->nBytes > BLOCK_PIPELINE_QUEUE_BYTES);
+    };
+    if (full()) {
+        int64_t nStart = GetTimeMicros();
+        condSpace.wait(lock, [this, &full] { return fInterrupt || !full(); });
+        stats.nPushWaitMicros += GetTimeMicros() - nStart;
+    }
+    if (fInterrupt) return false;
+    nQueuedBytes += job->nBytes;
+    queueJobs.push_back(job);
+    queueTodo.push_back(std::move(job));
+    condWork.notify_one();
+    return true;
+}
+
+bool CBlockPipeline::Push(CUnhashedBlock&& block, const CDiskBlockPos& pos, unsigned int nSize)
+{
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->block = std::move(block);
+    job->fRead = false;
+    job->fProofOfStake = false;
+    job->nBytes = nSize;
+    job->result.pos = pos;
+    return Push(std::move(job));
+}
+
+bool CBlockPipeline::Push(const CDiskBlockPos& pos, const uint256& hash, bool fProofOfStake)
+{
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->fRead = true;
+    job->fProofOfStake = fProofOfStake;
+    job->hashExpected = hash;
+    job->nBytes = 0;
+    job->result.pos = pos;
+    return Push(std::move(job));
+}
+
+void CBlockPipeline::Finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fFinished = true;
+    }
+    condDone.notify_all();
+}
+
+bool CBlockPipeline::Pop(Result& result)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    auto ready = [this] { return fInterrupt || (queueJobs.empty() ? fFinished : queueJobs.front()->fDone); };
+    if (!ready()) {
+        int64_t nStart = GetTimeMicros();
+        condDone.wait(lock, ready);
+        stats.nPopWaitMicros += GetTimeMicros() - nStart;
+    }
+    if (fInterrupt || queueJobs.empty()) return false;
+
+    std::shared_ptr<Job> job = std::move(queueJobs.front());
+    queueJobs.pop_front();
+    nQueuedBytes -= job->nBytes;
+    stats.nBlocks++;
+    stats.nBytes += job->nBytes;
+    result = std::move(job->result);
+    condSpace.notify_all();
+    return true;
+}
+
+void CBlockPipeline::Clear()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        // Jobs being worked on finish unnoticed
+        queueTodo.clear();
+        queueJobs.clear();
+        nQueuedBytes = 0;
+    }
+    condSpace.notify_all();
+}
+
+void CBlockPipeline::Interrupt()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fInterrupt = true;
+    }
+    condWork.notify_all();
+    condDone.notify_all();
+    condSpace.notify_all();
+}
+
+size_t CBlockPipeline::size()
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return queueJobs.size();
+}
+
+CBlockPipeline::Stats CBlockPipeline::GetStats()
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return stats;
+}
+
+int GetBlockPipelineThreads()
+{
+    int nThreads = gArgs.GetArg("-loadblockthreads", DEFAULT_BLOCK_PIPELINE_THREADS);
+    if (nThreads <= 0)
+        nThreads = GetNumCores() - 1;
+    return std::max(1, std::min(nThreads, MAX_BLOCK_PIPELINE_THREADS));
+}
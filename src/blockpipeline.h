@@ -0,0 +1,140 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKPIPELINE_H
+#define BITCOIN_BLOCKPIPELINE_H
+
+#include <chain.h>
+#include <primitives/block.h>
+#include <primitives/transaction.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Consensus { struct Params; }
+
+//! -loadblockthreads default: one per core, up to MAX_BLOCK_PIPELINE_THREADS
+static const int DEFAULT_BLOCK_PIPELINE_THREADS = 0;
+static const int MAX_BLOCK_PIPELINE_THREADS = 8;
+//! Blocks queued in a CBlockPipeline before pushing more waits for the consumer
+static const size_t BLOCK_PIPELINE_QUEUE = 64;
+//! Serialized size of the blocks queued before pushing more waits for the consumer
+static const size_t BLOCK_PIPELINE_QUEUE_BYTES = 64 << 20;
+
+/**
+ * A block as stored in a block file, with its transactions parsed but not
+ * hashed yet.
+ */
+class CUnhashedBlock
+{
+public:
+    CBlockHeader header;
+    std::vector<CMutableTransaction> vtx;
+    std::vector<unsigned char> vchBlockSig;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(header);
+        READWRITE(vtx);
+        READWRITE(vchBlockSig);
+    }
+};
+
+/**
+ * Prepares blocks for validation on a pool of threads: hashes them, and
+ * runs the checks that need no context (CheckBlock), so that their result is
+ * cached in the block. Blocks are either pushed parsed, by a thread reading
+ * a block file, or read from the block files by the pool. They come out in
+ * the order they were pushed in.
+ */
+class CBlockPipeline
+{
+public:
+    struct Result
+    {
+        //! Null if the block couldn't be read
+        std::shared_ptr<CBlock> pblock;
+        uint256 hash;
+        CDiskBlockPos pos;
+    };
+
+    struct Stats
+    {
+        uint64_t nBlocks;
+        uint64_t nBytes;
+        //! Time spent waiting to push, because the consumer fell behind
+        int64_t nPushWaitMicros;
+        //! Time spent waiting for the next block to be done
+        int64_t nPopWaitMicros;
+    };
+
+private:
+    struct Job
+    {
+        CUnhashedBlock block;
+        //! Read the block from pos instead, and check it hashes to hashExpected
+        bool fRead;
+        bool fProofOfStake;
+        uint256 hashExpected;
+        size_t nBytes;
+        bool fDone;
+        Result result;
+    };
+
+    const Consensus::Params& params;
+    std::vector<std::thread> threads;
+
+    std::mutex cs;
+    std::condition_variable condWork;
+    std::condition_variable condDone;
+    std::condition_variable condSpace;
+    //! Jobs not started yet
+    std::deque<std::shared_ptr<Job>> queueTodo;
+    //! All jobs not popped yet, in push order
+    std::deque<std::shared_ptr<Job>> queueJobs;
+    size_t nQueuedBytes;
+    bool fFinished;
+    bool fInterrupt;
+    Stats stats;
+
+    void ThreadWork();
+    void Process(Job& job);
+    bool Push(std::shared_ptr<Job> job);
+
+public:
+    CBlockPipeline(const Consensus::Params& paramsIn, int nThreads);
+    ~CBlockPipeline();
+
+    CBlockPipeline(const CBlockPipeline&) = delete;
+    CBlockPipeline& operator=(const CBlockPipeline&) = delete;
+
+    /** Queue a block read from a block file at pos. Waits while the queue is full; false once interrupted. */
+    bool Push(CUnhashedBlock&& block, const CDiskBlockPos& pos, unsigned int nSize);
+    /** Queue reading the block with the given hash from the block files. */
+    bool Push(const CDiskBlockPos& pos, const uint256& hash, bool fProofOfStake);
+    /** No more blocks will be pushed. */
+    void Finish();
+    /** Take the oldest block, waiting until it's done. False if there is none left after Finish, or once interrupted. */
+    bool Pop(Result& result);
+    /** Drop the queued blocks. */
+    void Clear();
+    void Interrupt();
+
+    size_t size();
+    Stats GetStats();
+};
+
+/** Number of threads for a CBlockPipeline, from -loadblockthreads. */
+int GetBlockPipelineThreads();
+
+#endif // BITCOIN_BLOCKPIPELINE_H
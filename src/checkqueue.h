@@ -8,6 +8,9 @@
 #include <sync.h>
 
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -16,6 +19,9 @@
 template <typename T>
 class CCheckQueueControl;
 
+//! Workers with a queue of their own in a CCheckQueue; any more share them
+static const int MAX_CHECKQUEUE_WORKERS = 64;
+
 /** 
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
@@ -25,12 +31,34 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Each worker has a queue of its own, which the master spreads the
+  * verifications over, and which the others steal from once theirs is
+  * empty. Taking work only locks the worker's own queue (or the one it
+  * steals from), and completion is counted with atomics: the shared mutex
+  * is only used to put workers with nothing to do to sleep.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
+        std::vector<T> queue;
+    };
+
+    //! Queue 0 belongs to the master
+    std::unique_ptr<WorkerQueue[]> queues;
+
+    //! Number of worker threads that started
+    std::atomic<int> nWorkers;
+
+    //! Queue the next batch added starts at
+    int nNextQueue;
+
+    //! Mutex for threads with nothing to do to wait on
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,87 +67,102 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
-
-    //! The total number of workers (including the master).
-    int nTotal;
-
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
+
+    //! Number of verifications still queued
+    std::atomic<unsigned int> nQueued;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    int QueuesUsed() const
+    {
+        return std::min(nWorkers.load() + 1, MAX_CHECKQUEUE_WORKERS + 1);
+    }
+
+    /**
+     * Move a batch of verifications to vChecks, from queue nQueue, or else
+     * from the other queues. Batches get smaller as a queue empties, so that
+     * the workers finish approximately simultaneously: a worker takes half
+     * of what's left in its queue, up to nBatchSize, and a thief half of
+     * what it finds. Returns the number of verifications taken.
+     */
+    unsigned int Take(int nQueue, std::vector<T>& vChecks)
+    {
+        const int nQueues = QueuesUsed();
+        for (int i = 0; i < nQueues && nQueued.load() > 0; i++) {
+            WorkerQueue& worker = queues[(nQueue + i) % nQueues];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.queue.empty())
+                continue;
+            const unsigned int nNow = std::max(1U, std::min(nBatchSize, (unsigned int)(worker.queue.size() + 1) / 2));
+            vChecks.resize(nNow);
+            for (unsigned int j = 0; j < nNow; j++) {
+                // Swap jobs from the queue to the local batch vector instead of copying.
+                vChecks[j].swap(worker.queue.back());
+                worker.queue.pop_back();
+            }
+            nQueued -= nNow;
+            return nNow;
+        }
+        return 0;
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        int nQueue = 0;
+        if (!fMaster) {
+            const int nWorker = nWorkers++;
+            nQueue = 1 + nWorker % MAX_CHECKQUEUE_WORKERS;
+        }
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if (fMaster && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+            const unsigned int nNow = Take(nQueue, vChecks);
+            if (nNow) {
+                // Check whether we need to do work at all
+                bool fOk = fAllOk.load();
+                // execute work
+                for (T& check : vChecks)
+                    if (fOk)
+                        fOk = check();
+                // The checks are destructed before they count as done
+                vChecks.clear();
+                if (!fOk)
+                    fAllOk = false;
+                if (nTodo.fetch_sub(nNow) == nNow && !fMaster) {
+                    // We processed the last element; inform the master it can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    condMaster.notify_one();
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                // Wait for the verifications other workers are still doing
+                while (nTodo.load() > 0 && nQueued.load() == 0)
+                    condMaster.wait(lock);
+                if (nTodo.load() == 0) {
+                    bool fRet = fAllOk;
+                    // reset the status for new work later
+                    fAllOk = true;
+                    // return the current status
+                    return fRet;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+            } else {
+                while (nQueued.load() == 0)
+                    condWorker.wait(lock); // wait
             }
-            // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
         } while (true);
     }
 
@@ -128,7 +171,8 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    explicit CCheckQueue(unsigned int nBatchSizeIn) :
+        queues(new WorkerQueue[MAX_CHECKQUEUE_WORKERS + 1]), nWorkers(0), nNextQueue(0), fAllOk(true), nTodo(0), nQueued(0), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
@@ -145,15 +189,30 @@ public:
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
         nTodo += vChecks.size();
+
+        // Spread the checks over the queues, starting where the last batch ended
+        const int nQueues = QueuesUsed();
+        const size_t nPerQueue = std::max<size_t>(1, vChecks.size() / nQueues);
+        size_t nAdded = 0;
+        while (nAdded < vChecks.size()) {
+            const size_t nEnd = std::min(vChecks.size(), nAdded + nPerQueue);
+            WorkerQueue& worker = queues[nNextQueue];
+            nNextQueue = (nNextQueue + 1) % nQueues;
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            nQueued += nEnd - nAdded;
+            for (; nAdded < nEnd; nAdded++) {
+                worker.queue.push_back(T());
+                vChecks[nAdded].swap(worker.queue.back());
+            }
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
@@ -7,6 +7,7 @@
 #define BITCOIN_COINS_H
 
 #include <primitives/transaction.h>
+#include <arenamap.h>
 #include <compressor.h>
 #include <core_memusage.h>
 #include <hash.h>
@@ -119,7 +120,7 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+typedef arenamap<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -0,0 +1,284 @@
+// Copyright (c) 2010 Satoshi Nakamoto
+// Copyright (c) 2009-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinstats.h>
+
+#include <chain.h>
+#include <coins.h>
+#include <hash.h>
+#include <init.h>
+#include <serialize.h>
+#include <streams.h>
+#include <sync.h>
+#include <txdb.h>
+#include <util.h>
+#include <validation.h>
+#include <version.h>
+
+#include <condition_variable>
+#include <functional>
+
+std::unique_ptr<CCoinsStatsTracker> pcoinsstats;
+
+namespace {
+
+/**
+ * The coin database is scanned in key ranges, one for each value of the
+ * first byte of the txid. A txid never spans two ranges, so hashing the
+ * serialized ranges in order gives the same hash_serialized_2 as a single
+ * pass over the database.
+ */
+static const int UTXO_SCAN_SHARDS = 256;
+
+struct CScanShard
+{
+    bool fDone;
+    CCoinsStats stats;
+    std::vector<unsigned char> vchData;
+
+    CScanShard() : fDone(false) {}
+};
+
+/** Scans the coins of one range with pcursor, writing them to ss. */
+template <typename Stream>
+bool ScanShard(CCoinsViewDBCursor* pcursor, int nShard, CCoinsStats& stats, Stream& ss, const std::function<bool()>& fnInterrupt)
+{
+    uint256 hashStart;
+    *hashStart.begin() = nShard;
+    pcursor->Seek(COutPoint(hashStart, 0));
+
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    while (pcursor->Valid()) {
+        if (fnInterrupt()) return false;
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key)) {
+            return error("%s: unable to read key", __func__);
+        }
+        if (*key.hash.begin() != nShard) {
+            break;
+        }
+        if (!pcursor->GetValue(coin)) {
+            return error("%s: unable to read value", __func__);
+        }
+        if (!outputs.empty() && key.hash != prevkey) {
+            ApplyStats(stats, ss, prevkey, outputs);
+            outputs.clear();
+        }
+        prevkey = key.hash;
+        outputs[key.n] = std::move(coin);
+        pcursor->Next();
+    }
+    if (!outputs.empty()) {
+        ApplyStats(stats, ss, prevkey, outputs);
+    }
+    return true;
+}
+
+/**
+ * Runs one thread per cursor over the ranges, and merges their results in
+ * key order. Threads stay at most a window of ranges ahead of the merge, to
+ * bound the memory the serialized ranges take.
+ */
+class CUTXOScan
+{
+private:
+    const std::vector<std::unique_ptr<CCoinsViewDBCursor>>& vCursors;
+    const bool fHash;
+    const std::function<bool()> fnInterrupt;
+    const int nWindow;
+
+    std::mutex cs;
+    std::condition_variable cond;
+    std::vector<CScanShard> vShards;
+    int nMerged;
+    bool fAbort;
+    bool fFailed;
+
+    void ThreadScan(int nThread)
+    {
+        CCoinsViewDBCursor* pcursor = vCursors[nThread].get();
+        for (int nShard = nThread; nShard < UTXO_SCAN_SHARDS; nShard += vCursors.size()) {
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                cond.wait(lock, [&] { return fAbort || nShard < nMerged + nWindow; });
+                if (fAbort) return;
+            }
+            CScanShard shard;
+            bool fOk;
+            if (fHash) {
+                CVectorWriter ss(SER_GETHASH, PROTOCOL_VERSION, shard.vchData, 0);
+                fOk = ScanShard(pcursor, nShard, shard.stats, ss, fnInterrupt);
+            } else {
+                CSizeComputer ss(SER_GETHASH, PROTOCOL_VERSION);
+                fOk = ScanShard(pcursor, nShard, shard.stats, ss, fnInterrupt);
+            }
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                if (fOk) {
+                    shard.fDone = true;
+                    vShards[nShard] = std::move(shard);
+                } else {
+                    fAbort = fFailed = true;
+                }
+            }
+            cond.notify_all();
+            if (!fOk) return;
+        }
+    }
+
+public:
+    CUTXOScan(const std::vector<std::unique_ptr<CCoinsViewDBCursor>>& vCursorsIn, bool fHashIn, std::function<bool()> fnInterruptIn) :
+        vCursors(vCursorsIn), fHash(fHashIn), fnInterrupt(std::move(fnInterruptIn)), nWindow(2 * vCursorsIn.size()),
+        vShards(UTXO_SCAN_SHARDS), nMerged(0), fAbort(false), fFailed(false) {}
+
+    bool Run(CCoinsStats& stats)
+    {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < vCursors.size(); i++) {
+            threads.emplace_back(std::bind(&CUTXOScan::ThreadScan, this, i));
+        }
+
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << stats.hashBlock;
+        for (int nShard = 0; nShard < UTXO_SCAN_SHARDS; nShard++) {
+            CScanShard shard;
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                cond.wait(lock, [&] { return fAbort || vShards[nShard].fDone; });
+                if (fAbort) break;
+                shard = std::move(vShards[nShard]);
+                nMerged = nShard + 1;
+            }
+            cond.notify_all();
+            ss.write((const char*)shard.vchData.data(), shard.vchData.size());
+            stats.nTransactions += shard.stats.nTransactions;
+            stats.nTransactionOutputs += shard.stats.nTransactionOutputs;
+            stats.nBogoSize += shard.stats.nBogoSize;
+            stats.nTotalAmount += shard.stats.nTotalAmount;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(cs);
+            fAbort = true;
+        }
+        cond.notify_all();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        if (fFailed) return false;
+        if (fHash) stats.hashSerialized = ss.GetHash();
+        return true;
+    }
+};
+
+/** Creates the cursors for a scan. Requires cs_main, so that they all see the same state. */
+void CreateScanCursors(CCoinsViewDB* view, std::vector<std::unique_ptr<CCoinsViewDBCursor>>& vCursors)
+{
+    AssertLockHeld(cs_main);
+    int nThreads = std::max(1, std::min(GetNumCores(), MAX_UTXO_SCAN_THREADS));
+    for (int i = 0; i < nThreads; i++) {
+        vCursors.emplace_back(view->DBCursor());
+    }
+}
+
+} // namespace
+
+bool GetUTXOStats(CCoinsViewDB *view, CCoinsStats &stats, bool fHash)
+{
+    std::vector<std::unique_ptr<CCoinsViewDBCursor>> vCursors;
+    {
+        LOCK(cs_main);
+        if (pcoinsflush && !pcoinsflush->Sync()) {
+            return error("%s: unable to write the UTXO set", __func__);
+        }
+        CreateScanCursors(view, vCursors);
+        stats.hashBlock = vCursors[0]->GetBestBlock();
+        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
+    }
+    if (!CUTXOScan(vCursors, fHash, ShutdownRequested).Run(stats)) {
+        return false;
+    }
+    stats.nDiskSize = view->EstimateSize();
+    return true;
+}
+
+CCoinsStatsTracker::CCoinsStatsTracker() : fScanned(false), nHeight(0), fStop(false)
+{
+}
+
+CCoinsStatsTracker::~CCoinsStatsTracker()
+{
+    fStop = true;
+    if (threadScan.joinable()) {
+        threadScan.join();
+    }
+}
+
+bool CCoinsStatsTracker::Start(CCoinsViewDB* view)
+{
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        if (pcoinsflush && !pcoinsflush->Sync()) {
+            return error("%s: unable to write the UTXO set", __func__);
+        }
+        CreateScanCursors(view, vCursors);
+        std::lock_guard<std::mutex> lock(cs);
+        hashBlock = vCursors[0]->GetBestBlock();
+        BlockMap::const_iterator it = mapBlockIndex.find(hashBlock);
+        // Nothing is connected yet on a fresh data directory
+        nHeight = it != mapBlockIndex.end() ? it->second->nHeight : -1;
+        statsScan.hashBlock = hashBlock;
+        statsScan.nHeight = nHeight;
+    }
+    threadScan = std::thread(&TraceThread<std::function<void()> >, "utxostats", std::function<void()>(std::bind(&CCoinsStatsTracker::ThreadScan, this)));
+    return true;
+}
+
+void CCoinsStatsTracker::ThreadScan()
+{
+    int64_t nStart = GetTimeMillis();
+    CCoinsStats stats;
+    stats.hashBlock = statsScan.hashBlock;
+    bool fOk = CUTXOScan(vCursors, false, [this] { return fStop.load(); }).Run(stats);
+    vCursors.clear();
+    if (!fOk) {
+        if (!fStop) LogPrintf("%s: unable to scan the UTXO set\n", __func__);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(cs);
+    statsScan.nTransactionOutputs = stats.nTransactionOutputs;
+    statsScan.nBogoSize = stats.nBogoSize;
+    statsScan.nTotalAmount = stats.nTotalAmount;
+    fScanned = true;
+    LogPrintf("Scanned %u UTXOs at height %d in %dms\n", statsScan.nTransactionOutputs, statsScan.nHeight, GetTimeMillis() - nStart);
+}
+
+void CCoinsStatsTracker::Apply(const CCoinsStatsDelta& deltaBlock, const CBlockIndex* pindexTip)
+{
+    AssertLockHeld(cs_main);
+    std::lock_guard<std::mutex> lock(cs);
+    delta.nTransactionOutputs += deltaBlock.nTransactionOutputs;
+    delta.nBogoSize += deltaBlock.nBogoSize;
+    delta.nTotalAmount += deltaBlock.nTotalAmount;
+    hashBlock = pindexTip->GetBlockHash();
+    nHeight = pindexTip->nHeight;
+}
+
+bool CCoinsStatsTracker::Get(CCoinsStats& stats) const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    if (!fScanned) return false;
+    stats = CCoinsStats();
+    stats.hashBlock = hashBlock;
+    stats.nHeight = nHeight;
+    stats.nTransactionOutputs = statsScan.nTransactionOutputs + delta.nTransactionOutputs;
+    stats.nBogoSize = statsScan.nBogoSize + delta.nBogoSize;
+    stats.nTotalAmount = statsScan.nTotalAmount + delta.nTotalAmount;
+    return true;
+}
@@ -0,0 +1,143 @@
+// Copyright (c) 2010 Satoshi Nakamoto
+// Copyright (c) 2009-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATS_H
+#define BITCOIN_COINSTATS_H
+
+#include <amount.h>
+#include <coins.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <assert.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+class CBlockIndex;
+class CCoinsViewDB;
+class CCoinsViewDBCursor;
+
+//! -utxostats default
+static const bool DEFAULT_UTXOSTATS = false;
+//! Maximum number of threads scanning the UTXO set
+static const int MAX_UTXO_SCAN_THREADS = 16;
+
+struct CCoinsStats
+{
+    int nHeight;
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    uint256 hashSerialized;
+    uint64_t nDiskSize;
+    CAmount nTotalAmount;
+
+    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
+};
+
+//! A meaningless metric for the size of an unspent output
+static inline uint64_t GetBogoSize(const CScript& scriptPubKey)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + scriptPubKey.size() /* scriptPubKey */;
+}
+
+//! Add the unspent outputs of one transaction to stats, and their hash_serialized_2 data to ss
+template <typename Stream>
+void ApplyStats(CCoinsStats &stats, Stream& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    ss << hash;
+    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
+    stats.nTransactions++;
+    for (const auto& output : outputs) {
+        ss << VARINT(output.first + 1);
+        ss << output.second.out.scriptPubKey;
+        ss << VARINT(output.second.out.nValue);
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += output.second.out.nValue;
+        stats.nBogoSize += GetBogoSize(output.second.out.scriptPubKey);
+    }
+    ss << VARINT(0);
+}
+
+/**
+ * Calculate statistics about the unspent transaction output set. The coins
+ * are scanned by several threads, each with its own cursor on the same
+ * state of the database. Without fHash, hashSerialized is left unset.
+ */
+bool GetUTXOStats(CCoinsViewDB *view, CCoinsStats &stats, bool fHash = true);
+
+/** Change of the UTXO set totals by connecting or disconnecting blocks. */
+struct CCoinsStatsDelta
+{
+    int64_t nTransactionOutputs;
+    int64_t nBogoSize;
+    CAmount nTotalAmount;
+
+    CCoinsStatsDelta() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+
+    void AddCoin(const CTxOut& out)
+    {
+        nTransactionOutputs++;
+        nBogoSize += GetBogoSize(out.scriptPubKey);
+        nTotalAmount += out.nValue;
+    }
+
+    void SpendCoin(const CTxOut& out)
+    {
+        nTransactionOutputs--;
+        nBogoSize -= GetBogoSize(out.scriptPubKey);
+        nTotalAmount -= out.nValue;
+    }
+};
+
+/**
+ * UTXO set totals kept up to date as blocks are connected and disconnected
+ * (-utxostats), so they can be reported without scanning the set. They
+ * start from a scan in the background; the number of transactions and
+ * hash_serialized_2 need a full scan and are not kept.
+ */
+class CCoinsStatsTracker
+{
+private:
+    mutable std::mutex cs;
+    //! Totals at the database state of the initial scan
+    CCoinsStats statsScan;
+    //! Changes by the blocks connected and disconnected since
+    CCoinsStatsDelta delta;
+    bool fScanned;
+    uint256 hashBlock;
+    int nHeight;
+
+    //! Cursors for the initial scan, all on the same state of the database
+    std::vector<std::unique_ptr<CCoinsViewDBCursor>> vCursors;
+    std::atomic<bool> fStop;
+    std::thread threadScan;
+
+    void ThreadScan();
+
+public:
+    CCoinsStatsTracker();
+    ~CCoinsStatsTracker();
+
+    /** Flush the chain state and start the initial scan of view in the background. */
+    bool Start(CCoinsViewDB* view);
+    /** Account for a block being connected or disconnected, pindexTip being the new tip. Requires cs_main. */
+    void Apply(const CCoinsStatsDelta& deltaBlock, const CBlockIndex* pindexTip);
+    /** Get the current totals. Returns false while the initial scan runs. */
+    bool Get(CCoinsStats& stats) const;
+};
+
+/** Global variable that points to the UTXO set totals kept with -utxostats (or nullptr) */
+extern std::unique_ptr<CCoinsStatsTracker> pcoinsstats;
+
+#endif // BITCOIN_COINSTATS_H
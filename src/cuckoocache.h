@@ -176,6 +176,12 @@ private:
      */
     mutable std::vector<bool> epoch_flags;
 
+    /** aged_flags marks the discardable entries that were still live when
+     * epoch_check aged them out, as opposed to entries erased through
+     * contains(). Overwriting one of those counts as an eviction in insert().
+     */
+    mutable bit_packed_atomic_flags aged_flags;
+
     /** epoch_heuristic_counter is used to determine when an epoch might be aged
      * & an expensive scan should be done.  epoch_heuristic_counter is
      * decremented on insert and reset to the new number of inserts which would
@@ -266,6 +272,7 @@ private:
     inline void allow_erase(uint32_t n) const
     {
         collection_flags.bit_set(n);
+        aged_flags.bit_unset(n);
     }
 
     /** please_keep marks the element at index n as an entry that should be kept.
@@ -275,6 +282,7 @@ private:
     inline void please_keep(uint32_t n) const
     {
         collection_flags.bit_unset(n);
+        aged_flags.bit_unset(n);
     }
 
     /** epoch_check handles the changing of epochs for elements stored in the
@@ -306,8 +314,12 @@ private:
             for (uint32_t i = 0; i < size; ++i)
                 if (epoch_flags[i])
                     epoch_flags[i] = false;
-                else
+                else {
+                    const bool live = !collection_flags.bit_is_set(i);
                     allow_erase(i);
+                    if (live)
+                        aged_flags.bit_set(i);
+                }
             epoch_heuristic_counter = epoch_size;
         } else
             // reset the epoch_heuristic_counter to next do a scan when worst
@@ -324,7 +336,7 @@ public:
     /** You must always construct a cache with some elements via a subsequent
      * call to setup or setup_bytes, otherwise operations may segfault.
      */
-    cache() : table(), size(), collection_flags(0), epoch_flags(),
+    cache() : table(), size(), collection_flags(0), epoch_flags(), aged_flags(0),
     epoch_heuristic_counter(), epoch_size(), depth_limit(0), hash_function()
     {
     }
@@ -345,6 +357,9 @@ public:
         table.resize(size);
         collection_flags.setup(size);
         epoch_flags.resize(size);
+        aged_flags.setup(size);
+        for (uint32_t i = 0; i < size; ++i)
+            aged_flags.bit_unset(i);
         // Set to 45% as described above
         epoch_size = std::max((uint32_t)1, (45 * size) / 100);
         // Initially set to wait for a whole epoch
@@ -356,7 +371,7 @@ public:
      * usage when deciding how many elements to store. It isn't perfect because
      * it doesn't account for any overhead (struct size, MallocUsage, collection
      * and epoch flags). This was done to simplify selecting a power of two
-     * size. In the expected use case, an extra two bits per entry should be
+     * size. In the expected use case, an extra three bits per entry should be
      * negligible compared to the size of the elements.
      *
      * @param bytes the approximate number of bytes to use for this data
@@ -369,6 +384,41 @@ public:
         return setup(bytes/sizeof(Element));
     }
 
+    /** resize changes the container to store no more than new_size elements,
+     * inserting the elements it held that were not discardable into the new
+     * table, until it runs out of room for them.
+     *
+     * Unlike setup, resize may be called any number of times. It is not
+     * threadsafe with any other operation on the container.
+     *
+     * @param new_size the desired number of elements to store
+     * @returns the maximum number of elements storable
+     */
+    uint32_t resize(uint32_t new_size)
+    {
+        std::vector<Element> kept;
+        for (uint32_t i = 0; i < size; ++i)
+            if (!collection_flags.bit_is_set(i))
+                kept.push_back(std::move(table[i]));
+        std::vector<Element>().swap(table);
+        std::vector<bool>().swap(epoch_flags);
+        setup(new_size);
+        for (Element& e : kept)
+            insert(std::move(e));
+        return size;
+    }
+
+    /** resize_bytes is to resize what setup_bytes is to setup.
+     *
+     * @param bytes the approximate number of bytes to use for this data
+     * structure.
+     * @returns the maximum number of elements storable
+     */
+    uint32_t resize_bytes(size_t bytes)
+    {
+        return resize(bytes/sizeof(Element));
+    }
+
     /** insert loops at most depth_limit times trying to insert a hash
      * at various locations in the table via a variant of the Cuckoo Algorithm
      * with eight hash locations.
@@ -387,9 +437,11 @@ public:
      * @post one of the following: All previously inserted elements and e are
      * now in the table, one previously inserted element is evicted from the
      * table, the entry attempted to be inserted is evicted.
+     * @returns true if a live element, or one aged out by epoch_check but
+     * never erased, was overwritten or dropped by this insertion
      *
      */
-    inline void insert(Element e)
+    inline bool insert(Element e)
     {
         epoch_check();
         uint32_t last_loc = invalid();
@@ -401,17 +453,18 @@ public:
             if (table[loc] == e) {
                 please_keep(loc);
                 epoch_flags[loc] = last_epoch;
-                return;
+                return false;
             }
         for (uint8_t depth = 0; depth < depth_limit; ++depth) {
             // First try to insert to an empty slot, if one exists
             for (uint32_t loc : locs) {
                 if (!collection_flags.bit_is_set(loc))
                     continue;
+                const bool evicted = aged_flags.bit_is_set(loc);
                 table[loc] = std::move(e);
                 please_keep(loc);
                 epoch_flags[loc] = last_epoch;
-                return;
+                return evicted;
             }
             /** Swap with the element at the location that was
             * not the last one looked at. Example:
@@ -437,6 +490,7 @@ public:
             // Recompute the locs -- unfortunately happens one too many times!
             locs = compute_hashes(e);
         }
+        return true;
     }
 
     /* contains iterates through the hash locations for a given element
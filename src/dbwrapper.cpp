@@ -12,6 +12,7 @@
 #include <memenv.h>
 #include <stdint.h>
 #include <algorithm>
+#include <atomic>
 
 class CBitcoinLevelDBLogger : public leveldb::Logger {
 public:
@@ -71,14 +72,61 @@ public:
     }
 };
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+/** LRU block cache that counts lookups, for getdbinfo */
+class CDBBlockCache : public leveldb::Cache
+{
+private:
+    leveldb::Cache* const cache;
+
+public:
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+    explicit CDBBlockCache(size_t capacity) : cache(leveldb::NewLRUCache(capacity)), nHits(0), nMisses(0) {}
+    ~CDBBlockCache() { delete cache; }
+
+    Handle* Insert(const leveldb::Slice& key, void* value, size_t charge,
+                   void (*deleter)(const leveldb::Slice& key, void* value)) override
+    {
+        return cache->Insert(key, value, charge, deleter);
+    }
+
+    Handle* Lookup(const leveldb::Slice& key) override
+    {
+        Handle* handle = cache->Lookup(key);
+        (handle ? nHits : nMisses).fetch_add(1, std::memory_order_relaxed);
+        return handle;
+    }
+
+    void Release(Handle* handle) override { cache->Release(handle); }
+    void* Value(Handle* handle) override { return cache->Value(handle); }
+    void Erase(const leveldb::Slice& key) override { cache->Erase(key); }
+    uint64_t NewId() override { return cache->NewId(); }
+    void Prune() override { cache->Prune(); }
+    size_t TotalCharge() const override { return cache->TotalCharge(); }
+};
+
+CDBOptions ReadDBOptions(const std::string& name)
+{
+    CDBOptions dbopts;
+    dbopts.nBloomBits = std::max<int64_t>(0, gArgs.GetArg("-" + name + "bloombits", DEFAULT_DB_BLOOM_BITS));
+    dbopts.nBlockSize = std::max<int64_t>(1, gArgs.GetArg("-" + name + "blocksize", DEFAULT_DB_BLOCK_SIZE));
+    dbopts.fCompression = gArgs.GetBoolArg("-" + name + "compression", DEFAULT_DB_COMPRESSION);
+    dbopts.nWriteBufferSize = std::max<int64_t>(0, gArgs.GetArg("-" + name + "writebuffer", 0)) << 20;
+    dbopts.nMaxOpenFiles = std::max<int64_t>(1, gArgs.GetArg("-" + name + "maxopenfiles", DEFAULT_DB_MAX_OPEN_FILES));
+    return dbopts;
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, const CDBOptions& dbopts)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.block_cache = new CDBBlockCache(nCacheSize / 2);
+    // up to two write buffers may be held in memory simultaneously
+    options.write_buffer_size = dbopts.nWriteBufferSize ? dbopts.nWriteBufferSize : nCacheSize / 4;
+    options.filter_policy = dbopts.nBloomBits ? leveldb::NewBloomFilterPolicy(dbopts.nBloomBits) : nullptr;
+    options.block_size = dbopts.nBlockSize;
+    options.compression = dbopts.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = dbopts.nMaxOpenFiles;
     options.info_log = new CBitcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
@@ -88,14 +136,17 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, const CDBOptions& dboptsIn)
+    : dbopts(dboptsIn), nBlockCacheSize(nCacheSize / 2)
 {
     penv = nullptr;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, dbopts);
+    dbopts.nWriteBufferSize = options.write_buffer_size;
+    pblockcache = static_cast<CDBBlockCache*>(options.block_cache);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -149,6 +200,7 @@ CDBWrapper::~CDBWrapper()
     options.info_log = nullptr;
     delete options.block_cache;
     options.block_cache = nullptr;
+    pblockcache = nullptr;
     delete penv;
     options.env = nullptr;
 }
@@ -180,6 +232,18 @@ std::vector<unsigned char> CDBWrapper::CreateObfuscateKey() const
 
 }
 
+bool CDBWrapper::GetProperty(const std::string& property, std::string& value) const
+{
+    return pdb->GetProperty(property, &value);
+}
+
+void CDBWrapper::GetBlockCacheStats(uint64_t& nHits, uint64_t& nMisses, size_t& nUsage) const
+{
+    nHits = pblockcache->nHits;
+    nMisses = pblockcache->nMisses;
+    nUsage = pblockcache->TotalCharge();
+}
+
 bool CDBWrapper::IsEmpty()
 {
     std::unique_ptr<CDBIterator> it(NewIterator());
@@ -19,6 +19,39 @@
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 
+//! Default bloom filter bits per key
+static const int DEFAULT_DB_BLOOM_BITS = 10;
+//! Default approximate size of the blocks in a table file (bytes)
+static const int DEFAULT_DB_BLOCK_SIZE = 4096;
+//! Default for snappy compression of table blocks
+static const bool DEFAULT_DB_COMPRESSION = false;
+//! Default number of table files LevelDB keeps open
+static const int DEFAULT_DB_MAX_OPEN_FILES = 64;
+
+/** LevelDB tuning of one database */
+struct CDBOptions
+{
+    //! Bloom filter bits per key, 0 for no filter
+    int nBloomBits;
+    //! Approximate size of the blocks in a table file
+    size_t nBlockSize;
+    //! Compress table blocks with snappy (if LevelDB is built with it)
+    bool fCompression;
+    //! Size of the write buffer, 0 for a quarter of the cache size
+    size_t nWriteBufferSize;
+    //! Number of table files kept open
+    int nMaxOpenFiles;
+
+    CDBOptions() : nBloomBits(DEFAULT_DB_BLOOM_BITS), nBlockSize(DEFAULT_DB_BLOCK_SIZE), fCompression(DEFAULT_DB_COMPRESSION),
+                   nWriteBufferSize(0), nMaxOpenFiles(DEFAULT_DB_MAX_OPEN_FILES) {}
+};
+
+/**
+ * Read the tuning of a database from -<name>bloombits, -<name>blocksize,
+ * -<name>compression, -<name>writebuffer (MiB) and -<name>maxopenfiles.
+ */
+CDBOptions ReadDBOptions(const std::string& name);
+
 class dbwrapper_error : public std::runtime_error
 {
 public:
@@ -26,6 +59,7 @@ public:
 };
 
 class CDBWrapper;
+class CDBBlockCache;
 
 /** These should be considered an implementation detail of the specific database.
  */
@@ -183,6 +217,15 @@ private:
     //! database options used
     leveldb::Options options;
 
+    //! tuning the database was opened with, with the write buffer size in effect
+    CDBOptions dbopts;
+
+    //! size of the block cache
+    size_t nBlockCacheSize;
+
+    //! the block cache, which counts its hits (owned by options)
+    CDBBlockCache* pblockcache;
+
     //! options used when reading from the database
     leveldb::ReadOptions readoptions;
 
@@ -217,8 +260,9 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] dboptsIn    LevelDB tuning, see ReadDBOptions.
      */
-    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const CDBOptions& dboptsIn = CDBOptions());
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -309,6 +353,15 @@ public:
      */
     bool IsEmpty();
 
+    const CDBOptions& GetDBOptions() const { return dbopts; }
+    size_t GetBlockCacheSize() const { return nBlockCacheSize; }
+
+    /** Value of a LevelDB property, e.g. "leveldb.stats". Returns false if unknown. */
+    bool GetProperty(const std::string& property, std::string& value) const;
+
+    /** Block cache lookups that found and missed their block, and memory it uses. */
+    void GetBlockCacheStats(uint64_t& nHits, uint64_t& nMisses, size_t& nUsage) const;
+
     template<typename K>
     size_t EstimateSize(const K& key_begin, const K& key_end) const
     {
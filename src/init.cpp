@@ -11,9 +11,13 @@
 
 #include <addrman.h>
 #include <amount.h>
+#include <blockfile.h>
+#include <blockindexfile.h>
+#include <blockpipeline.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
+#include <coinstats.h>
 #include <compat/sanity.h>
 #include <consensus/validation.h>
 #include <fs.h>
@@ -21,6 +25,7 @@
 #include <httprpc.h>
 #include <key.h>
 #include <validation.h>
+#include <mempooljournal.h>
 #include <miner.h>
 #include <netbase.h>
 #include <net.h>
@@ -218,8 +223,9 @@ void Shutdown()
     threadGroup.join_all();
 
     if (fDumpMempoolLater && gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
-        DumpMempool();
+        FlushMempoolJournal();
     }
+    StopMempoolJournal();
 
     if (fFeeEstimatesInitialized)
     {
@@ -253,8 +259,13 @@ void Shutdown()
         if (pcoinsTip != nullptr) {
             FlushStateToDisk();
         }
+        if (pblocktree != nullptr && gArgs.GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT)) {
+            WriteBlockIndexSnapshot();
+        }
+        pcoinsstats.reset();
         pcoinsTip.reset();
         pcoinscatcher.reset();
+        pcoinsflush.reset();
         pcoinsdbview.reset();
         pblocktree.reset();
     }
@@ -342,9 +353,15 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-blockfilemmap", strprintf("Map block files that are no longer written to into memory for reading (default: %u)", DEFAULT_BLOCKFILE_MMAP));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-blockindexsnapshot", strprintf("Copy the block index to a flat file at shutdown, to load it faster at the next start (default: %u)", DEFAULT_BLOCKINDEX_SNAPSHOT));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
     strUsage +=HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)"), defaultChainParams->GetConsensus().defaultAssumeValid.GetHex(), testnetChainParams->GetConsensus().defaultAssumeValid.GetHex()));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-assumevalidstake", strprintf("Also assume that the ancestors of the -assumevalid block have valid coinstake signatures and rewards (default: %u)", DEFAULT_ASSUME_VALID_STAKE));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), BITCOIN_CONF_FILENAME));
     if (mode == HMM_BITCOIND)
     {
@@ -355,11 +372,24 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     if (showDebug) {
         strUsage += HelpMessageOpt("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
+        const std::pair<const char*, const char*> dbs[] = {{COINSDB_OPTIONS_PREFIX, "chain state"}, {BLOCKDB_OPTIONS_PREFIX, "block index"}};
+        for (const auto& it : dbs) {
+            const char* prefix = it.first;
+            const char* db = it.second;
+            strUsage += HelpMessageOpt(strprintf("-%sbloombits=<n>", prefix), strprintf("Bloom filter bits per key of the %s database, 0 for none (default: %u)", db, DEFAULT_DB_BLOOM_BITS));
+            strUsage += HelpMessageOpt(strprintf("-%sblocksize=<n>", prefix), strprintf("Size in bytes of the blocks in the %s database files (default: %u)", db, DEFAULT_DB_BLOCK_SIZE));
+            strUsage += HelpMessageOpt(strprintf("-%scache=<n>", prefix), strprintf("Cache of the %s database in megabytes, taken from -dbcache (default: automatic)", db));
+            strUsage += HelpMessageOpt(strprintf("-%scompression", prefix), strprintf("Compress the %s database with snappy, if LevelDB is built with it (default: %u)", db, DEFAULT_DB_COMPRESSION));
+            strUsage += HelpMessageOpt(strprintf("-%smaxopenfiles=<n>", prefix), strprintf("Number of files of the %s database kept open (default: %u)", db, DEFAULT_DB_MAX_OPEN_FILES));
+            strUsage += HelpMessageOpt(strprintf("-%swritebuffer=<n>", prefix), strprintf("Write buffer of the %s database in megabytes (default: a quarter of its cache)", db));
+        }
     }
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-loadblockthreads=<n>", strprintf("Number of threads hashing and checking blocks while importing or reindexing, up to %d (0 = one per core, default: %d)", MAX_BLOCK_PIPELINE_THREADS, DEFAULT_BLOCK_PIPELINE_THREADS));
     strUsage += HelpMessageOpt("-debuglogfile=<file>", strprintf(_("Specify location of debug log file: this can be an absolute path or a path relative to the data directory (default: %s)"), DEFAULT_DEBUGLOGFILE));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
@@ -367,7 +397,7 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug) {
         strUsage += HelpMessageOpt("-minimumchainwork=<hex>", strprintf("Minimum work assumed to exist on a valid chain in hex (default: %s, testnet: %s)", defaultChainParams->GetConsensus().nMinimumChainWork.GetHex(), testnetChainParams->GetConsensus().nMinimumChainWork.GetHex()));
     }
-    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to keep a journal of the mempool and load it on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
     strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
@@ -384,6 +414,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
+    strUsage += HelpMessageOpt("-utxostats", strprintf(_("Keep UTXO set totals up to date as blocks are connected, so gettxoutsetinfo can report them without a scan (default: %u)"), DEFAULT_UTXOSTATS));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open (see the `addnode` RPC command help for more info)"));
@@ -399,6 +430,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-listen", _("Accept connections from outside (default: 1 if no -proxy or -connect)"));
     strUsage += HelpMessageOpt("-listenonion", strprintf(_("Automatically create Tor hidden service (default: %d)"), DEFAULT_LISTEN_ONION));
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
+    strUsage += HelpMessageOpt("-maxparalleldials=<n>", strprintf(_("Maximum number of outbound connection attempts made in parallel, 1 to %d (default: %u)"), MAX_PARALLEL_DIALS, DEFAULT_MAX_PARALLEL_DIALS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
@@ -411,6 +443,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
+    strUsage += HelpMessageOpt("-torbootstraptimeout=<n>", strprintf(_("Maximum time in seconds to wait for the built-in Tor to bootstrap before connecting to peers (default: %u)"), DEFAULT_TOR_BOOTSTRAP_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
 #ifdef USE_UPNP
@@ -588,6 +621,20 @@ struct CImportingNow
     }
 };
 
+// Blocks connected by ActivateBestChain are read ahead while this exists
+struct CBlockPrefetchNow
+{
+    CBlockPipeline pipeline;
+
+    explicit CBlockPrefetchNow(const CChainParams& chainparams) : pipeline(chainparams.GetConsensus(), GetBlockPipelineThreads()) {
+        SetBlockPrefetch(&pipeline);
+    }
+
+    ~CBlockPrefetchNow() {
+        SetBlockPrefetch(nullptr);
+    }
+};
+
 
 // If we're using -prune with -reindex, then delete block files that will be ignored by the
 // reindex.  Since reindexing works by starting at block file 0 and looping until a blockfile
@@ -685,8 +732,20 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
     }
 
     // scan for better chains in the block chain database, that are not yet connected in the active best chain
+    // (all of it with -reindex and -reindex-chainstate), reading the blocks ahead
     CValidationState state;
-    if (!ActivateBestChain(state, chainparams)) {
+    bool fActivated;
+    {
+        CBlockPrefetchNow prefetch(chainparams);
+        int64_t nStart = GetTimeMillis();
+        fActivated = ActivateBestChain(state, chainparams);
+        CBlockPipeline::Stats stats = prefetch.pipeline.GetStats();
+        if (stats.nBlocks > 0) {
+            LogPrintf("Connected %u blocks read ahead in %dms (validation waited %dms for reading)\n",
+                stats.nBlocks, GetTimeMillis() - nStart, stats.nPopWaitMicros / 1000);
+        }
+    }
+    if (!fActivated) {
         LogPrintf("Failed to connect best block");
         StartShutdown();
         return;
@@ -700,6 +759,7 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
     } // End scope of CImportingNow
     if (gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         LoadMempool();
+        StartMempoolJournal();
         fDumpMempoolLater = !fRequestShutdown;
     }
 }
@@ -932,12 +992,17 @@ bool AppInitParameterInteraction()
     nUserMaxConnections = gArgs.GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
+    // Databases keeping more files open than by default need more descriptors,
+    // and so do the block and undo files kept open for reading
+    int nDBFiles = ReadDBOptions(COINSDB_OPTIONS_PREFIX).nMaxOpenFiles + ReadDBOptions(BLOCKDB_OPTIONS_PREFIX).nMaxOpenFiles;
+    int nMinCoreFD = MIN_CORE_FILEDESCRIPTORS ? MIN_CORE_FILEDESCRIPTORS + (int)MAX_BLOCKFILE_FDS + std::max(0, nDBFiles - 2 * DEFAULT_DB_MAX_OPEN_FILES) : 0;
+
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
-    nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
-    if (nFD < MIN_CORE_FILEDESCRIPTORS)
+    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - nMinCoreFD - MAX_ADDNODE_CONNECTIONS)), 0);
+    nFD = RaiseFileDescriptorLimit(nMaxConnections + nMinCoreFD + MAX_ADDNODE_CONNECTIONS);
+    if (nFD < nMinCoreFD)
         return InitError(_("Not enough file descriptors available."));
-    nMaxConnections = std::min(nFD - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS, nMaxConnections);
+    nMaxConnections = std::min(nFD - nMinCoreFD - MAX_ADDNODE_CONNECTIONS, nMaxConnections);
 
     if (nMaxConnections < nUserMaxConnections)
         InitWarning(strprintf(_("Reducing -maxconnections from %d to %d, because of system limitations."), nUserMaxConnections, nMaxConnections));
@@ -998,8 +1063,9 @@ bool AppInitParameterInteraction()
     fCheckpointsEnabled = gArgs.GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
     hashAssumeValid = uint256S(gArgs.GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
+    fAssumeValidStake = gArgs.GetBoolArg("-assumevalidstake", DEFAULT_ASSUME_VALID_STAKE);
     if (!hashAssumeValid.IsNull())
-        LogPrintf("Assuming ancestors of block %s have valid signatures.\n", hashAssumeValid.GetHex());
+        LogPrintf("Assuming ancestors of block %s have valid signatures%s.\n", hashAssumeValid.GetHex(), fAssumeValidStake ? " and stake rewards" : "");
     else
         LogPrintf("Validating signatures for all blocks.\n");
 
@@ -1467,6 +1533,7 @@ bool AppInitMain()
 
     fReindex = gArgs.GetBoolArg("-reindex", false);
     bool fReindexChainState = gArgs.GetBoolArg("-reindex-chainstate", false);
+    g_blockfilecache.SetMmap(gArgs.GetBoolArg("-blockfilemmap", DEFAULT_BLOCKFILE_MMAP));
 
     // cache size calculations
     int64_t nTotalCache = (gArgs.GetArg("-dbcache", nDefaultDbCache) << 20);
@@ -1474,14 +1541,25 @@ bool AppInitMain()
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greater than nMaxDbcache
     int64_t nBlockTreeDBCache = nTotalCache / 8;
     nBlockTreeDBCache = std::min(nBlockTreeDBCache, (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
+    if (gArgs.IsArgSet(strprintf("-%scache", BLOCKDB_OPTIONS_PREFIX))) // explicit size, up to half of the total
+        nBlockTreeDBCache = std::min(nTotalCache / 2, std::max<int64_t>(0, gArgs.GetArg(strprintf("-%scache", BLOCKDB_OPTIONS_PREFIX), 0)) << 20);
     nTotalCache -= nBlockTreeDBCache;
+    // The transaction index entries kept in memory come out of the block index database's share
+    int64_t nTxIndexCache = 0;
+    if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+        nTxIndexCache = nBlockTreeDBCache / nTxIndexCacheShare;
+        nBlockTreeDBCache -= nTxIndexCache;
+    }
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
+    if (gArgs.IsArgSet(strprintf("-%scache", COINSDB_OPTIONS_PREFIX))) // explicit size, up to half of the remainder
+        nCoinDBCache = std::min(nTotalCache / 2, std::max<int64_t>(0, gArgs.GetArg(strprintf("-%scache", COINSDB_OPTIONS_PREFIX), 0)) << 20);
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for transaction index cache\n", nTxIndexCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
 
@@ -1497,12 +1575,13 @@ bool AppInitMain()
             try {
                 UnloadBlockIndex();
                 pcoinsTip.reset();
-                pcoinsdbview.reset();
                 pcoinscatcher.reset();
+                pcoinsflush.reset();
+                pcoinsdbview.reset();
                 // new CBlockTreeDB tries to delete the existing file, which
                 // fails if it's still open from the previous loop. Close it first:
                 pblocktree.reset();
-                pblocktree.reset(new CBlockTreeDB(nBlockTreeDBCache, false, fReset));
+                pblocktree.reset(new CBlockTreeDB(nBlockTreeDBCache, false, fReset, nTxIndexCache));
 
                 if (fReset) {
                     pblocktree->WriteReindexing(true);
@@ -1534,9 +1613,15 @@ bool AppInitMain()
                     break;
                 }
 
+                // Convert a transaction index keyed by full txids
+                if (fTxIndex && !pblocktree->UpgradeTxIndex()) {
+                    strLoadError = _("Error upgrading transaction index");
+                    break;
+                }
+
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
-                if (fHavePruned && !fPruneMode) {
+                if (fHavePruned && !fPruneMode && !fTxOutSnapshot) {
                     strLoadError = _("You need to rebuild the database using -reindex to go back to unpruned mode.  This will redownload the entire blockchain");
                     break;
                 }
@@ -1554,7 +1639,8 @@ bool AppInitMain()
                 // block tree into mapBlockIndex!
 
                 pcoinsdbview.reset(new CCoinsViewDB(nCoinDBCache, false, fReset || fReindexChainState));
-                pcoinscatcher.reset(new CCoinsViewErrorCatcher(pcoinsdbview.get()));
+                pcoinsflush.reset(new CCoinsViewBackgroundFlush(pcoinsdbview.get()));
+                pcoinscatcher.reset(new CCoinsViewErrorCatcher(pcoinsflush.get()));
 
                 // If necessary, upgrade from older database format.
                 // This is a no-op if we cleared the coinsviewdb with -reindex or -reindex-chainstate
@@ -1662,6 +1748,12 @@ bool AppInitMain()
         LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);        
     }
 
+    if (gArgs.GetBoolArg("-utxostats", DEFAULT_UTXOSTATS)) {
+        pcoinsstats.reset(new CCoinsStatsTracker());
+        if (!pcoinsstats->Start(pcoinsdbview.get()))
+            return InitError(_("Unable to start keeping UTXO set totals"));
+    }
+
     fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fsbridge::fopen(est_path, "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1690,6 +1782,12 @@ bool AppInitMain()
         }
     }
 
+    // a node started from a UTXO snapshot lacks the blocks below it
+    if (fTxOutSnapshot) {
+        LogPrintf("Unsetting NODE_NETWORK, chain state was loaded from a UTXO snapshot\n");
+        nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+    }
+
     if (chainparams.GetConsensus().vDeployments[Consensus::DEPLOYMENT_SEGWIT].nTimeout != 0) {
         // Only advertise witness capabilities if they have a reasonable start time.
         // This allows us to have the code merged without a defined softfork, by setting its
@@ -1722,6 +1820,12 @@ bool AppInitMain()
 
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
 
+    if (gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        scheduler.scheduleEvery([] {
+            if (fDumpMempoolLater) FlushMempoolJournal();
+        }, MEMPOOL_JOURNAL_FLUSH_INTERVAL * 1000);
+    }
+
     // Wait for genesis block to be processed
     {
         WaitableLock lock(cs_GenesisWait);
@@ -1767,6 +1871,7 @@ bool AppInitMain()
     connOptions.nMaxOutbound = std::min(MAX_OUTBOUND_CONNECTIONS, connOptions.nMaxConnections);
     connOptions.nMaxAddnode = MAX_ADDNODE_CONNECTIONS;
     connOptions.nMaxFeeler = 1;
+    connOptions.nMaxParallelDials = gArgs.GetArg("-maxparalleldials", DEFAULT_MAX_PARALLEL_DIALS);
     connOptions.nBestHeight = chain_active_height;
     connOptions.uiInterface = &uiInterface;
     connOptions.m_msgproc = peerLogic.get();
@@ -1819,6 +1924,30 @@ bool AppInitMain()
             connOptions.m_specified_outgoing = connect;
         }
     }
+
+    // Connecting through the built-in Tor before it is bootstrapped only produces failed attempts
+    if (GetTorBootstrapProgress() >= 0) {
+        const int64_t nTimeout = gArgs.GetArg("-torbootstraptimeout", DEFAULT_TOR_BOOTSTRAP_TIMEOUT) * 1000;
+        const int64_t nWaitStart = GetTimeMillis();
+        int nLastProgress = -1;
+        int nProgress;
+        while ((nProgress = GetTorBootstrapProgress()) < 100 && !ShutdownRequested()) {
+            if (GetTimeMillis() - nWaitStart >= nTimeout) {
+                LogPrintf("Tor not bootstrapped after %ds (%d%%), starting network anyway\n", nTimeout / 1000, nProgress);
+                break;
+            }
+            if (nProgress != nLastProgress) {
+                uiInterface.InitMessage(strprintf(_("Bootstrapping Tor network (%d%%)..."), nProgress));
+                nLastProgress = nProgress;
+            }
+            MilliSleep(250);
+        }
+        if (nProgress >= 100)
+            LogPrintf("Tor bootstrapped, waited %dms for it\n", GetTimeMillis() - nWaitStart);
+        if (ShutdownRequested())
+            return false;
+    }
+
     if (!connman.Start(scheduler, connOptions)) {
         return false;
     }
@@ -0,0 +1,255 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <mempooljournal.h>
+
+#include <clientversion.h>
+#include <hash.h>
+#include <txmempool.h>
+#include <util.h>
+#include <utiltime.h>
+
+#include <algorithm>
+
+void CMempoolReplay::Add(const CTransactionRef& tx, int64_t nTime)
+{
+    const uint256& hash = tx->GetHash();
+    Remove(hash);
+    Entry entry;
+    entry.tx = tx;
+    entry.nTime = nTime;
+    mapEntries[hash] = listEntries.insert(listEntries.end(), std::move(entry));
+    vPending.push_back(hash);
+}
+
+void CMempoolReplay::Remove(const uint256& hash)
+{
+    auto it = mapEntries.find(hash);
+    if (it == mapEntries.end())
+        return;
+    listEntries.erase(it->second);
+    mapEntries.erase(it);
+}
+
+void CMempoolReplay::SetFlags(const CMempoolScriptFlags& flags)
+{
+    for (const uint256& hash : vPending) {
+        auto it = mapEntries.find(hash);
+        if (it != mapEntries.end())
+            it->second->flags = flags;
+    }
+    vPending.clear();
+}
+
+CMempoolJournal::CMempoolJournal() :
+    buffer(SER_DISK, CLIENT_VERSION), fOpen(false), nSize(0), nSnapshotSize(0)
+{
+}
+
+void CMempoolJournal::TransactionAdded(CTransactionRef tx)
+{
+    LOCK(cs);
+    buffer << (uint8_t)RECORD_ADD << tx << GetTime();
+}
+
+void CMempoolJournal::TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    LOCK(cs);
+    buffer << (uint8_t)RECORD_REMOVE << tx->GetHash();
+}
+
+void CMempoolJournal::Restart(CTxMemPool& pool, const CMempoolScriptFlags& flagsIn, const std::map<uint256, CAmount>& mapDeltasIn)
+{
+    AssertLockHeld(pool.cs);
+    LOCK(cs);
+    // Nothing is written until the file for the new snapshot is opened
+    fOpen = false;
+    buffer.clear();
+    flags = flagsIn;
+    mapDeltas = mapDeltasIn;
+    if (!connAdded.connected()) {
+        connAdded = pool.NotifyEntryAdded.connect([this](CTransactionRef tx) { TransactionAdded(tx); });
+        connRemoved = pool.NotifyEntryRemoved.connect([this](CTransactionRef tx, MemPoolRemovalReason reason) { TransactionRemoved(tx, reason); });
+    }
+}
+
+bool CMempoolJournal::Open(const fs::path& pathIn, const uint256& nonce, uint64_t nSnapshotSizeIn)
+{
+    LOCK(csFile);
+    CAutoFile file(fsbridge::fopen(pathIn, "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return error("%s: failed to open %s", __func__, pathIn.string());
+    try {
+        file << MEMPOOL_JOURNAL_VERSION << nonce;
+        FileCommit(file.Get());
+    } catch (const std::exception& e) {
+        return error("%s: failed to write %s: %s", __func__, pathIn.string(), e.what());
+    }
+
+    LOCK(cs);
+    path = pathIn;
+    fOpen = connAdded.connected();
+    nSize = sizeof(MEMPOOL_JOURNAL_VERSION) + nonce.size();
+    nSnapshotSize = nSnapshotSizeIn;
+    return fOpen;
+}
+
+void CMempoolJournal::Stop()
+{
+    LOCK(cs);
+    connAdded.disconnect();
+    connRemoved.disconnect();
+    fOpen = false;
+    buffer.clear();
+}
+
+void CMempoolJournal::Checkpoint(const CMempoolScriptFlags& flagsNow, const std::map<uint256, CAmount>& mapDeltasNow)
+{
+    LOCK(cs);
+    if (!connAdded.connected())
+        return;
+    // Transactions checked before the flags changed stay in the mempool, so
+    // there is no telling what any of them was checked under from now on
+    if (flagsNow != flags)
+        flags = CMempoolScriptFlags();
+    if (mapDeltasNow != mapDeltas) {
+        buffer << (uint8_t)RECORD_DELTAS << mapDeltasNow;
+        mapDeltas = mapDeltasNow;
+    }
+    if (!buffer.empty())
+        buffer << (uint8_t)RECORD_FLAGS << flags;
+}
+
+bool CMempoolJournal::Write()
+{
+    LOCK(csFile);
+    std::vector<char> vch;
+    fs::path pathWrite;
+    {
+        LOCK(cs);
+        if (!fOpen)
+            return false;
+        if (buffer.empty())
+            return true;
+        vch.assign(buffer.begin(), buffer.end());
+        buffer.clear();
+        pathWrite = path;
+    }
+
+    bool fWritten = false;
+    CAutoFile file(fsbridge::fopen(pathWrite, "ab"), SER_DISK, CLIENT_VERSION);
+    if (!file.IsNull()) {
+        try {
+            file << (uint32_t)vch.size() << Hash(vch.begin(), vch.end());
+            file.write(vch.data(), vch.size());
+            fWritten = true;
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+    }
+
+    LOCK(cs);
+    if (!fWritten) {
+        // The changes are lost, so the file needs a new snapshot to be of use
+        fOpen = false;
+        return error("%s: failed to append to %s", __func__, pathWrite.string());
+    }
+    nSize += sizeof(uint32_t) + 32 + vch.size();
+    return true;
+}
+
+CMempoolScriptFlags CMempoolJournal::GetFlags(const CMempoolScriptFlags& flagsNow)
+{
+    LOCK(cs);
+    return flags == flagsNow ? flags : CMempoolScriptFlags();
+}
+
+bool CMempoolJournal::IsRecording()
+{
+    LOCK(cs);
+    return connAdded.connected();
+}
+
+bool CMempoolJournal::IsOpen()
+{
+    LOCK(cs);
+    return fOpen;
+}
+
+bool CMempoolJournal::NeedsCompaction()
+{
+    LOCK(cs);
+    return nSize > std::max(MEMPOOL_JOURNAL_COMPACT_MIN_SIZE, MEMPOOL_JOURNAL_COMPACT_RATIO * nSnapshotSize);
+}
+
+bool ReadMempoolJournal(const fs::path& path, const uint256& nonce, CMempoolReplay& replay)
+{
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return false;
+
+    uint64_t nFileSize;
+    uint64_t nBatches = 0;
+    try {
+        nFileSize = fs::file_size(path);
+        uint64_t version;
+        uint256 nonceFile;
+        file >> version >> nonceFile;
+        if (version != MEMPOOL_JOURNAL_VERSION || nonceFile != nonce)
+            return false;
+        nFileSize -= sizeof(version) + nonceFile.size();
+    } catch (const std::exception& e) {
+        return false;
+    }
+
+    while (true) {
+        std::vector<char> vch;
+        try {
+            uint32_t nBatchSize;
+            uint256 hash;
+            file >> nBatchSize >> hash;
+            if (nBatchSize > nFileSize)
+                break;
+            vch.resize(nBatchSize);
+            file.read(vch.data(), vch.size());
+            nFileSize -= sizeof(nBatchSize) + hash.size() + nBatchSize;
+            if (Hash(vch.begin(), vch.end()) != hash)
+                break;
+        } catch (const std::exception& e) {
+            // End of the file, or a batch torn by a crash
+            break;
+        }
+
+        CDataStream ss(vch.data(), vch.data() + vch.size(), SER_DISK, CLIENT_VERSION);
+        try {
+            while (!ss.empty()) {
+                uint8_t nType;
+                ss >> nType;
+                if (nType == CMempoolJournal::RECORD_ADD) {
+                    CTransactionRef tx;
+                    int64_t nTime;
+                    ss >> tx >> nTime;
+                    replay.Add(tx, nTime);
+                } else if (nType == CMempoolJournal::RECORD_REMOVE) {
+                    uint256 hash;
+                    ss >> hash;
+                    replay.Remove(hash);
+                } else if (nType == CMempoolJournal::RECORD_DELTAS) {
+                    ss >> replay.mapDeltas;
+                } else if (nType == CMempoolJournal::RECORD_FLAGS) {
+                    CMempoolScriptFlags flags;
+                    ss >> flags;
+                    replay.SetFlags(flags);
+                } else {
+                    return error("%s: unknown record type %u in %s", __func__, (unsigned int)nType, path.string());
+                }
+            }
+        } catch (const std::exception& e) {
+            return error("%s: failed to deserialize %s: %s", __func__, path.string(), e.what());
+        }
+        nBatches++;
+    }
+    LogPrint(BCLog::MEMPOOL, "%s: replayed %u batches of mempool changes\n", __func__, nBatches);
+    return true;
+}
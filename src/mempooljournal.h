@@ -0,0 +1,165 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MEMPOOLJOURNAL_H
+#define BITCOIN_MEMPOOLJOURNAL_H
+
+#include <amount.h>
+#include <fs.h>
+#include <primitives/transaction.h>
+#include <serialize.h>
+#include <streams.h>
+#include <sync.h>
+#include <uint256.h>
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include <boost/signals2/connection.hpp>
+
+class CTxMemPool;
+enum class MemPoolRemovalReason;
+
+static const uint64_t MEMPOOL_JOURNAL_VERSION = 1;
+//! Seconds between appending the mempool's changes to its journal
+static const int64_t MEMPOOL_JOURNAL_FLUSH_INTERVAL = 10;
+//! Compact the journal into mempool.dat once it is this many times larger...
+static const uint64_t MEMPOOL_JOURNAL_COMPACT_RATIO = 2;
+//! ...and at least this large
+static const uint64_t MEMPOOL_JOURNAL_COMPACT_MIN_SIZE = 8 << 20;
+
+/**
+ * The script verification flags mempool transactions were checked under:
+ * the policy flags and those of the block after the tip. Null when unknown.
+ */
+struct CMempoolScriptFlags
+{
+    uint32_t nPolicyFlags;
+    uint32_t nBlockFlags;
+
+    CMempoolScriptFlags() : nPolicyFlags(0), nBlockFlags(0) {}
+    CMempoolScriptFlags(uint32_t nPolicyFlagsIn, uint32_t nBlockFlagsIn) : nPolicyFlags(nPolicyFlagsIn), nBlockFlags(nBlockFlagsIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nPolicyFlags);
+        READWRITE(nBlockFlags);
+    }
+
+    bool IsNull() const { return nPolicyFlags == 0 && nBlockFlags == 0; }
+
+    friend bool operator==(const CMempoolScriptFlags& a, const CMempoolScriptFlags& b)
+    {
+        return a.nPolicyFlags == b.nPolicyFlags && a.nBlockFlags == b.nBlockFlags;
+    }
+    friend bool operator!=(const CMempoolScriptFlags& a, const CMempoolScriptFlags& b) { return !(a == b); }
+};
+
+/**
+ * The transactions of mempool.dat with the changes of its journal replayed
+ * on top, in the order they were added.
+ */
+class CMempoolReplay
+{
+public:
+    struct Entry
+    {
+        CTransactionRef tx;
+        int64_t nTime;
+        //! Flags the scripts were checked under, null until a journal record says
+        CMempoolScriptFlags flags;
+    };
+
+private:
+    std::list<Entry> listEntries;
+    std::map<uint256, std::list<Entry>::iterator> mapEntries;
+    //! Entries added since the last flags record
+    std::vector<uint256> vPending;
+
+public:
+    std::map<uint256, CAmount> mapDeltas;
+
+    void Add(const CTransactionRef& tx, int64_t nTime);
+    void Remove(const uint256& hash);
+    /** The entries added since the last call were checked under flags. */
+    void SetFlags(const CMempoolScriptFlags& flags);
+
+    const std::list<Entry>& GetEntries() const { return listEntries; }
+};
+
+/**
+ * Append-only journal of the transactions added to and removed from the
+ * mempool since mempool.dat was written, so that the mempool survives a
+ * restart without dumping it whole. Changes are recorded in memory as the
+ * mempool signals them and appended to the file periodically, in batches
+ * with a checksum so that a batch torn by a crash is dropped when reading.
+ * Each batch ends with the script flags its transactions were checked
+ * under, which lets loading skip checking their scripts again.
+ */
+class CMempoolJournal
+{
+public:
+    enum RecordType : uint8_t {
+        RECORD_ADD = 'a',
+        RECORD_REMOVE = 'r',
+        RECORD_DELTAS = 'd',
+        RECORD_FLAGS = 'f',
+    };
+
+private:
+    CCriticalSection cs;
+    //! Records not written to the file yet
+    CDataStream buffer;
+    //! Flags the mempool's transactions were checked under, null once they changed
+    CMempoolScriptFlags flags;
+    //! Fee deltas as of the last record of them
+    std::map<uint256, CAmount> mapDeltas;
+    boost::signals2::scoped_connection connAdded;
+    boost::signals2::scoped_connection connRemoved;
+
+    //! Serializes writing the file; taken before cs
+    CCriticalSection csFile;
+    fs::path path;
+    bool fOpen;
+    uint64_t nSize;
+    uint64_t nSnapshotSize;
+
+    void TransactionAdded(CTransactionRef tx);
+    void TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason);
+
+public:
+    CMempoolJournal();
+
+    /**
+     * Record pool's changes from now on, on top of a snapshot of it taken
+     * under the same lock of pool.cs, checked under flagsIn.
+     */
+    void Restart(CTxMemPool& pool, const CMempoolScriptFlags& flagsIn, const std::map<uint256, CAmount>& mapDeltasIn);
+    /** Replace the journal file with an empty one for the snapshot with the given nonce, of nSnapshotSizeIn bytes. */
+    bool Open(const fs::path& pathIn, const uint256& nonce, uint64_t nSnapshotSizeIn);
+    /** Stop recording changes and close the file. */
+    void Stop();
+    /**
+     * Record the flags and fee deltas of the mempool, as of the changes
+     * recorded so far. Call with cs_main and pool.cs held.
+     */
+    void Checkpoint(const CMempoolScriptFlags& flagsNow, const std::map<uint256, CAmount>& mapDeltasNow);
+    /** Append the recorded changes to the file. */
+    bool Write();
+
+    /** Flags all the mempool's transactions were checked under, given the current ones; null if unknown. */
+    CMempoolScriptFlags GetFlags(const CMempoolScriptFlags& flagsNow);
+    bool IsRecording();
+    bool IsOpen();
+    /** Whether the file has grown enough to be compacted into a new snapshot. */
+    bool NeedsCompaction();
+};
+
+/** Replay the journal at path on top of replay, if it belongs to the snapshot with the given nonce. */
+bool ReadMempoolJournal(const fs::path& path, const uint256& nonce, CMempoolReplay& replay);
+
+#endif // BITCOIN_MEMPOOLJOURNAL_H
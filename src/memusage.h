@@ -5,6 +5,7 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include <arenamap.h>
 #include <indirectmap.h>
 
 #include <stdlib.h>
@@ -116,6 +117,16 @@ static inline size_t IncrementalDynamicUsage(const std::map<X, Y, Z>& m)
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >));
 }
 
+// arenamap owns its slot table and whole arena chunks, used or not
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const arenamap<X, Y, Z>& m)
+{
+    return MallocUsage(m.bucket_count() * arenamap<X, Y, Z>::SLOT_BYTES) +
+           MallocUsage(m.chunk_capacity() * arenamap<X, Y, Z>::CHUNK_POINTER_BYTES) +
+           MallocUsage(arenamap<X, Y, Z>::CHUNK_BYTES) * m.chunk_count();
+}
+
 // indirectmap has underlying map with pointer as key
 
 template<typename X, typename Y>
@@ -59,6 +59,9 @@ uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockWeight = 0;
 int64_t nLastCoinStakeSearchInterval = 0;
 
+// One per witness setting, as getblocktemplate and staking ask for different ones
+static CBlockTemplateCache blocktemplatecache[2];
+
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
     int64_t nOldTime = pblock->nTime;
@@ -74,6 +77,60 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
     return nNewTime - nOldTime;
 }
 
+bool CBlockTemplateCache::Key::operator==(const Key& other) const
+{
+    return hashPrevBlock == other.hashPrevBlock && nHeight == other.nHeight &&
+           nLockTimeCutoff == other.nLockTimeCutoff && fIncludeWitness == other.fIncludeWitness &&
+           nBlockMaxWeight == other.nBlockMaxWeight && blockMinFeeRate == other.blockMinFeeRate;
+}
+
+CBlockTemplateCache::CBlockTemplateCache() :
+    fValid(false), key(), fFull(false), nTimeDeferred(std::numeric_limits<int64_t>::max()), nTimeLatest(0), nTransactionsUpdated(0)
+{
+}
+
+void CBlockTemplateCache::Connect(CTxMemPool& pool)
+{
+    LOCK(cs);
+    if (connAdded.connected())
+        return;
+    connAdded = pool.NotifyEntryAdded.connect([this](CTransactionRef tx) { TransactionAdded(tx); });
+    connRemoved = pool.NotifyEntryRemoved.connect([this](CTransactionRef tx, MemPoolRemovalReason reason) { TransactionRemoved(tx, reason); });
+}
+
+void CBlockTemplateCache::Invalidate()
+{
+    LOCK(cs);
+    fValid = false;
+    listEntries.clear();
+    mapEntries.clear();
+    vAdded.clear();
+    vRemoved.clear();
+    nTimeLatest = 0;
+}
+
+void CBlockTemplateCache::TransactionAdded(CTransactionRef tx)
+{
+    LOCK(cs);
+    if (!fValid)
+        return;
+    ++nTransactionsUpdated;
+    vAdded.push_back(std::move(tx));
+    if (vAdded.size() + vRemoved.size() > MAX_BLOCK_TEMPLATE_CACHE_UPDATES)
+        Invalidate();
+}
+
+void CBlockTemplateCache::TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    LOCK(cs);
+    if (!fValid)
+        return;
+    ++nTransactionsUpdated;
+    vRemoved.push_back(tx->GetHash());
+    if (vAdded.size() + vRemoved.size() > MAX_BLOCK_TEMPLATE_CACHE_UPDATES)
+        Invalidate();
+}
+
 BlockAssembler::Options::Options() {
     blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
     nBlockMaxWeight = DEFAULT_BLOCK_MAX_WEIGHT;
@@ -114,6 +171,8 @@ void BlockAssembler::resetBlock()
     nBlockWeight = 4000;
     nBlockSigOpsCost = 400;
     fIncludeWitness = false;
+    fBlockFull = false;
+    nTimeDeferred = std::numeric_limits<int64_t>::max();
 
     // These counters do not include coinbase tx
     nBlockTx = 0;
@@ -166,7 +225,23 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    int nCachedAdded = 0;
+    int nCachedRemoved = 0;
+    const CBlockTemplateCache::Key key = {pindexPrev->GetBlockHash(), nHeight, nLockTimeCutoff, fIncludeWitness, nBlockMaxWeight, blockMinFeeRate};
+    CBlockTemplateCache& cache = blocktemplatecache[fIncludeWitness];
+    cache.Connect(mempool);
+    if (!addCachedTxs(cache, key, nCachedAdded, nCachedRemoved)) {
+        // Drop whatever came from the cache and select from the whole mempool
+        pblock->vtx.resize(1);
+        pblocktemplate->vTxFees.resize(1);
+        pblocktemplate->vTxSigOpsCost.resize(1);
+        nBlockWeight = 4000;
+        nBlockSigOpsCost = 400;
+        nBlockTx = 0;
+        nFees = 0;
+        addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+        storeCachedTxs(cache, key);
+    }
 
     int64_t nTime1 = GetTimeMicros();
 
@@ -212,15 +287,117 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
     CValidationState state;
     if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false, fProofOfStake)) {
+        cache.Invalidate();
         throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
     }
     int64_t nTime2 = GetTimeMicros();
 
-    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants, %d/%d cached txs added/removed), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, nCachedAdded, nCachedRemoved, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
 
     return std::move(pblocktemplate);
 }
 
+void BlockAssembler::AddToBlock(const CBlockTemplateCache::Entry& entry)
+{
+    pblock->vtx.push_back(entry.tx);
+    pblocktemplate->vTxFees.push_back(entry.nFee);
+    pblocktemplate->vTxSigOpsCost.push_back(entry.nSigOpCost);
+    nBlockWeight += entry.nWeight;
+    ++nBlockTx;
+    nBlockSigOpsCost += entry.nSigOpCost;
+    nFees += entry.nFee;
+}
+
+// The cached selection is what addPackageTxs would select again as long as
+// the block had room for every package worth including: a removed
+// transaction then just leaves the block (its descendants are removed from
+// the mempool as well), and an added one joins it if its in-mempool parents
+// are in the block and it would be selected on its own. Anything else, like
+// a transaction that may pay for a parent that was left out, one that
+// leaves behind a parent it may have paid for, or one that doesn't fit,
+// needs a new selection. So does a block time earlier than one of the
+// selected transactions, which the clock going back can give.
+bool BlockAssembler::addCachedTxs(CBlockTemplateCache& cache, const CBlockTemplateCache::Key& key, int &nAdded, int &nRemoved)
+{
+    LOCK(cache.cs);
+    if (!cache.fValid || !(cache.key == key) || pblock->nTime >= cache.nTimeDeferred || (int64_t)pblock->nTime < cache.nTimeLatest)
+        return false;
+    // The mempool changed in a way that wasn't notified, like a prioritisation
+    if (cache.nTransactionsUpdated != mempool.GetTransactionsUpdated())
+        return false;
+    // Until it's updated, the cache is only good for a new selection
+    cache.fValid = false;
+
+    for (const uint256& hash : cache.vRemoved) {
+        auto it = cache.mapEntries.find(hash);
+        if (it == cache.mapEntries.end())
+            continue;
+        if (cache.fFull)
+            return false;
+        // A parent may have been selected only for this transaction's fee
+        for (const CTxIn& txin : it->second->tx->vin) {
+            if (cache.mapEntries.count(txin.prevout.hash) && mempool.exists(txin.prevout.hash))
+                return false;
+        }
+        cache.listEntries.erase(it->second);
+        cache.mapEntries.erase(it);
+        ++nRemoved;
+    }
+    cache.vRemoved.clear();
+
+    for (const CBlockTemplateCache::Entry& entry : cache.listEntries)
+        AddToBlock(entry);
+
+    nTimeDeferred = cache.nTimeDeferred;
+    for (const CTransactionRef& tx : cache.vAdded) {
+        CTxMemPool::txiter iter = mempool.mapTx.find(tx->GetHash());
+        // Removed again since
+        if (iter == mempool.mapTx.end() || cache.mapEntries.count(tx->GetHash()))
+            continue;
+        if (cache.fFull)
+            return false;
+        for (const CTxIn& txin : tx->vin) {
+            if (!cache.mapEntries.count(txin.prevout.hash) && mempool.exists(txin.prevout.hash))
+                return false;
+        }
+        if (iter->GetModifiedFee() < blockMinFeeRate.GetFee(iter->GetTxSize()))
+            continue;
+        CTxMemPool::setEntries package;
+        package.insert(iter);
+        if (!TestPackageTransactions(package))
+            continue;
+        if (!TestPackage(iter->GetTxSize(), iter->GetSigOpCost()))
+            return false;
+
+        CBlockTemplateCache::Entry entry = {iter->GetSharedTx(), iter->GetFee(), iter->GetSigOpCost(), (uint64_t)iter->GetTxWeight()};
+        cache.mapEntries.emplace(tx->GetHash(), cache.listEntries.insert(cache.listEntries.end(), entry));
+        cache.nTimeLatest = std::max<int64_t>(cache.nTimeLatest, tx->nTime);
+        AddToBlock(entry);
+        ++nAdded;
+    }
+    cache.vAdded.clear();
+    cache.nTimeDeferred = nTimeDeferred;
+    cache.fValid = true;
+    return true;
+}
+
+void BlockAssembler::storeCachedTxs(CBlockTemplateCache& cache, const CBlockTemplateCache::Key& key)
+{
+    LOCK(cache.cs);
+    cache.Invalidate();
+    for (size_t i = 1; i < pblock->vtx.size(); i++) {
+        const CTransactionRef& tx = pblock->vtx[i];
+        CBlockTemplateCache::Entry entry = {tx, pblocktemplate->vTxFees[i], pblocktemplate->vTxSigOpsCost[i], (uint64_t)GetTransactionWeight(*tx)};
+        cache.mapEntries.emplace(tx->GetHash(), cache.listEntries.insert(cache.listEntries.end(), entry));
+        cache.nTimeLatest = std::max<int64_t>(cache.nTimeLatest, tx->nTime);
+    }
+    cache.key = key;
+    cache.fFull = fBlockFull;
+    cache.nTimeDeferred = nTimeDeferred;
+    cache.nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    cache.fValid = true;
+}
+
 void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
 {
     for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
@@ -255,6 +432,11 @@ bool BlockAssembler::TestPackageTransactions(const CTxMemPool::setEntries& packa
             return false;
         if (!fIncludeWitness && it->GetTx().HasWitness())
             return false;
+        // DeepOnion: Don't add a TX that's time is in the future.
+        if (it->GetTx().nTime > pblock->nTime) {
+            nTimeDeferred = std::min<int64_t>(nTimeDeferred, it->GetTx().nTime);
+            return false;
+        }
     }
     return true;
 }
@@ -397,11 +579,6 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
             }
         }
 
-        // DeepOnion: Don't add a TX that's time is in the future.
-        if(pblock->nTime < iter->GetSharedTx()->nTime) {
-            continue;
-        }
-
         // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
         // contain anything that is inBlock.
         assert(!inBlock.count(iter));
@@ -421,6 +598,7 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
         }
 
         if (!TestPackage(packageSize, packageSigOpsCost)) {
+            fBlockFull = true;
             if (fUsingModified) {
                 // Since we always look at the best entry in mapModifiedTx,
                 // we must erase failed entries so that we can consider the
@@ -7,9 +7,12 @@
 #define BITCOIN_MINER_H
 
 #include <primitives/block.h>
+#include <sync.h>
 #include <txmempool.h>
 
 #include <stdint.h>
+#include <list>
+#include <map>
 #include <memory>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
@@ -22,6 +25,8 @@ class CWallet;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+//! Mempool changes a CBlockTemplateCache records before it gives up on updating its selection
+static const size_t MAX_BLOCK_TEMPLATE_CACHE_UPDATES = 100000;
 
 struct CBlockTemplate
 {
@@ -120,6 +125,72 @@ struct update_for_parent_inclusion
     CTxMemPool::txiter iter;
 };
 
+/**
+ * The transactions BlockAssembler last selected for a block, with the mempool
+ * changes notified since. As long as the chain tip and the assembler's options
+ * stay the same, and the mempool changed only by these notified additions and
+ * removals, the next template starts from this selection and applies the
+ * changes to it, instead of selecting packages from the whole mempool again.
+ */
+class CBlockTemplateCache
+{
+public:
+    struct Entry
+    {
+        CTransactionRef tx;
+        CAmount nFee;
+        int64_t nSigOpCost;
+        uint64_t nWeight;
+    };
+
+    //! What the selection depends on besides the mempool
+    struct Key
+    {
+        uint256 hashPrevBlock;
+        int nHeight;
+        int64_t nLockTimeCutoff;
+        bool fIncludeWitness;
+        unsigned int nBlockMaxWeight;
+        CFeeRate blockMinFeeRate;
+
+        bool operator==(const Key& other) const;
+    };
+
+private:
+    CCriticalSection cs;
+    bool fValid;
+    Key key;
+    //! Selected transactions, in block order
+    std::list<Entry> listEntries;
+    std::map<uint256, std::list<Entry>::iterator> mapEntries;
+    //! A package was left out because the block was full
+    bool fFull;
+    //! Earliest time at which a transaction left out for being in the future can be included
+    int64_t nTimeDeferred;
+    //! Latest time of a selected transaction, which the block time must not be before
+    int64_t nTimeLatest;
+    //! Value of the mempool's transactions updated counter if it only changed by the notifications below
+    unsigned int nTransactionsUpdated;
+    std::vector<CTransactionRef> vAdded;
+    std::vector<uint256> vRemoved;
+
+    boost::signals2::scoped_connection connAdded;
+    boost::signals2::scoped_connection connRemoved;
+
+    void TransactionAdded(CTransactionRef tx);
+    void TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason);
+
+    friend class BlockAssembler;
+
+public:
+    CBlockTemplateCache();
+
+    /** Start following the changes to pool, once. */
+    void Connect(CTxMemPool& pool);
+    /** Make the next template select its transactions from scratch. */
+    void Invalidate();
+};
+
 /** Generate a new block, without valid proof-of-work */
 class BlockAssembler
 {
@@ -140,6 +211,9 @@ private:
     uint64_t nBlockSigOpsCost;
     CAmount nFees;
     CTxMemPool::setEntries inBlock;
+    // A package didn't fit, and earliest time of a package left out for being in the future
+    bool fBlockFull;
+    int64_t nTimeDeferred;
 
     // Chain context for the block
     int nHeight;
@@ -166,6 +240,16 @@ private:
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
 
+    // Methods for reusing the transactions selected for the previous block.
+    /** Add the transactions in cache to the block, updated for the mempool
+      * changes since. Returns false if the selection has to be done again;
+      * nAdded and nRemoved count the changes applied (for logging). */
+    bool addCachedTxs(CBlockTemplateCache& cache, const CBlockTemplateCache::Key& key, int &nAdded, int &nRemoved);
+    /** Add a tx from the cache to the block */
+    void AddToBlock(const CBlockTemplateCache::Entry& entry);
+    /** Store the transactions in the block in cache */
+    void storeCachedTxs(CBlockTemplateCache& cache, const CBlockTemplateCache::Key& key);
+
     // Methods for how to add transactions to a block.
     /** Add transactions based on feerate including unconfirmed ancestors
       * Increments nPackagesSelected / nDescendantsUpdated with corresponding
@@ -366,6 +366,76 @@ static CAddress GetBindAddress(SOCKET sock)
     return addr_bind;
 }
 
+CDialStats::Entry& CDialStats::GetOrCreate(const CService& addr)
+{
+    AssertLockHeld(cs);
+    auto it = mapStats.find(addr);
+    if (it != mapStats.end())
+        return it->second;
+    if (mapStats.size() >= MAX_DIAL_STATS) {
+        // Forget the address we heard least recently about
+        auto itOldest = mapStats.begin();
+        for (auto itCheck = mapStats.begin(); itCheck != mapStats.end(); ++itCheck) {
+            if (itCheck->second.nLastUpdate < itOldest->second.nLastUpdate)
+                itOldest = itCheck;
+        }
+        mapStats.erase(itOldest);
+    }
+    return mapStats[addr];
+}
+
+void CDialStats::RecordSuccess(const CService& addr, int64_t nLatencyMillis)
+{
+    LOCK(cs);
+    Entry& entry = GetOrCreate(addr);
+    if (entry.nSuccesses == 0)
+        entry.nAvgLatency = nLatencyMillis;
+    else
+        entry.nAvgLatency = (entry.nAvgLatency * 3 + nLatencyMillis) / 4;
+    entry.nSuccesses++;
+    entry.nLastUpdate = GetTime();
+}
+
+void CDialStats::RecordFailure(const CService& addr)
+{
+    LOCK(cs);
+    Entry& entry = GetOrCreate(addr);
+    entry.nFailures++;
+    entry.nLastUpdate = GetTime();
+}
+
+bool CDialStats::Get(const CService& addr, Entry& entry) const
+{
+    LOCK(cs);
+    auto it = mapStats.find(addr);
+    if (it == mapStats.end())
+        return false;
+    entry = it->second;
+    return true;
+}
+
+bool CDialStats::IsSlow(const CService& addr) const
+{
+    Entry entry;
+    if (!Get(addr, entry))
+        return false;
+    if (entry.nFailures >= 3 && entry.nFailures > entry.nSuccesses)
+        return true;
+    return entry.nSuccesses > 0 && entry.nAvgLatency > DIAL_SLOW_LATENCY;
+}
+
+size_t CDialStats::Size() const
+{
+    LOCK(cs);
+    return mapStats.size();
+}
+
+void CDialStats::Clear()
+{
+    LOCK(cs);
+    mapStats.clear();
+}
+
 CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCountFailure)
 {
     if (pszDest == nullptr) {
@@ -417,6 +487,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
     proxyType proxy;
     if (addrConnect.IsValid()) {
         bool proxyConnectionFailed = false;
+        int64_t nDialStart = GetTimeMillis();
 
         if (GetProxy(addrConnect.GetNetwork(), proxy)) {
             hSocket = CreateSocket(proxy.proxy);
@@ -436,6 +507,13 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
             // If a connection to the node was attempted, and failure (if any) is not caused by a problem connecting to
             // the proxy, mark this as an attempt.
             addrman.Attempt(addrConnect, fCountFailure);
+            if (connected) {
+                int64_t nLatency = GetTimeMillis() - nDialStart;
+                m_dial_stats.RecordSuccess(addrConnect, nLatency);
+                LogPrint(BCLog::NET, "connected to %s in %dms\n", addrConnect.ToString(), nLatency);
+            } else {
+                m_dial_stats.RecordFailure(addrConnect);
+            }
         }
     } else if (pszDest && GetNameProxy(proxy)) {
         hSocket = CreateSocket(proxy.proxy);
@@ -1778,8 +1856,18 @@ void CConnman::ThreadOpenConnections(const std::vector<std::string> connect)
 
         // Only connect out to one peer per network group (/16 for IPv4).
         // Do this here so we don't have to critsect vNodes inside mapAddresses critsect.
+        // Groups of dials still in flight count as connected, so parallel dials never
+        // target the same group.
         int nOutbound = 0;
         std::set<std::vector<unsigned char> > setConnected;
+        {
+            std::lock_guard<std::mutex> lock(mutexPendingDials);
+            if (nDialsInFlight >= nMaxParallelDials) {
+                // All dialers are busy, keep the outbound slot for the next round
+                continue;
+            }
+            setConnected.insert(setDialGroupsInFlight.begin(), setDialGroupsInFlight.end());
+        }
         {
             LOCK(cs_vNodes);
             for (CNode* pnode : vNodes) {
@@ -1856,6 +1944,10 @@ void CConnman::ThreadOpenConnections(const std::vector<std::string> connect)
             if (addr.GetPort() != Params().GetDefaultPort() && nTries < 50)
                 continue;
 
+            // prefer addresses that were quick to reach last time, only fall back to slow ones after 20 attempts
+            if (nTries < 20 && m_dial_stats.IsSlow(addr))
+                continue;
+
             addrConnect = addr;
             break;
         }
@@ -1870,7 +1962,54 @@ void CConnman::ThreadOpenConnections(const std::vector<std::string> connect)
                 LogPrint(BCLog::NET, "Making feeler connection to %s\n", addrConnect.ToString());
             }
 
-            OpenNetworkConnection(addrConnect, (int)setConnected.size() >= std::min(nMaxConnections - 1, 2), &grant, nullptr, false, fFeeler);
+            QueueDial(addrConnect, (int)setConnected.size() >= std::min(nMaxConnections - 1, 2), grant, fFeeler);
+        }
+    }
+}
+
+void CConnman::QueueDial(const CAddress& addrConnect, bool fCountFailure, CSemaphoreGrant& grant, bool fFeeler)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutexPendingDials);
+        vPendingDials.emplace_back();
+        PendingDial& dial = vPendingDials.back();
+        dial.addr = addrConnect;
+        dial.fCountFailure = fCountFailure;
+        dial.fFeeler = fFeeler;
+        grant.MoveTo(dial.grant);
+        setDialGroupsInFlight.insert(addrConnect.GetGroup());
+        nDialsInFlight++;
+    }
+    condPendingDials.notify_one();
+}
+
+void CConnman::ThreadDial()
+{
+    // Each dialer runs one blocking connect + SOCKS5 handshake at a time. Running
+    // several of them lets Tor build circuits to different hidden services
+    // concurrently instead of paying each circuit setup in turn.
+    while (!interruptNet)
+    {
+        PendingDial dial;
+        {
+            std::unique_lock<std::mutex> lock(mutexPendingDials);
+            condPendingDials.wait(lock, [this] { return !vPendingDials.empty() || interruptNet; });
+            if (interruptNet)
+                break;
+            PendingDial& front = vPendingDials.front();
+            dial.addr = front.addr;
+            dial.fCountFailure = front.fCountFailure;
+            dial.fFeeler = front.fFeeler;
+            front.grant.MoveTo(dial.grant);
+            vPendingDials.pop_front();
+        }
+
+        OpenNetworkConnection(dial.addr, dial.fCountFailure, &dial.grant, nullptr, false, dial.fFeeler);
+
+        {
+            std::lock_guard<std::mutex> lock(mutexPendingDials);
+            setDialGroupsInFlight.erase(setDialGroupsInFlight.find(dial.addr.GetGroup()));
+            nDialsInFlight--;
         }
     }
 }
@@ -2205,6 +2344,7 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nSendBufferMaxSize = 0;
     nReceiveFloodSize = 0;
     flagInterruptMsgProc = false;
+    nDialsInFlight = 0;
     SetTryNewOutboundPeer(false);
 
     Options connOptions;
@@ -2357,6 +2497,12 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
     if (connOptions.m_use_addrman_outgoing || !connOptions.m_specified_outgoing.empty())
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this, connOptions.m_specified_outgoing)));
 
+    // Dial addrman-selected peers in parallel
+    if (connOptions.m_use_addrman_outgoing) {
+        for (int i = 0; i < nMaxParallelDials; i++)
+            threadDialers.emplace_back(&TraceThread<std::function<void()> >, "dial", std::function<void()>(std::bind(&CConnman::ThreadDial, this)));
+    }
+
     // Process messages
     threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
 
@@ -2391,6 +2537,10 @@ void CConnman::Interrupt()
 
     interruptNet();
     InterruptSocks5(true);
+    {
+        std::lock_guard<std::mutex> lock(mutexPendingDials);
+        condPendingDials.notify_all();
+    }
 
     if (semOutbound) {
         for (int i=0; i<(nMaxOutbound + nMaxFeeler); i++) {
@@ -2411,6 +2561,17 @@ void CConnman::Stop()
         threadMessageHandler.join();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
+    for (std::thread& threadDialer : threadDialers) {
+        if (threadDialer.joinable())
+            threadDialer.join();
+    }
+    threadDialers.clear();
+    {
+        std::lock_guard<std::mutex> lock(mutexPendingDials);
+        vPendingDials.clear();
+        setDialGroupsInFlight.clear();
+        nDialsInFlight = 0;
+    }
     if (threadOpenAddedConnections.joinable())
         threadOpenAddedConnections.join();
     if (threadDNSAddressSeed.joinable())
@@ -24,6 +24,8 @@
 
 #include <atomic>
 #include <deque>
+#include <map>
+#include <set>
 #include <stdint.h>
 #include <thread>
 #include <memory>
@@ -59,6 +61,14 @@ static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 static const int MAX_OUTBOUND_CONNECTIONS = 8;
 /** Maximum number of addnode outgoing nodes */
 static const int MAX_ADDNODE_CONNECTIONS = 8;
+/** -maxparalleldials default: outbound dials (connect + SOCKS5 handshake) allowed in flight at once */
+static const int DEFAULT_MAX_PARALLEL_DIALS = 4;
+/** Upper bound for -maxparalleldials */
+static const int MAX_PARALLEL_DIALS = MAX_OUTBOUND_CONNECTIONS;
+/** Average dial latency (in milliseconds) above which an address is only tried after faster ones */
+static const int64_t DIAL_SLOW_LATENCY = 8000;
+/** Maximum number of addresses for which dial latency statistics are kept */
+static const size_t MAX_DIAL_STATS = 2000;
 /** -listen default */
 static const bool DEFAULT_LISTEN = true;
 /** -upnp default */
@@ -113,6 +123,38 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/**
+ * Outbound dial statistics per address. Over Tor, establishing a circuit to a
+ * hidden service takes anywhere from under a second to tens of seconds, so we
+ * remember how long connecting (including the SOCKS5 handshake) took and how
+ * often it failed, and let ThreadOpenConnections try fast addresses first.
+ */
+class CDialStats
+{
+public:
+    struct Entry
+    {
+        int64_t nAvgLatency = 0; //!< Exponential moving average of successful dials, in milliseconds
+        int nSuccesses = 0;
+        int nFailures = 0;
+        int64_t nLastUpdate = 0;
+    };
+
+    void RecordSuccess(const CService& addr, int64_t nLatencyMillis);
+    void RecordFailure(const CService& addr);
+    bool Get(const CService& addr, Entry& entry) const;
+    //! Whether addr is known to be slow or mostly unreachable and should be deprioritized
+    bool IsSlow(const CService& addr) const;
+    size_t Size() const;
+    void Clear();
+
+private:
+    Entry& GetOrCreate(const CService& addr);
+
+    mutable CCriticalSection cs;
+    std::map<CService, Entry> mapStats GUARDED_BY(cs);
+};
+
 class NetEventsInterface;
 class CConnman
 {
@@ -132,6 +174,7 @@ public:
         int nMaxOutbound = 0;
         int nMaxAddnode = 0;
         int nMaxFeeler = 0;
+        int nMaxParallelDials = DEFAULT_MAX_PARALLEL_DIALS;
         int nBestHeight = 0;
         CClientUIInterface* uiInterface = nullptr;
         NetEventsInterface* m_msgproc = nullptr;
@@ -153,6 +196,7 @@ public:
         nMaxOutbound = std::min(connOptions.nMaxOutbound, connOptions.nMaxConnections);
         nMaxAddnode = connOptions.nMaxAddnode;
         nMaxFeeler = connOptions.nMaxFeeler;
+        nMaxParallelDials = std::max(1, std::min(connOptions.nMaxParallelDials, MAX_PARALLEL_DIALS));
         nBestHeight = connOptions.nBestHeight;
         clientInterface = connOptions.uiInterface;
         m_msgproc = connOptions.m_msgproc;
@@ -315,6 +359,14 @@ public:
 
     void WakeMessageHandler();
 private:
+    /** An outbound connection handed from ThreadOpenConnections to a dialer thread */
+    struct PendingDial {
+        CAddress addr;
+        bool fCountFailure;
+        bool fFeeler;
+        CSemaphoreGrant grant;
+    };
+
     struct ListenSocket {
         SOCKET socket;
         bool whitelisted;
@@ -329,6 +381,8 @@ private:
     void AddOneShot(const std::string& strDest);
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
+    void QueueDial(const CAddress& addrConnect, bool fCountFailure, CSemaphoreGrant& grant, bool fFeeler);
+    void ThreadDial();
     void ThreadMessageHandler();
     void AcceptConnection(const ListenSocket& hListenSocket);
     void ThreadSocketHandler();
@@ -411,6 +465,7 @@ private:
     int nMaxOutbound;
     int nMaxAddnode;
     int nMaxFeeler;
+    int nMaxParallelDials;
     std::atomic<int> nBestHeight;
     CClientUIInterface* clientInterface;
     NetEventsInterface* m_msgproc;
@@ -427,11 +482,20 @@ private:
 
     CThreadInterrupt interruptNet;
 
+    /** Dials queued or in progress; the network groups in flight are excluded from selection */
+    std::deque<PendingDial> vPendingDials;
+    std::multiset<std::vector<unsigned char>> setDialGroupsInFlight;
+    int nDialsInFlight;
+    std::mutex mutexPendingDials;
+    std::condition_variable condPendingDials;
+    CDialStats m_dial_stats;
+
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
     std::thread threadMessageHandler;
+    std::vector<std::thread> threadDialers;
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of nMaxOutbound
@@ -56,6 +56,20 @@ struct COrphanTx {
 static CCriticalSection g_cs_orphans;
 std::map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(g_cs_orphans);
 std::map<COutPoint, std::set<std::map<uint256, COrphanTx>::iterator, IteratorComparator>> mapOrphanTransactionsByPrev GUARDED_BY(g_cs_orphans);
+
+/** A transaction from a peer, waiting for its scripts to be verified off the message handler thread */
+struct PendingTx {
+    CTransactionRef tx;
+    CValidationState state;
+    bool fVerified;
+};
+static CWaitableCriticalSection cs_pending_txs;
+static CConditionVariable cond_pending_txs;
+/** The peer's later messages wait for it, so there is at most one per peer */
+static std::map<NodeId, PendingTx> mapPendingTxs GUARDED_BY(cs_pending_txs);
+/** Peers whose transaction is still to be verified, in the order they sent them */
+static std::deque<NodeId> queuePendingTxs GUARDED_BY(cs_pending_txs);
+static bool fStopVerifyingTxs GUARDED_BY(cs_pending_txs) = false;
 void EraseOrphansFor(NodeId peer);
 
 static size_t vExtraTxnForCompactIt GUARDED_BY(g_cs_orphans) = 0;
@@ -76,6 +90,38 @@ namespace {
     /** Number of nodes with fSyncStarted. */
     int nSyncStarted = 0;
 
+    /**
+     * Stretch of the headers chain between two consecutive checkpoints. While
+     * the single sync peer walks the chain from our best header, other peers
+     * are asked for the headers of later segments with getheaders(start, stop).
+     * Since the stop checkpoint commits to every header before it, a segment
+     * is only accepted when it links up with the checkpoint hash. Protected
+     * by cs_main.
+     */
+    struct HeadersSegment {
+        uint256 hashStart;      //!< Checkpoint the segment starts after
+        int nHeightStart;
+        uint256 hashStop;       //!< Checkpoint that ends the segment
+        int nHeightStop;
+        uint256 hashLast;       //!< Last header received so far, hashStart if none
+        int nHeightLast;
+        NodeId nodeid;          //!< Peer fetching this segment, or -1
+        int64_t nRequestTime;   //!< When the outstanding getheaders was sent (in microseconds)
+    };
+    std::vector<HeadersSegment> vHeadersSegments;
+    bool fHeadersSegmentsInitialized = false;
+
+    /** Headers batch received from a segment peer that does not connect to our headers chain yet. */
+    struct COrphanHeaders {
+        std::vector<CBlockHeader> headers;
+        NodeId fromPeer;
+        size_t nSegment;
+    };
+    /** Orphan header batches by the hashPrevBlock of their first header. Protected by cs_main. */
+    std::map<uint256, COrphanHeaders> mapOrphanHeaders;
+    /** Number of headers in mapOrphanHeaders. Protected by cs_main. */
+    size_t nOrphanHeaders = 0;
+
     /**
      * Sources of received blocks, saved to be able to send them reject
      * messages or ban them when processing happens afterwards. Protected by
@@ -114,6 +160,7 @@ namespace {
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
+        bool fUnsolicited;                                       //!< Whether the peer announced this block as a compact block before we asked for it.
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -139,6 +186,26 @@ namespace {
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
 } // namespace
 
+// Size the download window so that requests cover one round trip at the rate the peer delivers
+// blocks (the bandwidth-delay product), with a factor of two of headroom so the window can grow
+// until the link rather than the window limits throughput. Over Tor, round trips of 1-3 seconds
+// are common and the fixed MAX_BLOCKS_IN_TRANSIT_PER_PEER leaves most of the bandwidth unused.
+int GetBlockDownloadWindow(int64_t nAvgBlockInterval, int64_t nPingUsecTime)
+{
+    if (nAvgBlockInterval <= 0 || nPingUsecTime <= 0)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nWindow = 2 * nPingUsecTime / nAvgBlockInterval + 1;
+    return std::max<int64_t>(MAX_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(nWindow, MAX_BLOCKS_IN_TRANSIT_PER_PEER_ADAPTIVE));
+}
+
+// Whether an idle peer that delivers a block every nAvgBlockInterval microseconds should take over
+// the block a staller delivering every nStallerAvgBlockInterval holds up (0 if not measured yet).
+// Blocks only ever move to measurably faster peers, so they cannot bounce back and forth.
+bool ShouldReassignStalledBlock(int64_t nAvgBlockInterval, int64_t nStallerAvgBlockInterval)
+{
+    return nAvgBlockInterval > 0 && (nStallerAvgBlockInterval == 0 || nAvgBlockInterval < nStallerAvgBlockInterval);
+}
+
 namespace {
 
 struct CBlockReject {
@@ -180,6 +247,10 @@ struct CNodeState {
     bool fSyncStarted;
     //! When to potentially disconnect peer for stalling headers download
     int64_t nHeadersSyncTimeout;
+    //! Index into vHeadersSegments of the checkpoint segment this peer is fetching, or -1.
+    int nHeadersSegment;
+    //! Whether this peer failed to deliver a checkpoint segment; it is not asked for another one.
+    bool fHeadersSegmentFailed;
     //! Since when we're stalling block download progress (in microseconds), or 0.
     int64_t nStallingSince;
     std::list<QueuedBlock> vBlocksInFlight;
@@ -187,6 +258,12 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Moving average of the time between blocks arriving from this peer while we await them (in microseconds), or 0.
+    int64_t nAvgBlockInterval;
+    //! When the last block we requested from this peer arrived (in microseconds), or 0.
+    int64_t nLastBlockReceived;
+    //! How many blocks we are willing to have in flight from this peer, see UpdateBlockDownloadWindow.
+    int nBlockDownloadWindow;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -250,10 +327,15 @@ struct CNodeState {
         nUnconnectingHeaders = 0;
         fSyncStarted = false;
         nHeadersSyncTimeout = 0;
+        nHeadersSegment = -1;
+        fHeadersSegmentFailed = false;
         nStallingSince = 0;
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nAvgBlockInterval = 0;
+        nLastBlockReceived = 0;
+        nBlockDownloadWindow = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -335,6 +417,34 @@ bool MarkBlockAsReceived(const uint256& hash) {
     return false;
 }
 
+// Requires cs_main.
+// Record the arrival of a block we requested from nodeid, to measure the rate at which the peer delivers blocks.
+void RecordBlockArrival(NodeId nodeid, const uint256& hash) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    // A block pushed to us was never waited for, so its arrival says nothing about the peer's rate
+    if (itInFlight->second.second->fUnsolicited)
+        return;
+    CNodeState *state = State(nodeid);
+    assert(state != nullptr);
+    int64_t nNow = GetTimeMicros();
+    // Time since the previous block arrived, or since we started waiting if the peer was idle in between
+    int64_t nInterval = nNow - std::max(state->nLastBlockReceived, state->nDownloadingSince);
+    if (nInterval > 0) {
+        if (state->nAvgBlockInterval == 0)
+            state->nAvgBlockInterval = nInterval;
+        else
+            state->nAvgBlockInterval = (state->nAvgBlockInterval * 7 + nInterval) / 8;
+    }
+    state->nLastBlockReceived = nNow;
+}
+
+// Requires cs_main.
+void UpdateBlockDownloadWindow(CNodeState *state, int64_t nPingUsecTime) {
+    state->nBlockDownloadWindow = GetBlockDownloadWindow(state->nAvgBlockInterval, nPingUsecTime);
+}
+
 // Requires cs_main.
 // returns false, still setting pit, if the block was already in flight from the same peer
 // pit will only be valid as long as the same cs_main lock is being held
@@ -355,7 +465,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex*
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
+            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr), false});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -464,7 +574,7 @@ bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex)
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
  *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams) 
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const CBlockIndex*& pindexStalled, const Consensus::Params& consensusParams)
 {
     if (count == 0)
         return;
@@ -508,6 +618,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     // LogPrintf(">> nMaxHeight = %d, nWindowEnd = %d\n", nMaxHeight, nWindowEnd);
     NodeId waitingfor = -1;
+    const CBlockIndex* pindexWaitingFor = nullptr;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -543,6 +654,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        pindexStalled = pindexWaitingFor;
                     }
                     return;
                 }
@@ -553,11 +665,109 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
 }
 
+void InitHeadersSegments(const CChainParams& chainparams)
+{
+    if (fHeadersSegmentsInitialized)
+        return;
+    fHeadersSegmentsInitialized = true;
+
+    const MapCheckpoints& checkpoints = chainparams.Checkpoints().mapCheckpoints;
+    for (auto it = checkpoints.begin(); it != checkpoints.end() && std::next(it) != checkpoints.end(); ++it) {
+        HeadersSegment segment;
+        segment.hashStart = it->second;
+        segment.nHeightStart = it->first;
+        segment.hashStop = std::next(it)->second;
+        segment.nHeightStop = std::next(it)->first;
+        segment.hashLast = segment.hashStart;
+        segment.nHeightLast = segment.nHeightStart;
+        segment.nodeid = -1;
+        segment.nRequestTime = 0;
+        vHeadersSegments.push_back(segment);
+    }
+}
+
+/** Stop fetching the peer's checkpoint segment. What was received so far is kept for the next peer. */
+void ReleaseHeadersSegment(CNodeState* state)
+{
+    if (state->nHeadersSegment < 0)
+        return;
+    vHeadersSegments[state->nHeadersSegment].nodeid = -1;
+    state->nHeadersSegment = -1;
+}
+
+/** Forget everything received for a checkpoint segment so it gets fetched again. */
+void ResetHeadersSegment(size_t nSegment)
+{
+    HeadersSegment& segment = vHeadersSegments[nSegment];
+    if (segment.nodeid != -1) {
+        CNodeState* state = State(segment.nodeid);
+        if (state)
+            state->nHeadersSegment = -1;
+        segment.nodeid = -1;
+    }
+    segment.hashLast = segment.hashStart;
+    segment.nHeightLast = segment.nHeightStart;
+
+    for (auto it = mapOrphanHeaders.begin(); it != mapOrphanHeaders.end(); ) {
+        if (it->second.nSegment == nSegment) {
+            nOrphanHeaders -= it->second.headers.size();
+            it = mapOrphanHeaders.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/** Number of headers in mapOrphanHeaders received from this peer. */
+size_t CountOrphanHeaders(NodeId nodeid)
+{
+    size_t nCount = 0;
+    for (const auto& entry : mapOrphanHeaders) {
+        if (entry.second.fromPeer == nodeid)
+            nCount += entry.second.headers.size();
+    }
+    return nCount;
+}
+
+void RequestHeadersSegment(CNode* pto, CNodeState* state, CConnman* connman)
+{
+    HeadersSegment& segment = vHeadersSegments[state->nHeadersSegment];
+    segment.nRequestTime = GetTimeMicros();
+    LogPrint(BCLog::NET, "getheaders (%d) to checkpoint %d to peer=%d\n", segment.nHeightLast, segment.nHeightStop, pto->GetId());
+    const CNetMsgMaker msgMaker(pto->GetSendVersion());
+    connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, CBlockLocator(std::vector<uint256>(1, segment.hashLast)), segment.hashStop));
+}
+
+/** Hand the lowest checkpoint segment nobody is fetching yet to this peer. */
+void AssignHeadersSegment(CNode* pto, CNodeState* state, CConnman* connman)
+{
+    if (state->nHeadersSegment >= 0 || state->fHeadersSegmentFailed || nOrphanHeaders >= MAX_ORPHAN_HEADERS ||
+            CountOrphanHeaders(pto->GetId()) >= MAX_ORPHAN_HEADERS_PER_PEER)
+        return;
+
+    for (size_t i = 0; i < vHeadersSegments.size(); i++) {
+        HeadersSegment& segment = vHeadersSegments[i];
+        if (segment.nHeightStop > pto->nStartingHeight)
+            break;
+        // Skip segments being fetched, finished ones and the one the sync peer is walking through
+        if (segment.nodeid != -1 || segment.hashLast == segment.hashStop || segment.nHeightStart <= pindexBestHeader->nHeight)
+            continue;
+        if (mapBlockIndex.count(segment.hashStop))
+            continue;
+
+        segment.nodeid = pto->GetId();
+        state->nHeadersSegment = i;
+        RequestHeadersSegment(pto, state, connman);
+        return;
+    }
+}
+
 } // namespace
 
 // This function is used for testing the stale tip eviction logic, see
@@ -596,6 +806,7 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
 
     if (state->fSyncStarted)
         nSyncStarted--;
+    ReleaseHeadersSegment(state);
 
     if (state->nMisbehavior == 0 && state->fCurrentlyConnected) {
         fUpdateConnectionTime = true;
@@ -605,6 +816,10 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
         mapBlocksInFlight.erase(entry.hash);
     }
     EraseOrphansFor(nodeid);
+    {
+        WaitableLock lock(cs_pending_txs);
+        mapPendingTxs.erase(nodeid);
+    }
     nPreferredDownload -= state->fPreferredDownload;
     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
     assert(nPeersWithValidatedDownloads >= 0);
@@ -635,6 +850,9 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nBlockDownloadWindow = state->nBlockDownloadWindow;
+    stats.nHeadersSegment = state->nHeadersSegment >= 0 ? vHeadersSegments[state->nHeadersSegment].nHeightStop : -1;
+    stats.nOrphanHeaders = CountOrphanHeaders(nodeid);
     return true;
 }
 
@@ -813,6 +1031,55 @@ PeerLogicValidation::PeerLogicValidation(CConnman* connmanIn, CScheduler &schedu
     // timer.
     static_assert(EXTRA_PEER_CHECK_INTERVAL < STALE_CHECK_INTERVAL, "peer eviction timer should be less than stale tip check timer");
     scheduler.scheduleEvery(std::bind(&PeerLogicValidation::CheckForStaleTipAndEvictPeers, this, consensusParams), EXTRA_PEER_CHECK_INTERVAL * 1000);
+
+    {
+        WaitableLock lock(cs_pending_txs);
+        fStopVerifyingTxs = false;
+    }
+    m_tx_verify_thread = std::thread(&TraceThread<std::function<void()> >, "txverify", std::function<void()>(std::bind(&PeerLogicValidation::ThreadVerifyTransactions, this)));
+}
+
+PeerLogicValidation::~PeerLogicValidation()
+{
+    {
+        WaitableLock lock(cs_pending_txs);
+        fStopVerifyingTxs = true;
+    }
+    cond_pending_txs.notify_all();
+    m_tx_verify_thread.join();
+}
+
+void PeerLogicValidation::ThreadVerifyTransactions()
+{
+    while (true) {
+        NodeId nodeid;
+        CTransactionRef ptx;
+        {
+            WaitableLock lock(cs_pending_txs);
+            cond_pending_txs.wait(lock, [] { return fStopVerifyingTxs || !queuePendingTxs.empty(); });
+            if (fStopVerifyingTxs)
+                return;
+            nodeid = queuePendingTxs.front();
+            queuePendingTxs.pop_front();
+            auto it = mapPendingTxs.find(nodeid);
+            if (it == mapPendingTxs.end())
+                continue;
+            ptx = it->second.tx;
+        }
+
+        CValidationState state;
+        PreVerifyTransaction(ptx, state);
+
+        {
+            WaitableLock lock(cs_pending_txs);
+            auto it = mapPendingTxs.find(nodeid);
+            if (it == mapPendingTxs.end() || it->second.tx != ptx)
+                continue;
+            it->second.state = state;
+            it->second.fVerified = true;
+        }
+        connman->WakeMessageHandler();
+    }
 }
 
 void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex, const std::vector<CTransactionRef>& vtxConflicted) {
@@ -882,24 +1149,22 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
             return;
         ProcessBlockAvailability(pnode->GetId());
 
-        // DeepOnion: PoS blocks don't pass validation with CompactBlocks so commenting out for now.
-        //            In the future we may need to review this as there are ties with SEGWIT.
-        // vvvvvvvvvvvv DO NOT REMOVE GREEN CODE vvvvvvvvvvvvvvvvvvvvv
-//        CNodeState &state = *State(pnode->GetId());
-//         If the peer has, or we announced to them the previous block already,
-//         but we don't think they have this one, go ahead and announce it
-//        if (state.fPreferHeaderAndIDs && (!fWitnessEnabled || state.fWantsCmpctWitness) &&
-//                !PeerHasHeader(&state, pindex) && PeerHasHeader(&state, pindex->pprev)) {
-//
-//            LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
-//                    hashBlock.ToString(), pnode->GetId());
-//            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
-//            state.pindexBestHeaderSent = pindex;
-//        }
-//
-//         for old client send inv message
-//        if(pnode->nVersion < PROTOCOL_VERSION)
-        // ^^^^^^^^^^^^ DO NOT REMOVE GREEN CODE ^^^^^^^^^^^^^^^^^^^^^^
+        // DeepOnion: only peers that understand the PoS cmpctblock format
+        // (block signature and prefilled coinstake) can be sent one.
+        CNodeState &state = *State(pnode->GetId());
+        // If the peer has, or we announced to them the previous block already,
+        // but we don't think they have this one, go ahead and announce it
+        if (pnode->nVersion >= POS_CMPCT_BLOCKS_VERSION &&
+                state.fPreferHeaderAndIDs && (!fWitnessEnabled || state.fWantsCmpctWitness) &&
+                !PeerHasHeader(&state, pindex) && PeerHasHeader(&state, pindex->pprev)) {
+
+            LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
+                    hashBlock.ToString(), pnode->GetId());
+            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            state.pindexBestHeaderSent = pindex;
+        }
+        // for other peers send an inv message
+        else
         {
             std::vector<CInv> vInv;
             vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
@@ -965,8 +1230,7 @@ void PeerLogicValidation::BlockChecked(const CBlock& block, const CValidationSta
              !IsInitialBlockDownload() &&
              mapBlocksInFlight.count(hash) == mapBlocksInFlight.size()) {
         if (it != mapBlockSource.end()) {
-            // DeepOnion: Compact blocks break PoS validation, so don't tell any nodes to send them.
-//            MaybeSetPeerAsAnnouncingHeaderAndIDs(it->second.first, connman);
+            MaybeSetPeerAsAnnouncingHeaderAndIDs(it->second.first, connman);
         }
     }
     if (it != mapBlockSource.end())
@@ -1178,18 +1442,18 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
             // instead we respond with the full, non-compact block.
             bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
             int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
-//            if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-//                if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == mi->second->GetBlockHash()) {
-//                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
-//                } else {
-//                    CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
-//                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
-//                }
-//            } else {
-//                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
-//            }
-//          DeepOnion: The above "Green Code" should not be removed. CMPCTBLOCK break validation.
-            connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
+            // DeepOnion: peers older than POS_CMPCT_BLOCKS_VERSION would drop the
+            // block signature, so they always get the full block.
+            if (pfrom->nVersion >= POS_CMPCT_BLOCKS_VERSION && CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == mi->second->GetBlockHash()) {
+                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
+                } else {
+                    CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
+                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                }
+            } else {
+                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
+            }
         }
 
         // Trigger the peer node to send a getblocks request for the next batch of inventory
@@ -1299,6 +1563,150 @@ inline void static SendBlockTransactions(const CBlock& block, const BlockTransac
 }
 
 
+enum HeadersSegmentStatus {
+    HEADERS_SEGMENT_NONE,       //!< Not an answer to a checkpoint segment request
+    HEADERS_SEGMENT_CONNECTS,   //!< Segment headers that connect to our headers chain
+    HEADERS_SEGMENT_BUFFERED,   //!< Segment headers kept in mapOrphanHeaders until they connect
+    HEADERS_SEGMENT_DROPPED,    //!< Segment headers not kept because the peer's share of mapOrphanHeaders is full
+    HEADERS_SEGMENT_INVALID,
+};
+
+/**
+ * Move the peer's checkpoint segment past headers that were accepted or
+ * buffered, and ask for the next batch.
+ */
+static void AdvanceHeadersSegment(CNode* pfrom, CNodeState* nodestate, const std::vector<CBlockHeader>& headers, CConnman* connman)
+{
+    AssertLockHeld(cs_main);
+    HeadersSegment& segment = vHeadersSegments[nodestate->nHeadersSegment];
+    segment.hashLast = headers.back().GetHash();
+    segment.nHeightLast += headers.size();
+    UpdateBlockAvailability(pfrom->GetId(), segment.hashLast);
+
+    if (segment.hashLast == segment.hashStop) {
+        LogPrint(BCLog::NET, "received headers up to checkpoint %d from peer=%d\n", segment.nHeightStop, pfrom->GetId());
+        ReleaseHeadersSegment(nodestate);
+    } else if (headers.size() < MAX_HEADERS_RESULTS) {
+        // The peer does not have the rest of the segment (yet)
+        nodestate->fHeadersSegmentFailed = true;
+        ReleaseHeadersSegment(nodestate);
+    } else if (nOrphanHeaders >= MAX_ORPHAN_HEADERS || CountOrphanHeaders(pfrom->GetId()) >= MAX_ORPHAN_HEADERS_PER_PEER) {
+        // Picked up again by SendMessages once the buffered headers connect
+        ReleaseHeadersSegment(nodestate);
+    } else {
+        RequestHeadersSegment(pfrom, nodestate, connman);
+    }
+}
+
+/**
+ * Check a headers message against the checkpoint segment requested from this
+ * peer. Headers that connect to our headers chain are left to the caller,
+ * which advances the segment once they are accepted. Headers that do not
+ * connect yet are buffered after the context-free checks, and the next batch
+ * is requested right away.
+ */
+static HeadersSegmentStatus ProcessHeadersSegment(CNode* pfrom, CNodeState* nodestate, const std::vector<CBlockHeader>& headers, const CChainParams& chainparams, CConnman* connman)
+{
+    AssertLockHeld(cs_main);
+    if (nodestate->nHeadersSegment < 0)
+        return HEADERS_SEGMENT_NONE;
+    const size_t nSegment = nodestate->nHeadersSegment;
+    const HeadersSegment& segment = vHeadersSegments[nSegment];
+    if (headers[0].hashPrevBlock != segment.hashLast)
+        return HEADERS_SEGMENT_NONE;
+
+    uint256 hashLast = segment.hashLast;
+    int nHeightLast = segment.nHeightLast;
+    for (const CBlockHeader& header : headers) {
+        if (header.hashPrevBlock != hashLast || nHeightLast >= segment.nHeightStop) {
+            Misbehaving(pfrom->GetId(), 20);
+            nodestate->fHeadersSegmentFailed = true;
+            ReleaseHeadersSegment(nodestate);
+            return HEADERS_SEGMENT_INVALID;
+        }
+        hashLast = header.GetHash();
+        nHeightLast++;
+    }
+    if (nHeightLast == segment.nHeightStop && hashLast != segment.hashStop) {
+        // The peer is on a chain that does not go through the checkpoint
+        Misbehaving(pfrom->GetId(), 20);
+        nodestate->fHeadersSegmentFailed = true;
+        ReleaseHeadersSegment(nodestate);
+        return HEADERS_SEGMENT_INVALID;
+    }
+
+    if (mapBlockIndex.find(headers[0].hashPrevBlock) != mapBlockIndex.end())
+        return HEADERS_SEGMENT_CONNECTS;
+
+    // Buffered headers are only fully validated once they connect
+    for (const CBlockHeader& header : headers) {
+        CValidationState state;
+        if (!CheckBlockHeader(header, state, chainparams.GetConsensus())) {
+            int nDoS = 0;
+            state.IsInvalid(nDoS);
+            Misbehaving(pfrom->GetId(), nDoS);
+            nodestate->fHeadersSegmentFailed = true;
+            ResetHeadersSegment(nSegment);
+            return HEADERS_SEGMENT_INVALID;
+        }
+    }
+
+    if (CountOrphanHeaders(pfrom->GetId()) + headers.size() > MAX_ORPHAN_HEADERS_PER_PEER) {
+        // The peer already holds its share of the buffer, leave the rest of the segment to others
+        ReleaseHeadersSegment(nodestate);
+        return HEADERS_SEGMENT_DROPPED;
+    }
+
+    COrphanHeaders& orphan = mapOrphanHeaders[headers[0].hashPrevBlock];
+    nOrphanHeaders += headers.size() - orphan.headers.size();
+    orphan.headers = headers;
+    orphan.fromPeer = pfrom->GetId();
+    orphan.nSegment = nSegment;
+
+    AdvanceHeadersSegment(pfrom, nodestate, headers, connman);
+    return HEADERS_SEGMENT_BUFFERED;
+}
+
+/**
+ * Process buffered segment headers that connect to our headers chain now.
+ * pindexLast is moved forward if the linked headers extend it.
+ */
+static void LinkOrphanHeaders(const CChainParams& chainparams, const CBlockIndex*& pindexLast)
+{
+    while (true) {
+        COrphanHeaders orphan;
+        {
+            LOCK(cs_main);
+            auto it = mapOrphanHeaders.begin();
+            while (it != mapOrphanHeaders.end() && mapBlockIndex.find(it->first) == mapBlockIndex.end())
+                ++it;
+            if (it == mapOrphanHeaders.end())
+                return;
+            orphan = std::move(it->second);
+            nOrphanHeaders -= orphan.headers.size();
+            mapOrphanHeaders.erase(it);
+        }
+
+        CValidationState state;
+        const CBlockIndex* pindex = nullptr;
+        if (!ProcessNewBlockHeaders(orphan.headers, state, chainparams, &pindex)) {
+            LOCK(cs_main);
+            int nDoS;
+            if (state.IsInvalid(nDoS)) {
+                Misbehaving(orphan.fromPeer, nDoS);
+            }
+            CNodeState* nodestate = State(orphan.fromPeer);
+            if (nodestate)
+                nodestate->fHeadersSegmentFailed = true;
+            ResetHeadersSegment(orphan.nSegment);
+            LogPrint(BCLog::NET, "invalid buffered headers from peer=%d, fetching checkpoint %d again\n", orphan.fromPeer, vHeadersSegments[orphan.nSegment].nHeightStop);
+            continue;
+        }
+        if (pindexLast && pindex->GetAncestor(pindexLast->nHeight) == pindexLast)
+            pindexLast = pindex;
+    }
+}
+
 bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::vector<CBlockHeader>& headers, const CChainParams& chainparams, bool punish_duplicate_invalid)
 {
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
@@ -1310,11 +1718,22 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
     }
 
     bool received_new_header = false;
+    bool fSegmentResponse = false;
     const CBlockIndex *pindexLast = nullptr;
     {
         LOCK(cs_main);
         CNodeState *nodestate = State(pfrom->GetId());
 
+        // Answers to checkpoint segment requests may arrive before the headers
+        // they build on; those are buffered instead of treated as unconnecting.
+        HeadersSegmentStatus segment_status = ProcessHeadersSegment(pfrom, nodestate, headers, chainparams, connman);
+        if (segment_status == HEADERS_SEGMENT_INVALID) {
+            return error("invalid checkpoint segment headers");
+        } else if (segment_status == HEADERS_SEGMENT_BUFFERED || segment_status == HEADERS_SEGMENT_DROPPED) {
+            return true;
+        }
+        fSegmentResponse = segment_status == HEADERS_SEGMENT_CONNECTS;
+
         // If this looks like it could be a block announcement (nCount <
         // MAX_BLOCKS_TO_ANNOUNCE), use special logic for handling headers that
         // don't connect:
@@ -1361,6 +1780,13 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
     CValidationState state;
     CBlockHeader first_invalid_header;
     if (!ProcessNewBlockHeaders(headers, state, chainparams, &pindexLast, &first_invalid_header)) {
+        if (fSegmentResponse) {
+            LOCK(cs_main);
+            CNodeState *nodestate = State(pfrom->GetId());
+            nodestate->fHeadersSegmentFailed = true;
+            if (nodestate->nHeadersSegment >= 0)
+                ResetHeadersSegment(nodestate->nHeadersSegment);
+        }
         int nDoS;
         if (state.IsInvalid(nDoS)) {
             LOCK(cs_main);
@@ -1404,7 +1830,10 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
             return error("invalid header received");
         }
     }
-    
+
+    // Buffered segment headers may connect now
+    LinkOrphanHeaders(chainparams, pindexLast);
+
     {
         LOCK(cs_main);
         CNodeState *nodestate = State(pfrom->GetId());
@@ -1424,7 +1853,10 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
             nodestate->m_last_block_announcement = GetTime();
         }
 
-        if (nCount == MAX_HEADERS_RESULTS) {
+        if (fSegmentResponse && nodestate->nHeadersSegment >= 0 &&
+                vHeadersSegments[nodestate->nHeadersSegment].hashLast == headers[0].hashPrevBlock) {
+            AdvanceHeadersSegment(pfrom, nodestate, headers, connman);
+        } else if (nCount == MAX_HEADERS_RESULTS && !fSegmentResponse) {
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
@@ -1485,9 +1917,10 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
         }
         // If we're in IBD, we want outbound peers that will serve us a useful
         // chain. Disconnect peers that are on chains with insufficient work.
-        if (IsInitialBlockDownload() && nCount != MAX_HEADERS_RESULTS) {
+        if (IsInitialBlockDownload() && nCount != MAX_HEADERS_RESULTS && !fSegmentResponse) {
             // When nCount < MAX_HEADERS_RESULTS, we know we have no more
-            // headers to fetch from this peer.
+            // headers to fetch from this peer (a segment ends at a checkpoint
+            // instead).
             if (nodestate->pindexBestKnownBlock && nodestate->pindexBestKnownBlock->nChainWork < nMinimumChainWork) {
                 // This peer has too little work on their headers chain to help
                 // us sync -- disconnect if using an outbound slot (unless
@@ -1518,6 +1951,191 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
     return true;
 }
 
+/**
+ * Hand a transaction from a peer, whose scripts PreVerifyTransaction found
+ * invalid if stateVerify is, to the mempool, then relay it or reject it.
+ */
+static void ProcessTransaction(CNode* pfrom, const CTransactionRef& ptx, const CValidationState& stateVerify, CConnman* connman)
+{
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    const std::string strCommand = NetMsgType::TX;
+    std::deque<COutPoint> vWorkQueue;
+    std::vector<uint256> vEraseQueue;
+    const CTransaction& tx = *ptx;
+    CInv inv(MSG_TX, tx.GetHash());
+
+    LOCK2(cs_main, g_cs_orphans);
+
+    bool fMissingInputs = false;
+    CValidationState state;
+
+    pfrom->setAskFor.erase(inv.hash);
+    mapAlreadyAskedFor.erase(inv.hash);
+
+    std::list<CTransactionRef> lRemovedTxn;
+
+    // A transaction whose signatures failed is rejected without verifying them again
+    const bool fAlreadyHave = AlreadyHave(inv);
+    if (!fAlreadyHave && !stateVerify.IsValid())
+        state = stateVerify;
+
+    if (!fAlreadyHave && state.IsValid() &&
+        AcceptToMemoryPool(mempool, state, ptx, &fMissingInputs, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
+        mempool.check(pcoinsTip.get());
+        RelayTransaction(tx, connman);
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            vWorkQueue.emplace_back(inv.hash, i);
+        }
+
+        pfrom->nLastTXTime = GetTime();
+
+        LogPrint(BCLog::MEMPOOL, "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
+            pfrom->GetId(),
+            tx.GetHash().ToString(),
+            mempool.size(), mempool.DynamicMemoryUsage() / 1000);
+
+        // Recursively process any orphan transactions that depended on this one
+        std::set<NodeId> setMisbehaving;
+        while (!vWorkQueue.empty()) {
+            auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
+            vWorkQueue.pop_front();
+            if (itByPrev == mapOrphanTransactionsByPrev.end())
+                continue;
+            for (auto mi = itByPrev->second.begin();
+                 mi != itByPrev->second.end();
+                 ++mi)
+            {
+                const CTransactionRef& porphanTx = (*mi)->second.tx;
+                const CTransaction& orphanTx = *porphanTx;
+                const uint256& orphanHash = orphanTx.GetHash();
+                NodeId fromPeer = (*mi)->second.fromPeer;
+                bool fMissingInputs2 = false;
+                // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                CValidationState stateDummy;
+
+
+                if (setMisbehaving.count(fromPeer))
+                    continue;
+                if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, &fMissingInputs2, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
+                    LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n", orphanHash.ToString());
+                    RelayTransaction(orphanTx, connman);
+                    for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
+                        vWorkQueue.emplace_back(orphanHash, i);
+                    }
+                    vEraseQueue.push_back(orphanHash);
+                }
+                else if (!fMissingInputs2)
+                {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                    {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos);
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint(BCLog::MEMPOOL, "   invalid orphan tx %s\n", orphanHash.ToString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee
+                    LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n", orphanHash.ToString());
+                    vEraseQueue.push_back(orphanHash);
+                    if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
+                        // Do not use rejection cache for witness transactions or
+                        // witness-stripped transactions, as they can have been malleated.
+                        // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+                        assert(recentRejects);
+                        recentRejects->insert(orphanHash);
+                    }
+                }
+                mempool.check(pcoinsTip.get());
+            }
+        }
+
+        for (uint256 hash : vEraseQueue)
+            EraseOrphanTx(hash);
+    }
+    else if (fMissingInputs)
+    {
+        bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
+        for (const CTxIn& txin : tx.vin) {
+            if (recentRejects->contains(txin.prevout.hash)) {
+                fRejectedParents = true;
+                break;
+            }
+        }
+        if (!fRejectedParents) {
+            uint32_t nFetchFlags = GetFetchFlags(pfrom);
+            for (const CTxIn& txin : tx.vin) {
+                CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
+                pfrom->AddInventoryKnown(_inv);
+                if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
+            }
+            AddOrphanTx(ptx, pfrom->GetId());
+
+            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, gArgs.GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+            if (nEvicted > 0) {
+                LogPrint(BCLog::MEMPOOL, "mapOrphan overflow, removed %u tx\n", nEvicted);
+            }
+        } else {
+            LogPrint(BCLog::MEMPOOL, "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
+            // We will continue to reject this tx since it has rejected
+            // parents so avoid re-requesting it from other peers.
+            recentRejects->insert(tx.GetHash());
+        }
+    } else {
+        if (!tx.HasWitness() && !state.CorruptionPossible()) {
+            // Do not use rejection cache for witness transactions or
+            // witness-stripped transactions, as they can have been malleated.
+            // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+            assert(recentRejects);
+            recentRejects->insert(tx.GetHash());
+            if (RecursiveDynamicUsage(*ptx) < 100000) {
+                AddToCompactExtraTransactions(ptx);
+            }
+        } else if (tx.HasWitness() && RecursiveDynamicUsage(*ptx) < 100000) {
+            AddToCompactExtraTransactions(ptx);
+        }
+
+        if (pfrom->fWhitelisted && gArgs.GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
+            // Always relay transactions received from whitelisted peers, even
+            // if they were already in the mempool or rejected from it due
+            // to policy, allowing the node to function as a gateway for
+            // nodes hidden behind it.
+            //
+            // Never relay transactions that we would assign a non-zero DoS
+            // score for, as we expect peers to do the same with us in that
+            // case.
+            int nDoS = 0;
+            if (!state.IsInvalid(nDoS) || nDoS == 0) {
+                LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->GetId());
+                RelayTransaction(tx, connman);
+            } else {
+                LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->GetId(), FormatStateMessage(state));
+            }
+        }
+    }
+
+    for (const CTransactionRef& removedTx : lRemovedTxn)
+        AddToCompactExtraTransactions(removedTx);
+
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        LogPrint(BCLog::MEMPOOLREJ, "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
+            pfrom->GetId(),
+            FormatStateMessage(state));
+        if (state.GetRejectCode() > 0 && state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
+                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
+        if (nDoS > 0) {
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->GetId());
@@ -1770,19 +2388,19 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             // nodes)
             connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDHEADERS));
         }
-//        if (pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION) {
-//            // Tell our peer we are willing to provide version 1 or 2 cmpctblocks
-//            // However, we do not request new block announcements using
-//            // cmpctblock messages.
-//            // We send this to non-NODE NETWORK peers as well, because
-//            // they may wish to request compact blocks from us
-//            bool fAnnounceUsingCMPCTBLOCK = false;
-//            uint64_t nCMPCTBLOCKVersion = 2;
-//            if (pfrom->GetLocalServices() & NODE_WITNESS)
-//                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion));
-//            nCMPCTBLOCKVersion = 1;
-//            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion));
-//        }
+        if (pfrom->nVersion >= POS_CMPCT_BLOCKS_VERSION) {
+            // Tell our peer we are willing to provide version 1 or 2 cmpctblocks
+            // However, we do not request new block announcements using
+            // cmpctblock messages.
+            // We send this to non-NODE NETWORK peers as well, because
+            // they may wish to request compact blocks from us
+            bool fAnnounceUsingCMPCTBLOCK = false;
+            uint64_t nCMPCTBLOCKVersion = 2;
+            if (pfrom->GetLocalServices() & NODE_WITNESS)
+                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion));
+            nCMPCTBLOCKVersion = 1;
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion));
+        }
         pfrom->fSuccessfullyConnected = true;
     }
 
@@ -1855,6 +2473,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         bool fAnnounceUsingCMPCTBLOCK = false;
         uint64_t nCMPCTBLOCKVersion = 0;
         vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (pfrom->nVersion < POS_CMPCT_BLOCKS_VERSION) {
+            LogPrint(BCLog::NET, "ignoring sendcmpct from pre-PoS-cmpctblock peer=%d\n", pfrom->GetId());
+            return true;
+        }
         if (nCMPCTBLOCKVersion == 1 || ((pfrom->GetLocalServices() & NODE_WITNESS) && nCMPCTBLOCKVersion == 2)) {
             LOCK(cs_main);
             // fProvidesHeaderAndIDs is used to "lock in" version of compact blocks we send (fWantsCmpctWitness)
@@ -2141,185 +2763,30 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
-        std::deque<COutPoint> vWorkQueue;
-        std::vector<uint256> vEraseQueue;
         CTransactionRef ptx;
         vRecv >> ptx;
-        const CTransaction& tx = *ptx;
 
-        CInv inv(MSG_TX, tx.GetHash());
+        CInv inv(MSG_TX, ptx->GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        LOCK2(cs_main, g_cs_orphans);
-
-        bool fMissingInputs = false;
-        CValidationState state;
-
-        pfrom->setAskFor.erase(inv.hash);
-        mapAlreadyAskedFor.erase(inv.hash);
-
-        std::list<CTransactionRef> lRemovedTxn;
-
-        if (!AlreadyHave(inv) &&
-            AcceptToMemoryPool(mempool, state, ptx, &fMissingInputs, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
-            mempool.check(pcoinsTip.get());
-            RelayTransaction(tx, connman);
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                vWorkQueue.emplace_back(inv.hash, i);
-            }
-
-            pfrom->nLastTXTime = GetTime();
-
-            LogPrint(BCLog::MEMPOOL, "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
-                pfrom->GetId(),
-                tx.GetHash().ToString(),
-                mempool.size(), mempool.DynamicMemoryUsage() / 1000);
-
-            // Recursively process any orphan transactions that depended on this one
-            std::set<NodeId> setMisbehaving;
-            while (!vWorkQueue.empty()) {
-                auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
-                vWorkQueue.pop_front();
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (auto mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const CTransactionRef& porphanTx = (*mi)->second.tx;
-                    const CTransaction& orphanTx = *porphanTx;
-                    const uint256& orphanHash = orphanTx.GetHash();
-                    NodeId fromPeer = (*mi)->second.fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, &fMissingInputs2, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
-                        LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx, connman);
-                        for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
-                            vWorkQueue.emplace_back(orphanHash, i);
-                        }
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint(BCLog::MEMPOOL, "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee
-                        LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
-                            // Do not use rejection cache for witness transactions or
-                            // witness-stripped transactions, as they can have been malleated.
-                            // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                            assert(recentRejects);
-                            recentRejects->insert(orphanHash);
-                        }
-                    }
-                    mempool.check(pcoinsTip.get());
-                }
-            }
-
-            for (uint256 hash : vEraseQueue)
-                EraseOrphanTx(hash);
-        }
-        else if (fMissingInputs)
-        {
-            bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
-            for (const CTxIn& txin : tx.vin) {
-                if (recentRejects->contains(txin.prevout.hash)) {
-                    fRejectedParents = true;
-                    break;
-                }
-            }
-            if (!fRejectedParents) {
-                uint32_t nFetchFlags = GetFetchFlags(pfrom);
-                for (const CTxIn& txin : tx.vin) {
-                    CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
-                    pfrom->AddInventoryKnown(_inv);
-                    if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
-                }
-                AddOrphanTx(ptx, pfrom->GetId());
-
-                // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-                unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, gArgs.GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-                if (nEvicted > 0) {
-                    LogPrint(BCLog::MEMPOOL, "mapOrphan overflow, removed %u tx\n", nEvicted);
-                }
-            } else {
-                LogPrint(BCLog::MEMPOOL, "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
-                // We will continue to reject this tx since it has rejected
-                // parents so avoid re-requesting it from other peers.
-                recentRejects->insert(tx.GetHash());
-            }
-        } else {
-            if (!tx.HasWitness() && !state.CorruptionPossible()) {
-                // Do not use rejection cache for witness transactions or
-                // witness-stripped transactions, as they can have been malleated.
-                // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                assert(recentRejects);
-                recentRejects->insert(tx.GetHash());
-                if (RecursiveDynamicUsage(*ptx) < 100000) {
-                    AddToCompactExtraTransactions(ptx);
-                }
-            } else if (tx.HasWitness() && RecursiveDynamicUsage(*ptx) < 100000) {
-                AddToCompactExtraTransactions(ptx);
-            }
-
-            if (pfrom->fWhitelisted && gArgs.GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
-                // Always relay transactions received from whitelisted peers, even
-                // if they were already in the mempool or rejected from it due
-                // to policy, allowing the node to function as a gateway for
-                // nodes hidden behind it.
-                //
-                // Never relay transactions that we would assign a non-zero DoS
-                // score for, as we expect peers to do the same with us in that
-                // case.
-                int nDoS = 0;
-                if (!state.IsInvalid(nDoS) || nDoS == 0) {
-                    LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->GetId());
-                    RelayTransaction(tx, connman);
-                } else {
-                    LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->GetId(), FormatStateMessage(state));
-                }
-            }
-        }
-
-        for (const CTransactionRef& removedTx : lRemovedTxn)
-            AddToCompactExtraTransactions(removedTx);
-
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
+        // Verify the scripts on the verification thread, see ProcessMessages
         {
-            LogPrint(BCLog::MEMPOOLREJ, "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
-                pfrom->GetId(),
-                FormatStateMessage(state));
-            if (state.GetRejectCode() > 0 && state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
-                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
-                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
-            if (nDoS > 0) {
-                Misbehaving(pfrom->GetId(), nDoS);
-            }
+            WaitableLock lock(cs_pending_txs);
+            mapPendingTxs[pfrom->GetId()] = PendingTx{ptx, CValidationState(), false};
+            queuePendingTxs.push_back(pfrom->GetId());
         }
+        cond_pending_txs.notify_one();
     }
 
 
     else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
+        if (pfrom->nVersion < POS_CMPCT_BLOCKS_VERSION) {
+            // Without the block signature the block cannot be reconstructed
+            LogPrint(BCLog::NET, "ignoring cmpctblock from pre-PoS-cmpctblock peer=%d\n", pfrom->GetId());
+            return true;
+        }
+
         CBlockHeaderAndShortTxIDs cmpctblock;
         vRecv >> cmpctblock;
 
@@ -2421,7 +2888,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) ||
                  (fAlreadyInFlight && blockInFlightIt->second.first == pfrom->GetId())) {
                 std::list<QueuedBlock>::iterator* queuedBlockIt = nullptr;
-                if (!MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), pindex, &queuedBlockIt)) {
+                if (MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), pindex, &queuedBlockIt)) {
+                    // Newly in flight: the peer announced it before we asked for it
+                    (*queuedBlockIt)->fUnsolicited = true;
+                } else {
                     if (!(*queuedBlockIt)->partialBlock)
                         (*queuedBlockIt)->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
                     else {
@@ -2589,6 +3059,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 // though the block was successfully read, and rely on the
                 // handling in ProcessNewBlock to ensure the block index is
                 // updated, reject messages go out, etc.
+                RecordBlockArrival(pfrom->GetId(), resp.blockhash);
                 MarkBlockAsReceived(resp.blockhash); // it is now an empty pointer
                 fBlockRead = true;
                 // mapBlockSource is only used for sending reject messages and DoS scores,
@@ -2666,6 +3137,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             LOCK(cs_main);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
+            RecordBlockArrival(pfrom->GetId(), hash);
             forceProcessing |= MarkBlockAsReceived(hash);
             // mapBlockSource is only used for sending reject messages and DoS scores,
             // so the race between here and cs_main in ProcessNewBlock is fine.
@@ -2953,6 +3425,27 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     if (pfrom->fPauseSend)
         return false;
 
+    // The messages after a transaction wait until its scripts are verified,
+    // so that they are still processed in order while other peers' are not
+    // held up meanwhile
+    CTransactionRef ptxVerified;
+    CValidationState stateVerify;
+    {
+        WaitableLock lock(cs_pending_txs);
+        auto it = mapPendingTxs.find(pfrom->GetId());
+        if (it != mapPendingTxs.end()) {
+            if (!it->second.fVerified)
+                return false;
+            ptxVerified = it->second.tx;
+            stateVerify = it->second.state;
+            mapPendingTxs.erase(it);
+        }
+    }
+    if (ptxVerified) {
+        ProcessTransaction(pfrom, ptxVerified, stateVerify, connman);
+        return true;
+    }
+
     std::list<CNetMessage> msgs;
     {
         LOCK(pfrom->cs_vProcessMsg);
@@ -3285,6 +3778,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         if (!state.fSyncStarted && !pto->fClient && !fImporting && !fReindex) {
             // Only actively request headers from a single peer, unless we're close to today.
             if ((nSyncStarted == 0 && fFetch) || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 24 * 60 * 60) {
+                ReleaseHeadersSegment(&state);
                 state.fSyncStarted = true;
                 state.nHeadersSyncTimeout = GetTimeMicros() + HEADERS_DOWNLOAD_TIMEOUT_BASE + HEADERS_DOWNLOAD_TIMEOUT_PER_HEADER * (GetAdjustedTime() - pindexBestHeader->GetBlockTime())/(consensusParams.nPowTargetSpacing);
                 nSyncStarted++;
@@ -3302,6 +3796,13 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                 connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), uint256()));                   
             }
         }
+        // While the sync peer walks the headers chain, fetch the segments
+        // between later checkpoints from the other peers in parallel.
+        if (!state.fSyncStarted && nSyncStarted > 0 && !pto->fClient && !fImporting && !fReindex &&
+                pindexBestHeader->GetBlockTime() <= GetAdjustedTime() - 24 * 60 * 60) {
+            InitHeadersSegments(Params());
+            AssignHeadersSegment(pto, &state, connman);
+        }
 
         // Resend wallet transactions that haven't gotten in a block yet
         // Except during reindex, importing and IBD, when old wallet
@@ -3379,8 +3880,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                 }
             }
             if (!fRevertToInv && !vHeaders.empty()) {
-                // DeepOnion: Below "Green Code" should not be removed - CMPCTBLOCK break PoS validation.
-                /*if (vHeaders.size() == 1 && state.fPreferHeaderAndIDs) {
+                if (vHeaders.size() == 1 && state.fPreferHeaderAndIDs) {
                     // We only send up to 1 block as header-and-ids, as otherwise
                     // probably means we're doing an initial-ish-sync or they're slow
                     LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", __func__,
@@ -3409,7 +3909,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                         connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                     }
                     state.pindexBestHeaderSent = pBestIndex;
-                } else */ if (state.fPreferHeaders) {
+                } else if (state.fPreferHeaders) {
                     if (vHeaders.size() > 1) {
                         LogPrint(BCLog::NET, "%s: %u headers, range (%s, %s), to peer=%d\n", __func__,
                                 vHeaders.size(),
@@ -3587,9 +4087,11 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         if (!vInv.empty())
             connman->PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
 
-        // Detect whether we're stalling
+        // Detect whether we're stalling. A peer needs at least a round trip to respond, so
+        // high-latency peers get correspondingly more time.
         nNow = GetTimeMicros();
-        if (state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
+        int64_t nStallingTimeout = std::max<int64_t>(1000000 * BLOCK_STALLING_TIMEOUT, 2 * pto->nPingUsecTime);
+        if (state.nStallingSince && state.nStallingSince < nNow - nStallingTimeout) {
             // Stalling only triggers when the block download window cannot move. During normal steady state,
             // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
             // should only happen during initial block download.
@@ -3611,6 +4113,12 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                 return true;
             }
         }
+        // Check for checkpoint segment timeouts; the segment moves on to another peer
+        if (state.nHeadersSegment >= 0 && nNow > vHeadersSegments[state.nHeadersSegment].nRequestTime + HEADERS_SEGMENT_TIMEOUT) {
+            LogPrint(BCLog::NET, "Timeout downloading checkpoint segment headers from peer=%d\n", pto->GetId());
+            state.fHeadersSegmentFailed = true;
+            ReleaseHeadersSegment(&state);
+        }
         // Check for headers sync timeouts
         if (state.fSyncStarted && state.nHeadersSyncTimeout < std::numeric_limits<int64_t>::max()) {
             // Detect whether this is a stalling initial-headers-sync peer
@@ -3652,10 +4160,12 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        UpdateBlockDownloadWindow(&state, pto->nPingUsecTime);
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < state.nBlockDownloadWindow) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            const CBlockIndex* pindexStalled = nullptr;
+            FindNextBlocksToDownload(pto->GetId(), state.nBlockDownloadWindow - state.nBlocksInFlight, vToDownload, staller, pindexStalled, consensusParams);
             for (const CBlockIndex *pindex : vToDownload) {
             	if(mapBannedHash.count(pindex->GetBlockHash()))
             	{
@@ -3669,9 +4179,19 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                     pindex->nHeight, pto->GetId());
             }
             if (state.nBlocksInFlight == 0 && staller != -1) {
-                if (State(staller)->nStallingSince == 0) {
-                    State(staller)->nStallingSince = nNow;
+                CNodeState *stateStaller = State(staller);
+                if (stateStaller->nStallingSince == 0) {
+                    stateStaller->nStallingSince = nNow;
                     LogPrint(BCLog::NET, "Stall started peer=%d\n", staller);
+                } else if (pindexStalled != nullptr && ShouldReassignStalledBlock(state.nAvgBlockInterval, stateStaller->nAvgBlockInterval) &&
+                           !mapBannedHash.count(pindexStalled->GetBlockHash())) {
+                    // The window is held up by a single block from a slower peer while we sit idle:
+                    // ask for it here instead.
+                    uint32_t nFetchFlags = GetFetchFlags(pto);
+                    vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindexStalled->GetBlockHash()));
+                    MarkBlockAsInFlight(pto->GetId(), pindexStalled->GetBlockHash(), pindexStalled);
+                    LogPrint(BCLog::NET, "Reassigning stalled block %s (%d) from peer=%d to peer=%d\n", pindexStalled->GetBlockHash().ToString(),
+                        pindexStalled->nHeight, staller, pto->GetId());
                 }
             }
         }
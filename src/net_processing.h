@@ -22,6 +22,13 @@ static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
  *  Timeout = base + per_header * (expected number of headers) */
 static constexpr int64_t HEADERS_DOWNLOAD_TIMEOUT_BASE = 15 * 60 * 1000000; // 15 minutes
 static constexpr int64_t HEADERS_DOWNLOAD_TIMEOUT_PER_HEADER = 1000; // 1ms/header
+/** How long a peer may take to answer a getheaders for a checkpoint segment before the
+ *  segment is handed to another peer, in microseconds */
+static constexpr int64_t HEADERS_SEGMENT_TIMEOUT = 2 * 60 * 1000000; // 2 minutes
+/** Maximum number of out-of-order headers buffered until they connect to our headers chain */
+static constexpr unsigned int MAX_ORPHAN_HEADERS = 200000;
+/** Maximum number of those headers that may come from a single peer */
+static constexpr unsigned int MAX_ORPHAN_HEADERS_PER_PEER = 20000;
 /** Protect at least this many outbound peers from disconnection due to slow/
  * behind headers chain.
  */
@@ -41,6 +48,7 @@ private:
 
 public:
     explicit PeerLogicValidation(CConnman* connman, CScheduler &scheduler);
+    ~PeerLogicValidation();
 
     void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindexConnected, const std::vector<CTransactionRef>& vtxConflicted) override;
     void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
@@ -67,6 +75,10 @@ public:
 
 private:
     int64_t m_stale_tip_check_time; //! Next time to check for stale tip
+
+    /** Verifies the scripts of the transactions peers send, see ProcessMessages */
+    std::thread m_tx_verify_thread;
+    void ThreadVerifyTransactions();
 };
 
 struct CNodeStateStats {
@@ -74,6 +86,9 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlockDownloadWindow;
+    int nHeadersSegment;
+    size_t nOrphanHeaders;
 };
 
 /** Get statistics from node state */
@@ -13,6 +13,8 @@
 #include <util.h>
 
 static constexpr double INF_FEERATE = 1e99;
+/** Below this, the stored moving averages of a TxConfirmStats are rescaled */
+static constexpr double MIN_AVG_SCALE = 1e-100;
 
 std::string StringForFeeEstimateHorizon(FeeEstimateHorizon horizon) {
     static const std::map<FeeEstimateHorizon, std::string> horizon_strings = {
@@ -98,6 +100,11 @@ private:
 
     double decay;
 
+    // The moving averages above are stored divided by decay^(blocks since they were
+    // last rescaled), so that decaying them all only takes updating this factor.
+    // Multiply a stored value by avgScale to get the moving average.
+    double avgScale;
+
     // Resolution (# of blocks) with which confirmations are tracked
     unsigned int scale;
 
@@ -108,7 +115,17 @@ private:
     // transactions still unconfirmed after GetMaxConfirms for each bucket
     std::vector<int> oldUnconfTxs;
 
+    // For each bucket X, the number of transactions unconfirmed for Y blocks or
+    // more, including oldUnconfTxs, as of unconfHeight; rebuilt when stale
+    mutable std::vector<std::vector<int> > unconfAtLeast; // unconfAtLeast[Y][X]
+    mutable unsigned int unconfHeight;
+    mutable bool unconfStale;
+
     void resizeInMemoryCounters(size_t newbuckets);
+    /** Fold avgScale into the stored moving averages */
+    void Rescale();
+    /** Make unconfAtLeast count the transactions unconfirmed at nBlockHeight */
+    void UpdateUnconfirmedTotals(unsigned int nBlockHeight) const;
 
 public:
     /**
@@ -140,7 +157,7 @@ public:
                   unsigned int bucketIndex, bool inBlock);
 
     /** Update our estimates by decaying our historical moving average and updating
-        with the data gathered from the current block */
+        with the data gathered from the current block. Takes constant time. */
     void UpdateMovingAverages();
 
     /**
@@ -153,16 +170,17 @@ public:
      * @param requireGreater return the lowest feerate such that all higher values pass minSuccess OR
      *        return the highest feerate such that all lower values fail minSuccess
      * @param nBlockHeight the current block height
+     * @param log whether to log the calculation
      */
     double EstimateMedianVal(int confTarget, double sufficientTxVal,
                              double minSuccess, bool requireGreater, unsigned int nBlockHeight,
-                             EstimationResult *result = nullptr) const;
+                             EstimationResult *result = nullptr, bool log = true) const;
 
     /** Return the max number of confirms we're tracking */
     unsigned int GetMaxConfirms() const { return scale * confAvg.size(); }
 
-    /** Write state of estimation data to a file*/
-    void Write(CAutoFile& fileout) const;
+    /** Write state of estimation data to a stream*/
+    void Write(CDataStream& stream) const;
 
     /**
      * Read saved state of estimation data from a file and replace all internal data structures and
@@ -175,7 +193,7 @@ public:
 TxConfirmStats::TxConfirmStats(const std::vector<double>& defaultBuckets,
                                 const std::map<double, unsigned int>& defaultBucketMap,
                                unsigned int maxPeriods, double _decay, unsigned int _scale)
-    : buckets(defaultBuckets), bucketMap(defaultBucketMap)
+    : buckets(defaultBuckets), bucketMap(defaultBucketMap), avgScale(1), unconfHeight(0), unconfStale(true)
 {
     decay = _decay;
     assert(_scale != 0 && "_scale must be non-zero");
@@ -202,6 +220,36 @@ void TxConfirmStats::resizeInMemoryCounters(size_t newbuckets) {
         unconfTxs[i].resize(newbuckets);
     }
     oldUnconfTxs.resize(newbuckets);
+    unconfAtLeast.assign(GetMaxConfirms() + 1, std::vector<int>(newbuckets));
+    unconfStale = true;
+}
+
+void TxConfirmStats::Rescale()
+{
+    for (unsigned int j = 0; j < buckets.size(); j++) {
+        for (unsigned int i = 0; i < confAvg.size(); i++)
+            confAvg[i][j] *= avgScale;
+        for (unsigned int i = 0; i < failAvg.size(); i++)
+            failAvg[i][j] *= avgScale;
+        avg[j] *= avgScale;
+        txCtAvg[j] *= avgScale;
+    }
+    avgScale = 1;
+}
+
+void TxConfirmStats::UpdateUnconfirmedTotals(unsigned int nBlockHeight) const
+{
+    if (!unconfStale && unconfHeight == nBlockHeight)
+        return;
+    unsigned int bins = unconfTxs.size();
+    unconfAtLeast[GetMaxConfirms()] = oldUnconfTxs;
+    for (unsigned int confct = GetMaxConfirms(); confct-- > 0; ) {
+        const std::vector<int>& unconf = unconfTxs[(nBlockHeight - confct)%bins];
+        for (unsigned int j = 0; j < buckets.size(); j++)
+            unconfAtLeast[confct][j] = unconfAtLeast[confct + 1][j] + unconf[j];
+    }
+    unconfHeight = nBlockHeight;
+    unconfStale = false;
 }
 
 // Roll the unconfirmed txs circular buffer
@@ -211,6 +259,7 @@ void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
         oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
         unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
     }
+    unconfStale = true;
 }
 
 
@@ -221,29 +270,25 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
         return;
     int periodsToConfirm = (blocksToConfirm + scale - 1)/scale;
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
+    const double one = 1 / avgScale;
     for (size_t i = periodsToConfirm; i <= confAvg.size(); i++) {
-        confAvg[i - 1][bucketindex]++;
+        confAvg[i - 1][bucketindex] += one;
     }
-    txCtAvg[bucketindex]++;
-    avg[bucketindex] += val;
+    txCtAvg[bucketindex] += one;
+    avg[bucketindex] += val * one;
 }
 
 void TxConfirmStats::UpdateMovingAverages()
 {
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay;
-        for (unsigned int i = 0; i < failAvg.size(); i++)
-            failAvg[i][j] = failAvg[i][j] * decay;
-        avg[j] = avg[j] * decay;
-        txCtAvg[j] = txCtAvg[j] * decay;
-    }
+    avgScale *= decay;
+    if (avgScale < MIN_AVG_SCALE)
+        Rescale();
 }
 
 // returns -1 on error conditions
 double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
                                          double successBreakPoint, bool requireGreater,
-                                         unsigned int nBlockHeight, EstimationResult *result) const
+                                         unsigned int nBlockHeight, EstimationResult *result, bool log) const
 {
     // Counters for a bucket (or range of buckets)
     double nConf = 0; // Number of tx's confirmed within the confTarget
@@ -254,6 +299,9 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
 
     int maxbucketindex = buckets.size() - 1;
 
+    UpdateUnconfirmedTotals(nBlockHeight);
+    const std::vector<int>& unconfAtTarget = unconfAtLeast[std::min<unsigned int>(confTarget, GetMaxConfirms())];
+
     // requireGreater means we are looking for the lowest feerate such that all higher
     // values pass, so we start at maxbucketindex (highest feerate) and look at successively
     // smaller buckets until we reach failure.  Otherwise, we are looking for the highest
@@ -272,7 +320,6 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int bestFarBucket = startbucket;
 
     bool foundAnswer = false;
-    unsigned int bins = unconfTxs.size();
     bool newBucketRange = true;
     bool passing = true;
     EstimatorBucket passBucket;
@@ -285,12 +332,10 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
             newBucketRange = false;
         }
         curFarBucket = bucket;
-        nConf += confAvg[periodTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
-        failNum += failAvg[periodTarget - 1][bucket];
-        for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
-            extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
-        extraNum += oldUnconfTxs[bucket];
+        nConf += confAvg[periodTarget - 1][bucket] * avgScale;
+        totalNum += txCtAvg[bucket] * avgScale;
+        failNum += failAvg[periodTarget - 1][bucket] * avgScale;
+        extraNum += unconfAtTarget[bucket];
         // If we have enough transaction data points in this range of buckets,
         // we can test for success
         // (Only count the confirmed data points, so that each confirmation count
@@ -345,13 +390,13 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int minBucket = std::min(bestNearBucket, bestFarBucket);
     unsigned int maxBucket = std::max(bestNearBucket, bestFarBucket);
     for (unsigned int j = minBucket; j <= maxBucket; j++) {
-        txSum += txCtAvg[j];
+        txSum += txCtAvg[j] * avgScale;
     }
     if (foundAnswer && txSum != 0) {
         txSum = txSum / 2;
         for (unsigned int j = minBucket; j <= maxBucket; j++) {
-            if (txCtAvg[j] < txSum)
-                txSum -= txCtAvg[j];
+            if (txCtAvg[j] * avgScale < txSum)
+                txSum -= txCtAvg[j] * avgScale;
             else { // we're in the right bucket
                 median = avg[j] / txCtAvg[j];
                 break;
@@ -374,7 +419,7 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
         failBucket.leftMempool = failNum;
     }
 
-    LogPrint(BCLog::ESTIMATEFEE, "FeeEst: %d %s%.0f%% decay %.5f: feerate: %g from (%g - %g) %.2f%% %.1f/(%.1f %d mem %.1f out) Fail: (%g - %g) %.2f%% %.1f/(%.1f %d mem %.1f out)\n",
+    if (log) LogPrint(BCLog::ESTIMATEFEE, "FeeEst: %d %s%.0f%% decay %.5f: feerate: %g from (%g - %g) %.2f%% %.1f/(%.1f %d mem %.1f out) Fail: (%g - %g) %.2f%% %.1f/(%.1f %d mem %.1f out)\n",
              confTarget, requireGreater ? ">" : "<", 100.0 * successBreakPoint, decay,
              median, passBucket.start, passBucket.end,
              100 * passBucket.withinTarget / (passBucket.totalConfirmed + passBucket.inMempool + passBucket.leftMempool),
@@ -393,14 +438,32 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     return median;
 }
 
-void TxConfirmStats::Write(CAutoFile& fileout) const
+static std::vector<double> Scaled(const std::vector<double>& v, double factor)
+{
+    std::vector<double> scaled(v);
+    for (double& x : scaled)
+        x *= factor;
+    return scaled;
+}
+
+static std::vector<std::vector<double>> Scaled(const std::vector<std::vector<double>>& v, double factor)
+{
+    std::vector<std::vector<double>> scaled;
+    scaled.reserve(v.size());
+    for (const std::vector<double>& x : v)
+        scaled.push_back(Scaled(x, factor));
+    return scaled;
+}
+
+void TxConfirmStats::Write(CDataStream& stream) const
 {
-    fileout << decay;
-    fileout << scale;
-    fileout << avg;
-    fileout << txCtAvg;
-    fileout << confAvg;
-    fileout << failAvg;
+    // The file has the moving averages themselves
+    stream << decay;
+    stream << scale;
+    stream << Scaled(avg, avgScale);
+    stream << Scaled(txCtAvg, avgScale);
+    stream << Scaled(confAvg, avgScale);
+    stream << Scaled(failAvg, avgScale);
 }
 
 void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets)
@@ -451,6 +514,8 @@ void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets
         }
     }
 
+    avgScale = 1;
+
     // Resize the current block variables which aren't stored in the data file
     // to match the number of confirms and buckets
     resizeInMemoryCounters(numBuckets);
@@ -463,6 +528,7 @@ unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
     unsigned int blockIndex = nBlockHeight % unconfTxs.size();
+    // unconfAtLeast stays valid: new transactions are unconfirmed for 0 blocks
     unconfTxs[blockIndex][bucketindex]++;
     return bucketindex;
 }
@@ -478,6 +544,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
         return;  //This can't happen because we call this with our best seen height, no entries can have higher
     }
 
+    unconfStale = true;
     if (blocksAgo >= (int)unconfTxs.size()) {
         if (oldUnconfTxs[bucketindex] > 0) {
             oldUnconfTxs[bucketindex]--;
@@ -499,7 +566,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
         assert(scale != 0);
         unsigned int periodsAgo = blocksAgo / scale;
         for (size_t i = 0; i < periodsAgo && i < failAvg.size(); i++) {
-            failAvg[i][bucketindex]++;
+            failAvg[i][bucketindex] += 1 / avgScale;
         }
     }
 }
@@ -540,6 +607,9 @@ CBlockPolicyEstimator::CBlockPolicyEstimator()
     feeStats = std::unique_ptr<TxConfirmStats>(new TxConfirmStats(buckets, bucketMap, MED_BLOCK_PERIODS, MED_DECAY, MED_SCALE));
     shortStats = std::unique_ptr<TxConfirmStats>(new TxConfirmStats(buckets, bucketMap, SHORT_BLOCK_PERIODS, SHORT_DECAY, SHORT_SCALE));
     longStats = std::unique_ptr<TxConfirmStats>(new TxConfirmStats(buckets, bucketMap, LONG_BLOCK_PERIODS, LONG_DECAY, LONG_SCALE));
+
+    LOCK(cs_feeEstimator);
+    UpdateSmartFeeTable();
 }
 
 CBlockPolicyEstimator::~CBlockPolicyEstimator()
@@ -659,6 +729,8 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
 
     trackedTxs = 0;
     untrackedTxs = 0;
+
+    UpdateSmartFeeTable();
 }
 
 CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget) const
@@ -760,26 +832,26 @@ double CBlockPolicyEstimator::estimateCombinedFee(unsigned int confTarget, doubl
     if (confTarget >= 1 && confTarget <= longStats->GetMaxConfirms()) {
         // Find estimate from shortest time horizon possible
         if (confTarget <= shortStats->GetMaxConfirms()) { // short horizon
-            estimate = shortStats->EstimateMedianVal(confTarget, SUFFICIENT_TXS_SHORT, successThreshold, true, nBestSeenHeight, result);
+            estimate = shortStats->EstimateMedianVal(confTarget, SUFFICIENT_TXS_SHORT, successThreshold, true, nBestSeenHeight, result, false);
         }
         else if (confTarget <= feeStats->GetMaxConfirms()) { // medium horizon
-            estimate = feeStats->EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, successThreshold, true, nBestSeenHeight, result);
+            estimate = feeStats->EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, successThreshold, true, nBestSeenHeight, result, false);
         }
         else { // long horizon
-            estimate = longStats->EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, successThreshold, true, nBestSeenHeight, result);
+            estimate = longStats->EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, successThreshold, true, nBestSeenHeight, result, false);
         }
         if (checkShorterHorizon) {
             EstimationResult tempResult;
             // If a lower confTarget from a more recent horizon returns a lower answer use it.
             if (confTarget > feeStats->GetMaxConfirms()) {
-                double medMax = feeStats->EstimateMedianVal(feeStats->GetMaxConfirms(), SUFFICIENT_FEETXS, successThreshold, true, nBestSeenHeight, &tempResult);
+                double medMax = feeStats->EstimateMedianVal(feeStats->GetMaxConfirms(), SUFFICIENT_FEETXS, successThreshold, true, nBestSeenHeight, &tempResult, false);
                 if (medMax > 0 && (estimate == -1 || medMax < estimate)) {
                     estimate = medMax;
                     if (result) *result = tempResult;
                 }
             }
             if (confTarget > shortStats->GetMaxConfirms()) {
-                double shortMax = shortStats->EstimateMedianVal(shortStats->GetMaxConfirms(), SUFFICIENT_TXS_SHORT, successThreshold, true, nBestSeenHeight, &tempResult);
+                double shortMax = shortStats->EstimateMedianVal(shortStats->GetMaxConfirms(), SUFFICIENT_TXS_SHORT, successThreshold, true, nBestSeenHeight, &tempResult, false);
                 if (shortMax > 0 && (estimate == -1 || shortMax < estimate)) {
                     estimate = shortMax;
                     if (result) *result = tempResult;
@@ -798,10 +870,10 @@ double CBlockPolicyEstimator::estimateConservativeFee(unsigned int doubleTarget,
     double estimate = -1;
     EstimationResult tempResult;
     if (doubleTarget <= shortStats->GetMaxConfirms()) {
-        estimate = feeStats->EstimateMedianVal(doubleTarget, SUFFICIENT_FEETXS, DOUBLE_SUCCESS_PCT, true, nBestSeenHeight, result);
+        estimate = feeStats->EstimateMedianVal(doubleTarget, SUFFICIENT_FEETXS, DOUBLE_SUCCESS_PCT, true, nBestSeenHeight, result, false);
     }
     if (doubleTarget <= feeStats->GetMaxConfirms()) {
-        double longEstimate = longStats->EstimateMedianVal(doubleTarget, SUFFICIENT_FEETXS, DOUBLE_SUCCESS_PCT, true, nBestSeenHeight, &tempResult);
+        double longEstimate = longStats->EstimateMedianVal(doubleTarget, SUFFICIENT_FEETXS, DOUBLE_SUCCESS_PCT, true, nBestSeenHeight, &tempResult, false);
         if (longEstimate > estimate) {
             estimate = longEstimate;
             if (result) *result = tempResult;
@@ -810,7 +882,9 @@ double CBlockPolicyEstimator::estimateConservativeFee(unsigned int doubleTarget,
     return estimate;
 }
 
-/** estimateSmartFee returns the max of the feerates calculated with a 60%
+/** The smart fee estimates at each target are calculated once a block, and
+ * estimateSmartFee looks them up without taking cs_feeEstimator. The
+ * calculation is the max of the feerates calculated with a 60%
  * threshold required at target / 2, an 85% threshold required at target and a
  * 95% threshold required at 2 * target.  Each calculation is performed at the
  * shortest time horizon which tracks the required target.  Conservative
@@ -819,33 +893,64 @@ double CBlockPolicyEstimator::estimateConservativeFee(unsigned int doubleTarget,
  */
 CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, FeeCalculation *feeCalc, bool conservative) const
 {
-    LOCK(cs_feeEstimator);
+    std::shared_ptr<const SmartFeeTable> table = std::atomic_load(&smartFeeTable);
 
     if (feeCalc) {
         feeCalc->desiredTarget = confTarget;
         feeCalc->returnedTarget = confTarget;
     }
 
-    double median = -1;
-    EstimationResult tempResult;
-
     // Return failure if trying to analyze a target we're not tracking
-    if (confTarget <= 0 || (unsigned int)confTarget > longStats->GetMaxConfirms()) {
+    if (confTarget <= 0 || (unsigned int)confTarget > table->highestTarget) {
         return CFeeRate(0);  // error condition
     }
 
     // It's not possible to get reasonable estimates for confTarget of 1
     if (confTarget == 1) confTarget = 2;
 
-    unsigned int maxUsableEstimate = MaxUsableEstimate();
-    if ((unsigned int)confTarget > maxUsableEstimate) {
-        confTarget = maxUsableEstimate;
+    if ((unsigned int)confTarget > table->maxUsableEstimate) {
+        confTarget = table->maxUsableEstimate;
     }
     if (feeCalc) feeCalc->returnedTarget = confTarget;
 
     if (confTarget <= 1) return CFeeRate(0); // error condition
 
-    assert(confTarget > 0); //estimateCombinedFee and estimateConservativeFee take unsigned ints
+    const SmartFeeTable::Estimate& estimate = (conservative ? table->conservative : table->economical)[confTarget];
+    if (feeCalc) {
+        feeCalc->est = estimate.est;
+        feeCalc->reason = estimate.reason;
+    }
+    return estimate.feeRate;
+}
+
+void CBlockPolicyEstimator::UpdateSmartFeeTable()
+{
+    AssertLockHeld(cs_feeEstimator);
+    int64_t nTimeStart = GetTimeMicros();
+    std::shared_ptr<SmartFeeTable> table = std::make_shared<SmartFeeTable>();
+    table->highestTarget = longStats->GetMaxConfirms();
+    table->maxUsableEstimate = MaxUsableEstimate();
+    table->economical.resize(table->maxUsableEstimate + 1);
+    table->conservative.resize(table->maxUsableEstimate + 1);
+    for (unsigned int confTarget = 2; confTarget <= table->maxUsableEstimate; confTarget++) {
+        for (bool conservative : {false, true}) {
+            SmartFeeTable::Estimate& estimate = (conservative ? table->conservative : table->economical)[confTarget];
+            FeeCalculation feeCalc;
+            estimate.feeRate = calculateSmartFee(confTarget, &feeCalc, conservative);
+            estimate.est = feeCalc.est;
+            estimate.reason = feeCalc.reason;
+        }
+    }
+    std::atomic_store(&smartFeeTable, std::shared_ptr<const SmartFeeTable>(std::move(table)));
+    LogPrint(BCLog::ESTIMATEFEE, "Blockpolicy smart fee estimates updated for targets up to %u in %.2fms\n",
+             MaxUsableEstimate(), (GetTimeMicros() - nTimeStart) * 0.001);
+}
+
+CFeeRate CBlockPolicyEstimator::calculateSmartFee(unsigned int confTarget, FeeCalculation *feeCalc, bool conservative) const
+{
+    double median = -1;
+    EstimationResult tempResult;
+
     /** true is passed to estimateCombined fee for target/2 and target so
      * that we check the max confirms for shorter time horizons as well.
      * This is necessary to preserve monotonically increasing estimates.
@@ -899,20 +1004,25 @@ CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, FeeCalculation
 bool CBlockPolicyEstimator::Write(CAutoFile& fileout) const
 {
     try {
-        LOCK(cs_feeEstimator);
-        fileout << 149900; // version required to read: 0.14.99 or later
-        fileout << CLIENT_VERSION; // version that wrote the file
-        fileout << nBestSeenHeight;
-        if (BlockSpan() > HistoricalBlockSpan()/2) {
-            fileout << firstRecordedHeight << nBestSeenHeight;
-        }
-        else {
-            fileout << historicalFirst << historicalBest;
+        // Serialize in memory, so that the estimator is not locked while writing the file
+        CDataStream stream(SER_DISK, CLIENT_VERSION);
+        {
+            LOCK(cs_feeEstimator);
+            stream << 149900; // version required to read: 0.14.99 or later
+            stream << CLIENT_VERSION; // version that wrote the file
+            stream << nBestSeenHeight;
+            if (BlockSpan() > HistoricalBlockSpan()/2) {
+                stream << firstRecordedHeight << nBestSeenHeight;
+            }
+            else {
+                stream << historicalFirst << historicalBest;
+            }
+            stream << buckets;
+            feeStats->Write(stream);
+            shortStats->Write(stream);
+            longStats->Write(stream);
         }
-        fileout << buckets;
-        feeStats->Write(fileout);
-        shortStats->Write(fileout);
-        longStats->Write(fileout);
+        fileout.write(stream.data(), stream.size());
     }
     catch (const std::exception&) {
         LogPrintf("CBlockPolicyEstimator::Write(): unable to write policy estimator data (non-fatal)\n");
@@ -972,6 +1082,7 @@ bool CBlockPolicyEstimator::Read(CAutoFile& filein)
             nBestSeenHeight = nFileBestSeenHeight;
             historicalFirst = nFileHistoricalFirst;
             historicalBest = nFileHistoricalBest;
+            UpdateSmartFeeTable();
         }
     }
     catch (const std::exception& e) {
@@ -12,6 +12,7 @@
 #include <sync.h>
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -207,6 +208,8 @@ public:
      *  blocks. If no answer can be given at confTarget, return an estimate at
      *  the closest target where one can be given.  'conservative' estimates are
      *  valid over longer time horizons also.
+     *  Estimates are calculated for all targets as blocks are processed, so
+     *  this only looks one up, without locking.
      */
     CFeeRate estimateSmartFee(int confTarget, FeeCalculation *feeCalc, bool conservative) const;
 
@@ -257,9 +260,31 @@ private:
 
     mutable CCriticalSection cs_feeEstimator;
 
+    /** estimateSmartFee's answers, as of the last block processed */
+    struct SmartFeeTable
+    {
+        struct Estimate
+        {
+            CFeeRate feeRate;
+            EstimationResult est;
+            FeeReason reason = FeeReason::NONE;
+        };
+        unsigned int highestTarget = 0;
+        unsigned int maxUsableEstimate = 0;
+        //! Indexed by target, from 2 up to maxUsableEstimate
+        std::vector<Estimate> economical;
+        std::vector<Estimate> conservative;
+    };
+    //! Only accessed with std::atomic_load and std::atomic_store
+    std::shared_ptr<const SmartFeeTable> smartFeeTable;
+
     /** Process a transaction confirmed in a block*/
     bool processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry* entry);
 
+    /** Calculate the estimates estimateSmartFee answers with */
+    void UpdateSmartFeeTable();
+    /** Helper for estimateSmartFee: the estimate at a target it can be given for */
+    CFeeRate calculateSmartFee(unsigned int confTarget, FeeCalculation *feeCalc, bool conservative) const;
     /** Helper for estimateSmartFee */
     double estimateCombinedFee(unsigned int confTarget, double successThreshold, bool checkShorterHorizon, EstimationResult *result) const;
     /** Helper for estimateSmartFee */
@@ -6,6 +6,7 @@
 #include <random.h>
 
 #include "pos.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "arith_uint256.h"
 
@@ -276,10 +277,10 @@ static bool GetKernelStakeModifier(CBlockIndex* pindexFrom, uint64_t& nStakeModi
 //
 
 const int SHIFT_FACTOR = 1<<16;
-bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pBlockFrom, CValidationState& state, CTransactionRef txPrevRef, unsigned int nTxPrevOffset,  
+bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pBlockFrom, CValidationState& state, unsigned int nTimeTxPrev, CAmount nValuePrev, unsigned int nTxPrevOffset,
 		const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, uint256& targetProofOfStake, bool fDebugLog)
 {
-    if (nTimeTx < txPrevRef->nTime)  // Transaction timestamp violation
+    if (nTimeTx < nTimeTxPrev)  // Transaction timestamp violation
         return state.DoS(100, error("CheckStakeKernelHash() : nTime violation"));
 
     unsigned int nTimeBlockFrom = pBlockFrom->nTime;
@@ -290,9 +291,7 @@ bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pBlockFrom, CValidati
     bnTargetPerCoinDay.SetCompact(nBits);
 
     //uint256 hashBlockFrom = pBlockFrom->GetBlockHash(); //unused 
-    int64_t nValuePrev = txPrevRef->vout[prevout.n].nValue;
-
-    arith_uint256 bnCoinDayWeight = arith_uint256(nValuePrev) * GetWeight((int64_t)txPrevRef->nTime, (int64_t)nTimeTx) / COIN / (24 * 60 * 60);
+    arith_uint256 bnCoinDayWeight = arith_uint256(nValuePrev) * GetWeight((int64_t)nTimeTxPrev, (int64_t)nTimeTx) / COIN / (24 * 60 * 60);
     targetProofOfStake = ArithToUint256(bnCoinDayWeight * bnTargetPerCoinDay);
 
     // Calculate hash
@@ -317,7 +316,7 @@ bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pBlockFrom, CValidati
     }
     
     ss << nStakeModifier;
-    ss << nTimeBlockFrom << nTxPrevOffset << txPrevRef->nTime << prevout.n << nTimeTx;
+    ss << nTimeBlockFrom << nTxPrevOffset << nTimeTxPrev << prevout.n << nTimeTx;
     hashProofOfStake = Hash(ss.begin(), ss.end());
     
     if(fDebugLog)
@@ -329,7 +328,7 @@ bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pBlockFrom, CValidati
             DateTimeStrFormat("%Y-%m-%d %H:%M:%S", pBlockFrom->GetBlockTime()).c_str());
             LogPrintf("CheckStakeKernelHash() : check modifier=0x%016x nTimeBlockFrom=%u nTxPrevOffset=%u nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s nBits=%u bnTargetPerCoinDay=%s bnCoinDayWeight=%s targetProofOfStake=%s\n",
             nStakeModifier,
-            nTimeBlockFrom, nTxPrevOffset, txPrevRef->nTime, prevout.n, nTimeTx,
+            nTimeBlockFrom, nTxPrevOffset, nTimeTxPrev, prevout.n, nTimeTx,
             hashProofOfStake.ToString().c_str(),
             nBits,
             bnTargetPerCoinDay.ToString().c_str(),
@@ -350,9 +349,34 @@ bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pBlockFrom, CValidati
     return true;
 }
 
+// Get what the stake kernel needs of the transaction a coinstake spends
+bool GetStakePrevTx(CBlockTreeDB& blockTreeDB, const uint256& hash, CStakePrevTx& txPrev)
+{
+    // First try finding the previous transaction in database
+    CDiskTxPos txindex;
+    CTransactionRef tx;
+    CBlockHeader header;
+    if (ReadTxFromIndex(blockTreeDB, hash, tx, header, txindex))
+    {
+        txPrev.nTime = tx->nTime;
+        txPrev.nTxOffset = txindex.nTxOffset + 80;	// nTxOffset counts after header
+        return true;
+    }
+
+    // Coins loaded from a UTXO snapshot come without their transactions
+    return blockTreeDB.ReadStakePrevTx(hash, txPrev);
+}
+
+// Check the signature of the coinstake kernel, usually cached already when the block arrived
+bool CheckCoinStakeSignature(const CTransaction& tx, const Coin& coinPrev)
+{
+    PrecomputedTransactionData txdata(tx);
+    return VerifyScript(tx.vin[0].scriptSig, coinPrev.out.scriptPubKey, nullptr, SCRIPT_VERIFY_NONE, CachingTransactionSignatureChecker(&tx, 0, coinPrev.out.nValue, false, txdata));
+}
+
 // Check kernel hash target and coinstake signature
 bool CheckProofOfStake(CBlockTreeDB& blockTreeDB, CBlockIndex* pindexPrev, CValidationState& state, const CBlock& block, uint256& hashProofOfStake, 
-		uint256& targetProofOfStake, BlockMap& mapBlockIndex, CCoinsViewCache& view)
+		uint256& targetProofOfStake, BlockMap& mapBlockIndex, CCoinsViewCache& view, bool fCheckSignature)
 {
 	LogPrint(BCLog::STAKE, ">> CheckProofOfStake\n");
 	const CTransaction& tx = *block.vtx[1];
@@ -364,32 +388,10 @@ bool CheckProofOfStake(CBlockTreeDB& blockTreeDB, CBlockIndex* pindexPrev, CVali
     // Kernel (input 0) must match the stake hash target per coin age (nBits)
     const CTxIn& txin = tx.vin[0];
 
-    // First try finding the previous transaction in database
-	CDiskTxPos txindex;
-	CTransactionRef txPrevRef;
-	unsigned int nTxPrevOffset = 0;
-    if (blockTreeDB.ReadTxIndex(txin.prevout.hash, txindex))
-	{
-		CBlockHeader headerPrev;
-		nTxPrevOffset = txindex.nTxOffset + 80;	// nTxOffset counts after header
-        CAutoFile file(OpenBlockFile(txindex, true), SER_DISK, CLIENT_VERSION);
-        if (file.IsNull())
-        {
-        	return state.DoS(100, error("CheckProofOfStake() : OpenBlockFile failed"));
-        }
-        try {
-            file >> headerPrev;
-            fseek(file.Get(), txindex.nTxOffset, SEEK_CUR);
-            CMutableTransaction txPrev0;
-            txPrev0.Unserialize(file);            
-            txPrevRef = MakeTransactionRef(std::move(txPrev0));
-        } catch (const std::exception& e) {
-        	return state.DoS(100, error("CheckProofOfStake() : Deserialize or I/O error, can't get prev tx - %s", e.what()));
-        }
-	}
-	else
-		return state.DoS(100, error(">> CheckProofOfStake() : blockTreeDB.ReadTxIndex failed.\n"));
-	
+    CStakePrevTx txPrev;
+    if (!GetStakePrevTx(blockTreeDB, txin.prevout.hash, txPrev))
+        return state.DoS(100, error("CheckProofOfStake() : can't get prev tx %s", txin.prevout.hash.ToString()));
+
     Coin coinPrev;
     if(!view.GetCoin(txin.prevout, coinPrev)){
         return state.DoS(100, error("CheckProofOfStake() : Stake prevout does not exist %s, n: %d", txin.prevout.hash.ToString(), txin.prevout.n));
@@ -404,10 +406,10 @@ bool CheckProofOfStake(CBlockTreeDB& blockTreeDB, CBlockIndex* pindexPrev, CVali
     }
 
     // Verify signature
-    if (!VerifySignature(coinPrev, txin.prevout.hash, tx, 0, SCRIPT_VERIFY_NONE))
+    if (fCheckSignature && !CheckCoinStakeSignature(tx, coinPrev))
         return state.DoS(100, error("CheckProofOfStake() : VerifySignature failed on coinstake %s", tx.GetHash().ToString()));
        
-    if (!CheckStakeKernelHash(nBits, blockFrom, state, txPrevRef, nTxPrevOffset, txin.prevout, tx.nTime, hashProofOfStake, targetProofOfStake, LogAcceptCategory(BCLog::STAKE)))
+    if (!CheckStakeKernelHash(nBits, blockFrom, state, txPrev.nTime, coinPrev.out.nValue, txPrev.nTxOffset, txin.prevout, tx.nTime, hashProofOfStake, targetProofOfStake, LogAcceptCategory(BCLog::STAKE)))
         return state.DoS(100, error("CheckProofOfStake() : INFO: check kernel failed on coinstake %s, hashProof=%s", tx.GetHash().ToString().c_str(), hashProofOfStake.ToString().c_str())); 
 
     return true;
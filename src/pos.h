@@ -26,13 +26,21 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
 
 // Check whether stake kernel meets hash target
 // Sets hashProofOfStake on success return
-bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pBlockFrom, CValidationState& state, CTransactionRef txPrevRef, unsigned int nTxPrevOffset,  
+bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pBlockFrom, CValidationState& state, unsigned int nTimeTxPrev, CAmount nValuePrev, unsigned int nTxPrevOffset,
 		const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, uint256& targetProofOfStake, bool fDebugLog);
 
+// Get what the stake kernel needs of the transaction a coinstake spends, from
+// the transaction index or from the data loaded with a UTXO snapshot
+bool GetStakePrevTx(CBlockTreeDB& blockTreeDB, const uint256& hash, CStakePrevTx& txPrev);
+
+// Check the signature of the coinstake kernel spending coinPrev
+bool CheckCoinStakeSignature(const CTransaction& tx, const Coin& coinPrev);
+
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
+// The signature is assumed valid without fCheckSignature (see -assumevalidstake)
 bool CheckProofOfStake(CBlockTreeDB& blockTreeDB, CBlockIndex* pindexPrev, CValidationState& state, const CBlock& block, uint256& hashProofOfStake, 
-		uint256& targetProofOfStake, BlockMap& mapBlockIndex, CCoinsViewCache& view);
+		uint256& targetProofOfStake, BlockMap& mapBlockIndex, CCoinsViewCache& view, bool fCheckSignature = true);
 
 // Check whether the coinstake timestamp meets protocol
 bool CheckCoinStakeTimestamp(int64_t nTimeBlock, int64_t nTimeTx);
@@ -10,23 +10,27 @@
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <coins.h>
+#include <coinstats.h>
 #include <consensus/validation.h>
 #include <validation.h>
 #include <core_io.h>
 #include <policy/feerate.h>
 #include <policy/policy.h>
+#include <pos.h>
 #include <primitives/transaction.h>
 #include <rpc/server.h>
 #include <streams.h>
 #include <sync.h>
 #include <txdb.h>
 #include <txmempool.h>
+#include <txoutsnapshot.h>
 #include <util.h>
 #include <utilstrencodings.h>
 #include <hash.h>
 #include <validationinterface.h>
 #include <warnings.h>
 
+#include <sstream>
 #include <stdint.h>
 
 #include <univalue.h>
@@ -834,77 +838,6 @@ UniValue getblock(const JSONRPCRequest& request)
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
-struct CCoinsStats
-{
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nBogoSize;
-    uint256 hashSerialized;
-    uint64_t nDiskSize;
-    CAmount nTotalAmount;
-
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
-};
-
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
-{
-    assert(!outputs.empty());
-    ss << hash;
-    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
-    stats.nTransactions++;
-    for (const auto output : outputs) {
-        ss << VARINT(output.first + 1);
-        ss << output.second.out.scriptPubKey;
-        ss << VARINT(output.second.out.nValue);
-        stats.nTransactionOutputs++;
-        stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
-    }
-    ss << VARINT(0);
-}
-
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
-{
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-    assert(pcursor);
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
-    }
-    ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        COutPoint key;
-        Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hash;
-            outputs[key.n] = std::move(coin);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nDiskSize = view->EstimateSize();
-    return true;
-}
-
 UniValue pruneblockchain(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -954,40 +887,180 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
     return uint64_t(height);
 }
 
+static UniValue DBInfoToJSON(const CDBWrapper& db, bool fVerbose)
+{
+    UniValue ret(UniValue::VOBJ);
+
+    const CDBOptions& dbopts = db.GetDBOptions();
+    UniValue options(UniValue::VOBJ);
+    options.push_back(Pair("bloom_bits", dbopts.nBloomBits));
+    options.push_back(Pair("block_size", (uint64_t)dbopts.nBlockSize));
+    options.push_back(Pair("compression", dbopts.fCompression));
+    options.push_back(Pair("write_buffer", (uint64_t)dbopts.nWriteBufferSize));
+    options.push_back(Pair("max_open_files", dbopts.nMaxOpenFiles));
+    ret.push_back(Pair("options", options));
+
+    uint64_t nHits, nMisses;
+    size_t nUsage;
+    db.GetBlockCacheStats(nHits, nMisses, nUsage);
+    UniValue cache(UniValue::VOBJ);
+    cache.push_back(Pair("size", (uint64_t)db.GetBlockCacheSize()));
+    cache.push_back(Pair("usage", (uint64_t)nUsage));
+    cache.push_back(Pair("hits", nHits));
+    cache.push_back(Pair("misses", nMisses));
+    cache.push_back(Pair("hit_rate", nHits + nMisses ? (double)nHits / (nHits + nMisses) : 0.0));
+    ret.push_back(Pair("block_cache", cache));
+
+    std::string value;
+    if (db.GetProperty("leveldb.approximate-memory-usage", value)) {
+        ret.push_back(Pair("memory_usage", atoi64(value)));
+    }
+
+    // Per level table files and compaction totals, from the table
+    // LevelDB prints after a "----" line in its stats
+    UniValue levels(UniValue::VARR);
+    if (db.GetProperty("leveldb.stats", value)) {
+        std::istringstream stats(value);
+        std::string line;
+        bool fTable = false;
+        while (std::getline(stats, line)) {
+            if (!fTable) {
+                fTable = line.compare(0, 4, "----") == 0;
+                continue;
+            }
+            int nLevel, nFiles;
+            double dSize, dTime, dRead, dWrite;
+            if (sscanf(line.c_str(), "%d %d %lf %lf %lf %lf", &nLevel, &nFiles, &dSize, &dTime, &dRead, &dWrite) != 6) continue;
+            UniValue level(UniValue::VOBJ);
+            level.push_back(Pair("level", nLevel));
+            level.push_back(Pair("files", nFiles));
+            level.push_back(Pair("size_mb", dSize));
+            level.push_back(Pair("compaction_seconds", dTime));
+            level.push_back(Pair("compaction_read_mb", dRead));
+            level.push_back(Pair("compaction_write_mb", dWrite));
+            levels.push_back(level);
+        }
+        if (fVerbose) ret.push_back(Pair("stats", value));
+    }
+    ret.push_back(Pair("levels", levels));
+    if (fVerbose && db.GetProperty("leveldb.sstables", value)) {
+        ret.push_back(Pair("sstables", value));
+    }
+    return ret;
+}
+
+UniValue getdbinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw std::runtime_error(
+            "getdbinfo ( verbose )\n"
+            "\nReturns the tuning and statistics of the chain state and block index databases.\n"
+            "\nArguments:\n"
+            "1. verbose    (boolean, optional, default=false) Also return LevelDB's own stats and table file listing\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {            (json object) The chain state database\n"
+            "    \"options\": {             (json object) Options it was opened with (-coinsdb*)\n"
+            "      \"bloom_bits\": n,       (numeric) Bloom filter bits per key\n"
+            "      \"block_size\": n,       (numeric) Size of the blocks in the table files\n"
+            "      \"compression\": true|false, (boolean) Whether blocks are compressed\n"
+            "      \"write_buffer\": n,     (numeric) Size of the write buffer\n"
+            "      \"max_open_files\": n    (numeric) Number of table files kept open\n"
+            "    },\n"
+            "    \"block_cache\": {         (json object) The cache of table blocks\n"
+            "      \"size\": n,             (numeric) Its capacity in bytes\n"
+            "      \"usage\": n,            (numeric) Bytes in use\n"
+            "      \"hits\": n,             (numeric) Lookups that found their block\n"
+            "      \"misses\": n,           (numeric) Lookups that did not\n"
+            "      \"hit_rate\": x.xxx      (numeric) hits / (hits + misses)\n"
+            "    },\n"
+            "    \"memory_usage\": n,       (numeric) Approximate memory LevelDB uses\n"
+            "    \"levels\": [              (json array) Levels with files or compactions\n"
+            "      {\n"
+            "        \"level\": n,          (numeric) The level\n"
+            "        \"files\": n,          (numeric) Number of table files\n"
+            "        \"size_mb\": x,        (numeric) Their total size\n"
+            "        \"compaction_seconds\": x,  (numeric) Time spent compacting into the level\n"
+            "        \"compaction_read_mb\": x,  (numeric) Data read by those compactions\n"
+            "        \"compaction_write_mb\": x  (numeric) Data written by them\n"
+            "      }, ...\n"
+            "    ],\n"
+            "    \"stats\": \"str\",          (string, verbose only) LevelDB's stats\n"
+            "    \"sstables\": \"str\"        (string, verbose only) The table files of each level\n"
+            "  },\n"
+            "  \"blockindex\": { ... }      (json object) The block index database (-blockdb*), as above\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbinfo", "")
+            + HelpExampleRpc("getdbinfo", "")
+        );
+
+    bool fVerbose = !request.params[0].isNull() && request.params[0].get_bool();
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("chainstate", DBInfoToJSON(pcoinsdbview->GetDB(), fVerbose)));
+    ret.push_back(Pair("blockindex", DBInfoToJSON(*pblocktree, fVerbose)));
+    return ret;
+}
+
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 1)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( hash_serialized )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless hash_serialized is false and the node runs with -utxostats.\n"
+            "\nArguments:\n"
+            "1. hash_serialized    (boolean, optional, default=true) Whether to compute hash_serialized_2\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions (not with -utxostats totals)\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (only if hash_serialized)\n"
             "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "false")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    bool fHash = request.params[0].isNull() || request.params[0].get_bool();
+
     UniValue ret(UniValue::VOBJ);
 
     CCoinsStats stats;
+    bool fTracked = false;
+    if (!fHash) {
+        // loadtxoutset replaces the tracker under cs_main
+        LOCK(cs_main);
+        fTracked = pcoinsstats && pcoinsstats->Get(stats);
+    }
+    if (fTracked) {
+        ret.push_back(Pair("height", (int64_t)stats.nHeight));
+        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+        ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
+        ret.push_back(Pair("disk_size", (uint64_t)pcoinsdbview->EstimateSize()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        return ret;
+    }
+
     FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview.get(), stats)) {
+    if (GetUTXOStats(pcoinsdbview.get(), stats, fHash)) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
-        ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+        if (fHash) {
+            ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+        }
         ret.push_back(Pair("disk_size", stats.nDiskSize));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     } else {
@@ -996,6 +1069,188 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the UTXO set at the chain tip to a file, together with the block index\n"
+            "that loadtxoutset needs to start another node from it.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"      (string, required) The file to write. A relative path is taken relative to the data directory.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,            (numeric) The number of coins written\n"
+            "  \"base_hash\": \"hash\",           (string) The hash of the block the snapshot is taken at\n"
+            "  \"base_height\": n,              (numeric) The height of that block\n"
+            "  \"path\": \"path\",                (string) The absolute path of the file\n"
+            "  \"hash_serialized_2\": \"hash\",   (string) The hash of the coins, as gettxoutsetinfo reports it\n"
+            "  \"snapshot_hash\": \"hash\"        (string) The hash of the file, to be passed to loadtxoutset\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    const fs::path pathTemp = path.string() + ".incomplete";
+    if (fs::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CAutoFile file(fsbridge::fopen(pathTemp, "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to open " + pathTemp.string() + " for writing");
+
+    CTxOutSnapshotHeader header;
+    memcpy(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart));
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(pcoinsdbview->Cursor());
+        if (pcursor->GetBestBlock() != chainActive.Tip()->GetBlockHash())
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to flush the UTXO set");
+        header.hashBlock = chainActive.Tip()->GetBlockHash();
+        header.nHeight = chainActive.Height();
+        if (header.nHeight == 0)
+            throw JSONRPCError(RPC_MISC_ERROR, "No blocks to take a snapshot of");
+
+        // The counts are filled in once the coins are written
+        file << header;
+        for (int nHeight = 1; nHeight <= header.nHeight; nHeight++) {
+            CDiskBlockIndex diskindex(chainActive[nHeight]);
+            diskindex.nStatus = BLOCK_VALID_SCRIPTS;
+            file << diskindex;
+        }
+    }
+
+    // The cursor iterates a snapshot of the database, so the coins can be
+    // written without holding cs_main
+    CCoinsStats stats;
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << header.hashBlock;
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    auto write_outputs = [&]() {
+        CStakePrevTx txPrev;
+        if (!GetStakePrevTx(*pblocktree, prevkey, txPrev))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to find transaction " + prevkey.GetHex() + " (is -txindex enabled?)");
+        ApplyStats(stats, ss, prevkey, outputs);
+        unsigned int nOutputs = outputs.size();
+        file << prevkey << txPrev << VARINT(nOutputs);
+        for (const auto& output : outputs) {
+            file << VARINT(output.first) << output.second;
+        }
+        outputs.clear();
+    };
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        if (!outputs.empty() && key.hash != prevkey) {
+            write_outputs();
+        }
+        prevkey = key.hash;
+        outputs[key.n] = std::move(coin);
+        pcursor->Next();
+    }
+    if (!outputs.empty()) {
+        write_outputs();
+    }
+    stats.hashSerialized = ss.GetHash();
+    file << stats.hashSerialized;
+
+    header.nTransactions = stats.nTransactions;
+    header.nTransactionOutputs = stats.nTransactionOutputs;
+    if (fseek(file.Get(), 0, SEEK_SET) != 0)
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to write " + pathTemp.string());
+    file << header;
+    file.fclose();
+    if (!RenameOver(pathTemp, path))
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to rename " + pathTemp.string());
+
+    uint256 hashSnapshot;
+    CAutoFile fileRead(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (fileRead.IsNull() || !HashTxOutSnapshot(fileRead.Get(), hashSnapshot))
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to read back " + path.string());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_written", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("base_hash", header.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", header.nHeight));
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+    ret.push_back(Pair("snapshot_hash", hashSnapshot.GetHex()));
+    return ret;
+}
+
+UniValue loadtxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 2)
+        throw std::runtime_error(
+            "loadtxoutset \"path\" \"snapshot_hash\"\n"
+            "\nLoad a UTXO set snapshot written by dumptxoutset, so the node continues from the\n"
+            "snapshot block instead of validating the chain up to it. The blocks below it are not\n"
+            "downloaded, as on a pruned node.\n"
+            "This only works on a node that has no blocks but the genesis block, so start it with\n"
+            "-connect=0 or turn networking off with setnetworkactive until the snapshot is loaded.\n"
+            "The contents of the snapshot are trusted, so snapshot_hash must come from a trusted node.\n"
+            "The node keeps advertising that it serves old blocks until it is restarted.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"           (string, required) The snapshot file. A relative path is taken relative to the data directory.\n"
+            "2. \"snapshot_hash\"  (string, required) The snapshot_hash dumptxoutset reported for the file\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_loaded\": n,             (numeric) The number of coins loaded\n"
+            "  \"tip_hash\": \"hash\",            (string) The hash of the new chain tip\n"
+            "  \"base_height\": n,              (numeric) The height of the new chain tip\n"
+            "  \"path\": \"path\"                 (string) The absolute path of the file\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\" \"5a5e6e10b4c4e4e0b1c3a9c1f6b2f1c6e4f7d4e3c2b1a0f9e8d7c6b5a4938271\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"5a5e6e10b4c4e4e0b1c3a9c1f6b2f1c6e4f7d4e3c2b1a0f9e8d7c6b5a4938271\"")
+        );
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    const uint256 hashExpected = ParseHashV(request.params[1], "snapshot_hash");
+
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unable to open " + path.string());
+
+    // Check the whole file before touching the chain state
+    uint256 hashSnapshot;
+    if (!HashTxOutSnapshot(file.Get(), hashSnapshot) || fseek(file.Get(), 0, SEEK_SET) != 0)
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to read " + path.string());
+    if (hashSnapshot != hashExpected)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Snapshot hash is " + hashSnapshot.GetHex() + ", not the one given");
+
+    CTxOutSnapshotHeader header;
+    std::string strFailReason;
+    if (!LoadTxOutSnapshot(Params(), file, header, strFailReason))
+        throw JSONRPCError(RPC_MISC_ERROR, strFailReason);
+
+    // The totals kept so far are of the replaced coins. Blocks apply their
+    // changes to pcoinsstats under cs_main, so it is replaced under it too.
+    LOCK(cs_main);
+    if (pcoinsstats) {
+        pcoinsstats.reset(new CCoinsStatsTracker());
+        if (!pcoinsstats->Start(pcoinsdbview.get()))
+            throw JSONRPCError(RPC_MISC_ERROR, "Unable to start keeping UTXO set totals");
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_loaded", (int64_t)header.nTransactionOutputs));
+    ret.push_back(Pair("tip_hash", header.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", header.nHeight));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
 UniValue gettxout(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -1687,10 +1942,12 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getchaintxstats",        &getchaintxstats,        {"nblocks", "blockhash"} },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       {} },
     { "blockchain",         "getblockcount",          &getblockcount,          {} },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           {"path"} },
     { "blockchain",         "getblock",               &getblock,               {"blockhash","verbosity|verbose"} },
     { "blockchain",         "getblockhash",           &getblockhash,           {"height"} },
     { "blockchain",         "getblockheader",         &getblockheader,         {"blockhash","verbose"} },
     { "blockchain",         "getchaintips",           &getchaintips,           {} },
+    { "blockchain",         "getdbinfo",              &getdbinfo,              {"verbose"} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          {} },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    {"txid","verbose"} },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  {"txid","verbose"} },
@@ -1698,7 +1955,8 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_serialized"} },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           {"path","snapshot_hash"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
     { "blockchain",         "verifyblockchain",       &verifyblockchain,       {} },
@@ -16,6 +16,7 @@
 #include <rpc/blockchain.h>
 #include <rpc/server.h>
 #include <rpc/util.h>
+#include <script/sigcache.h>
 #include <stealth.h>
 #include <timedata.h>
 #include <util.h>
@@ -534,6 +535,80 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
     }
 }
 
+static UniValue SigCacheStatsToJSON(const SigCacheStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("size", (uint64_t)stats.nElements));
+    obj.push_back(Pair("bytes", (uint64_t)(stats.nElements * sizeof(uint256))));
+    obj.push_back(Pair("hits", stats.nHits));
+    obj.push_back(Pair("misses", stats.nMisses));
+    obj.push_back(Pair("evictions", stats.nEvictions));
+    return obj;
+}
+
+static UniValue SigCacheInfo()
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("signatures", SigCacheStatsToJSON(GetSignatureCacheStats())));
+    LOCK(cs_main);
+    obj.push_back(Pair("scripts", SigCacheStatsToJSON(GetScriptExecutionCacheStats())));
+    return obj;
+}
+
+UniValue getsigcacheinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getsigcacheinfo\n"
+            "Returns the sizes and usage of the signature cache and the script execution cache.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"signatures\": {          (json object) Valid signature cache\n"
+            "    \"size\": xxxxx,          (numeric) Number of entries the cache can hold\n"
+            "    \"bytes\": xxxxx,         (numeric) Memory used for the entries\n"
+            "    \"hits\": xxxxx,          (numeric) Lookups that found an entry since startup\n"
+            "    \"misses\": xxxxx,        (numeric) Lookups that did not find one\n"
+            "    \"evictions\": xxxxx,     (numeric) Entries dropped for lack of room\n"
+            "  },\n"
+            "  \"scripts\": {             (json object) Script execution cache, with the same fields\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
+
+    return SigCacheInfo();
+}
+
+UniValue setsigcachesize(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "setsigcachesize size\n"
+            "Resizes the signature cache and the script execution cache, as -maxsigcachesize does at startup.\n"
+            "The entries that fit in the new size are kept.\n"
+            "\nArguments:\n"
+            "1. size    (numeric, required) Sum of the sizes of both caches, in MiB\n"
+            "\nResult: the same as getsigcacheinfo\n"
+            "\nExamples:\n"
+            + HelpExampleCli("setsigcachesize", "64")
+            + HelpExampleRpc("setsigcachesize", "64")
+        );
+
+    int64_t nMaxSigCacheSize = request.params[0].get_int64();
+    if (nMaxSigCacheSize < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative size");
+    size_t nBytes = GetSigCacheBytes(nMaxSigCacheSize);
+    ResizeSignatureCache(nBytes);
+    {
+        LOCK(cs_main);
+        ResizeScriptExecutionCache(nBytes);
+    }
+    return SigCacheInfo();
+}
+
 uint32_t getCategoryMask(UniValue cats) {
     cats = cats.get_array();
     uint32_t mask = 0;
@@ -650,6 +725,8 @@ static const CRPCCommand commands[] =
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getmemoryinfo",          &getmemoryinfo,          {"mode"} },
     { "control",            "logging",                &logging,                {"include", "exclude"}},
+    { "control",            "getsigcacheinfo",        &getsigcacheinfo,        {} },
+    { "control",            "setsigcachesize",        &setsigcachesize,        {"size"} },
     { "util",               "validateaddress",        &validateaddress,        {"address"} }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         {"nrequired","keys"} },
     { "util",               "verifymessage",          &verifymessage,          {"address","signature","message"} },
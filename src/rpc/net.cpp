@@ -101,6 +101,9 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"blockwindow\": n,          (numeric) The number of blocks we are willing to have in flight from this peer\n"
+            "    \"headers_segment\": n,      (numeric) The checkpoint height up to which we are fetching headers from this peer, -1 if none\n"
+            "    \"orphan_headers\": n,       (numeric) The number of headers from this peer buffered until they connect to our headers chain\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent aggregated by message type\n"
@@ -167,6 +170,9 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("blockwindow", statestats.nBlockDownloadWindow));
+            obj.push_back(Pair("headers_segment", statestats.nHeadersSegment));
+            obj.push_back(Pair("orphan_headers", (uint64_t)statestats.nOrphanHeaders));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
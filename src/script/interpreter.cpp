@@ -10,6 +10,7 @@
 #include <crypto/sha256.h>
 #include <pubkey.h>
 #include <script/script.h>
+#include <streams.h>
 #include <uint256.h>
 
 typedef std::vector<unsigned char> valtype;
@@ -1167,6 +1168,11 @@ uint256 GetOutputsHash(const CTransaction& txTo) {
 
 } // namespace
 
+//! Size of an input serialized with its script blanked: prevout, empty script, nSequence
+static const size_t LEGACY_BLANKED_INPUT_SIZE = 32 + 4 + 1 + 4;
+//! Number of inputs between the hash states kept for legacy signature hashes
+static const size_t LEGACY_MIDSTATE_INTERVAL = 16;
+
 PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
 {
     // Cache is calculated only for transactions with witness
@@ -1178,6 +1184,44 @@ PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
     }
 }
 
+PrecomputedLegacySighash::PrecomputedLegacySighash(const CTransaction& txTo)
+{
+    CVectorWriter s(SER_GETHASH, 0, vchBlanked, 0);
+    s << txTo.nVersion << txTo.nTime;
+    WriteCompactSize(s, txTo.vin.size());
+    nInputsOffset = vchBlanked.size();
+    for (const CTxIn& txin : txTo.vin) {
+        s << txin.prevout << CScript() << txin.nSequence;
+    }
+    assert(vchBlanked.size() == nInputsOffset + txTo.vin.size() * LEGACY_BLANKED_INPUT_SIZE);
+    s << txTo.vout << txTo.nLockTime;
+
+    CHashWriter ss(SER_GETHASH, 0);
+    size_t nHashed = 0;
+    for (size_t nInput = 0; nInput < txTo.vin.size(); nInput += LEGACY_MIDSTATE_INTERVAL) {
+        const size_t nInputBegin = nInputsOffset + nInput * LEGACY_BLANKED_INPUT_SIZE;
+        ss.write((const char*)&vchBlanked[nHashed], nInputBegin - nHashed);
+        nHashed = nInputBegin;
+        vMidstates.push_back(ss);
+    }
+}
+
+std::shared_ptr<const PrecomputedLegacySighash> PrecomputedTransactionData::GetLegacySighash(const CTransaction& txTo) const
+{
+    // Signing an input serializes the whole transaction, so without this
+    // checking all inputs of a transaction would be quadratic in its size
+    if (txTo.vin.size() < 2)
+        return nullptr;
+    std::shared_ptr<const PrecomputedLegacySighash> legacy = std::atomic_load(&m_legacy_sighash);
+    if (!legacy) {
+        // Threads racing here each build one, the first to finish is kept
+        std::shared_ptr<const PrecomputedLegacySighash> fresh = std::make_shared<const PrecomputedLegacySighash>(txTo);
+        if (std::atomic_compare_exchange_strong(&m_legacy_sighash, &legacy, fresh))
+            legacy = fresh;
+    }
+    return legacy;
+}
+
 uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount, SigVersion sigversion, const PrecomputedTransactionData* cache)
 {
     assert(nIn < txTo.vin.size());
@@ -1241,6 +1285,27 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    // With all inputs and outputs signed, everything but the input being
+    // signed is as in the precomputed serialization
+    if (cache && !(nHashType & SIGHASH_ANYONECANPAY) &&
+        (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
+        const std::shared_ptr<const PrecomputedLegacySighash> legacy = cache->GetLegacySighash(txTo);
+        if (legacy) {
+            const std::vector<unsigned char>& vch = legacy->vchBlanked;
+            const size_t nMidstate = nIn / LEGACY_MIDSTATE_INTERVAL;
+            const size_t nHashed = legacy->nInputsOffset + nMidstate * LEGACY_MIDSTATE_INTERVAL * LEGACY_BLANKED_INPUT_SIZE;
+            const size_t nInputBegin = legacy->nInputsOffset + nIn * LEGACY_BLANKED_INPUT_SIZE;
+            const size_t nInputEnd = nInputBegin + LEGACY_BLANKED_INPUT_SIZE;
+
+            CHashWriter ss(legacy->vMidstates[nMidstate]);
+            ss.write((const char*)&vch[nHashed], nInputBegin - nHashed);
+            txTmp.SerializeInput(ss, nIn);
+            ss.write((const char*)&vch[nInputEnd], vch.size() - nInputEnd);
+            ss << nHashType;
+            return ss.GetHash();
+        }
+    }
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
@@ -1422,6 +1487,86 @@ static bool VerifyWitnessProgram(const CScriptWitness& witness, int witversion,
     return true;
 }
 
+/** Size of the data of a direct push at pc in script, or 0 if there is none. */
+static inline unsigned int DirectPushSize(const CScript& script, unsigned int pc)
+{
+    if (pc >= script.size() || script[pc] > 0x4b || pc + 1 + script[pc] > script.size())
+        return 0;
+    return script[pc];
+}
+
+/**
+ * Fast path of VerifyScript for the spends of P2PKH and P2PK outputs that
+ * nearly all inputs are, coinstakes included: a scriptSig of direct pushes of
+ * the signature (and the public key) checked against the template, without
+ * running EvalScript on either script. Returns false if the scripts are not of
+ * that form; otherwise sets ret and serror as VerifyScript would.
+ */
+static bool VerifyPayToPubKeyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness& witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror, bool& ret)
+{
+    // OP_DUP OP_HASH160 <20 bytes> OP_EQUALVERIFY OP_CHECKSIG, or <pubkey> OP_CHECKSIG
+    const bool fPayToPubKeyHash = scriptPubKey.size() == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 &&
+                                  scriptPubKey[2] == 20 && scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG;
+    const bool fPayToPubKey = (scriptPubKey.size() == 35 || scriptPubKey.size() == 67) &&
+                              DirectPushSize(scriptPubKey, 0) == scriptPubKey.size() - 2 && scriptPubKey.back() == OP_CHECKSIG;
+    if (!fPayToPubKeyHash && !fPayToPubKey)
+        return false;
+
+    // Pushes of a single byte may not be minimal; leave them, and empty
+    // signatures, to EvalScript
+    const unsigned int nSigSize = DirectPushSize(scriptSig, 0);
+    if (nSigSize < 2)
+        return false;
+    // EvalScript drops pushes of the signature from the script code; only a
+    // push in the template of data the size of the signature could be one
+    if (nSigSize == (fPayToPubKeyHash ? 20 : scriptPubKey.size() - 2))
+        return false;
+    const unsigned int nPubKeySize = fPayToPubKeyHash ? DirectPushSize(scriptSig, 1 + nSigSize) : 0;
+    if (fPayToPubKeyHash ? nPubKeySize < 2 || 2 + nSigSize + nPubKeySize != scriptSig.size() : 1 + nSigSize != scriptSig.size())
+        return false;
+
+    try {
+        const valtype vchSig(scriptSig.begin() + 1, scriptSig.begin() + 1 + nSigSize);
+        const valtype vchPubKey = fPayToPubKeyHash ? valtype(scriptSig.begin() + 2 + nSigSize, scriptSig.end()) :
+                                                     valtype(scriptPubKey.begin() + 1, scriptPubKey.end() - 1);
+        if (fPayToPubKeyHash) {
+            unsigned char hash[20];
+            CHash160().Write(vchPubKey.data(), vchPubKey.size()).Finalize(hash);
+            if (memcmp(hash, &scriptPubKey[3], sizeof(hash)) != 0) {
+                ret = set_error(serror, SCRIPT_ERR_EQUALVERIFY);
+                return true;
+            }
+        }
+
+        if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, SIGVERSION_BASE, serror)) {
+            ret = false;
+            return true;
+        }
+        if (!checker.CheckSig(vchSig, vchPubKey, scriptPubKey, SIGVERSION_BASE)) {
+            ret = set_error(serror, (flags & SCRIPT_VERIFY_NULLFAIL) ? SCRIPT_ERR_SIG_NULLFAIL : SCRIPT_ERR_EVAL_FALSE);
+            return true;
+        }
+    } catch (...) {
+        ret = set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
+        return true;
+    }
+
+    // Both scripts leave the stack with just the result
+    if ((flags & SCRIPT_VERIFY_CLEANSTACK) != 0) {
+        assert((flags & SCRIPT_VERIFY_P2SH) != 0);
+        assert((flags & SCRIPT_VERIFY_WITNESS) != 0);
+    }
+    if (flags & SCRIPT_VERIFY_WITNESS) {
+        assert((flags & SCRIPT_VERIFY_P2SH) != 0);
+        if (!witness.IsNull()) {
+            ret = set_error(serror, SCRIPT_ERR_WITNESS_UNEXPECTED);
+            return true;
+        }
+    }
+    ret = set_success(serror);
+    return true;
+}
+
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
 {
 	
@@ -1431,6 +1576,11 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
     }
     bool hadWitness = false;
 
+    bool ret;
+    if (VerifyPayToPubKeyScript(scriptSig, scriptPubKey, *witness, flags, checker, serror, ret)) {
+        return ret;
+    }
+
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
 
     if ((flags & SCRIPT_VERIFY_SIGPUSHONLY) != 0 && !scriptSig.IsPushOnly()) {
@@ -6,9 +6,11 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include <hash.h>
 #include <script/script_error.h>
 #include <primitives/transaction.h>
 
+#include <memory>
 #include <vector>
 #include <stdint.h>
 #include <string>
@@ -115,12 +117,40 @@ enum
 
 bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror);
 
+/**
+ * Legacy SIGHASH_ALL serialization of a transaction with the scripts of all
+ * inputs blanked, and the hash states at the start of every
+ * LEGACY_MIDSTATE_INTERVAL'th input, so that the signature hash of an input
+ * only hashes the inputs after the last such state and the rest of the
+ * transaction.
+ */
+struct PrecomputedLegacySighash
+{
+    std::vector<unsigned char> vchBlanked;
+    std::vector<CHashWriter> vMidstates;
+    size_t nInputsOffset = 0;
+
+    explicit PrecomputedLegacySighash(const CTransaction& tx);
+};
+
 struct PrecomputedTransactionData
 {
     uint256 hashPrevouts, hashSequence, hashOutputs;
     bool ready = false;
 
     explicit PrecomputedTransactionData(const CTransaction& tx);
+
+    /**
+     * The legacy serialization of tx, which must be the transaction this was
+     * constructed for, or null if it has a single input. Built by the first
+     * legacy SIGHASH_ALL signature hash, which script check threads may ask
+     * for concurrently, so transactions whose scripts are never checked do
+     * not pay for it.
+     */
+    std::shared_ptr<const PrecomputedLegacySighash> GetLegacySighash(const CTransaction& tx) const;
+
+private:
+    mutable std::shared_ptr<const PrecomputedLegacySighash> m_legacy_sighash;
 };
 
 enum SigVersion
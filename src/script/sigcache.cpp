@@ -14,7 +14,12 @@
 #include <cuckoocache.h>
 #include <boost/thread.hpp>
 
+#include <atomic>
+
 namespace {
+//! Number of independently locked parts of the signature cache
+static const unsigned int SIGNATURE_CACHE_SHARDS = 16;
+
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
@@ -26,8 +31,28 @@ private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
     typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
+
+    /**
+     * The entries are split by their first byte over shards with a lock each,
+     * so that script check threads rarely wait on each other's lookups. Only
+     * the lowest bits of the first hash are fixed within a shard, which does
+     * not skew where it places them. Shards are aligned to a cache line so
+     * that the locks and counters of neighbouring shards do not share one.
+     */
+    struct alignas(64) Shard
+    {
+        map_type setValid;
+        boost::shared_mutex cs_sigcache;
+        std::atomic<uint64_t> nHits{0};
+        std::atomic<uint64_t> nMisses{0};
+        std::atomic<uint64_t> nEvictions{0};
+    };
+    Shard shards[SIGNATURE_CACHE_SHARDS];
+
+    Shard& GetShard(const uint256& entry)
+    {
+        return shards[*entry.begin() % SIGNATURE_CACHE_SHARDS];
+    }
 
 public:
     CSignatureCache()
@@ -44,18 +69,50 @@ public:
     bool
     Get(const uint256& entry, const bool erase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.contains(entry, erase);
+        Shard& shard = GetShard(entry);
+        boost::shared_lock<boost::shared_mutex> lock(shard.cs_sigcache);
+        if (!shard.setValid.contains(entry, erase)) {
+            shard.nMisses++;
+            return false;
+        }
+        shard.nHits++;
+        return true;
     }
 
     void Set(uint256& entry)
     {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.insert(entry);
+        Shard& shard = GetShard(entry);
+        boost::unique_lock<boost::shared_mutex> lock(shard.cs_sigcache);
+        shard.nEvictions += shard.setValid.insert(entry);
     }
-    uint32_t setup_bytes(size_t n)
+    size_t setup_bytes(size_t n)
     {
-        return setValid.setup_bytes(n);
+        size_t nElems = 0;
+        for (Shard& shard : shards) {
+            boost::unique_lock<boost::shared_mutex> lock(shard.cs_sigcache);
+            nElems += shard.setValid.setup_bytes(n / SIGNATURE_CACHE_SHARDS);
+        }
+        return nElems;
+    }
+    size_t resize_bytes(size_t n)
+    {
+        size_t nElems = 0;
+        for (Shard& shard : shards) {
+            boost::unique_lock<boost::shared_mutex> lock(shard.cs_sigcache);
+            nElems += shard.setValid.resize_bytes(n / SIGNATURE_CACHE_SHARDS);
+        }
+        return nElems;
+    }
+    SigCacheStats GetStats(size_t nElements)
+    {
+        SigCacheStats stats;
+        stats.nElements = nElements;
+        for (const Shard& shard : shards) {
+            stats.nHits += shard.nHits;
+            stats.nMisses += shard.nMisses;
+            stats.nEvictions += shard.nEvictions;
+        }
+        return stats;
     }
 };
 
@@ -66,20 +123,41 @@ public:
  * signatureCache could be made local to VerifySignature.
 */
 static CSignatureCache signatureCache;
+static std::atomic<size_t> nSignatureCacheElements(0);
 } // namespace
 
+size_t GetSigCacheBytes(int64_t nMaxSigCacheSize)
+{
+    // The size is split evenly between the two caches
+    return std::min(std::max((int64_t)0, nMaxSigCacheSize / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+}
+
 // To be called once in AppInitMain/BasicTestingSetup to initialize the
 // signatureCache.
 void InitSignatureCache()
 {
     // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
-    // setup_bytes creates the minimum possible cache (2 elements).
-    size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    // setup_bytes creates the minimum possible cache (2 elements per shard).
+    size_t nMaxCacheSize = GetSigCacheBytes(gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE));
     size_t nElems = signatureCache.setup_bytes(nMaxCacheSize);
+    nSignatureCacheElements = nElems;
     LogPrintf("Using %zu MiB out of %zu/2 requested for signature cache, able to store %zu elements\n",
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+size_t ResizeSignatureCache(size_t nBytes)
+{
+    size_t nElems = signatureCache.resize_bytes(nBytes);
+    nSignatureCacheElements = nElems;
+    LogPrintf("Resized signature cache to %zu MiB, able to store %zu elements\n", (nElems*sizeof(uint256)) >>20, nElems);
+    return nElems;
+}
+
+SigCacheStats GetSignatureCacheStats()
+{
+    return signatureCache.GetStats(nSignatureCacheElements);
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     uint256 entry;
@@ -51,6 +51,21 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const override;
 };
 
+/** Size and hit, miss and eviction counts of the signature or script execution cache */
+struct SigCacheStats
+{
+    size_t nElements = 0; //!< number of entries the cache can hold
+    uint64_t nHits = 0;
+    uint64_t nMisses = 0;
+    uint64_t nEvictions = 0; //!< entries dropped, or let go, for lack of room
+};
+
+/** Bytes of each of the signature and script execution caches for -maxsigcachesize=<nMaxSigCacheSize> */
+size_t GetSigCacheBytes(int64_t nMaxSigCacheSize);
+
 void InitSignatureCache();
+/** Resize the signature cache to about nBytes, keeping the entries that fit. Returns the number of entries it can hold. */
+size_t ResizeSignatureCache(size_t nBytes);
+SigCacheStats GetSignatureCacheStats();
 
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -0,0 +1,190 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * Memory resource for node based containers: small blocks are carved out of
+ * large chunks and recycled through a free list per block size, instead of
+ * being allocated one by one. That saves the malloc overhead of every node
+ * and keeps the nodes of a container close in memory.
+ *
+ * Blocks of up to MAX_BLOCK_SIZE_BYTES are served from the pool; larger ones,
+ * such as the bucket array of a hash table, come from operator new. Freed
+ * blocks are kept for reuse, and the chunks are only given back when the
+ * resource is destroyed: BytesInUse() counts the blocks handed out, while
+ * ChunkBytes() is what the pool holds, which stays at its peak.
+ *
+ * Not thread safe; it is meant to be used under the lock of the container
+ * owning it.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(void*)>
+class PoolResource
+{
+    static_assert(ALIGN_BYTES >= sizeof(void*) && (ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two, and hold a pointer");
+    static_assert(ALIGN_BYTES <= alignof(std::max_align_t), "chunks are only aligned to max_align_t");
+    static_assert(MAX_BLOCK_SIZE_BYTES % ALIGN_BYTES == 0, "MAX_BLOCK_SIZE_BYTES must be a multiple of ALIGN_BYTES");
+
+    struct ListNode {
+        ListNode* next;
+    };
+
+    const std::size_t nChunkSizeBytes;
+    std::vector<std::unique_ptr<char[]>> vChunks;
+    //! Free blocks, by size in units of ALIGN_BYTES
+    std::array<ListNode*, MAX_BLOCK_SIZE_BYTES / ALIGN_BYTES + 1> freeLists;
+    //! Part of the last chunk not handed out yet
+    char* pAvailable;
+    char* pAvailableEnd;
+    std::size_t nBytesInUse;
+
+    static bool IsPooled(std::size_t bytes, std::size_t alignment)
+    {
+        return bytes <= MAX_BLOCK_SIZE_BYTES && alignment <= ALIGN_BYTES;
+    }
+
+    static std::size_t NumUnits(std::size_t bytes)
+    {
+        return bytes == 0 ? 1 : (bytes + ALIGN_BYTES - 1) / ALIGN_BYTES;
+    }
+
+    void PushFree(void* p, std::size_t nUnits)
+    {
+        ListNode* node = new (p) ListNode;
+        node->next = freeLists[nUnits];
+        freeLists[nUnits] = node;
+    }
+
+public:
+    explicit PoolResource(std::size_t nChunkSizeBytesIn = 256 << 10) :
+        nChunkSizeBytes(nChunkSizeBytesIn / ALIGN_BYTES * ALIGN_BYTES), pAvailable(nullptr), pAvailableEnd(nullptr), nBytesInUse(0)
+    {
+        freeLists.fill(nullptr);
+    }
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsPooled(bytes, alignment))
+            return ::operator new(bytes);
+
+        const std::size_t nUnits = NumUnits(bytes);
+        void* p;
+        if (freeLists[nUnits] != nullptr) {
+            ListNode* node = freeLists[nUnits];
+            freeLists[nUnits] = node->next;
+            p = node;
+        } else {
+            const std::size_t nBytes = nUnits * ALIGN_BYTES;
+            if ((std::size_t)(pAvailableEnd - pAvailable) < nBytes) {
+                // Keep what is left of the chunk for blocks that small
+                if (pAvailable != pAvailableEnd)
+                    PushFree(pAvailable, (pAvailableEnd - pAvailable) / ALIGN_BYTES);
+                vChunks.emplace_back(new char[nChunkSizeBytes]);
+                pAvailable = vChunks.back().get();
+                pAvailableEnd = pAvailable + nChunkSizeBytes;
+            }
+            p = pAvailable;
+            pAvailable += nBytes;
+        }
+        nBytesInUse += nUnits * ALIGN_BYTES;
+        return p;
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (!IsPooled(bytes, alignment)) {
+            ::operator delete(p);
+            return;
+        }
+        const std::size_t nUnits = NumUnits(bytes);
+        PushFree(p, nUnits);
+        nBytesInUse -= nUnits * ALIGN_BYTES;
+    }
+
+    /** Size of the blocks handed out from the pool and not freed yet. */
+    std::size_t BytesInUse() const { return nBytesInUse; }
+    /** Memory held in chunks, including free blocks. */
+    std::size_t ChunkBytes() const { return vChunks.size() * nChunkSizeBytes; }
+};
+
+/** Allocator serving its allocations from a PoolResource, which must outlive it. */
+template <class T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(void*)>
+class PoolAllocator
+{
+public:
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+private:
+    ResourceType* resource;
+
+public:
+    explicit PoolAllocator(ResourceType* resourceIn) noexcept : resource(resourceIn) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : resource(other.GetResource()) {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args)
+    {
+        ::new ((void*)p) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    void destroy(U* p)
+    {
+        p->~U();
+    }
+
+    std::size_t max_size() const noexcept { return std::size_t(-1) / sizeof(T); }
+
+    ResourceType* GetResource() const noexcept { return resource; }
+};
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.GetResource() == b.GetResource();
+}
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
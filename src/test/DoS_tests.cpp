@@ -5,6 +5,7 @@
 // Unit tests for denial-of-service detection/prevention code
 
 #include <chainparams.h>
+#include <consensus/validation.h>
 #include <keystore.h>
 #include <net.h>
 #include <net_processing.h>
@@ -30,6 +31,8 @@ struct COrphanTx {
     int64_t nTimeExpire;
 };
 extern std::map<uint256, COrphanTx> mapOrphanTransactions;
+extern int GetBlockDownloadWindow(int64_t nAvgBlockInterval, int64_t nPingUsecTime);
+extern bool ShouldReassignStalledBlock(int64_t nAvgBlockInterval, int64_t nStallerAvgBlockInterval);
 
 CService ip(uint32_t i)
 {
@@ -92,7 +95,7 @@ BOOST_AUTO_TEST_CASE(outbound_slow_chain_eviction)
     peerLogic->FinalizeNode(dummyNode1.GetId(), dummy);
 }
 
-void AddRandomOutboundPeer(std::vector<CNode *> &vNodes, PeerLogicValidation &peerLogic)
+CNode* AddRandomOutboundPeer(std::vector<CNode *> &vNodes, PeerLogicValidation &peerLogic)
 {
     CAddress addr(ip(GetRandInt(0xffffffff)), NODE_NONE);
     vNodes.emplace_back(new CNode(id++, ServiceFlags(NODE_NETWORK|NODE_WITNESS), 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", /*fInboundIn=*/ false));
@@ -104,6 +107,7 @@ void AddRandomOutboundPeer(std::vector<CNode *> &vNodes, PeerLogicValidation &pe
     node.fSuccessfullyConnected = true;
 
     CConnmanTest::AddNode(node);
+    return &node;
 }
 
 BOOST_AUTO_TEST_CASE(stale_tip_peer_management)
@@ -175,6 +179,221 @@ BOOST_AUTO_TEST_CASE(stale_tip_peer_management)
     CConnmanTest::ClearNodes();
 }
 
+static CNode* AddHeadersPeer(std::vector<CNode*>& vNodes, PeerLogicValidation& peerLogic)
+{
+    CNode* node = AddRandomOutboundPeer(vNodes, peerLogic);
+    node->nStartingHeight = 2000000;
+    std::atomic<bool> interruptDummy(false);
+    LOCK(node->cs_sendProcessing);
+    peerLogic.SendMessages(node, interruptDummy);
+    return node;
+}
+
+static std::vector<CBlockHeader> BuildHeaders(const uint256& hashPrev, size_t nCount)
+{
+    std::vector<CBlockHeader> headers(nCount);
+    uint256 hashLast = hashPrev;
+    for (size_t i = 0; i < nCount; i++) {
+        headers[i].nVersion = 1;
+        headers[i].hashPrevBlock = hashLast;
+        headers[i].hashMerkleRoot = InsecureRand256();
+        headers[i].nTime = Params().GenesisBlock().nTime + i;
+        headers[i].nBits = Params().GenesisBlock().nBits;
+        hashLast = headers[i].GetHash();
+    }
+    return headers;
+}
+
+/** Deliver a message to peerLogic as if it came in over the wire. */
+static void ReceiveMessage(PeerLogicValidation& peerLogic, CNode* node, const char* pszCommand, const CDataStream& payload)
+{
+    CMessageHeader hdr(Params().MessageStart(), pszCommand, payload.size());
+    uint256 hash = Hash(payload.begin(), payload.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream hdrbuf(SER_NETWORK, PROTOCOL_VERSION);
+    hdrbuf << hdr;
+
+    CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    BOOST_CHECK_EQUAL(msg.readHeader(hdrbuf.data(), hdrbuf.size()), (int)hdrbuf.size());
+    BOOST_CHECK_EQUAL(msg.readData(payload.data(), payload.size()), (int)payload.size());
+    BOOST_CHECK(msg.complete());
+    {
+        // Nothing reads what we send, don't let it pause message processing
+        LOCK(node->cs_vSend);
+        node->vSendMsg.clear();
+        node->nSendSize = 0;
+        node->fPauseSend = false;
+    }
+    {
+        LOCK(node->cs_vProcessMsg);
+        node->vProcessMsg.push_back(msg);
+        node->nProcessQueueSize += payload.size() + CMessageHeader::HEADER_SIZE;
+    }
+    std::atomic<bool> interruptDummy(false);
+    peerLogic.ProcessMessages(node, interruptDummy);
+}
+
+static void ReceiveHeaders(PeerLogicValidation& peerLogic, CNode* node, const std::vector<CBlockHeader>& headers)
+{
+    // Every header is sent as a block without transactions and without block signature
+    CDataStream payload(SER_NETWORK, PROTOCOL_VERSION);
+    WriteCompactSize(payload, headers.size());
+    for (const CBlockHeader& header : headers)
+        payload << header << (uint8_t)0 << (uint8_t)0;
+    ReceiveMessage(peerLogic, node, NetMsgType::HEADERS, payload);
+}
+
+static void ReceiveTransaction(PeerLogicValidation& peerLogic, CNode* node, const CTransactionRef& tx)
+{
+    CDataStream payload(SER_NETWORK, PROTOCOL_VERSION);
+    payload << tx;
+    ReceiveMessage(peerLogic, node, NetMsgType::TX, payload);
+
+    // Its scripts are verified on another thread, and the result handled on
+    // the peer's next turn
+    std::atomic<bool> interruptDummy(false);
+    for (int i = 0; i < 1000 && !peerLogic.ProcessMessages(node, interruptDummy); i++)
+        MilliSleep(10);
+}
+
+static CNodeStateStats GetStats(const CNode* node)
+{
+    CNodeStateStats stats;
+    BOOST_CHECK(GetNodeStateStats(node->GetId(), stats));
+    return stats;
+}
+
+// Peers other than the sync peer fetch the headers between later checkpoints.
+// Batches that arrive before the headers they build on are buffered, broken
+// segments cost the peer, and no peer buffers more than its share.
+BOOST_AUTO_TEST_CASE(headers_segment_buffering)
+{
+    const MapCheckpoints& checkpoints = Params().Checkpoints().mapCheckpoints;
+    auto it = checkpoints.begin();
+    const std::pair<int, uint256> checkpoint0 = *it++;
+    const std::pair<int, uint256> checkpoint1 = *it++;
+    const std::pair<int, uint256> checkpoint2 = *it++;
+    const std::pair<int, uint256> checkpoint3 = *it++;
+    BOOST_REQUIRE(checkpoint2.first - checkpoint1.first > (int)MAX_ORPHAN_HEADERS_PER_PEER);
+
+    std::vector<CNode*> vNodes;
+    CNode* syncPeer = AddHeadersPeer(vNodes, *peerLogic);
+    CNode* peer1 = AddHeadersPeer(vNodes, *peerLogic);
+    CNode* peer2 = AddHeadersPeer(vNodes, *peerLogic);
+    CNode* peer3 = AddHeadersPeer(vNodes, *peerLogic);
+    BOOST_CHECK_EQUAL(GetStats(syncPeer).nHeadersSegment, -1);
+    BOOST_CHECK_EQUAL(GetStats(peer1).nHeadersSegment, checkpoint1.first);
+    BOOST_CHECK_EQUAL(GetStats(peer2).nHeadersSegment, checkpoint2.first);
+    BOOST_CHECK_EQUAL(GetStats(peer3).nHeadersSegment, checkpoint3.first);
+
+    // Out of order: the segment does not connect to our headers chain yet
+    std::vector<CBlockHeader> headers = BuildHeaders(checkpoint0.second, MAX_HEADERS_RESULTS);
+    ReceiveHeaders(*peerLogic, peer1, headers);
+    BOOST_CHECK_EQUAL(GetStats(peer1).nOrphanHeaders, MAX_HEADERS_RESULTS);
+    BOOST_CHECK_EQUAL(GetStats(peer1).nHeadersSegment, checkpoint1.first);
+    BOOST_CHECK_EQUAL(GetStats(peer1).nMisbehavior, 0);
+
+    // A segment that does not end in the checkpoint
+    while (GetStats(peer1).nOrphanHeaders + MAX_HEADERS_RESULTS < (size_t)(checkpoint1.first - checkpoint0.first)) {
+        headers = BuildHeaders(headers.back().GetHash(), MAX_HEADERS_RESULTS);
+        ReceiveHeaders(*peerLogic, peer1, headers);
+        BOOST_CHECK_EQUAL(GetStats(peer1).nHeadersSegment, checkpoint1.first);
+    }
+    size_t nBuffered = GetStats(peer1).nOrphanHeaders;
+    headers = BuildHeaders(headers.back().GetHash(), checkpoint1.first - checkpoint0.first - nBuffered);
+    ReceiveHeaders(*peerLogic, peer1, headers);
+    BOOST_CHECK_EQUAL(GetStats(peer1).nHeadersSegment, -1);
+    BOOST_CHECK_EQUAL(GetStats(peer1).nOrphanHeaders, nBuffered);
+    BOOST_CHECK_EQUAL(GetStats(peer1).nMisbehavior, 20);
+
+    // A batch that is not a chain
+    headers = BuildHeaders(checkpoint2.second, MAX_HEADERS_RESULTS);
+    headers[MAX_HEADERS_RESULTS / 2].hashPrevBlock = InsecureRand256();
+    ReceiveHeaders(*peerLogic, peer3, headers);
+    BOOST_CHECK_EQUAL(GetStats(peer3).nHeadersSegment, -1);
+    BOOST_CHECK_EQUAL(GetStats(peer3).nOrphanHeaders, 0U);
+    BOOST_CHECK_EQUAL(GetStats(peer3).nMisbehavior, 20);
+
+    // Overflow: the peer stops being asked for more once it holds its share
+    headers = BuildHeaders(checkpoint1.second, MAX_HEADERS_RESULTS);
+    ReceiveHeaders(*peerLogic, peer2, headers);
+    while (GetStats(peer2).nHeadersSegment != -1) {
+        BOOST_REQUIRE(GetStats(peer2).nOrphanHeaders < MAX_ORPHAN_HEADERS_PER_PEER);
+        headers = BuildHeaders(headers.back().GetHash(), MAX_HEADERS_RESULTS);
+        ReceiveHeaders(*peerLogic, peer2, headers);
+    }
+    BOOST_CHECK_EQUAL(GetStats(peer2).nOrphanHeaders, MAX_ORPHAN_HEADERS_PER_PEER);
+    BOOST_CHECK_EQUAL(GetStats(peer2).nMisbehavior, 0);
+    {
+        // Not handed another segment either
+        std::atomic<bool> interruptDummy(false);
+        LOCK(peer2->cs_sendProcessing);
+        peerLogic->SendMessages(peer2, interruptDummy);
+    }
+    BOOST_CHECK_EQUAL(GetStats(peer2).nHeadersSegment, -1);
+    BOOST_CHECK_EQUAL(GetStats(peer2).nOrphanHeaders, MAX_ORPHAN_HEADERS_PER_PEER);
+
+    bool dummy;
+    for (const CNode *node : vNodes) {
+        peerLogic->FinalizeNode(node->GetId(), dummy);
+    }
+    CConnmanTest::ClearNodes();
+}
+
+// Peers' transactions are verified off the message handler thread. A bad
+// signature found there rejects the transaction and costs the peer without
+// the mempool verifying it again.
+BOOST_AUTO_TEST_CASE(tx_preverify)
+{
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    auto spend = [&](const CKey& keySign) {
+        const COutPoint prevout(InsecureRand256(), 0);
+        {
+            LOCK(cs_main);
+            pcoinsTip->AddCoin(prevout, Coin(CTxOut(COIN, scriptPubKey), 1, false), false);
+        }
+        CMutableTransaction tx;
+        tx.nTime = GetAdjustedTime();
+        tx.vin.emplace_back(prevout);
+        tx.vout.emplace_back(COIN - 10 * CENT, scriptPubKey);
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(keySign.Sign(SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, COIN, SIGVERSION_BASE), vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[0].scriptSig << vchSig << ToByteVector(key.GetPubKey());
+        return MakeTransactionRef(tx);
+    };
+    const CTransactionRef txGood = spend(key);
+    const CTransactionRef txBad = spend(keyOther);
+
+    CValidationState state;
+    BOOST_CHECK(PreVerifyTransaction(txGood, state));
+    BOOST_CHECK(state.IsValid());
+    int nDoS = 0;
+    BOOST_CHECK(!PreVerifyTransaction(txBad, state));
+    BOOST_CHECK(state.IsInvalid(nDoS));
+    BOOST_CHECK_EQUAL(nDoS, 100);
+    BOOST_CHECK_EQUAL(state.GetRejectReason().find("mandatory-script-verify-flag-failed"), 0U);
+
+    std::vector<CNode*> vNodes;
+    CNode* peer1 = AddRandomOutboundPeer(vNodes, *peerLogic);
+    CNode* peer2 = AddRandomOutboundPeer(vNodes, *peerLogic);
+    ReceiveTransaction(*peerLogic, peer1, txBad);
+    BOOST_CHECK_EQUAL(GetStats(peer1).nMisbehavior, 100);
+    BOOST_CHECK(!mempool.exists(txBad->GetHash()));
+    ReceiveTransaction(*peerLogic, peer2, txGood);
+    BOOST_CHECK_EQUAL(GetStats(peer2).nMisbehavior, 0);
+    BOOST_CHECK(mempool.exists(txGood->GetHash()));
+
+    bool dummy;
+    for (const CNode *node : vNodes) {
+        peerLogic->FinalizeNode(node->GetId(), dummy);
+    }
+    CConnmanTest::ClearNodes();
+}
+
 BOOST_AUTO_TEST_CASE(DoS_banning)
 {
     std::atomic<bool> interruptDummy(false);
@@ -382,4 +601,38 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     BOOST_CHECK(mapOrphanTransactions.empty());
 }
 
+BOOST_AUTO_TEST_CASE(block_download_window)
+{
+    // Nothing measured yet: the fixed window
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(0, 0), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(0, 2000000), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(100000, 0), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(-1, 2000000), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // A fast link never shrinks below the fixed window
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(100000, 50000), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // Twice the round trip worth of blocks, plus one: a 2s ping at a block per 100ms
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(100000, 2000000), 41);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(50000, 1500000), 61);
+
+    // Capped for slow links with fast block delivery
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(10000, 3000000), MAX_BLOCKS_IN_TRANSIT_PER_PEER_ADAPTIVE);
+}
+
+BOOST_AUTO_TEST_CASE(block_download_stall_reassignment)
+{
+    // An idle peer without a measured rate never takes over a block
+    BOOST_CHECK(!ShouldReassignStalledBlock(0, 0));
+    BOOST_CHECK(!ShouldReassignStalledBlock(0, 500000));
+
+    // A measured peer takes over from a staller that never delivered anything
+    BOOST_CHECK(ShouldReassignStalledBlock(500000, 0));
+
+    // Only to a strictly faster peer, so the block cannot bounce back
+    BOOST_CHECK(ShouldReassignStalledBlock(100000, 500000));
+    BOOST_CHECK(!ShouldReassignStalledBlock(500000, 100000));
+    BOOST_CHECK(!ShouldReassignStalledBlock(100000, 100000));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
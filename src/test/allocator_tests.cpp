@@ -4,9 +4,12 @@
 
 #include <util.h>
 
+#include <support/allocators/pool.h>
 #include <support/allocators/secure.h>
 #include <test/test_bitcoin.h>
 
+#include <list>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(allocator_tests, BasicTestingSetup)
@@ -231,4 +234,87 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     BOOST_CHECK(pool.stats().used == initial.used);
 }
 
+BOOST_AUTO_TEST_CASE(pool_resource_tests)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 0U);
+    BOOST_CHECK_EQUAL(resource.ChunkBytes(), 0U);
+
+    // Sizes are rounded up to the alignment
+    void *a0 = resource.Allocate(8, 8);
+    void *a1 = resource.Allocate(1, 1);
+    void *a2 = resource.Allocate(0, 1);
+    BOOST_CHECK(a0 != a1 && a1 != a2 && a0 != a2);
+    BOOST_CHECK_EQUAL((uintptr_t)a0 % 8, 0U);
+    BOOST_CHECK_EQUAL((uintptr_t)a1 % 8, 0U);
+    BOOST_CHECK_EQUAL((uintptr_t)a2 % 8, 0U);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 24U);
+    BOOST_CHECK_EQUAL(resource.ChunkBytes(), 1024U);
+
+    // Freed blocks are reused by blocks of their size only
+    resource.Deallocate(a1, 1, 1);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 16U);
+    void *a3 = resource.Allocate(24, 8);
+    BOOST_CHECK(a3 != a1);
+    void *a4 = resource.Allocate(5, 4);
+    BOOST_CHECK(a4 == a1);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 48U);
+
+    // Blocks larger than the pooled size, or more aligned, come from operator new
+    void *big = resource.Allocate(65, 8);
+    void *aligned = resource.Allocate(16, 16);
+    memset(big, 0, 65);
+    memset(aligned, 0, 16);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 48U);
+    BOOST_CHECK_EQUAL(resource.ChunkBytes(), 1024U);
+    resource.Deallocate(big, 65, 8);
+    resource.Deallocate(aligned, 16, 16);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 48U);
+
+    resource.Deallocate(a0, 8, 8);
+    resource.Deallocate(a2, 0, 1);
+    resource.Deallocate(a3, 24, 8);
+    resource.Deallocate(a4, 5, 4);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 0U);
+    // Chunks are kept until the resource goes
+    BOOST_CHECK_EQUAL(resource.ChunkBytes(), 1024U);
+}
+
+BOOST_AUTO_TEST_CASE(pool_resource_chunk_tail)
+{
+    PoolResource<64, 8> resource(1024);
+    for (int i = 0; i < 15; i++)
+        resource.Allocate(64, 8);
+    char *p = static_cast<char*>(resource.Allocate(40, 8));
+    BOOST_CHECK_EQUAL(resource.ChunkBytes(), 1024U);
+
+    // The 24 bytes left of the first chunk are too few for this block, but not wasted
+    resource.Allocate(64, 8);
+    BOOST_CHECK_EQUAL(resource.ChunkBytes(), 2048U);
+    BOOST_CHECK(resource.Allocate(24, 8) == p + 40);
+    BOOST_CHECK_EQUAL(resource.ChunkBytes(), 2048U);
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 16 * 64 + 40 + 24U);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_tests)
+{
+    typedef PoolAllocator<int, 64> Allocator;
+    Allocator::ResourceType resource;
+    {
+        std::list<int, Allocator> list{Allocator(&resource)};
+        for (int i = 0; i < 1000; i++)
+            list.push_back(i);
+        BOOST_CHECK(resource.BytesInUse() >= 1000 * sizeof(int));
+        const size_t nChunkBytes = resource.ChunkBytes();
+
+        // Nodes freed by the list are reused without new chunks
+        list.clear();
+        BOOST_CHECK_EQUAL(resource.BytesInUse(), 0U);
+        for (int i = 0; i < 1000; i++)
+            list.push_back(i);
+        BOOST_CHECK_EQUAL(resource.ChunkBytes(), nChunkBytes);
+    }
+    BOOST_CHECK_EQUAL(resource.BytesInUse(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
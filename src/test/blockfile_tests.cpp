@@ -0,0 +1,81 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfile.h>
+#include <chain.h>
+#include <clientversion.h>
+#include <streams.h>
+#include <validation.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfile_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockfile_reader)
+{
+    // Two size-prefixed records, the first larger than the read-ahead
+    const CDiskBlockPos posFile(99, 0);
+    std::vector<unsigned char> vchFirst(BLOCKFILE_READ_AHEAD * 3, 0x5a);
+    const uint256 hash = InsecureRand256();
+    {
+        CAutoFile file(OpenBlockFile(posFile), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!file.IsNull());
+        file << (unsigned int)GetSerializeSize(vchFirst, SER_DISK, CLIENT_VERSION) << vchFirst;
+        file << (unsigned int)GetSerializeSize(hash, SER_DISK, CLIENT_VERSION) << hash;
+    }
+    const unsigned int nFirstPos = 4;
+    const unsigned int nSecondPos = nFirstPos + GetSerializeSize(vchFirst, SER_DISK, CLIENT_VERSION) + 4;
+
+    CBlockFileCache cache(1);
+    unsigned int nSize;
+    BOOST_CHECK(cache.ReadRecordSize(CDiskBlockPos(99, nFirstPos), "blk", nSize));
+    BOOST_CHECK_EQUAL(nSize, GetSerializeSize(vchFirst, SER_DISK, CLIENT_VERSION));
+    BOOST_CHECK(!cache.ReadRecordSize(CDiskBlockPos(99, 0), "blk", nSize));
+
+    {
+        CBlockFileReader reader(cache, CDiskBlockPos(99, nFirstPos), "blk", SER_DISK, CLIENT_VERSION);
+        std::vector<unsigned char> vch;
+        reader >> vch;
+        BOOST_CHECK(vch == vchFirst);
+        uint256 hashRead;
+        reader.ignore(4);
+        reader >> hashRead;
+        BOOST_CHECK(hashRead == hash);
+        BOOST_CHECK_THROW(reader >> hashRead, std::ios_base::failure);
+    }
+
+    // Skipping past the buffered data
+    {
+        CBlockFileReader reader(cache, CDiskBlockPos(99, 0), "blk", SER_DISK, CLIENT_VERSION);
+        unsigned int nFirstSize;
+        reader >> nFirstSize;
+        reader.ignore(nFirstSize + 4);
+        uint256 hashRead;
+        reader >> hashRead;
+        BOOST_CHECK(hashRead == hash);
+    }
+
+    // A whole record with one read, and a file that does not exist
+    {
+        CBlockFileReader reader(cache, CDiskBlockPos(99, nSecondPos), "blk", SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(reader.Prefetch(32));
+        BOOST_CHECK(!reader.Prefetch(33));
+        uint256 hashRead;
+        reader >> hashRead;
+        BOOST_CHECK(hashRead == hash);
+    }
+    {
+        CBlockFileReader reader(cache, CDiskBlockPos(98, 0), "blk", SER_DISK, CLIENT_VERSION);
+        unsigned int n;
+        BOOST_CHECK_THROW(reader >> n, std::ios_base::failure);
+    }
+
+    cache.Close(99);
+    fs::remove(GetBlockPosFilename(posFile, "blk"));
+    BOOST_CHECK_EQUAL(cache.Read(CDiskBlockPos(99, 0), "blk", (char*)&nSize, 4), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,199 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockindexfile.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <txdb.h>
+#include <util.h>
+
+#include <test/test_bitcoin.h>
+
+#include <map>
+#include <memory>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+//! A genesis block with two children, one of which is extended by a PoS block
+struct TestBlockIndex
+{
+    std::vector<uint256> vHash;
+    std::vector<std::unique_ptr<CBlockIndex>> vIndex;
+
+    TestBlockIndex()
+    {
+        // phashBlock points into vHash
+        vHash.reserve(4);
+        for (int n = 0; n < 4; n++) {
+            vHash.push_back(InsecureRand256());
+            vIndex.emplace_back(new CBlockIndex());
+            CBlockIndex& index = *vIndex.back();
+            index.phashBlock = &vHash.back();
+            index.nHeight = n == 0 ? 0 : n == 3 ? 2 : 1;
+            index.pprev = n == 0 ? nullptr : n == 3 ? vIndex[1].get() : vIndex[0].get();
+            index.nStatus = BLOCK_VALID_SCRIPTS | BLOCK_HAVE_DATA | (n == 2 ? 0 : BLOCK_HAVE_UNDO);
+            index.nTx = n + 1;
+            index.nFile = n;
+            index.nDataPos = 1000 * n + 8;
+            index.nUndoPos = n == 2 ? 0 : 500 * n + 8;
+            index.nVersion = 7;
+            index.hashMerkleRoot = InsecureRand256();
+            index.nTime = 1500000000 + n;
+            index.nBits = 0x1e0fffff;
+            index.nNonce = InsecureRand32();
+            index.nStakeModifier = InsecureRandBits(64);
+            if (n == 3) {
+                index.nFlags = CBlockIndex::BLOCK_PROOF_OF_STAKE | CBlockIndex::BLOCK_STAKE_ENTROPY;
+                index.prevoutStake = COutPoint(InsecureRand256(), 1);
+                index.nStakeTime = index.nTime;
+                index.hashProofOfStake = InsecureRand256();
+            }
+        }
+    }
+
+    std::vector<const CBlockIndex*> Get() const
+    {
+        std::vector<const CBlockIndex*> v;
+        for (const auto& pindex : vIndex)
+            v.push_back(pindex.get());
+        return v;
+    }
+};
+
+void CheckSameIndex(const CBlockIndex& a, const CBlockIndex& b)
+{
+    BOOST_CHECK_EQUAL(a.nHeight, b.nHeight);
+    BOOST_CHECK_EQUAL(a.nStatus, b.nStatus);
+    BOOST_CHECK_EQUAL(a.nTx, b.nTx);
+    BOOST_CHECK_EQUAL(a.nFile, b.nFile);
+    BOOST_CHECK_EQUAL(a.nDataPos, b.nDataPos);
+    BOOST_CHECK_EQUAL(a.nUndoPos, b.nUndoPos);
+    BOOST_CHECK_EQUAL(a.nVersion, b.nVersion);
+    BOOST_CHECK(a.hashMerkleRoot == b.hashMerkleRoot);
+    BOOST_CHECK_EQUAL(a.nTime, b.nTime);
+    BOOST_CHECK_EQUAL(a.nBits, b.nBits);
+    BOOST_CHECK_EQUAL(a.nNonce, b.nNonce);
+    BOOST_CHECK_EQUAL(a.nFlags, b.nFlags);
+    BOOST_CHECK_EQUAL(a.nStakeModifier, b.nStakeModifier);
+    BOOST_CHECK(a.prevoutStake == b.prevoutStake);
+    BOOST_CHECK_EQUAL(a.nStakeTime, b.nStakeTime);
+    BOOST_CHECK(a.hashProofOfStake == b.hashProofOfStake);
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(blockindexfile_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockindexfile_roundtrip)
+{
+    TestBlockIndex test;
+    const fs::path path = GetDataDir() / "index_test.dat";
+    const uint256 nonce = InsecureRand256();
+    BOOST_CHECK(WriteBlockIndexFile(path, nonce, test.Get()));
+
+    CBlockIndexFile file;
+    BOOST_CHECK(!file.Open(path, InsecureRand256(), test.vIndex.size()));
+    BOOST_CHECK(!file.Open(path, nonce, test.vIndex.size() - 1));
+    BOOST_REQUIRE(file.Open(path, nonce, test.vIndex.size()));
+    BOOST_CHECK_EQUAL(file.size(), test.vIndex.size());
+    for (uint64_t n = 0; n < file.size(); n++) {
+        const CBlockIndex& index = *test.vIndex[n];
+        BOOST_CHECK(file.GetHash(n) == index.GetBlockHash());
+        BOOST_CHECK_EQUAL(file.GetPrev(n), n == 0 ? -1 : n == 3 ? 1 : 0);
+        CBlockIndex indexRead;
+        file.Get(n, indexRead);
+        CheckSameIndex(indexRead, index);
+    }
+    file.Close();
+
+    // Parents have to be written first
+    std::vector<const CBlockIndex*> vUnsorted = test.Get();
+    std::swap(vUnsorted[1], vUnsorted[3]);
+    BOOST_CHECK(!WriteBlockIndexFile(path, nonce, vUnsorted));
+
+    // A truncated file is rejected
+    fs::resize_file(path, BLOCKINDEX_HEADER_SIZE + BLOCKINDEX_RECORD_SIZE);
+    BOOST_CHECK(!file.Open(path, nonce, test.vIndex.size()));
+    fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(blockindexfile_blocktree)
+{
+    TestBlockIndex test;
+    fs::create_directories(GetDataDir() / "blocks");
+    CBlockTreeDB blocktree(1 << 20, true);
+    std::map<uint256, std::unique_ptr<CBlockIndex>> mapLoaded;
+    auto insert = [&mapLoaded](const uint256& hash) -> CBlockIndex* {
+        if (hash.IsNull())
+            return nullptr;
+        std::unique_ptr<CBlockIndex>& pindex = mapLoaded[hash];
+        if (!pindex) {
+            pindex.reset(new CBlockIndex());
+            pindex->phashBlock = &mapLoaded.find(hash)->first;
+        }
+        return pindex.get();
+    };
+
+    // The database is empty, but the snapshot is used while it matches it
+    BOOST_REQUIRE(blocktree.WriteBlockIndexSnapshot(test.Get()));
+    BOOST_REQUIRE(blocktree.LoadBlockIndexGuts(Params().GetConsensus(), insert));
+    BOOST_CHECK_EQUAL(mapLoaded.size(), test.vIndex.size());
+    for (const auto& pindex : test.vIndex) {
+        const CBlockIndex* pindexLoaded = mapLoaded[pindex->GetBlockHash()].get();
+        BOOST_REQUIRE(pindexLoaded);
+        BOOST_CHECK((pindexLoaded->pprev == nullptr) == (pindex->pprev == nullptr));
+        if (pindex->pprev)
+            BOOST_CHECK(pindexLoaded->pprev->GetBlockHash() == pindex->pprev->GetBlockHash());
+        CheckSameIndex(*pindexLoaded, *pindex);
+    }
+
+    // Entries written to the block index since are loaded on top of the snapshot
+    mapLoaded.clear();
+    test.vIndex[0]->nStatus |= BLOCK_FAILED_VALID;
+    std::vector<const CBlockIndex*> vWrite(1, test.vIndex[0].get());
+    BOOST_REQUIRE(blocktree.WriteBatchSync({}, 0, vWrite));
+    BOOST_REQUIRE(blocktree.LoadBlockIndexGuts(Params().GetConsensus(), insert));
+    BOOST_CHECK_EQUAL(mapLoaded.size(), test.vIndex.size());
+    CheckSameIndex(*mapLoaded[test.vHash[0]], *test.vIndex[0]);
+
+    // and copied to it in place, or appended, at the next write
+    const uint256 hashNew = InsecureRand256();
+    CBlockIndex indexNew(*test.vIndex[3]);
+    indexNew.phashBlock = &hashNew;
+    indexNew.pprev = test.vIndex[3].get();
+    indexNew.nHeight = 3;
+    vWrite.assign(1, &indexNew);
+    BOOST_REQUIRE(blocktree.WriteBatchSync({}, 0, vWrite));
+    auto lookup = [&](const uint256& hash) -> const CBlockIndex* {
+        if (hash == hashNew)
+            return &indexNew;
+        for (const auto& pindex : test.vIndex)
+            if (pindex->GetBlockHash() == hash)
+                return pindex.get();
+        return nullptr;
+    };
+    size_t nChanged;
+    BOOST_REQUIRE(blocktree.UpdateBlockIndexSnapshot(lookup, nChanged));
+    BOOST_CHECK_EQUAL(nChanged, 2U);
+    std::vector<uint256> vChanged;
+    blocktree.ReadBlockIndexChanges(vChanged);
+    BOOST_CHECK(vChanged.empty());
+    BOOST_CHECK_EQUAL(fs::file_size(GetDataDir() / "blocks" / "index.dat"), BLOCKINDEX_HEADER_SIZE + 5 * BLOCKINDEX_RECORD_SIZE);
+    mapLoaded.clear();
+    BOOST_REQUIRE(blocktree.LoadBlockIndexGuts(Params().GetConsensus(), insert));
+    BOOST_CHECK_EQUAL(mapLoaded.size(), test.vIndex.size() + 1);
+    CheckSameIndex(*mapLoaded[test.vHash[0]], *test.vIndex[0]);
+    BOOST_REQUIRE(mapLoaded[hashNew]->pprev);
+    BOOST_CHECK(mapLoaded[hashNew]->pprev->GetBlockHash() == test.vHash[3]);
+    CheckSameIndex(*mapLoaded[hashNew], indexNew);
+
+    // Nothing left to copy
+    BOOST_REQUIRE(blocktree.UpdateBlockIndexSnapshot(lookup, nChanged));
+    BOOST_CHECK_EQUAL(nChanged, 0U);
+    fs::remove(GetDataDir() / "blocks" / "index.dat");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
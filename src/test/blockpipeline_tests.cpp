@@ -0,0 +1,66 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockpipeline.h>
+#include <chainparams.h>
+#include <clientversion.h>
+#include <streams.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockpipeline_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockpipeline_order)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << genesis;
+
+    CBlockPipeline pipeline(Params().GetConsensus(), 3);
+    const int nBlocks = 100;
+    bool fPushed = true;
+    std::thread threadPush([&] {
+        for (int n = 0; n < nBlocks; n++) {
+            CDataStream ssBlock(ss);
+            CUnhashedBlock block;
+            ssBlock >> block;
+            fPushed &= pipeline.Push(std::move(block), CDiskBlockPos(0, n), ss.size());
+        }
+        pipeline.Finish();
+    });
+
+    CBlockPipeline::Result result;
+    for (int n = 0; n < nBlocks; n++) {
+        BOOST_REQUIRE(pipeline.Pop(result));
+        BOOST_CHECK_EQUAL(result.pos.nPos, (unsigned int)n);
+        BOOST_REQUIRE(result.pblock);
+        BOOST_CHECK(result.hash == genesis.GetHash());
+        BOOST_REQUIRE_EQUAL(result.pblock->vtx.size(), genesis.vtx.size());
+        BOOST_CHECK(result.pblock->vtx[0]->GetHash() == genesis.vtx[0]->GetHash());
+    }
+    BOOST_CHECK(!pipeline.Pop(result));
+    threadPush.join();
+    BOOST_CHECK(fPushed);
+
+    CBlockPipeline::Stats stats = pipeline.GetStats();
+    BOOST_CHECK_EQUAL(stats.nBlocks, (uint64_t)nBlocks);
+    BOOST_CHECK_EQUAL(stats.nBytes, (uint64_t)nBlocks * ss.size());
+}
+
+BOOST_AUTO_TEST_CASE(blockpipeline_interrupt)
+{
+    CBlockPipeline pipeline(Params().GetConsensus(), 1);
+    CBlockPipeline::Result result;
+    BOOST_CHECK(pipeline.Push(CDiskBlockPos(), uint256(), false));
+    pipeline.Clear();
+    BOOST_CHECK_EQUAL(pipeline.size(), 0U);
+
+    pipeline.Interrupt();
+    BOOST_CHECK(!pipeline.Pop(result));
+    BOOST_CHECK(!pipeline.Push(CDiskBlockPos(), uint256(), false));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
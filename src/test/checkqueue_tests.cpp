@@ -302,6 +302,28 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_UniqueCheck)
     tg.join_all();
 }
 
+// Test that checks queued before the workers started, all on the master's
+// queue, are stolen and run once each
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Steal)
+{
+    auto queue = std::unique_ptr<Correct_Queue>(new Correct_Queue {QUEUE_BATCH_SIZE});
+    boost::thread_group tg;
+    size_t COUNT = 10000;
+    FakeCheckCheckCompletion::n_calls = 0;
+    {
+        CCheckQueueControl<FakeCheckCheckCompletion> control(queue.get());
+        std::vector<FakeCheckCheckCompletion> vChecks(COUNT);
+        control.Add(vChecks);
+        for (auto x = 0; x < nScriptCheckThreads; ++x) {
+           tg.create_thread([&]{queue->Thread();});
+        }
+        BOOST_REQUIRE(control.Wait());
+    }
+    BOOST_REQUIRE_EQUAL(FakeCheckCheckCompletion::n_calls, COUNT);
+    tg.interrupt_all();
+    tg.join_all();
+}
+
 
 // Test that blocks which might allocate lots of memory free their memory aggressively.
 //
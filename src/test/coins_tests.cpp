@@ -3,11 +3,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <coins.h>
+#include <coinstats.h>
 #include <script/standard.h>
 #include <uint256.h>
 #include <undo.h>
 #include <utilstrencodings.h>
 #include <test/test_bitcoin.h>
+#include <txdb.h>
 #include <validation.h>
 #include <consensus/validation.h>
 
@@ -855,4 +857,216 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_map)
+{
+    CCoinsMap map;
+    std::map<COutPoint, CAmount> result;
+    std::vector<const CCoinsCacheEntry*> entries;
+
+    for (uint32_t i = 0; i < 3000; i++) {
+        COutPoint outpoint(InsecureRand256(), i);
+        CCoinsCacheEntry& entry = map[outpoint];
+        entry.coin.out.nValue = i;
+        result[outpoint] = i;
+        entries.push_back(&entry);
+    }
+    BOOST_CHECK_EQUAL(map.size(), result.size());
+    // Entries do not move when the table grows
+    size_t n = 0;
+    for (const auto& it : result) {
+        CCoinsMap::const_iterator found = map.find(it.first);
+        BOOST_CHECK(found != map.end());
+        BOOST_CHECK_EQUAL(found->second.coin.out.nValue, it.second);
+        BOOST_CHECK(entries[it.second] == &found->second);
+        n++;
+    }
+    BOOST_CHECK_EQUAL(n, map.size());
+    BOOST_CHECK(memusage::DynamicUsage(map) >= map.size() * sizeof(CCoinsMap::value_type));
+
+    // Erase every other entry while iterating, then reuse the freed nodes
+    size_t usage = memusage::DynamicUsage(map);
+    bool erase = true;
+    for (CCoinsMap::iterator it = map.begin(); it != map.end(); erase = !erase) {
+        if (erase) {
+            result.erase(it->first);
+            it = map.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    BOOST_CHECK_EQUAL(map.size(), result.size());
+    for (uint32_t i = 0; i < 1000; i++) {
+        COutPoint outpoint(InsecureRand256(), i);
+        BOOST_CHECK(map.emplace(outpoint, CCoinsCacheEntry()).second);
+        BOOST_CHECK(!map.emplace(outpoint, CCoinsCacheEntry()).second);
+        result[outpoint] = 0;
+    }
+    BOOST_CHECK_EQUAL(map.size(), result.size());
+    BOOST_CHECK(memusage::DynamicUsage(map) <= usage);
+    for (const auto& entry : map) {
+        BOOST_CHECK(result.count(entry.first));
+    }
+
+    map.clear();
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), 0U);
+
+    // Emplacing a key that is present never grows the table, even when the
+    // next insert would, so iterators held across it stay valid
+    const COutPoint first(InsecureRand256(), 0);
+    map.emplace(first, CCoinsCacheEntry());
+    for (uint32_t i = 1; i < 3000; i++) {
+        const size_t nBuckets = map.bucket_count();
+        CCoinsMap::iterator it = map.find(first);
+        BOOST_CHECK(!map.emplace(first, CCoinsCacheEntry()).second);
+        BOOST_CHECK_EQUAL(map.bucket_count(), nBuckets);
+        BOOST_CHECK(it == map.find(first));
+        map.emplace(COutPoint(InsecureRand256(), i), CCoinsCacheEntry());
+    }
+    BOOST_CHECK_EQUAL(map.size(), 3000U);
+}
+
+BOOST_FIXTURE_TEST_CASE(ccoins_background_flush, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewBackgroundFlush flush(&db);
+    const uint256 hashBlock = InsecureRand256();
+    const COutPoint outpoint(InsecureRand256(), 0);
+    const CTxOut txout(7, CScript() << OP_TRUE);
+
+    {
+        CCoinsViewCache cache(&flush);
+        cache.AddCoin(outpoint, Coin(txout, 1, false), false);
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+    // The write may still be pending, but the view reflects it either way
+    BOOST_CHECK(flush.GetBestBlock() == hashBlock);
+    BOOST_CHECK(flush.HaveCoin(outpoint));
+    BOOST_CHECK(flush.Sync());
+    BOOST_CHECK_EQUAL(flush.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    Coin coin;
+    BOOST_CHECK(db.GetCoin(outpoint, coin));
+    BOOST_CHECK(coin.out == txout);
+
+    // Spends are written as erasures
+    const uint256 hashBlock2 = InsecureRand256();
+    {
+        CCoinsViewCache cache(&flush);
+        BOOST_CHECK(cache.SpendCoin(outpoint));
+        cache.SetBestBlock(hashBlock2);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!flush.HaveCoin(outpoint));
+    BOOST_CHECK(flush.Sync());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock2);
+    BOOST_CHECK(!db.HaveCoin(outpoint));
+
+    // Entries leave the map batch by batch, and the view stays complete
+    gArgs.ForceSetArg("-dbbatchsize", "1000");
+    const uint256 hashBlock3 = InsecureRand256();
+    std::vector<COutPoint> outpoints;
+    {
+        CCoinsViewCache cache(&flush);
+        for (int i = 0; i < 1000; i++) {
+            outpoints.emplace_back(InsecureRand256(), i);
+            cache.AddCoin(outpoints.back(), Coin(txout, 1, false), false);
+        }
+        cache.SetBestBlock(hashBlock3);
+        BOOST_CHECK(cache.Flush());
+    }
+    for (const COutPoint& op : outpoints)
+        BOOST_CHECK(flush.HaveCoin(op));
+    BOOST_CHECK(flush.Sync());
+    gArgs.ForceSetArg("-dbbatchsize", std::to_string(nDefaultDbBatchSize));
+    BOOST_CHECK_EQUAL(flush.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(db.GetBestBlock() == hashBlock3);
+    for (const COutPoint& op : outpoints)
+        BOOST_CHECK(db.HaveCoin(op));
+}
+
+BOOST_FIXTURE_TEST_CASE(ccoins_utxo_stats, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    uint256 hashBlock;
+    {
+        LOCK(cs_main);
+        hashBlock = chainActive.Tip()->GetBlockHash();
+    }
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 1000; i++) {
+            const uint256 txid = InsecureRand256();
+            const int nOutputs = 1 + InsecureRandRange(3);
+            for (int n = 0; n < nOutputs; n++) {
+                CTxOut txout(InsecureRandRange(1000000), CScript() << ToByteVector(InsecureRand256()) << OP_CHECKSIG);
+                cache.AddCoin(COutPoint(txid, n), Coin(txout, 1 + InsecureRandRange(100), InsecureRandBool()), false);
+            }
+        }
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // Single pass over the database, as the sharded scan must reproduce
+    CCoinsStats statsExpected;
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << hashBlock;
+    std::unique_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_CHECK(pcursor->GetKey(key) && pcursor->GetValue(coin));
+        if (!outputs.empty() && key.hash != prevkey) {
+            ApplyStats(statsExpected, ss, prevkey, outputs);
+            outputs.clear();
+        }
+        prevkey = key.hash;
+        outputs[key.n] = std::move(coin);
+    }
+    ApplyStats(statsExpected, ss, prevkey, outputs);
+
+    CCoinsStats stats;
+    BOOST_CHECK(GetUTXOStats(&db, stats));
+    BOOST_CHECK(stats.hashBlock == hashBlock);
+    BOOST_CHECK(stats.hashSerialized == ss.GetHash());
+    BOOST_CHECK_EQUAL(stats.nTransactions, 1000U);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, statsExpected.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(stats.nBogoSize, statsExpected.nBogoSize);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, statsExpected.nTotalAmount);
+
+    CCoinsStats statsNoHash;
+    BOOST_CHECK(GetUTXOStats(&db, statsNoHash, false));
+    BOOST_CHECK(statsNoHash.hashSerialized.IsNull());
+    BOOST_CHECK_EQUAL(statsNoHash.nTransactionOutputs, stats.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(statsNoHash.nTotalAmount, stats.nTotalAmount);
+
+    // Totals kept from a background scan and block deltas
+    CCoinsStatsTracker tracker;
+    BOOST_CHECK(tracker.Start(&db));
+    CCoinsStats statsTracked;
+    while (!tracker.Get(statsTracked)) {
+        MilliSleep(10);
+    }
+    BOOST_CHECK_EQUAL(statsTracked.nTransactionOutputs, stats.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(statsTracked.nBogoSize, stats.nBogoSize);
+    BOOST_CHECK_EQUAL(statsTracked.nTotalAmount, stats.nTotalAmount);
+
+    CCoinsStatsDelta delta;
+    const CTxOut txout(5000, CScript() << OP_TRUE);
+    delta.AddCoin(txout);
+    delta.AddCoin(txout);
+    delta.SpendCoin(txout);
+    {
+        LOCK(cs_main);
+        tracker.Apply(delta, chainActive.Tip());
+    }
+    BOOST_CHECK(tracker.Get(statsTracked));
+    BOOST_CHECK_EQUAL(statsTracked.nTransactionOutputs, stats.nTransactionOutputs + 1);
+    BOOST_CHECK_EQUAL(statsTracked.nBogoSize, stats.nBogoSize + GetBogoSize(txout.scriptPubKey));
+    BOOST_CHECK_EQUAL(statsTracked.nTotalAmount, stats.nTotalAmount + 5000);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
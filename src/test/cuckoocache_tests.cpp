@@ -377,4 +377,61 @@ BOOST_AUTO_TEST_CASE(cuckoocache_generations)
     test_cache_generations<CuckooCache::cache<uint256, SignatureCacheHasher>>();
 }
 
+/* Test that resizing keeps the entries that were not erased, as many as fit,
+ * and that insert reports the entries it drops.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_resize)
+{
+    local_rand_ctx = FastRandomContext(true);
+    CuckooCache::cache<uint256, SignatureCacheHasher> cc{};
+    const uint32_t size = cc.setup(1 << 14);
+    std::vector<uint256> hashes(size / 2);
+    for (uint256& h : hashes) {
+        insecure_GetRandHash(h);
+        BOOST_CHECK(!cc.insert(h));
+    }
+
+    BOOST_CHECK_EQUAL(cc.resize(4 * size), 4 * size);
+    for (const uint256& h : hashes)
+        BOOST_CHECK(cc.contains(h, false));
+
+    BOOST_CHECK(cc.contains(hashes[0], true));
+    cc.resize(2 * size);
+    BOOST_CHECK(!cc.contains(hashes[0], false));
+    for (size_t i = 1; i < hashes.size(); ++i)
+        BOOST_CHECK(cc.contains(hashes[i], false));
+
+    BOOST_CHECK_EQUAL(cc.resize(size / 4), size / 4);
+    size_t kept = 0;
+    for (const uint256& h : hashes)
+        kept += cc.contains(h, false);
+    BOOST_CHECK(kept <= size / 4);
+    BOOST_CHECK(kept > size / 8);
+
+    // Inserting more than fit has to let go of some
+    size_t evicted = 0;
+    uint256 v;
+    for (uint32_t i = 0; i < size; ++i) {
+        insecure_GetRandHash(v);
+        evicted += cc.insert(v);
+    }
+    BOOST_CHECK(evicted > 0);
+}
+
+/* Test that overwriting entries that were erased through contains() is not
+ * reported as an eviction, however many times the table turns over.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_erased_not_evicted)
+{
+    local_rand_ctx = FastRandomContext(true);
+    CuckooCache::cache<uint256, SignatureCacheHasher> cc{};
+    const uint32_t size = cc.setup(1 << 12);
+    uint256 h;
+    for (uint32_t i = 0; i < 8 * size; ++i) {
+        insecure_GetRandHash(h);
+        BOOST_CHECK(!cc.insert(h));
+        BOOST_CHECK(cc.contains(h, true));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -40,6 +40,47 @@ BOOST_AUTO_TEST_CASE(dbwrapper)
     }
 }
 
+// Test tuning options and statistics
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    fs::path ph = fs::temp_directory_path() / fs::unique_path();
+    CDBOptions dbopts;
+    dbopts.nBloomBits = 0;
+    dbopts.nBlockSize = 1024;
+    dbopts.nWriteBufferSize = 1 << 16;
+    CDBWrapper dbw(ph, (1 << 20), true, false, false, dbopts);
+    BOOST_CHECK_EQUAL(dbw.GetDBOptions().nBloomBits, 0);
+    BOOST_CHECK_EQUAL(dbw.GetDBOptions().nBlockSize, 1024U);
+    BOOST_CHECK_EQUAL(dbw.GetDBOptions().nWriteBufferSize, 1U << 16);
+    BOOST_CHECK_EQUAL(dbw.GetBlockCacheSize(), 1U << 19);
+
+    // Without a set size, the write buffer is a quarter of the cache
+    CDBWrapper dbwDefault(ph, (1 << 20), true, false, false);
+    BOOST_CHECK_EQUAL(dbwDefault.GetDBOptions().nWriteBufferSize, 1U << 18);
+
+    for (int i = 0; i < 1000; i++) {
+        BOOST_CHECK(dbw.Write(std::make_pair('k', i), InsecureRand256()));
+    }
+    // Move everything from the write buffer into table files, read through the block cache
+    dbw.CompactRange(std::make_pair('k', 0), std::make_pair('k', 1000));
+    uint256 res;
+    BOOST_CHECK(dbw.Read(std::make_pair('k', 10), res));
+    BOOST_CHECK(dbw.Read(std::make_pair('k', 10), res));
+    uint64_t nHits, nMisses;
+    size_t nUsage;
+    dbw.GetBlockCacheStats(nHits, nMisses, nUsage);
+    // Both reads look in the block cache; what is stored in it depends on
+    // whether the environment maps table files into memory
+    BOOST_CHECK(nHits + nMisses >= 2);
+    BOOST_CHECK(nMisses >= 1);
+    BOOST_CHECK(nUsage <= dbw.GetBlockCacheSize());
+
+    std::string value;
+    BOOST_CHECK(dbw.GetProperty("leveldb.stats", value));
+    BOOST_CHECK(dbw.GetProperty("leveldb.num-files-at-level0", value));
+    BOOST_CHECK(!dbw.GetProperty("leveldb.nonexistent", value));
+}
+
 // Test batch operations
 BOOST_AUTO_TEST_CASE(dbwrapper_batch)
 {
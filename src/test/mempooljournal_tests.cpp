@@ -0,0 +1,102 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <mempooljournal.h>
+#include <random.h>
+#include <txmempool.h>
+#include <util.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mempooljournal_tests, TestingSetup)
+
+static CTransactionRef MakeTx()
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1000;
+    return MakeTransactionRef(std::move(mtx));
+}
+
+BOOST_AUTO_TEST_CASE(mempooljournal_replay)
+{
+    CTxMemPool pool;
+    CMempoolJournal journal;
+    TestMemPoolEntryHelper entry;
+    const fs::path path = GetDataDir() / "mempool.journal";
+    const uint256 nonce = InsecureRand256();
+    const CMempoolScriptFlags flags(1, 2);
+
+    {
+        LOCK(pool.cs);
+        journal.Restart(pool, flags, std::map<uint256, CAmount>());
+    }
+    BOOST_CHECK(journal.Open(path, nonce, 0));
+
+    CTransactionRef tx1 = MakeTx(), tx2 = MakeTx(), tx3 = MakeTx(), tx4 = MakeTx();
+    pool.addUnchecked(tx1->GetHash(), entry.FromTx(*tx1));
+    pool.addUnchecked(tx2->GetHash(), entry.FromTx(*tx2));
+    pool.addUnchecked(tx3->GetHash(), entry.FromTx(*tx3));
+    pool.removeRecursive(*tx2);
+    std::map<uint256, CAmount> mapDeltas;
+    mapDeltas[tx1->GetHash()] = 100;
+    journal.Checkpoint(flags, mapDeltas);
+    BOOST_CHECK(journal.Write());
+
+    // Added after the last checkpoint, so not known to be checked under flags
+    pool.addUnchecked(tx4->GetHash(), entry.FromTx(*tx4));
+    BOOST_CHECK(journal.Write());
+
+    CMempoolReplay replay;
+    BOOST_CHECK(ReadMempoolJournal(path, nonce, replay));
+    const std::list<CMempoolReplay::Entry>& entries = replay.GetEntries();
+    BOOST_REQUIRE_EQUAL(entries.size(), 3U);
+    auto it = entries.begin();
+    BOOST_CHECK(it->tx->GetHash() == tx1->GetHash());
+    BOOST_CHECK(it->flags == flags);
+    ++it;
+    BOOST_CHECK(it->tx->GetHash() == tx3->GetHash());
+    BOOST_CHECK(it->flags == flags);
+    ++it;
+    BOOST_CHECK(it->tx->GetHash() == tx4->GetHash());
+    BOOST_CHECK(it->flags.IsNull());
+    BOOST_CHECK(replay.mapDeltas == mapDeltas);
+
+    // The journal of another snapshot isn't replayed
+    CMempoolReplay replayOther;
+    BOOST_CHECK(!ReadMempoolJournal(path, InsecureRand256(), replayOther));
+    BOOST_CHECK(replayOther.GetEntries().empty());
+
+    // Once the flags change, what the transactions were checked under is unknown
+    const CMempoolScriptFlags flagsNew(1, 3);
+    BOOST_CHECK(journal.GetFlags(flags) == flags);
+    CTransactionRef tx5 = MakeTx();
+    pool.addUnchecked(tx5->GetHash(), entry.FromTx(*tx5));
+    journal.Checkpoint(flagsNew, mapDeltas);
+    BOOST_CHECK(journal.GetFlags(flagsNew).IsNull());
+    BOOST_CHECK(journal.Write());
+
+    // A batch torn by a crash is ignored
+    {
+        CAutoFile file(fsbridge::fopen(path, "ab"), SER_DISK, CLIENT_VERSION);
+        file << (uint32_t)1000 << uint256();
+    }
+
+    CMempoolReplay replayChanged;
+    BOOST_CHECK(ReadMempoolJournal(path, nonce, replayChanged));
+    BOOST_REQUIRE_EQUAL(replayChanged.GetEntries().size(), 4U);
+    BOOST_CHECK(replayChanged.GetEntries().front().flags == flags);
+    BOOST_CHECK(replayChanged.GetEntries().back().tx->GetHash() == tx5->GetHash());
+    BOOST_CHECK(replayChanged.GetEntries().back().flags.IsNull());
+
+    journal.Stop();
+    BOOST_CHECK(!journal.IsRecording());
+    BOOST_CHECK(!journal.Write());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
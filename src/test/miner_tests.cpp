@@ -13,6 +13,7 @@
 #include <policy/policy.h>
 #include <pubkey.h>
 #include <script/standard.h>
+#include <timedata.h>
 #include <txmempool.h>
 #include <uint256.h>
 #include <util.h>
@@ -520,4 +521,91 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+// Templates on the same tip start from the previous selection
+BOOST_AUTO_TEST_CASE(CreateNewBlock_template_cache)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const CChainParams& chainparams = *chainParams;
+    const CScript scriptPubKey = CScript() << OP_TRUE;
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    TestMemPoolEntryHelper entry;
+    const int64_t nTime = GetAdjustedTime() - 60;
+
+    std::vector<COutPoint> vPrevout;
+    {
+        LOCK(cs_main);
+        for (int i = 0; i < 3; i++) {
+            vPrevout.emplace_back(InsecureRand256(), 0);
+            pcoinsTip->AddCoin(vPrevout.back(), Coin(CTxOut(50 * COIN, scriptPubKey), 1, false), false);
+        }
+    }
+    auto spend = [&](const COutPoint& prevout, CAmount nValueIn, CAmount nFee, int64_t nTimeTx) {
+        CMutableTransaction tx;
+        tx.nTime = nTimeTx;
+        tx.vin.emplace_back(prevout);
+        tx.vout.emplace_back(nValueIn - nFee, scriptPubKey);
+        return tx;
+    };
+    auto contains = [&](const uint256& hash) {
+        for (const CTransactionRef& tx : pblocktemplate->block.vtx) {
+            if (tx->GetHash() == hash)
+                return true;
+        }
+        return false;
+    };
+
+    CMutableTransaction txParent = spend(vPrevout[0], 50 * COIN, 10000, nTime);
+    mempool.addUnchecked(txParent.GetHash(), entry.Fee(10000).Time(nTime).FromTx(txParent));
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+    BOOST_CHECK(contains(txParent.GetHash()));
+
+    // A child of a selected transaction joins the selection...
+    CMutableTransaction txChild = spend(COutPoint(txParent.GetHash(), 0), txParent.vout[0].nValue, 10000, nTime);
+    mempool.addUnchecked(txChild.GetHash(), entry.Fee(10000).Time(nTime).FromTx(txChild));
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == txChild.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -20000);
+
+    // ...and leaves it with its parent
+    mempool.removeRecursive(txParent);
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], 0);
+
+    // A free parent is selected for its paying child, and left out again
+    // once that child is gone
+    CMutableTransaction txFree = spend(vPrevout[1], 50 * COIN, 0, nTime);
+    mempool.addUnchecked(txFree.GetHash(), entry.Fee(0).Time(nTime).FromTx(txFree));
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    CMutableTransaction txPaying = spend(COutPoint(txFree.GetHash(), 0), txFree.vout[0].nValue, 50000, nTime);
+    mempool.addUnchecked(txPaying.GetHash(), entry.Fee(50000).Time(nTime).FromTx(txPaying));
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+    BOOST_CHECK(contains(txFree.GetHash()));
+    BOOST_CHECK(contains(txPaying.GetHash()));
+    mempool.removeRecursive(txPaying);
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK(!contains(txFree.GetHash()));
+
+    // A transaction from the future waits for the block time to reach it
+    const int64_t nTimeFuture = GetAdjustedTime() + 600;
+    CMutableTransaction txFuture = spend(vPrevout[2], 50 * COIN, 10000, nTimeFuture);
+    mempool.addUnchecked(txFuture.GetHash(), entry.Fee(10000).Time(nTime).FromTx(txFuture));
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(!contains(txFuture.GetHash()));
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(!contains(txFuture.GetHash()));
+    SetMockTime(nTimeFuture);
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(contains(txFuture.GetHash()));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+
+    SetMockTime(0);
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -13,6 +13,9 @@
 #include <chainparams.h>
 #include <util.h>
 
+#include <atomic>
+#include <thread>
+
 class CAddrManSerializationMock : public CAddrMan
 {
 public:
@@ -185,4 +188,180 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(dial_stats)
+{
+    CDialStats stats;
+    CService fast, slow, dead, unknown;
+    Lookup("250.8.1.1", fast, 17570, false);
+    Lookup("250.8.2.2", slow, 17570, false);
+    Lookup("250.8.3.3", dead, 17570, false);
+    Lookup("250.8.4.4", unknown, 17570, false);
+
+    stats.RecordSuccess(fast, 900);
+    stats.RecordSuccess(fast, 1300);
+    stats.RecordSuccess(slow, DIAL_SLOW_LATENCY * 2);
+    for (int i = 0; i < 3; i++)
+        stats.RecordFailure(dead);
+    BOOST_CHECK_EQUAL(stats.Size(), 3U);
+
+    CDialStats::Entry entry;
+    BOOST_CHECK(stats.Get(fast, entry));
+    BOOST_CHECK_EQUAL(entry.nSuccesses, 2);
+    BOOST_CHECK_EQUAL(entry.nAvgLatency, 1000);
+    BOOST_CHECK(!stats.Get(unknown, entry));
+
+    BOOST_CHECK(!stats.IsSlow(fast));
+    BOOST_CHECK(stats.IsSlow(slow));
+    BOOST_CHECK(stats.IsSlow(dead));
+    BOOST_CHECK(!stats.IsSlow(unknown));
+
+    // Recovering addresses are tried early again
+    for (int i = 0; i < 4; i++)
+        stats.RecordSuccess(dead, 500);
+    BOOST_CHECK(!stats.IsSlow(dead));
+
+    stats.Clear();
+    BOOST_CHECK_EQUAL(stats.Size(), 0U);
+}
+
+/** Minimal SOCKS5 server on the loopback interface that answers every CONNECT with success after a delay. */
+class Socks5StandIn
+{
+public:
+    explicit Socks5StandIn(int nDelayMillis) : nDelay(nDelayMillis), nActive(0), nMaxActive(0)
+    {
+        hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        struct sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        sin.sin_port = 0;
+        BOOST_REQUIRE(bind(hListen, (struct sockaddr*)&sin, sizeof(sin)) == 0);
+        BOOST_REQUIRE(listen(hListen, 16) == 0);
+        socklen_t len = sizeof(sin);
+        BOOST_REQUIRE(getsockname(hListen, (struct sockaddr*)&sin, &len) == 0);
+        addr = CService(CNetAddr(sin.sin_addr), ntohs(sin.sin_port));
+    }
+
+    ~Socks5StandIn()
+    {
+        for (std::thread& t : threads)
+            t.join();
+        CloseSocket(hListen);
+    }
+
+    void Serve(int nConnections)
+    {
+        threads.emplace_back([this, nConnections] {
+            std::vector<std::thread> handlers;
+            for (int i = 0; i < nConnections; i++) {
+                SOCKET hSocket = accept(hListen, nullptr, nullptr);
+                if (hSocket == INVALID_SOCKET)
+                    break;
+                handlers.emplace_back([this, hSocket] { Handle(hSocket); });
+            }
+            for (std::thread& t : handlers)
+                t.join();
+        });
+    }
+
+    CService addr;
+    int nDelay;
+    std::atomic<int> nActive;
+    std::atomic<int> nMaxActive;
+
+private:
+    static bool RecvAll(SOCKET hSocket, uint8_t* data, size_t len)
+    {
+        while (len > 0) {
+            ssize_t ret = recv(hSocket, (char*)data, len, 0);
+            if (ret <= 0)
+                return false;
+            data += ret;
+            len -= ret;
+        }
+        return true;
+    }
+
+    void Handle(SOCKET hSocket)
+    {
+        uint8_t buf[262];
+        if (RecvAll(hSocket, buf, 2) && RecvAll(hSocket, buf + 2, buf[1])) {
+            const uint8_t method[2] = {0x05, 0x00};
+            send(hSocket, (const char*)method, sizeof(method), MSG_NOSIGNAL);
+            // VER CMD RSV ATYP=DOMAINNAME LEN
+            if (RecvAll(hSocket, buf, 5) && RecvAll(hSocket, buf + 5, buf[4] + 2)) {
+                int nNow = ++nActive;
+                int nPrev = nMaxActive;
+                while (nNow > nPrev && !nMaxActive.compare_exchange_weak(nPrev, nNow)) {}
+                MilliSleep(nDelay);
+                --nActive;
+                const uint8_t reply[10] = {0x05, 0x00, 0x00, 0x01, 127, 0, 0, 1, 0x44, 0xa2};
+                send(hSocket, (const char*)reply, sizeof(reply), MSG_NOSIGNAL);
+            }
+        }
+        CloseSocket(hSocket);
+    }
+
+    SOCKET hListen;
+    std::vector<std::thread> threads;
+};
+
+/** Accepts every connection without processing any messages */
+class NetEventsStandIn : public NetEventsInterface
+{
+public:
+    bool ProcessMessages(CNode* pnode, std::atomic<bool>& interrupt) override { return false; }
+    bool SendMessages(CNode* pnode, std::atomic<bool>& interrupt) override { return true; }
+    void InitializeNode(CNode* pnode) override {}
+    void FinalizeNode(NodeId id, bool& update_connection_time) override {}
+};
+
+BOOST_AUTO_TEST_CASE(socks5_parallel_dials)
+{
+    // Left set by any CConnman stopped before
+    InterruptSocks5(false);
+
+    const int nDials = 4;
+    Socks5StandIn standin(300);
+    standin.Serve(nDials);
+    BOOST_REQUIRE(SetProxy(NET_TOR, proxyType(standin.addr)));
+
+    NetEventsStandIn msgproc;
+    std::vector<CAddress> vAddr;
+    {
+        CConnman connman(0x1337, 0x1337);
+        CConnman::Options options;
+        options.nMaxParallelDials = nDials;
+        options.m_msgproc = &msgproc;
+        connman.Init(options);
+        CConnmanTest::StartDialers(connman);
+
+        for (int i = 0; i < nDials; i++) {
+            CService addr;
+            BOOST_REQUIRE(Lookup(strprintf("%s%c.onion", std::string(15, 'a'), 'a' + i).c_str(), addr, 17570, false));
+            BOOST_REQUIRE(addr.IsTor());
+            vAddr.emplace_back(addr, NODE_NONE);
+            CConnmanTest::QueueDial(connman, vAddr.back());
+        }
+        for (int i = 0; i < 100 && CConnmanTest::DialsInFlight(connman) > 0; i++)
+            MilliSleep(50);
+        BOOST_CHECK_EQUAL(CConnmanTest::DialsInFlight(connman), 0);
+        BOOST_CHECK_EQUAL(connman.GetNodeCount(CConnman::CONNECTIONS_OUT), (size_t)nDials);
+
+        // Every dial went through the proxy and had its latency recorded
+        for (const CAddress& addr : vAddr) {
+            CDialStats::Entry entry;
+            BOOST_REQUIRE(CConnmanTest::GetDialStats(connman).Get(addr, entry));
+            BOOST_CHECK_EQUAL(entry.nSuccesses, 1);
+            BOOST_CHECK_EQUAL(entry.nFailures, 0);
+            BOOST_CHECK(entry.nAvgLatency >= 250);
+        }
+    }
+    InterruptSocks5(false);
+
+    // The handshakes overlapped rather than running one after another
+    BOOST_CHECK(standin.nMaxActive > 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include <policy/policy.h>
 #include <policy/fees.h>
+#include <streams.h>
 #include <txmempool.h>
 #include <uint256.h>
 #include <util.h>
@@ -179,4 +180,83 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(SmartFeeEstimatesAndPersistence, TestingSetup)
+{
+    CBlockPolicyEstimator feeEst;
+    CTxMemPool mpool(&feeEst);
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 0LL;
+
+    // No estimates before any block is seen
+    FeeCalculation feeCalc;
+    BOOST_CHECK(feeEst.estimateSmartFee(2, &feeCalc, false) == CFeeRate(0));
+    BOOST_CHECK_EQUAL(feeCalc.returnedTarget, 0);
+
+    // Mine every transaction in the block after it is seen, the higher fee
+    // ones first, so that lower fees take longer to confirm
+    std::vector<uint256> txHashes;
+    std::vector<CTransactionRef> block;
+    int blocknum = 0;
+    while (blocknum < 100) {
+        for (int j = 0; j < 10; j++) {
+            tx.vin[0].prevout.n = 100 * blocknum + j;
+            mpool.addUnchecked(tx.GetHash(), entry.Fee(1000 * (j + 1)).Time(GetTime()).Height(blocknum).FromTx(tx));
+            txHashes.push_back(tx.GetHash());
+        }
+        for (auto it = txHashes.begin(); it != txHashes.end(); ) {
+            CTransactionRef ptx = mpool.get(*it);
+            if (ptx && mpool.size() - block.size() > 5 * (blocknum % 2)) {
+                block.push_back(ptx);
+                it = txHashes.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        mpool.removeForBlock(block, ++blocknum);
+        block.clear();
+    }
+    for (const uint256& hash : txHashes) {
+        block.push_back(mpool.get(hash));
+    }
+    mpool.removeForBlock(block, ++blocknum);
+    BOOST_CHECK_EQUAL(mpool.size(), 0U);
+
+    // Estimates are given up to half of the blocks seen, and don't increase with the target
+    CFeeRate prevFeeRate = feeEst.estimateSmartFee(2, &feeCalc, false);
+    BOOST_CHECK(prevFeeRate > CFeeRate(0));
+    BOOST_CHECK_EQUAL(feeEst.estimateSmartFee(1000, &feeCalc, false).GetFeePerK(), feeEst.estimateSmartFee(blocknum / 2, nullptr, false).GetFeePerK());
+    BOOST_CHECK_EQUAL(feeCalc.desiredTarget, 1000);
+    BOOST_CHECK_EQUAL(feeCalc.returnedTarget, blocknum / 2);
+    for (int i = 3; i <= blocknum / 2; i++) {
+        CFeeRate feeRate = feeEst.estimateSmartFee(i, nullptr, false);
+        BOOST_CHECK(feeRate <= prevFeeRate);
+        BOOST_CHECK(feeRate <= feeEst.estimateSmartFee(i, nullptr, true));
+        prevFeeRate = feeRate;
+    }
+
+    // The moving averages are written as they are, however they are kept
+    const fs::path path = GetDataDir() / "fee_estimates.dat";
+    {
+        CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(feeEst.Write(file));
+    }
+    CBlockPolicyEstimator feeEstRead;
+    {
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(feeEstRead.Read(file));
+    }
+    for (int i = 1; i <= blocknum / 2; i++) {
+        BOOST_CHECK(feeEstRead.estimateFee(i) == feeEst.estimateFee(i));
+        FeeCalculation feeCalcRead;
+        BOOST_CHECK(feeEstRead.estimateSmartFee(i, &feeCalcRead, false) == feeEst.estimateSmartFee(i, &feeCalc, false));
+        BOOST_CHECK(feeCalcRead.reason == feeCalc.reason);
+        BOOST_CHECK(feeEstRead.estimateSmartFee(i, nullptr, true) == feeEst.estimateSmartFee(i, nullptr, true));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1462,6 +1462,81 @@ BOOST_AUTO_TEST_CASE(script_HasValidOps)
     BOOST_CHECK(!script.HasValidOps());
 }
 
+typedef std::vector<unsigned char> valtype;
+
+static ScriptError VerifySpend(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness& witness, unsigned int flags)
+{
+    const CMutableTransaction txCredit = BuildCreditingTransaction(scriptPubKey);
+    const CMutableTransaction txSpend = BuildSpendingTransaction(scriptSig, witness, txCredit);
+    ScriptError err;
+    bool success = VerifyScript(scriptSig, scriptPubKey, &witness, flags, MutableTransactionSignatureChecker(&txSpend, 0, txCredit.vout[0].nValue), &err);
+    BOOST_CHECK_EQUAL(success, err == SCRIPT_ERR_OK);
+    return err;
+}
+
+BOOST_AUTO_TEST_CASE(script_pay_to_pubkey)
+{
+    // VerifyScript checks P2PKH and P2PK spends against their template rather
+    // than running the scripts; the outcome must be the same
+    const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_LOW_S;
+    const unsigned int standardFlags = flags | SCRIPT_VERIFY_MINIMALDATA | SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK | SCRIPT_VERIFY_NULLFAIL;
+    const CScriptWitness noWitness;
+    CScriptWitness witness;
+    witness.stack.push_back(valtype(1, 1));
+
+    for (bool fCompressed : {true, false}) {
+        CKey key, otherKey;
+        key.MakeNewKey(fCompressed);
+        otherKey.MakeNewKey(fCompressed);
+        const CPubKey pubkey = key.GetPubKey();
+        const CScript p2pkh = CScript() << OP_DUP << OP_HASH160 << ToByteVector(pubkey.GetID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+        const CScript p2pk = CScript() << ToByteVector(pubkey) << OP_CHECKSIG;
+
+        for (const CScript& scriptPubKey : {p2pkh, p2pk}) {
+            const bool fPayToPubKeyHash = scriptPubKey == p2pkh;
+            const CMutableTransaction txSpend = BuildSpendingTransaction(CScript(), noWitness, BuildCreditingTransaction(scriptPubKey));
+            const uint256 hash = SignatureHash(scriptPubKey, txSpend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+            valtype vchSig, vchOtherSig;
+            BOOST_CHECK(key.Sign(hash, vchSig));
+            BOOST_CHECK(otherKey.Sign(hash, vchOtherSig));
+            vchSig.push_back(SIGHASH_ALL);
+            vchOtherSig.push_back(SIGHASH_ALL);
+            valtype vchBadSig = vchSig;
+            vchBadSig[10] ^= 1; // in R
+            valtype vchBadHashType = vchSig;
+            vchBadHashType.back() = 0x84;
+            auto ScriptSig = [&](const valtype& sig) {
+                return fPayToPubKeyHash ? CScript() << sig << ToByteVector(pubkey) : CScript() << sig;
+            };
+
+            BOOST_CHECK_EQUAL(VerifySpend(ScriptSig(vchSig), scriptPubKey, noWitness, flags), SCRIPT_ERR_OK);
+            BOOST_CHECK_EQUAL(VerifySpend(ScriptSig(vchSig), scriptPubKey, noWitness, standardFlags), SCRIPT_ERR_OK);
+            BOOST_CHECK_EQUAL(VerifySpend(ScriptSig(vchOtherSig), scriptPubKey, noWitness, flags), SCRIPT_ERR_EVAL_FALSE);
+            BOOST_CHECK_EQUAL(VerifySpend(ScriptSig(vchBadSig), scriptPubKey, noWitness, flags), SCRIPT_ERR_EVAL_FALSE);
+            BOOST_CHECK_EQUAL(VerifySpend(ScriptSig(vchBadSig), scriptPubKey, noWitness, standardFlags), SCRIPT_ERR_SIG_NULLFAIL);
+            BOOST_CHECK_EQUAL(VerifySpend(ScriptSig(vchBadHashType), scriptPubKey, noWitness, flags), SCRIPT_ERR_SIG_HASHTYPE);
+            BOOST_CHECK_EQUAL(VerifySpend(ScriptSig(valtype()), scriptPubKey, noWitness, flags), SCRIPT_ERR_EVAL_FALSE);
+            BOOST_CHECK_EQUAL(VerifySpend(ScriptSig(vchSig), scriptPubKey, witness, flags), SCRIPT_ERR_OK);
+            BOOST_CHECK_EQUAL(VerifySpend(ScriptSig(vchSig), scriptPubKey, witness, standardFlags), SCRIPT_ERR_WITNESS_UNEXPECTED);
+            BOOST_CHECK_EQUAL(VerifySpend((CScript() << OP_1) + ScriptSig(vchSig), scriptPubKey, noWitness, flags), SCRIPT_ERR_OK);
+            BOOST_CHECK_EQUAL(VerifySpend((CScript() << OP_1) + ScriptSig(vchSig), scriptPubKey, noWitness, standardFlags), SCRIPT_ERR_CLEANSTACK);
+            BOOST_CHECK_EQUAL(VerifySpend((CScript() << OP_NOP) + ScriptSig(vchSig), scriptPubKey, noWitness, flags | SCRIPT_VERIFY_SIGPUSHONLY), SCRIPT_ERR_SIG_PUSHONLY);
+
+            // A signature pushed with OP_PUSHDATA1 is not a minimal push
+            CScript scriptSig = CScript() << OP_PUSHDATA1 << vchSig;
+            if (fPayToPubKeyHash)
+                scriptSig << ToByteVector(pubkey);
+            BOOST_CHECK_EQUAL(VerifySpend(scriptSig, scriptPubKey, noWitness, flags), SCRIPT_ERR_OK);
+            BOOST_CHECK_EQUAL(VerifySpend(scriptSig, scriptPubKey, noWitness, standardFlags), SCRIPT_ERR_MINIMALDATA);
+
+            if (fPayToPubKeyHash) {
+                BOOST_CHECK_EQUAL(VerifySpend(CScript() << vchSig << ToByteVector(otherKey.GetPubKey()), scriptPubKey, noWitness, flags), SCRIPT_ERR_EQUALVERIFY);
+                BOOST_CHECK_EQUAL(VerifySpend(CScript(), scriptPubKey, noWitness, flags), SCRIPT_ERR_INVALID_STACK_OPERATION);
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(script_can_append_self)
 {
     CScript s, d;
@@ -161,6 +161,35 @@ BOOST_AUTO_TEST_CASE(sighash_test)
     #endif
 }
 
+BOOST_AUTO_TEST_CASE(sighash_precomputed)
+{
+    SeedInsecureRand(false);
+
+    // The precomputed serialization must give the same hashes for every
+    // input, around and across the hash states it keeps
+    for (int i = 0; i < 20; i++) {
+        CMutableTransaction txTo;
+        RandomTransaction(txTo, false);
+        const CTxIn txinFirst = txTo.vin[0];
+        txTo.vin.resize(1 + InsecureRandRange(80), txinFirst);
+        for (CTxIn& txin : txTo.vin) {
+            txin.prevout.hash = InsecureRand256();
+        }
+        const CTransaction tx(txTo);
+        const PrecomputedTransactionData txdata(tx);
+
+        for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++) {
+            CScript scriptCode;
+            RandomScript(scriptCode);
+            for (int nHashType : {(int)SIGHASH_ALL, 0, (int)InsecureRand32(), SIGHASH_ALL | SIGHASH_ANYONECANPAY, (int)SIGHASH_NONE}) {
+                BOOST_CHECK(SignatureHash(scriptCode, tx, nIn, nHashType, 0, SIGVERSION_BASE, &txdata) ==
+                            SignatureHashOld(scriptCode, tx, nIn, nHashType));
+            }
+        }
+        BOOST_CHECK_EQUAL(txdata.GetLegacySighash(tx) == nullptr, tx.vin.size() == 1);
+    }
+}
+
 // Goal: check that SignatureHash generates correct hash
 BOOST_AUTO_TEST_CASE(sighash_from_data)
 {
@@ -0,0 +1,146 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <arith_uint256.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <key.h>
+#include <pos.h>
+#include <script/interpreter.h>
+#include <script/standard.h>
+#include <validation.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(stakecheck_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(stakecheck_assumevalid)
+{
+    // A chain whose first half is buried more than two weeks of work deep
+    const int nLength = 2 * 60 * 60 * 24 * 7 * 2 / Params().GetConsensus().nPowTargetSpacing;
+    const int nAssumeValid = nLength - 1000;
+    std::vector<uint256> vHash(nLength);
+    std::vector<CBlockIndex> vIndex(nLength);
+    for (int i = 0; i < nLength; i++) {
+        vHash[i] = ArithToUint256(arith_uint256(i + 1));
+        vIndex[i].phashBlock = &vHash[i];
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = i ? &vIndex[i - 1] : nullptr;
+        vIndex[i].nBits = 0x1e0fffff;
+        vIndex[i].nChainWork = (i ? vIndex[i - 1].nChainWork : arith_uint256()) + GetBlockProof(vIndex[i]);
+        vIndex[i].BuildSkip();
+    }
+
+    LOCK(cs_main);
+    CBlockIndex* pindexBestHeaderOld = pindexBestHeader;
+    const uint256 hashAssumeValidOld = hashAssumeValid;
+    const arith_uint256 nMinimumChainWorkOld = nMinimumChainWork;
+    const bool fAssumeValidStakeOld = fAssumeValidStake;
+    pindexBestHeader = &vIndex.back();
+    hashAssumeValid = vHash[nAssumeValid];
+    mapBlockIndex[hashAssumeValid] = &vIndex[nAssumeValid];
+    nMinimumChainWork = 0;
+    fAssumeValidStake = true;
+
+    // Skipped below the -assumevalid block
+    BOOST_CHECK(!ScriptChecksRequired(&vIndex[100], Params()));
+    BOOST_CHECK(!StakeChecksRequired(&vIndex[100], Params()));
+    BOOST_CHECK(!StakeChecksRequired(&vIndex[nLength / 2 - 100], Params()));
+
+    // but not when buried too shallow, or above it
+    BOOST_CHECK(ScriptChecksRequired(&vIndex[nAssumeValid], Params()));
+    BOOST_CHECK(StakeChecksRequired(&vIndex[nAssumeValid], Params()));
+    BOOST_CHECK(StakeChecksRequired(&vIndex[nAssumeValid + 1], Params()));
+    BOOST_CHECK(StakeChecksRequired(&vIndex.back(), Params()));
+
+    // -assumevalidstake=0 still checks the stake of blocks whose scripts are skipped
+    fAssumeValidStake = false;
+    BOOST_CHECK(!ScriptChecksRequired(&vIndex[100], Params()));
+    BOOST_CHECK(StakeChecksRequired(&vIndex[100], Params()));
+
+    // -assumevalid=0 checks everything
+    fAssumeValidStake = true;
+    hashAssumeValid.SetNull();
+    BOOST_CHECK(ScriptChecksRequired(&vIndex[100], Params()));
+    BOOST_CHECK(StakeChecksRequired(&vIndex[100], Params()));
+
+    mapBlockIndex.erase(vHash[nAssumeValid]);
+    pindexBestHeader = pindexBestHeaderOld;
+    hashAssumeValid = hashAssumeValidOld;
+    nMinimumChainWork = nMinimumChainWorkOld;
+    fAssumeValidStake = fAssumeValidStakeOld;
+}
+
+BOOST_AUTO_TEST_CASE(stakecheck_signature)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    const COutPoint prevout(InsecureRand256(), 0);
+    const Coin coinPrev(CTxOut(100 * COIN, scriptPubKey), 1, false);
+    {
+        LOCK(cs_main);
+        pcoinsTip->AddCoin(prevout, Coin(coinPrev), false);
+    }
+
+    // A PoS block extending the tip, its coinstake signed with hashSigned
+    auto stake = [&](const uint256& hashSigned) {
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vout.resize(1);
+        coinbase.vout[0] = CTxOut(0, CScript());
+        CMutableTransaction coinstake;
+        coinstake.nTime = GetTime() + InsecureRand32() % 1000;
+        coinstake.vin.emplace_back(prevout);
+        coinstake.vout.resize(2);
+        coinstake.vout[0] = CTxOut(0, CScript());
+        coinstake.vout[1] = CTxOut(101 * COIN, scriptPubKey);
+        const uint256 hash = hashSigned.IsNull() ? SignatureHash(scriptPubKey, coinstake, 0, SIGHASH_ALL, coinPrev.out.nValue, SIGVERSION_BASE) : hashSigned;
+        std::vector<unsigned char> vchSig;
+        BOOST_REQUIRE(key.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        coinstake.vin[0].scriptSig = CScript() << vchSig << ToByteVector(key.GetPubKey());
+        CBlock block;
+        block.hashPrevBlock = chainActive.Tip()->GetBlockHash();
+        block.vtx.push_back(MakeTransactionRef(std::move(coinbase)));
+        block.vtx.push_back(MakeTransactionRef(std::move(coinstake)));
+        BOOST_REQUIRE(block.IsProofOfStake());
+        return block;
+    };
+
+    // A bad signature is rejected, whether or not it was checked on arrival
+    const CBlock blockBad = stake(InsecureRand256());
+    BOOST_CHECK(!CheckCoinStakeSignature(*blockBad.vtx[1], coinPrev));
+    {
+        CStakeSignatureCheck stakecheck(blockBad);
+        BOOST_CHECK(stakecheck.IsQueued());
+    }
+    BOOST_CHECK(!CheckCoinStakeSignature(*blockBad.vtx[1], coinPrev));
+
+    // A good one is accepted either way
+    const CBlock blockGood = stake(uint256());
+    BOOST_CHECK(CheckCoinStakeSignature(*blockGood.vtx[1], coinPrev));
+    const CBlock blockQueued = stake(uint256());
+    {
+        CStakeSignatureCheck stakecheck(blockQueued);
+        BOOST_CHECK(stakecheck.IsQueued());
+    }
+    BOOST_CHECK(CheckCoinStakeSignature(*blockQueued.vtx[1], coinPrev));
+
+    // Nothing is queued for blocks not extending the tip
+    CBlock blockFork = stake(InsecureRand256());
+    blockFork.hashPrevBlock = InsecureRand256();
+    {
+        CStakeSignatureCheck stakecheck(blockFork);
+        BOOST_CHECK(!stakecheck.IsQueued());
+    }
+    BOOST_CHECK(!CheckCoinStakeSignature(*blockFork.vtx[1], coinPrev));
+
+    LOCK(cs_main);
+    pcoinsTip->SpendCoin(prevout);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
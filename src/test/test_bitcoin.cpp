@@ -31,6 +31,30 @@ void CConnmanTest::ClearNodes()
     g_connman->vNodes.clear();
 }
 
+void CConnmanTest::StartDialers(CConnman& connman)
+{
+    connman.interruptNet.reset(); // as Start() does
+    for (int i = 0; i < connman.nMaxParallelDials; i++)
+        connman.threadDialers.emplace_back(&CConnman::ThreadDial, &connman);
+}
+
+void CConnmanTest::QueueDial(CConnman& connman, const CAddress& addr)
+{
+    CSemaphoreGrant grant;
+    connman.QueueDial(addr, false, grant, false);
+}
+
+int CConnmanTest::DialsInFlight(CConnman& connman)
+{
+    std::lock_guard<std::mutex> lock(connman.mutexPendingDials);
+    return connman.nDialsInFlight;
+}
+
+const CDialStats& CConnmanTest::GetDialStats(const CConnman& connman)
+{
+    return connman.m_dial_stats;
+}
+
 uint256 insecure_rand_seed = GetRandHash();
 FastRandomContext insecure_rand_ctx(insecure_rand_seed);
 
@@ -48,11 +48,17 @@ struct BasicTestingSetup {
 /** Testing setup that configures a complete environment.
  * Included are data directory, coins database, script check threads setup.
  */
+class CAddress;
 class CConnman;
+class CDialStats;
 class CNode;
 struct CConnmanTest {
     static void AddNode(CNode& node);
     static void ClearNodes();
+    static void StartDialers(CConnman& connman);
+    static void QueueDial(CConnman& connman, const CAddress& addr);
+    static int DialsInFlight(CConnman& connman);
+    static const CDialStats& GetDialStats(const CConnman& connman);
 };
 
 class PeerLogicValidation;
@@ -196,4 +196,23 @@ BOOST_AUTO_TEST_CASE(util_ParseTorReplyMapping)
     CheckParseTorReplyMapping("EVEN+more ARGS", {});
 }
 
+BOOST_AUTO_TEST_CASE(util_ParseTorBootstrapLine)
+{
+    // Notices as the embedded Tor writes them to tor.log
+    BOOST_CHECK_EQUAL(ParseTorBootstrapLine("Oct 16 20:00:01.000 [notice] Bootstrapped 0%: Starting"), 0);
+    BOOST_CHECK_EQUAL(ParseTorBootstrapLine("Oct 16 20:00:02.000 [notice] Bootstrapped 45%: Asking for relay descriptors"), 45);
+    BOOST_CHECK_EQUAL(ParseTorBootstrapLine("Oct 16 20:00:03.000 [notice] Bootstrapped 100%: Done"), 100);
+    BOOST_CHECK_EQUAL(ParseTorBootstrapLine("Bootstrapped 80% (ap_conn): Connecting to a relay to build circuits"), 80);
+
+    // Other lines, and notices with no valid percentage
+    BOOST_CHECK_EQUAL(ParseTorBootstrapLine(""), -1);
+    BOOST_CHECK_EQUAL(ParseTorBootstrapLine("Oct 16 20:00:00.000 [notice] Tor 0.3.2.10 opening log file."), -1);
+    BOOST_CHECK_EQUAL(ParseTorBootstrapLine("Bootstrapped"), -1);
+    BOOST_CHECK_EQUAL(ParseTorBootstrapLine("Bootstrapped 50"), -1);
+    BOOST_CHECK_EQUAL(ParseTorBootstrapLine("Bootstrapped %: Done"), -1);
+    BOOST_CHECK_EQUAL(ParseTorBootstrapLine("Bootstrapped x%: Done"), -1);
+    BOOST_CHECK_EQUAL(ParseTorBootstrapLine("Bootstrapped -5%: Done"), -1);
+    BOOST_CHECK_EQUAL(ParseTorBootstrapLine("Bootstrapped 101%: Done"), -1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
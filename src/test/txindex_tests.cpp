@@ -0,0 +1,124 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <txdb.h>
+#include <uint256.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+//! A txid sharing its first 8 bytes, and so its index key, with txid
+uint256 SameKey(const uint256& txid)
+{
+    uint256 other = InsecureRand256();
+    memcpy(other.begin(), txid.begin(), 8);
+    return other;
+}
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(txindex_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(txindex_shared_keys)
+{
+    CBlockTreeDB db(1 << 20, true);
+    const uint256 txid1 = InsecureRand256();
+    const uint256 txid2 = SameKey(txid1);
+    const uint256 txid3 = InsecureRand256();
+    const CDiskTxPos pos1(CDiskBlockPos(1, 100), 10);
+    const CDiskTxPos pos2(CDiskBlockPos(1, 100), 250);
+    const CDiskTxPos pos3(CDiskBlockPos(2, 8), 0);
+
+    BOOST_CHECK(db.WriteTxIndex({{txid1, pos1}}));
+    BOOST_CHECK(db.WriteTxIndex({{txid2, pos2}, {txid3, pos3}}));
+    // Writing the same entry again does not duplicate it
+    BOOST_CHECK(db.WriteTxIndex({{txid1, pos1}}));
+
+    std::vector<CDiskTxPos> vpos;
+    BOOST_CHECK(db.ReadTxIndex(txid2, vpos));
+    BOOST_REQUIRE_EQUAL(vpos.size(), 2U);
+    BOOST_CHECK(vpos[0] == pos1);
+    BOOST_CHECK(vpos[1] == pos2);
+    BOOST_CHECK(db.ReadTxIndex(txid3, vpos));
+    BOOST_REQUIRE_EQUAL(vpos.size(), 1U);
+    BOOST_CHECK(vpos[0] == pos3);
+    BOOST_CHECK(!db.ReadTxIndex(InsecureRand256(), vpos));
+
+    std::map<uint256, std::vector<CDiskTxPos> > mapPos;
+    const uint256 txidMissing = InsecureRand256();
+    db.ReadTxIndex({txid3, txidMissing, txid1, txid2}, mapPos);
+    BOOST_CHECK_EQUAL(mapPos.size(), 3U);
+    BOOST_CHECK(mapPos.count(txid1) && mapPos.count(txid2) && mapPos.count(txid3));
+    BOOST_CHECK(!mapPos.count(txidMissing));
+    BOOST_CHECK_EQUAL(mapPos[txid1].size(), 2U);
+    BOOST_CHECK(mapPos[txid3][0] == pos3);
+}
+
+BOOST_AUTO_TEST_CASE(txindex_upgrade)
+{
+    CBlockTreeDB db(1 << 20, true);
+    const uint256 txid1 = InsecureRand256();
+    const uint256 txid2 = SameKey(txid1);
+    const uint256 txid3 = InsecureRand256();
+    const CDiskTxPos pos1(CDiskBlockPos(0, 8), 1);
+    const CDiskTxPos pos2(CDiskBlockPos(0, 8), 2);
+    const CDiskTxPos pos3(CDiskBlockPos(0, 8), 3);
+    // Entries keyed by full txid, as older versions wrote them
+    BOOST_CHECK(db.Write(std::make_pair('t', txid1), pos1));
+    BOOST_CHECK(db.Write(std::make_pair('t', txid2), pos2));
+    BOOST_CHECK(db.Write(std::make_pair('t', txid3), pos3));
+
+    BOOST_CHECK(db.UpgradeTxIndex());
+    BOOST_CHECK(!db.Exists(std::make_pair('t', txid1)));
+    BOOST_CHECK(!db.Exists(std::make_pair('t', txid3)));
+
+    // Newest first, whichever of the txids sorts first
+    std::vector<CDiskTxPos> vpos;
+    BOOST_CHECK(db.ReadTxIndex(txid1, vpos));
+    BOOST_REQUIRE_EQUAL(vpos.size(), 2U);
+    BOOST_CHECK(vpos[0] == pos2);
+    BOOST_CHECK(vpos[1] == pos1);
+    BOOST_CHECK(db.ReadTxIndex(txid3, vpos));
+    BOOST_REQUIRE_EQUAL(vpos.size(), 1U);
+    BOOST_CHECK(vpos[0] == pos3);
+
+    // Nothing left to do the second time
+    BOOST_CHECK(db.UpgradeTxIndex());
+    BOOST_CHECK(db.ReadTxIndex(txid1, vpos));
+    BOOST_CHECK_EQUAL(vpos.size(), 2U);
+
+    // Older releases refuse the database rather than miss transactions
+    bool fValue = true;
+    BOOST_CHECK(db.ReadFlag("txindex", fValue) && !fValue);
+    BOOST_CHECK(db.ReadFlag("txindexcompact", fValue) && fValue);
+}
+
+BOOST_AUTO_TEST_CASE(txindex_cache_size)
+{
+    const size_t nTxIndexCacheSize = 1 << 16;
+    CBlockTreeDB db(1 << 20, true, false, nTxIndexCacheSize);
+    std::vector<std::pair<uint256, CDiskTxPos> > vect;
+    for (int i = 0; i < 5000; i++)
+        vect.emplace_back(InsecureRand256(), CDiskTxPos(CDiskBlockPos(0, 8), i));
+    BOOST_CHECK(db.WriteTxIndex(vect));
+    BOOST_CHECK(db.TxIndexCacheUsage() > 0);
+    BOOST_CHECK(db.TxIndexCacheUsage() <= nTxIndexCacheSize);
+
+    // Entries that no longer fit are read back from the database
+    std::vector<CDiskTxPos> vpos;
+    for (const auto& it : vect) {
+        BOOST_CHECK(db.ReadTxIndex(it.first, vpos));
+        BOOST_CHECK(vpos[0] == it.second);
+    }
+    BOOST_CHECK(db.TxIndexCacheUsage() <= nTxIndexCacheSize);
+
+    // Without a budget nothing is kept
+    CBlockTreeDB dbUncached(1 << 20, true);
+    const size_t nUsageEmpty = dbUncached.TxIndexCacheUsage();
+    BOOST_CHECK(dbUncached.WriteTxIndex(vect));
+    BOOST_CHECK_EQUAL(dbUncached.TxIndexCacheUsage(), nUsageEmpty);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
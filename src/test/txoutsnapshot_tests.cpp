@@ -0,0 +1,130 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <coinstats.h>
+#include <hash.h>
+#include <pos.h>
+#include <streams.h>
+#include <txdb.h>
+#include <txoutsnapshot.h>
+#include <validation.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+/** Write a snapshot of a made-up block 1 with one transaction's coins. */
+void WriteSnapshot(CAutoFile& file, const CBlockIndex* genesis, const uint256& txid, const CStakePrevTx& txPrev,
+                   const std::map<uint32_t, Coin>& outputs, CTxOutSnapshotHeader& header, bool fCorruptHash)
+{
+    CBlockIndex index;
+    index.pprev = const_cast<CBlockIndex*>(genesis);
+    index.nHeight = 1;
+    index.nVersion = genesis->nVersion;
+    index.nTime = genesis->nTime + 60;
+    index.nBits = genesis->nBits;
+    index.nTx = 2;
+    index.nStatus = BLOCK_VALID_SCRIPTS;
+    CDiskBlockIndex diskindex(&index);
+
+    CCoinsStats stats;
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << diskindex.GetBlockHash();
+    ApplyStats(stats, ss, txid, outputs);
+    uint256 hashSerialized = ss.GetHash();
+    if (fCorruptHash) hashSerialized = InsecureRand256();
+
+    memcpy(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart));
+    header.hashBlock = diskindex.GetBlockHash();
+    header.nHeight = 1;
+    header.nTransactions = stats.nTransactions;
+    header.nTransactionOutputs = stats.nTransactionOutputs;
+
+    unsigned int nOutputs = outputs.size();
+    file << header << diskindex << txid << txPrev << VARINT(nOutputs);
+    for (const auto& output : outputs) {
+        file << VARINT(output.first) << output.second;
+    }
+    file << hashSerialized;
+    fseek(file.Get(), 0, SEEK_SET);
+}
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(txoutsnapshot_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(txoutsnapshot_load)
+{
+    const uint256 txid = InsecureRand256();
+    CStakePrevTx txPrev;
+    txPrev.nTime = 1500000000;
+    txPrev.nTxOffset = 123;
+    std::map<uint32_t, Coin> outputs;
+    outputs[0] = Coin(CTxOut(50 * COIN, CScript() << OP_TRUE), 1, true);
+    outputs[3] = Coin(CTxOut(1 * COIN, CScript() << OP_TRUE), 1, true);
+
+    CAutoFile file(fsbridge::fopen(GetDataDir() / "snapshot.dat", "w+b"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!file.IsNull());
+    CTxOutSnapshotHeader header;
+    WriteSnapshot(file, chainActive.Genesis(), txid, txPrev, outputs, header, false);
+
+    // The file hash covers everything, so any change shows
+    uint256 hash1, hash2;
+    BOOST_CHECK(HashTxOutSnapshot(file.Get(), hash1));
+    fseek(file.Get(), 0, SEEK_SET);
+    BOOST_CHECK(HashTxOutSnapshot(file.Get(), hash2));
+    BOOST_CHECK(hash1 == hash2);
+    fseek(file.Get(), 0, SEEK_SET);
+
+    CTxOutSnapshotHeader headerRead;
+    std::string strFailReason;
+    BOOST_CHECK(LoadTxOutSnapshot(Params(), file, headerRead, strFailReason));
+    BOOST_CHECK(headerRead.hashBlock == header.hashBlock);
+
+    LOCK(cs_main);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 1);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == header.hashBlock);
+    BOOST_CHECK(!(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA));
+    BOOST_CHECK_EQUAL(chainActive.Tip()->nChainTx, chainActive.Genesis()->nChainTx + 2);
+    BOOST_CHECK(pindexBestHeader == chainActive.Tip());
+    BOOST_CHECK(fHavePruned && fTxOutSnapshot);
+    BOOST_CHECK(pcoinsTip->GetBestBlock() == header.hashBlock);
+    BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(txid, 0)));
+    BOOST_CHECK(!pcoinsTip->HaveCoin(COutPoint(txid, 1)));
+    BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(txid, 3)));
+
+    // Stakes spending the coins can be checked without their transaction
+    CStakePrevTx txPrevRead;
+    BOOST_CHECK(GetStakePrevTx(*pblocktree, txid, txPrevRead));
+    BOOST_CHECK_EQUAL(txPrevRead.nTime, txPrev.nTime);
+    BOOST_CHECK_EQUAL(txPrevRead.nTxOffset, txPrev.nTxOffset);
+
+    // Only a node without blocks takes a snapshot
+    fseek(file.Get(), 0, SEEK_SET);
+    BOOST_CHECK(!LoadTxOutSnapshot(Params(), file, headerRead, strFailReason));
+}
+
+BOOST_AUTO_TEST_CASE(txoutsnapshot_bad_hash)
+{
+    std::map<uint32_t, Coin> outputs;
+    outputs[0] = Coin(CTxOut(50 * COIN, CScript() << OP_TRUE), 1, true);
+
+    CAutoFile file(fsbridge::fopen(GetDataDir() / "snapshot.dat", "w+b"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!file.IsNull());
+    CTxOutSnapshotHeader header;
+    WriteSnapshot(file, chainActive.Genesis(), InsecureRand256(), CStakePrevTx(), outputs, header, true);
+
+    std::string strFailReason;
+    BOOST_CHECK(!LoadTxOutSnapshot(Params(), file, header, strFailReason));
+    BOOST_CHECK(strFailReason.find("do not match") != std::string::npos);
+
+    // Starting from the half-loaded chain state is refused
+    bool fLoading = false;
+    BOOST_CHECK(pblocktree->ReadFlag("txoutsnapshotloading", fLoading) && fLoading);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
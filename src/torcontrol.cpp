@@ -357,6 +357,22 @@ static std::map<std::string,std::string> ParseTorReplyMapping(const std::string
     return mapping;
 }
 
+int ParseTorBootstrapLine(const std::string& line)
+{
+    static const std::string prefix = "Bootstrapped ";
+    size_t pos = line.find(prefix);
+    if (pos == std::string::npos)
+        return -1;
+    pos += prefix.size();
+    size_t end = line.find('%', pos);
+    if (end == std::string::npos)
+        return -1;
+    int32_t progress;
+    if (!ParseInt32(line.substr(pos, end - pos), &progress) || progress < 0 || progress > 100)
+        return -1;
+    return progress;
+}
+
 /** Read full contents of a file and return them in a std::string.
  * Returns a pair <status, string>.
  * If an error occurred, status will be false, otherwise status will be true and the data will be returned in string.
@@ -17,4 +17,7 @@ void StartTorControl(boost::thread_group& threadGroup, CScheduler& scheduler);
 void InterruptTorControl();
 void StopTorControl();
 
+/** Parse the progress out of a Tor "Bootstrapped N%: ..." notice, -1 if the line is no such notice. */
+int ParseTorBootstrapLine(const std::string& line);
+
 #endif /* BITCOIN_TORCONTROL_H */
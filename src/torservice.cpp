@@ -3,11 +3,14 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <torservice.h>
+#include <torcontrol.h>
 #include <chainparamsbase.h>
 #include <utilstrencodings.h>
 #include <netbase.h>
 #include <net.h>
 #include <util.h>
+#include <utiltime.h>
+#include <sync.h>
 #include <crypto/hmac_sha256.h>
 
 #include <vector>
@@ -103,6 +106,18 @@ TorService::TorService(struct event_base* _base):
     fs::create_directory(tor_dir);
     fs::path log_file = tor_dir / "tor.log";
 
+    // Tor keeps the consensus and relay descriptors it downloaded in its DataDirectory.
+    // With a recent copy on disk, bootstrapping only has to build circuits. Whether
+    // the copy is still usable is up to Tor (it drops a consensus that is too old),
+    // this is only reported here, not enforced.
+    fs::path cached_consensus = tor_dir / "cached-microdesc-consensus";
+    if (fs::exists(cached_consensus)) {
+        int64_t nAge = GetTime() - fs::last_write_time(cached_consensus);
+        LogPrintf("torservice: reusing cached consensus in %s (%d minutes old)\n", tor_dir.string(), nAge / 60);
+    } else {
+        LogPrintf("torservice: no cached consensus in %s, Tor has to download the directory first\n", tor_dir.string());
+    }
+
     std::vector<std::string> argv;
     argv.push_back("tor");
     argv.push_back("--Log");
@@ -148,6 +163,41 @@ TorService::~TorService()
 
 }
 
+/****** Bootstrap progress ********/
+static CCriticalSection cs_torBootstrap;
+static fs::path torLogFile;
+/** Offset in tor.log up to which bootstrap notices have been parsed */
+static uint64_t nTorLogOffset = 0;
+static int nTorBootstrapProgress = -1;
+
+int GetTorBootstrapProgress()
+{
+    LOCK(cs_torBootstrap);
+    if (nTorBootstrapProgress < 0 || nTorBootstrapProgress >= 100)
+        return nTorBootstrapProgress;
+
+    FILE* file = fsbridge::fopen(torLogFile, "rb");
+    if (!file)
+        return nTorBootstrapProgress;
+    if (fseek(file, nTorLogOffset, SEEK_SET) == 0) {
+        // Only consume complete lines, Tor may be in the middle of writing the last one
+        std::string pending;
+        char buf[4096];
+        size_t nRead;
+        while ((nRead = fread(buf, 1, sizeof(buf), file)) > 0) {
+            pending.append(buf, nRead);
+            size_t eol;
+            while ((eol = pending.find('\n')) != std::string::npos) {
+                nTorBootstrapProgress = std::max(nTorBootstrapProgress, ParseTorBootstrapLine(pending.substr(0, eol)));
+                nTorLogOffset += eol + 1;
+                pending.erase(0, eol + 1);
+            }
+        }
+    }
+    fclose(file);
+    return nTorBootstrapProgress;
+}
+
 /****** Thread ********/
 static struct event_base *gBase;
 static boost::thread torServiceThread;
@@ -174,6 +224,16 @@ void StartTor(boost::thread_group& threadGroup, CScheduler& scheduler)
         return;
     }
 
+    {
+        // tor.log is appended to across restarts, only notices written from here on count
+        LOCK(cs_torBootstrap);
+        torLogFile = GetDataDir() / "tor" / "tor.log";
+        boost::system::error_code ec;
+        uint64_t nSize = fs::file_size(torLogFile, ec);
+        nTorLogOffset = ec ? 0 : nSize;
+        nTorBootstrapProgress = 0;
+    }
+
     torServiceThread = boost::thread(boost::bind(&TraceThread<void (*)()>, "torservice", &TorServiceThread));
 }
 
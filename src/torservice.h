@@ -10,8 +10,18 @@
 
 #include <scheduler.h>
 
+/** -torbootstraptimeout default: seconds to wait for the embedded Tor before starting the network anyway */
+static const int DEFAULT_TOR_BOOTSTRAP_TIMEOUT = 120;
+
 void StartTor(boost::thread_group& threadGroup, CScheduler& scheduler);
 void InterruptTor();
 void StopTor();
 
+/**
+ * Bootstrap progress (0-100) the embedded Tor reported since StartTor, or -1
+ * if it was not started. Progress is read from the "Bootstrapped N%" notices
+ * in <datadir>/tor/tor.log.
+ */
+int GetTorBootstrapProgress();
+
 #endif /* BITCOIN_TORSERVICE_H */
@@ -5,8 +5,10 @@
 
 #include <txdb.h>
 
+#include <blockindexfile.h>
 #include <chainparams.h>
 #include <hash.h>
+#include <memusage.h>
 #include <random.h>
 #include <pow.h>
 #include <uint256.h>
@@ -16,13 +18,20 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <tuple>
+
 #include <boost/thread.hpp>
 
 static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
+static const char DB_TXINDEX_COMPACT = 'T';
+static const char DB_STAKE_PREV = 'k';
 static const char DB_BLOCK_INDEX = 'b';
+static const char DB_BLOCK_INDEX_SNAPSHOT = 'x';
+static const char DB_BLOCK_INDEX_CHANGED = 'X';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_HEAD_BLOCKS = 'H';
@@ -54,7 +63,7 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, ReadDBOptions(COINSDB_OPTIONS_PREFIX))
 {
 }
 
@@ -82,6 +91,12 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    bool ret = WriteCoins(mapCoins, hashBlock);
+    mapCoins.clear();
+    return ret;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, const std::function<CCoinsMap::const_iterator(CCoinsMap::const_iterator)>& fnWritten) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -106,7 +121,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     batch.Erase(DB_BEST_BLOCK);
     batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, old_tip});
 
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
             if (it->second.coin.IsSpent())
@@ -116,12 +131,13 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        ++it;
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
             batch.Clear();
+            if (fnWritten)
+                it = fnWritten(it);
             if (crash_simulate) {
                 static FastRandomContext rng;
                 if (rng.randrange(crash_simulate) == 0) {
@@ -147,7 +163,164 @@ size_t CCoinsViewDB::EstimateSize() const
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CCoinsViewBackgroundFlush::CCoinsViewBackgroundFlush(CCoinsViewDB* dbIn) : db(dbIn), nFlushingUsage(0), fFlushFailed(false), fStop(false)
+{
+    threadFlush = std::thread(&TraceThread<std::function<void()> >, "coinsflush", std::function<void()>(std::bind(&CCoinsViewBackgroundFlush::ThreadFlush, this)));
+}
+
+CCoinsViewBackgroundFlush::~CCoinsViewBackgroundFlush()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fStop = true;
+    }
+    cond.notify_all();
+    // A pending write is finished first
+    threadFlush.join();
+}
+
+void CCoinsViewBackgroundFlush::ThreadFlush()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        cond.wait(lock, [this] { return fStop || (mapFlushing && !fFlushFailed); });
+        if (!mapFlushing || fFlushFailed)
+            return;
+
+        // Only this thread modifies mapFlushing, under cs, so it reads it without
+        CCoinsMap& mapCoins = *mapFlushing;
+        const uint256 hashBlock = hashFlushing;
+        const size_t nCoins = mapCoins.size();
+        lock.unlock();
+        // Entries in a partial batch are on disk and can go. Erased nodes
+        // stay in the map's arena, so once half of the entries are gone the
+        // rest is copied into a new map. Either way, the entries left are
+        // the ones not written yet.
+        size_t nCompactSize = nCoins;
+        auto fnWritten = [this, &mapCoins, &nCompactSize](CCoinsMap::const_iterator itNext) {
+            {
+                std::lock_guard<std::mutex> lockWritten(cs);
+                size_t nCoinsUsage = nFlushingUsage - memusage::DynamicUsage(mapCoins);
+                for (CCoinsMap::iterator it = mapCoins.begin(); CCoinsMap::const_iterator(it) != itNext; ) {
+                    nCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+                    it = mapCoins.erase(it);
+                }
+                nFlushingUsage = nCoinsUsage + memusage::DynamicUsage(mapCoins);
+            }
+            if (mapCoins.size() * 2 <= nCompactSize) {
+                CCoinsMap mapCompact(mapCoins.hash_function());
+                for (const auto& entry : mapCoins)
+                    mapCompact.emplace(entry.first, entry.second);
+                std::lock_guard<std::mutex> lockWritten(cs);
+                size_t nCoinsUsage = nFlushingUsage - memusage::DynamicUsage(mapCoins);
+                mapCoins.swap(mapCompact);
+                nFlushingUsage = nCoinsUsage + memusage::DynamicUsage(mapCoins);
+                nCompactSize = mapCoins.size();
+            }
+            return CCoinsMap::const_iterator(mapCoins.begin());
+        };
+        int64_t nStart = GetTimeMicros();
+        bool fOk = false;
+        try {
+            fOk = db->WriteCoins(mapCoins, hashBlock, fnWritten);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Error writing to coin database: %s\n", __func__, e.what());
+        }
+        LogPrint(BCLog::COINDB, "Background flush of %u coins took %.2fs\n", (unsigned int)nCoins, (GetTimeMicros() - nStart) * 0.000001);
+
+        std::unique_ptr<CCoinsMap> mapWritten;
+        lock.lock();
+        if (fOk) {
+            mapWritten.swap(mapFlushing);
+            nFlushingUsage = 0;
+        } else {
+            fFlushFailed = true;
+        }
+        cond.notify_all();
+        lock.unlock();
+        mapWritten.reset();
+        lock.lock();
+    }
+}
+
+bool CCoinsViewBackgroundFlush::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (mapFlushing) {
+            CCoinsMap::const_iterator it = mapFlushing->find(outpoint);
+            if (it != mapFlushing->end()) {
+                if (it->second.coin.IsSpent())
+                    return false;
+                coin = it->second.coin;
+                return true;
+            }
+        }
+    }
+    return db->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewBackgroundFlush::HaveCoin(const COutPoint &outpoint) const {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (mapFlushing) {
+            CCoinsMap::const_iterator it = mapFlushing->find(outpoint);
+            if (it != mapFlushing->end())
+                return !it->second.coin.IsSpent();
+        }
+    }
+    return db->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestBlock() const {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (mapFlushing)
+            return hashFlushing;
+    }
+    return db->GetBestBlock();
+}
+
+std::vector<uint256> CCoinsViewBackgroundFlush::GetHeadBlocks() const {
+    return db->GetHeadBlocks();
+}
+
+bool CCoinsViewBackgroundFlush::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this] { return !mapFlushing || fFlushFailed; });
+    if (fFlushFailed)
+        return false;
+    // Like CCoinsViewCache's usage, the coins' scripts count as well
+    nFlushingUsage = memusage::DynamicUsage(mapCoins);
+    for (const auto& entry : mapCoins)
+        nFlushingUsage += entry.second.coin.DynamicMemoryUsage();
+    mapFlushing.reset(new CCoinsMap(std::move(mapCoins)));
+    hashFlushing = hashBlock;
+    cond.notify_all();
+    return true;
+}
+
+CCoinsViewCursor *CCoinsViewBackgroundFlush::Cursor() const {
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this] { return !mapFlushing || fFlushFailed; });
+    return db->Cursor();
+}
+
+size_t CCoinsViewBackgroundFlush::EstimateSize() const {
+    return db->EstimateSize();
+}
+
+bool CCoinsViewBackgroundFlush::Sync() {
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this] { return !mapFlushing || fFlushFailed; });
+    return !fFlushFailed;
+}
+
+size_t CCoinsViewBackgroundFlush::DynamicMemoryUsage() const {
+    std::lock_guard<std::mutex> lock(cs);
+    return nFlushingUsage;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, size_t nTxIndexCacheSizeIn) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, ReadDBOptions(BLOCKDB_OPTIONS_PREFIX)), nTxIndexCacheVectorUsage(0), nTxIndexCacheSize(nTxIndexCacheSizeIn) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -171,6 +344,11 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 }
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
+{
+    return DBCursor();
+}
+
+CCoinsViewDBCursor *CCoinsViewDB::DBCursor() const
 {
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
@@ -224,26 +402,223 @@ void CCoinsViewDBCursor::Next()
     }
 }
 
+void CCoinsViewDBCursor::Seek(const COutPoint &outpoint)
+{
+    COutPoint outpointSeek(outpoint);
+    pcursor->Seek(CoinEntry(&outpointSeek));
+    CoinEntry entry(&keyTmp.second);
+    if (!pcursor->Valid() || !pcursor->GetKey(entry)) {
+        keyTmp.first = 0;
+    } else {
+        keyTmp.first = entry.key;
+    }
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_FILES, it->first), *it->second);
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
+    // Entries written after the snapshot are loaded on top of it, and
+    // copied to it when it is next written. Marking them takes one small key
+    // per entry in the same batch, and only while there is a snapshot;
+    // finding them otherwise would mean walking the whole database again.
+    const bool fSnapshot = !blockinfo.empty() && Exists(DB_BLOCK_INDEX_SNAPSHOT);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
+        if (fSnapshot)
+            batch.Write(std::make_pair(DB_BLOCK_INDEX_CHANGED, (*it)->GetBlockHash()), '1');
+    }
+    return WriteBatch(batch, true);
+}
+
+static fs::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blocks" / "index.dat";
+}
+
+void CBlockTreeDB::ReadBlockIndexChanges(std::vector<uint256>& vHash)
+{
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_BLOCK_INDEX_CHANGED, uint256()));
+    std::pair<char, uint256> key;
+    while (pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX_CHANGED) {
+        vHash.push_back(key.second);
+        pcursor->Next();
     }
+}
+
+bool CBlockTreeDB::WriteBlockIndexSnapshot(const std::vector<const CBlockIndex*>& vIndex)
+{
+    // Drop the old snapshot before its file is replaced
+    if (Exists(DB_BLOCK_INDEX_SNAPSHOT) && !Erase(DB_BLOCK_INDEX_SNAPSHOT, true))
+        return false;
+    const uint256 nonce = GetRandHash();
+    if (!WriteBlockIndexFile(GetBlockIndexSnapshotPath(), nonce, vIndex))
+        return false;
+    std::vector<uint256> vChanged;
+    ReadBlockIndexChanges(vChanged);
+    CDBBatch batch(*this);
+    batch.Write(DB_BLOCK_INDEX_SNAPSHOT, std::make_pair(nonce, (uint64_t)vIndex.size()));
+    for (const uint256& hash : vChanged)
+        batch.Erase(std::make_pair(DB_BLOCK_INDEX_CHANGED, hash));
     return WriteBatch(batch, true);
 }
 
-bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
-    return Read(std::make_pair(DB_TXINDEX, txid), pos);
+bool CBlockTreeDB::UpdateBlockIndexSnapshot(const std::function<const CBlockIndex*(const uint256&)>& lookupBlockIndex, size_t& nChanged)
+{
+    std::pair<uint256, uint64_t> snapshot;
+    if (!Read(DB_BLOCK_INDEX_SNAPSHOT, snapshot))
+        return false;
+    std::vector<uint256> vHash;
+    ReadBlockIndexChanges(vHash);
+    nChanged = vHash.size();
+    if (vHash.empty())
+        return true;
+
+    std::vector<const CBlockIndex*> vChanged;
+    vChanged.reserve(vHash.size());
+    for (const uint256& hash : vHash) {
+        const CBlockIndex* pindex = lookupBlockIndex(hash);
+        if (!pindex)
+            return false;
+        vChanged.push_back(pindex);
+    }
+    uint64_t nCount;
+    if (!UpdateBlockIndexFile(GetBlockIndexSnapshotPath(), snapshot.first, snapshot.second, vChanged, nCount))
+        return false;
+    CDBBatch batch(*this);
+    batch.Write(DB_BLOCK_INDEX_SNAPSHOT, std::make_pair(snapshot.first, nCount));
+    for (const uint256& hash : vHash)
+        batch.Erase(std::make_pair(DB_BLOCK_INDEX_CHANGED, hash));
+    return WriteBatch(batch, true);
+}
+
+namespace {
+
+//! Transaction index key: the first 8 bytes of the txid, serialized in the
+//! same order so the index sorts like the txids
+uint64_t TxIndexKey(const uint256 &txid)
+{
+    return ReadLE64(txid.begin());
+}
+
+} // namespace
+
+void CBlockTreeDB::CacheTxIndex(uint64_t key, const std::vector<CDiskTxPos> &vpos) {
+    std::lock_guard<std::mutex> lock(csTxIndexCache);
+    std::vector<CDiskTxPos>& vposCached = mapTxIndexCache[key];
+    nTxIndexCacheVectorUsage -= memusage::DynamicUsage(vposCached);
+    vposCached = vpos;
+    nTxIndexCacheVectorUsage += memusage::DynamicUsage(vposCached);
+    // Start over once the cache outgrows its share of -dbcache
+    if (memusage::DynamicUsage(mapTxIndexCache) + nTxIndexCacheVectorUsage > nTxIndexCacheSize) {
+        std::unordered_map<uint64_t, std::vector<CDiskTxPos>>().swap(mapTxIndexCache);
+        nTxIndexCacheVectorUsage = 0;
+    }
+}
+
+size_t CBlockTreeDB::TxIndexCacheUsage() {
+    std::lock_guard<std::mutex> lock(csTxIndexCache);
+    return memusage::DynamicUsage(mapTxIndexCache) + nTxIndexCacheVectorUsage;
+}
+
+bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, std::vector<CDiskTxPos> &vpos) {
+    const uint64_t key = TxIndexKey(txid);
+    {
+        std::lock_guard<std::mutex> lock(csTxIndexCache);
+        auto it = mapTxIndexCache.find(key);
+        if (it != mapTxIndexCache.end()) {
+            vpos = it->second;
+            return true;
+        }
+    }
+    if (!Read(std::make_pair(DB_TXINDEX_COMPACT, key), vpos))
+        return false;
+    CacheTxIndex(key, vpos);
+    return true;
+}
+
+void CBlockTreeDB::ReadTxIndex(const std::vector<uint256> &vtxid, std::map<uint256, std::vector<CDiskTxPos> > &mapPos) {
+    std::vector<uint256> vMissing;
+    {
+        std::lock_guard<std::mutex> lock(csTxIndexCache);
+        for (const uint256& txid : vtxid) {
+            auto it = mapTxIndexCache.find(TxIndexKey(txid));
+            if (it != mapTxIndexCache.end()) {
+                mapPos[txid] = it->second;
+            } else {
+                vMissing.push_back(txid);
+            }
+        }
+    }
+    if (vMissing.empty())
+        return;
+
+    // Seeking in key order only ever moves the iterator forward
+    std::sort(vMissing.begin(), vMissing.end());
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    uint64_t keyPrev = 0;
+    const std::vector<CDiskTxPos>* pvposPrev = nullptr;
+    for (size_t i = 0; i < vMissing.size(); i++) {
+        const uint64_t key = TxIndexKey(vMissing[i]);
+        if (i > 0 && key == keyPrev) {
+            if (pvposPrev) mapPos[vMissing[i]] = *pvposPrev;
+            continue;
+        }
+        keyPrev = key;
+        pvposPrev = nullptr;
+        pcursor->Seek(std::make_pair(DB_TXINDEX_COMPACT, key));
+        std::pair<char, uint64_t> keyFound;
+        std::vector<CDiskTxPos> vpos;
+        if (pcursor->Valid() && pcursor->GetKey(keyFound) && keyFound == std::make_pair(DB_TXINDEX_COMPACT, key) && pcursor->GetValue(vpos)) {
+            CacheTxIndex(key, vpos);
+            pvposPrev = &(mapPos[vMissing[i]] = std::move(vpos));
+        }
+    }
 }
 
 bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
+    // Entries sharing a key are merged with what is indexed under it
+    std::vector<uint256> vtxid;
+    vtxid.reserve(vect.size());
+    for (const auto& it : vect)
+        vtxid.push_back(it.first);
+    std::map<uint256, std::vector<CDiskTxPos> > mapExisting;
+    ReadTxIndex(vtxid, mapExisting);
+
+    std::map<uint64_t, std::vector<CDiskTxPos> > mapWrite;
+    for (const auto& it : vect) {
+        const uint64_t key = TxIndexKey(it.first);
+        auto itWrite = mapWrite.find(key);
+        if (itWrite == mapWrite.end()) {
+            auto itExisting = mapExisting.find(it.first);
+            itWrite = mapWrite.emplace(key, itExisting != mapExisting.end() ? itExisting->second : std::vector<CDiskTxPos>()).first;
+        }
+        std::vector<CDiskTxPos>& vpos = itWrite->second;
+        vpos.erase(std::remove(vpos.begin(), vpos.end(), it.second), vpos.end());
+        vpos.insert(vpos.begin(), it.second);
+    }
+
     CDBBatch batch(*this);
-    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(std::make_pair(DB_TXINDEX, it->first), it->second);
+    for (const auto& it : mapWrite)
+        batch.Write(std::make_pair(DB_TXINDEX_COMPACT, it.first), it.second);
+    if (!WriteBatch(batch))
+        return false;
+    for (const auto& it : mapWrite)
+        CacheTxIndex(it.first, it.second);
+    return true;
+}
+
+bool CBlockTreeDB::ReadStakePrevTx(const uint256 &txid, CStakePrevTx &prev) {
+    return Read(std::make_pair(DB_STAKE_PREV, txid), prev);
+}
+
+bool CBlockTreeDB::WriteStakePrevTxs(const std::vector<std::pair<uint256, CStakePrevTx> >&vect) {
+    CDBBatch batch(*this);
+    for (const auto& it : vect)
+        batch.Write(std::make_pair(DB_STAKE_PREV, it.first), it.second);
     return WriteBatch(batch);
 }
 
@@ -259,8 +634,76 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+/** Construct the block index entry of diskindex, the block hash. */
+static CBlockIndex* InsertDiskBlockIndex(const uint256& hash, const CDiskBlockIndex& diskindex, const std::function<CBlockIndex*(const uint256&)>& insertBlockIndex)
+{
+    CBlockIndex* pindexNew = insertBlockIndex(hash);
+    pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
+    pindexNew->nHeight        = diskindex.nHeight;
+    pindexNew->nFile          = diskindex.nFile;
+    pindexNew->nDataPos       = diskindex.nDataPos;
+    pindexNew->nUndoPos       = diskindex.nUndoPos;
+    pindexNew->nVersion       = diskindex.nVersion;
+    pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+    pindexNew->nTime          = diskindex.nTime;
+    pindexNew->nBits          = diskindex.nBits;
+    pindexNew->nNonce         = diskindex.nNonce;
+    pindexNew->nStatus        = diskindex.nStatus;
+    pindexNew->nTx            = diskindex.nTx;
+
+    // DeepOnion: Add the PoS data
+    pindexNew->nFlags = diskindex.nFlags;
+    pindexNew->nStakeModifier = diskindex.nStakeModifier;
+    pindexNew->prevoutStake 	= diskindex.prevoutStake;
+    pindexNew->nStakeTime 	= diskindex.nStakeTime;
+    pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
+    return pindexNew;
+}
+
+bool CBlockTreeDB::LoadBlockIndexSnapshot(std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+{
+    std::pair<uint256, uint64_t> snapshot;
+    if (!Read(DB_BLOCK_INDEX_SNAPSHOT, snapshot))
+        return false;
+    CBlockIndexFile file;
+    if (!file.Open(GetBlockIndexSnapshotPath(), snapshot.first, snapshot.second)) {
+        Erase(DB_BLOCK_INDEX_SNAPSHOT, true);
+        return false;
+    }
+
+    // Entries are in height order, so parents are found by position
+    std::vector<CBlockIndex*> vIndex;
+    vIndex.reserve(file.size());
+    for (uint64_t n = 0; n < file.size(); n++) {
+        if (n % 100000 == 0)
+            boost::this_thread::interruption_point();
+        CBlockIndex* pindexNew = insertBlockIndex(file.GetHash(n));
+        int64_t nPrev = file.GetPrev(n);
+        pindexNew->pprev = nPrev < 0 ? nullptr : vIndex[nPrev];
+        file.Get(n, *pindexNew);
+        vIndex.push_back(pindexNew);
+    }
+
+    // Then the entries written since
+    std::vector<uint256> vChanged;
+    ReadBlockIndexChanges(vChanged);
+    for (const uint256& hash : vChanged) {
+        CDiskBlockIndex diskindex;
+        if (!Read(std::make_pair(DB_BLOCK_INDEX, hash), diskindex)) {
+            Erase(DB_BLOCK_INDEX_SNAPSHOT, true);
+            return error("%s: changed block index entry %s not found", __func__, hash.ToString());
+        }
+        InsertDiskBlockIndex(hash, diskindex, insertBlockIndex);
+    }
+    LogPrintf("%s: loaded %u entries from the block index snapshot and %u changed since\n", __func__, vIndex.size(), vChanged.size());
+    return true;
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
 {
+    if (LoadBlockIndexSnapshot(insertBlockIndex))
+        return true;
+
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
@@ -273,27 +716,7 @@ bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams,
             CDiskBlockIndex diskindex;
             if (pcursor->GetValue(diskindex)) {
                 // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-
-                // DeepOnion: Add the PoS data
-                pindexNew->nFlags = diskindex.nFlags;
-                pindexNew->nStakeModifier = diskindex.nStakeModifier;
-                pindexNew->prevoutStake 	= diskindex.prevoutStake;
-                pindexNew->nStakeTime 	= diskindex.nStakeTime;
-                pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
-
+                InsertDiskBlockIndex(diskindex.GetBlockHash(), diskindex, insertBlockIndex);
 
                 // DeepOnion: Disable PoW Sanity check while loading block index from disk.
                 // We use the sha256 hash for the block index for performance reasons, which is recorded for later use.
@@ -371,6 +794,95 @@ public:
 
 }
 
+/** Upgrade the transaction index from full txid keys to the first 8 bytes
+ * of the txid. Old entries are sorted by txid, so entries sharing a key
+ * come one after the other. They are stored newest first, as WriteTxIndex
+ * would have, going by where their blocks are on disk.
+ */
+bool CBlockTreeDB::UpgradeTxIndex() {
+    // Older releases look up the 't' entries whenever the txindex flag is
+    // set. Clearing it makes them stop with an error asking for a -reindex.
+    bool fCompact = false;
+    if (!ReadFlag("txindexcompact", fCompact) || !fCompact) {
+        CDBBatch batch(*this);
+        batch.Write(std::make_pair(DB_FLAG, std::string("txindex")), '0');
+        batch.Write(std::make_pair(DB_FLAG, std::string("txindexcompact")), '1');
+        if (!WriteBatch(batch, true))
+            return error("%s: cannot mark the transaction index", __func__);
+    }
+
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    std::pair<char, uint256> key;
+    pcursor->Seek(std::make_pair(DB_TXINDEX, uint256()));
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_TXINDEX) {
+        return true;
+    }
+
+    int64_t count = 0;
+    LogPrintf("Upgrading transaction index...\n");
+    LogPrintf("[0%%]...");
+    uiInterface.ShowProgress(_("Upgrading transaction index"), 0, true);
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(*this);
+    int reportDone = 0;
+    uint64_t keyGroup = 0;
+    std::vector<uint256> vGroupTxid;
+    std::vector<CDiskTxPos> vGroup;
+    // Convert one group at a time, so an interrupted upgrade resumes cleanly
+    auto write_group = [&]() {
+        std::sort(vGroup.begin(), vGroup.end(), [](const CDiskTxPos& a, const CDiskTxPos& b) {
+            return std::make_tuple(a.nFile, a.nPos, a.nTxOffset) > std::make_tuple(b.nFile, b.nPos, b.nTxOffset);
+        });
+        batch.Write(std::make_pair(DB_TXINDEX_COMPACT, keyGroup), vGroup);
+        for (const uint256& txid : vGroupTxid)
+            batch.Erase(std::make_pair(DB_TXINDEX, txid));
+        vGroupTxid.clear();
+        vGroup.clear();
+    };
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        if (!pcursor->GetKey(key) || key.first != DB_TXINDEX) {
+            break;
+        }
+        if (count++ % 256 == 0) {
+            uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
+            int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+            uiInterface.ShowProgress(_("Upgrading transaction index"), percentageDone, true);
+            if (reportDone < percentageDone/10) {
+                // report max. every 10% step
+                LogPrintf("[%d%%]...", percentageDone);
+                reportDone = percentageDone/10;
+            }
+        }
+        CDiskTxPos pos;
+        if (!pcursor->GetValue(pos)) {
+            return error("%s: cannot parse transaction index record", __func__);
+        }
+        if (!vGroup.empty() && TxIndexKey(key.second) != keyGroup) {
+            write_group();
+            if (batch.SizeEstimate() > batch_size) {
+                WriteBatch(batch);
+                batch.Clear();
+            }
+        }
+        keyGroup = TxIndexKey(key.second);
+        vGroupTxid.push_back(key.second);
+        vGroup.push_back(pos);
+        pcursor->Next();
+    }
+    if (!vGroup.empty() && !ShutdownRequested()) {
+        write_group();
+    }
+    WriteBatch(batch);
+    CompactRange(std::make_pair(DB_TXINDEX, uint256()), key);
+    uiInterface.ShowProgress("", 100, false);
+    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
+    return !ShutdownRequested();
+}
+
 /** Upgrade the database from older formats.
  *
  * Currently implemented: from the per-tx utxo model (0.8..0.14.x) to per-txout.
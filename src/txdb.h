@@ -10,8 +10,13 @@
 #include <dbwrapper.h>
 #include <chain.h>
 
+#include <condition_variable>
+#include <functional>
 #include <map>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -37,6 +42,12 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! Prefix of the options tuning the coin database, see ReadDBOptions
+static const char* const COINSDB_OPTIONS_PREFIX = "coinsdb";
+//! Prefix of the options tuning the block index database
+static const char* const BLOCKDB_OPTIONS_PREFIX = "blockdb";
+//! Part of the block index database cache given to its transaction index entries
+static const int64_t nTxIndexCacheShare = 4;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -61,6 +72,33 @@ struct CDiskTxPos : public CDiskBlockPos
         CDiskBlockPos::SetNull();
         nTxOffset = 0;
     }
+
+    friend bool operator==(const CDiskTxPos &a, const CDiskTxPos &b) {
+        return a.nFile == b.nFile && a.nPos == b.nPos && a.nTxOffset == b.nTxOffset;
+    }
+};
+
+/**
+ * What a stake kernel needs of the transaction it spends, kept in the block
+ * tree database for coins loaded from a UTXO snapshot, whose transactions
+ * are not on disk.
+ */
+struct CStakePrevTx
+{
+    //! Time of the transaction
+    unsigned int nTime;
+    //! Offset of the transaction in its block, counting the header
+    unsigned int nTxOffset;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nTime);
+        READWRITE(VARINT(nTxOffset));
+    }
+
+    CStakePrevTx() : nTime(0), nTxOffset(0) {}
 };
 
 /** CCoinsView backed by the coin database (chainstate/) */
@@ -77,10 +115,65 @@ public:
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
+    //! Cursor over the coins, with the CCoinsViewDBCursor interface
+    CCoinsViewDBCursor *DBCursor() const;
 
+    //! Write the dirty entries of mapCoins. After each partial batch, fnWritten
+    //! is passed the first entry not yet written and returns the entry to
+    //! continue from; it may drop the written entries or rebuild the map.
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, const std::function<CCoinsMap::const_iterator(CCoinsMap::const_iterator)>& fnWritten = nullptr);
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+    //! The underlying database, for statistics
+    const CDBWrapper& GetDB() const { return db; }
+};
+
+/**
+ * CCoinsView on top of CCoinsViewDB that writes flushed caches to the
+ * database from a background thread, so a flush does not hold up validation.
+ *
+ * BatchWrite takes over the passed map and returns right away; a following
+ * BatchWrite waits until the previous map is written. Entries leave the map
+ * as soon as their batch is on disk, and the map is rebuilt as it empties to
+ * give their memory back. Reads are answered from what is left of it first,
+ * so this view always reflects the last BatchWrite. The DB_HEAD_BLOCKS marker that CCoinsViewDB::WriteCoins keeps
+ * around every write makes a crash in the middle recoverable as before.
+ */
+class CCoinsViewBackgroundFlush final : public CCoinsView
+{
+private:
+    CCoinsViewDB* const db;
+
+    mutable std::mutex cs;
+    mutable std::condition_variable cond;
+    //! Entries of the map being written to db that are not on disk yet, or nullptr
+    std::unique_ptr<CCoinsMap> mapFlushing;
+    uint256 hashFlushing;
+    size_t nFlushingUsage;
+    //! Whether writing mapFlushing failed; it is then kept to keep reads correct
+    bool fFlushFailed;
+    bool fStop;
+    std::thread threadFlush;
+
+    void ThreadFlush();
+
+public:
+    explicit CCoinsViewBackgroundFlush(CCoinsViewDB* dbIn);
+    ~CCoinsViewBackgroundFlush();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    std::vector<uint256> GetHeadBlocks() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    CCoinsViewCursor *Cursor() const override;
+    size_t EstimateSize() const override;
+
+    //! Wait until the last BatchWrite is on disk. Returns false if writing it failed.
+    bool Sync();
+    //! Memory used by the entries still being written
+    size_t DynamicMemoryUsage() const;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -95,6 +188,8 @@ public:
 
     bool Valid() const override;
     void Next() override;
+    //! Move to the first coin at or after outpoint
+    void Seek(const COutPoint &outpoint);
 
 private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
@@ -108,8 +203,20 @@ private:
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper
 {
+private:
+    //! Recently read or written transaction index entries, by key
+    std::mutex csTxIndexCache;
+    std::unordered_map<uint64_t, std::vector<CDiskTxPos>> mapTxIndexCache;
+    //! Memory used by the vectors in mapTxIndexCache, and the limit for all of it
+    size_t nTxIndexCacheVectorUsage;
+    size_t nTxIndexCacheSize;
+
+    void CacheTxIndex(uint64_t key, const std::vector<CDiskTxPos> &vpos);
+    bool LoadBlockIndexSnapshot(std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+
 public:
-    explicit CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    /** nTxIndexCacheSize bounds the transaction index entries kept in memory, on top of nCacheSize */
+    explicit CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, size_t nTxIndexCacheSize = 0);
 
     CBlockTreeDB(const CBlockTreeDB&) = delete;
     CBlockTreeDB& operator=(const CBlockTreeDB&) = delete;
@@ -119,11 +226,46 @@ public:
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindexing);
     bool ReadReindexing(bool &fReindexing);
-    bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
+    /**
+     * The transaction index is keyed by the first 8 bytes of the txid, so
+     * this returns the positions of all indexed transactions sharing them,
+     * newest first. Callers check the txid of what they read.
+     */
+    bool ReadTxIndex(const uint256 &txid, std::vector<CDiskTxPos> &vpos);
+    /** ReadTxIndex for many txids with one pass over the index in key order. */
+    void ReadTxIndex(const std::vector<uint256> &vtxid, std::map<uint256, std::vector<CDiskTxPos> > &mapPos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vect);
+    //! Memory used by the transaction index entries kept in memory
+    size_t TxIndexCacheUsage();
+    /**
+     * Convert a transaction index keyed by full txids. The database is marked
+     * first, so that older releases refuse it instead of reading an index
+     * they can't find anything in. Returns false if it failed or was interrupted.
+     */
+    bool UpgradeTxIndex();
+    bool ReadStakePrevTx(const uint256 &txid, CStakePrevTx &prev);
+    bool WriteStakePrevTxs(const std::vector<std::pair<uint256, CStakePrevTx> > &vect);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    /**
+     * Load the block index, from the snapshot written by WriteBlockIndexSnapshot
+     * if the database hasn't changed since, or else from the database.
+     */
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    /**
+     * Copy vIndex, the whole block index in height order, to a flat file
+     * that loads faster than the database. Entries written to the database
+     * after it are loaded on top of it.
+     */
+    bool WriteBlockIndexSnapshot(const std::vector<const CBlockIndex*>& vIndex);
+    /**
+     * Copy the entries written since the snapshot to it, looking them up
+     * with lookupBlockIndex; nChanged is set to their number. Returns false
+     * if the snapshot has to be written whole instead.
+     */
+    bool UpdateBlockIndexSnapshot(const std::function<const CBlockIndex*(const uint256&)>& lookupBlockIndex, size_t& nChanged);
+    //! Hashes of the block index entries written since the snapshot
+    void ReadBlockIndexChanges(std::vector<uint256>& vHash);
 };
 
 #endif // BITCOIN_TXDB_H
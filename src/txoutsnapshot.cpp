@@ -0,0 +1,24 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <txoutsnapshot.h>
+
+#include <hash.h>
+#include <version.h>
+
+constexpr char CTxOutSnapshotHeader::MAGIC[4];
+
+bool HashTxOutSnapshot(FILE* file, uint256& hash)
+{
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    char buf[1 << 16];
+    size_t nRead;
+    while ((nRead = fread(buf, 1, sizeof(buf), file)) > 0) {
+        hasher.write(buf, nRead);
+    }
+    if (ferror(file))
+        return false;
+    hash = hasher.GetHash();
+    return true;
+}
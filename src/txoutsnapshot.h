@@ -0,0 +1,78 @@
+// Copyright (c) 2018 The DeepOnion developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXOUTSNAPSHOT_H
+#define BITCOIN_TXOUTSNAPSHOT_H
+
+#include <protocol.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+//! Version of the snapshot format written by dumptxoutset
+static const int TXOUTSNAPSHOT_VERSION = 1;
+
+/**
+ * Header of a UTXO set snapshot, as written by dumptxoutset and read by
+ * loadtxoutset. It is followed by
+ *
+ * - the block index of the chain up to the snapshot block, heights 1 to
+ *   nHeight, as CDiskBlockIndex without block file positions. Besides the
+ *   headers this carries the stake modifiers and flags that checking
+ *   later stakes needs;
+ * - the coins grouped by transaction, in database order: txid,
+ *   CStakePrevTx, VARINT(number of outputs) and that many VARINT(n), Coin;
+ * - the hash_serialized_2 of the coins, as gettxoutsetinfo reports it at
+ *   the snapshot block.
+ *
+ * The whole file is committed to by the hash HashTxOutSnapshot returns,
+ * which loadtxoutset has to be given.
+ */
+class CTxOutSnapshotHeader
+{
+public:
+    static constexpr char MAGIC[4] = {'u', 't', 'x', 'o'};
+
+    char pchMagic[4];
+    CMessageHeader::MessageStartChars pchMessageStart;
+    int nVersion;
+    uint256 hashBlock;
+    int nHeight;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+
+    CTxOutSnapshotHeader() : nVersion(TXOUTSNAPSHOT_VERSION), nHeight(0), nTransactions(0), nTransactionOutputs(0)
+    {
+        memcpy(pchMagic, MAGIC, sizeof(pchMagic));
+        memset(pchMessageStart, 0, sizeof(pchMessageStart));
+    }
+
+    bool IsValid(const CMessageHeader::MessageStartChars& messageStart) const
+    {
+        return memcmp(pchMagic, MAGIC, sizeof(pchMagic)) == 0 &&
+               memcmp(pchMessageStart, messageStart, sizeof(pchMessageStart)) == 0 &&
+               nVersion == TXOUTSNAPSHOT_VERSION && nHeight > 0;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(FLATDATA(pchMagic));
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(nVersion);
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+    }
+};
+
+/** Hash a snapshot file from its current position to the end. */
+bool HashTxOutSnapshot(FILE* file, uint256& hash);
+
+#endif // BITCOIN_TXOUTSNAPSHOT_H
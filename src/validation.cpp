@@ -6,10 +6,13 @@
 #include <validation.h>
 
 #include <arith_uint256.h>
+#include <blockfile.h>
+#include <blockpipeline.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <checkqueue.h>
+#include <coinstats.h>
 #include <consensus/consensus.h>
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
@@ -17,6 +20,7 @@
 #include <cuckoocache.h>
 #include <hash.h>
 #include <init.h>
+#include <mempooljournal.h>
 #include <net.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
@@ -34,6 +38,7 @@
 #include <tinyformat.h>
 #include <txdb.h>
 #include <txmempool.h>
+#include <txoutsnapshot.h>
 #include <ui_interface.h>
 #include <undo.h>
 #include <util.h>
@@ -224,6 +229,14 @@ private:
       */
     std::set<CBlockIndex*> g_failed_blocks;
 
+    /**
+     * Reads blocks ahead of ActivateBestChainStep connecting them, while
+     * one is set (see SetBlockPrefetch). pindexPrefetchLast is the last block
+     * it was given. Protected by cs_main.
+     */
+    CBlockPipeline* pblockprefetch = nullptr;
+    const CBlockIndex* pindexPrefetchLast = nullptr;
+
 public:
     CChain chainActive;
     BlockMap mapBlockIndex;
@@ -238,9 +251,9 @@ public:
     bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock);
 
     // Block (dis)connection on a given view:
-    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view);
+    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, CCoinsStatsDelta* pstatsDelta = nullptr);
     bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false);
+                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false, CCoinsStatsDelta* pstatsDelta = nullptr);
 
     // Block disconnection on our pcoinsTip:
     bool DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool);
@@ -253,15 +266,20 @@ public:
     bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
     bool RewindBlockIndex(const CChainParams& params);
     bool LoadGenesisBlock(const CChainParams& chainparams);
+    bool LoadTxOutSnapshot(const CChainParams& chainparams, CAutoFile& file, CTxOutSnapshotHeader& header, std::string& strFailReason);
     bool ComputeStakeModifier(CBlockIndex* pindex, const CBlock& block, const CChainParams& chainparams);
 
     void PruneBlockIndexCandidates();
 
     void UnloadBlockIndex();
 
+    void SetBlockPrefetch(CBlockPipeline* pipeline);
+
 private:
     bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace);
     bool ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool);
+    void PrefetchBlocks(const CBlockIndex* pindexMostWork);
+    std::shared_ptr<const CBlock> TakePrefetchedBlock(const CBlockIndex* pindex);
 
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block);
     /** Create a new block index entry for a given block hash */
@@ -292,6 +310,7 @@ std::atomic_bool fReindex(false);
 bool fTxIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
+bool fTxOutSnapshot = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
@@ -306,6 +325,7 @@ int blockchainStatus = -2 ;
 bool fAbortScanForHash = false;
 
 uint256 hashAssumeValid;
+bool fAssumeValidStake = DEFAULT_ASSUME_VALID_STAKE;
 arith_uint256 nMinimumChainWork;
 
 CFeeRate minRelayTxFee = CFeeRate(DEFAULT_MIN_RELAY_TX_FEE);
@@ -363,8 +383,10 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
+std::unique_ptr<CCoinsViewBackgroundFlush> pcoinsflush;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
 std::unique_ptr<CBlockTreeDB> pblocktree;
+CBlockFileCache g_blockfilecache;
 
 enum FlushStateMode {
     FLUSH_STATE_NONE,
@@ -628,7 +650,7 @@ static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationSt
 
 static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx,
                               bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool bypass_limits, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+                              bool bypass_limits, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache, bool fTrustScripts)
 {
     const CTransaction& tx = *ptx;
     const uint256 hash = tx.GetHash();
@@ -993,8 +1015,10 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
+        // Transactions reloaded from disk had their scripts checked under the
+        // same flags before, and only need the checks above.
         PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
+        if (!fTrustScripts && !CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
             // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
             // need to turn both off, and compare against just turning off CLEANSTACK
             // to see if the failure is specifically due to witness validation.
@@ -1023,7 +1047,7 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
         // invalid blocks (using TestBlockValidity), however allowing such
         // transactions into the mempool can be exploited as a DoS attack.
         unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
-        if (!CheckInputsFromMempoolAndCache(tx, state, view, pool, currentBlockScriptVerifyFlags, true, txdata))
+        if (!fTrustScripts && !CheckInputsFromMempoolAndCache(tx, state, view, pool, currentBlockScriptVerifyFlags, true, txdata))
         {
             // If we're using promiscuousmempoolflags, we may hit this normally
             // Check if current block has some flags that scriptVerifyFlags
@@ -1080,10 +1104,10 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
 /** (try to) add transaction to memory pool with a specified acceptance time **/
 static bool AcceptToMemoryPoolWithTime(const CChainParams& chainparams, CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx,
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                        bool bypass_limits, const CAmount nAbsurdFee)
+                        bool bypass_limits, const CAmount nAbsurdFee, bool fTrustScripts = false)
 {
     std::vector<COutPoint> coins_to_uncache;
-    bool res = AcceptToMemoryPoolWorker(chainparams, pool, state, tx, pfMissingInputs, nAcceptTime, plTxnReplaced, bypass_limits, nAbsurdFee, coins_to_uncache);
+    bool res = AcceptToMemoryPoolWorker(chainparams, pool, state, tx, pfMissingInputs, nAcceptTime, plTxnReplaced, bypass_limits, nAbsurdFee, coins_to_uncache, fTrustScripts);
     if (!res) {
         for (const COutPoint& hashTx : coins_to_uncache)
             pcoinsTip->Uncache(hashTx);
@@ -1102,6 +1126,31 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, pfMissingInputs, GetTime(), plTxnReplaced, bypass_limits, nAbsurdFee);
 }
 
+bool ReadTxFromIndex(CBlockTreeDB& blocktree, const uint256& hash, CTransactionRef& tx, CBlockHeader& header, CDiskTxPos& postx)
+{
+    std::vector<CDiskTxPos> vpos;
+    if (!blocktree.ReadTxIndex(hash, vpos))
+        return false;
+    // Other transactions may share the index key
+    for (const CDiskTxPos& pos : vpos) {
+        CBlockFileReader file(g_blockfilecache, pos, "blk", SER_DISK, CLIENT_VERSION);
+        try {
+            file >> header;
+            file.ignore(pos.nTxOffset);
+            file >> tx;
+        } catch (const std::exception& e) {
+            error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            continue;
+        }
+        if (tx->GetHash() == hash) {
+            postx = pos;
+            return true;
+        }
+    }
+    tx.reset();
+    return false;
+}
+
 /**
  * Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock.
  * If blockIndex is provided, the transaction is fetched from the corresponding block.
@@ -1121,21 +1170,9 @@ bool GetTransaction(const uint256& hash, CTransactionRef& txOut, const Consensus
 
         if (fTxIndex) {
             CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
-                CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (const std::exception& e) {
-                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-                }
+            CBlockHeader header;
+            if (ReadTxFromIndex(*pblocktree, hash, txOut, header, postx)) {
                 hashBlock = header.GetHash();
-                if (txOut->GetHash() != hash)
-                    return error("%s: txid mismatch", __func__);
                 return true;
             }
 
@@ -1200,10 +1237,12 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    // Read the whole block with one call if its size is known
+    CBlockFileReader filein(g_blockfilecache, pos, "blk", SER_DISK, CLIENT_VERSION);
+    unsigned int nSize;
+    if (g_blockfilecache.ReadRecordSize(pos, "blk", nSize) && nSize <= MAX_SIZE) {
+        filein.Prefetch(nSize);
+    }
 
     // Read block
     try {
@@ -1524,16 +1563,31 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 
 static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
 static uint256 scriptExecutionCacheNonce(GetRandHash());
+static SigCacheStats scriptExecutionCacheStats; // guarded by cs_main
 
 void InitScriptExecutionCache() {
     // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
     // setup_bytes creates the minimum possible cache (2 elements).
-    size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nMaxCacheSize = GetSigCacheBytes(gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE));
     size_t nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize);
+    scriptExecutionCacheStats.nElements = nElems;
     LogPrintf("Using %zu MiB out of %zu/2 requested for script execution cache, able to store %zu elements\n",
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+size_t ResizeScriptExecutionCache(size_t nBytes) {
+    AssertLockHeld(cs_main);
+    size_t nElems = scriptExecutionCache.resize_bytes(nBytes);
+    scriptExecutionCacheStats.nElements = nElems;
+    LogPrintf("Resized script execution cache to %zu MiB, able to store %zu elements\n", (nElems*sizeof(uint256)) >>20, nElems);
+    return nElems;
+}
+
+SigCacheStats GetScriptExecutionCacheStats() {
+    AssertLockHeld(cs_main);
+    return scriptExecutionCacheStats;
+}
+
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set.
@@ -1548,6 +1602,34 @@ void InitScriptExecutionCache() {
  *
  * Non-static (and re-declared) in src/test/txvalidationcache_tests.cpp
  */
+/**
+ * Fill in state for the input check of tx that failed under flags, and return
+ * false.
+ */
+static bool ScriptCheckFailed(CValidationState& state, const CScriptCheck& check, const CTxOut& txout, const CTransaction& tx, unsigned int nIn, unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata)
+{
+    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
+        // Check whether the failure was caused by a
+        // non-mandatory script verification check, such as
+        // non-standard DER encodings or non-null dummy
+        // arguments; if so, don't trigger DoS protection to
+        // avoid splitting the network between upgraded and
+        // non-upgraded nodes.
+        CScriptCheck check2(txout, tx, nIn,
+                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
+        if (check2())
+            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
+    }
+    // Failures of other flags indicate a transaction that is
+    // invalid in new blocks, e.g. an invalid P2SH. We DoS ban
+    // such nodes as they are not following the protocol. That
+    // said during an upgrade careful thought should be taken
+    // as to the correct behavior - we may want to continue
+    // peering with non-upgraded nodes even after soft-fork
+    // super-majority signaling has occurred.
+    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+}
+
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
 {
     // if (!tx.IsCoinBase() && !tx.IsCoinStake())
@@ -1578,8 +1660,10 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
             AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
             if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
+                scriptExecutionCacheStats.nHits++;
                 return true;
             }
+            scriptExecutionCacheStats.nMisses++;
 
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
@@ -1598,33 +1682,14 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
                 } else if (!check()) {
-                    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
-                        // Check whether the failure was caused by a
-                        // non-mandatory script verification check, such as
-                        // non-standard DER encodings or non-null dummy
-                        // arguments; if so, don't trigger DoS protection to
-                        // avoid splitting the network between upgraded and
-                        // non-upgraded nodes.
-                        CScriptCheck check2(coin.out, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
-                        if (check2())
-                            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
-                    }
-                    // Failures of other flags indicate a transaction that is
-                    // invalid in new blocks, e.g. an invalid P2SH. We DoS ban
-                    // such nodes as they are not following the protocol. That
-                    // said during an upgrade careful thought should be taken
-                    // as to the correct behavior - we may want to continue
-                    // peering with non-upgraded nodes even after soft-fork
-                    // super-majority signaling has occurred.
-                    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+                    return ScriptCheckFailed(state, check, coin.out, tx, i, flags, cacheSigStore, txdata);
                 }
             }
 
             if (cacheFullScriptStore && !pvChecks) {
                 // We executed all of the provided scripts, and were told to
                 // cache the result. Do so now.
-                scriptExecutionCache.insert(hashCacheEntry);
+                scriptExecutionCacheStats.nEvictions += scriptExecutionCache.insert(hashCacheEntry);
             }
         }
     }
@@ -1668,14 +1733,16 @@ static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
         return error("%s: no undo data available", __func__);
     }
 
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
+    // Read the undo data and its checksum with one call if the size is known
+    CBlockFileReader filein(g_blockfilecache, pos, "rev", SER_DISK, CLIENT_VERSION);
+    unsigned int nSize;
+    if (g_blockfilecache.ReadRecordSize(pos, "rev", nSize) && nSize <= MAX_SIZE) {
+        filein.Prefetch(nSize + sizeof(uint256));
+    }
 
     // Read block
     uint256 hashChecksum;
-    CHashVerifier<CAutoFile> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
+    CHashVerifier<CBlockFileReader> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
     try {
         verifier << pindex->pprev->GetBlockHash();
         verifier >> blockundo;
@@ -1748,7 +1815,7 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  When FAILED is returned, view is left in an indeterminate state. */
-DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view)
+DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, CCoinsStatsDelta* pstatsDelta)
 {
     bool fClean = true;
 
@@ -1778,6 +1845,7 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
                 COutPoint out(hash, o);
                 Coin coin;
                 bool is_spent = view.SpendCoin(out, &coin);
+                if (is_spent && pstatsDelta) pstatsDelta->SpendCoin(coin.out);
                 if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != coin.nHeight || (is_coinbase || is_coinstake) != coin.fCoinBase) {
                     fClean = false; // transaction output mismatch
                 }
@@ -1795,6 +1863,7 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
             }
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
+                if (pstatsDelta) pstatsDelta->AddCoin(txundo.vprevout[j].out);
                 int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out);
                 if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
                 fClean = fClean && res != DISCONNECT_UNCLEAN;
@@ -1881,6 +1950,135 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+CStakeSignatureCheck::CStakeSignatureCheck(const CBlock& block)
+{
+    if (!nScriptCheckThreads || !block.IsProofOfStake())
+        return;
+    const CTransaction& tx = *block.vtx[1];
+    {
+        LOCK(cs_main);
+        if (chainActive.Tip() == nullptr || block.hashPrevBlock != chainActive.Tip()->GetBlockHash())
+            return;
+        txdata.reset(new PrecomputedTransactionData(tx));
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            const Coin& coin = pcoinsTip->AccessCoin(tx.vin[i].prevout);
+            if (!coin.IsSpent())
+                vChecks.emplace_back(coin.out, tx, i, STANDARD_SCRIPT_VERIFY_FLAGS, true, txdata.get());
+        }
+    }
+    if (vChecks.empty())
+        return;
+    // A failure is reported when the stake is checked
+    control.reset(new CCheckQueueControl<CScriptCheck>(&scriptcheckqueue));
+    control->Add(vChecks);
+}
+
+CStakeSignatureCheck::~CStakeSignatureCheck()
+{
+    // Waits for the queued checks
+    control.reset();
+}
+
+bool PreVerifyTransaction(const CTransactionRef& ptx, CValidationState& state)
+{
+    AssertLockNotHeld(cs_main);
+    const CTransaction& tx = *ptx;
+
+    // The checks AcceptToMemoryPool makes before the scripts come first, so
+    // that nothing is verified here that it would reject anyway
+    CValidationState stateDummy;
+    if (!CheckTransaction(tx, stateDummy) || tx.IsCoinBase() || tx.IsCoinStake())
+        return true;
+
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    bool witnessEnabled;
+    {
+        LOCK2(cs_main, mempool.cs);
+        if (mempool.exists(tx.GetHash()))
+            return true;
+        witnessEnabled = IsWitnessEnabled(chainActive.Tip(), Params().GetConsensus());
+        for (const CTxIn& txin : tx.vin) {
+            // Look the coins up without pulling them into the coins cache;
+            // which of them are still unspent is for AcceptToMemoryPool to
+            // tell, but a signature is cached whatever coin it was checked against.
+            Coin coin;
+            CTransactionRef txFrom = mempool.get(txin.prevout.hash);
+            if (txFrom) {
+                if (txin.prevout.n >= txFrom->vout.size())
+                    return true;
+                coin = Coin(txFrom->vout[txin.prevout.n], MEMPOOL_HEIGHT, false);
+            } else if (pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                coin = pcoinsTip->AccessCoin(txin.prevout);
+            } else if (!pcoinsflush || !pcoinsflush->GetCoin(txin.prevout, coin) || coin.IsSpent()) {
+                // Perhaps an orphan
+                return true;
+            }
+            view.AddCoin(txin.prevout, std::move(coin), true);
+        }
+    }
+
+    std::string reason;
+    if (tx.HasWitness() && !witnessEnabled && !gArgs.GetBoolArg("-prematurewitness", false))
+        return true;
+    if (fRequireStandard && (!IsStandardTx(tx, reason, witnessEnabled) || !AreInputsStandard(tx, view)))
+        return true;
+    int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+    if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
+        return true;
+    const CAmount nValueIn = view.GetValueIn(tx);
+    if (nValueIn < tx.GetValueOut() || nValueIn - tx.GetValueOut() < ::minRelayTxFee.GetFee(GetVirtualTransactionSize(tx, nSigOpsCost)))
+        return true;
+
+    unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!Params().RequireStandard()) {
+        scriptVerifyFlags = gArgs.GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
+    }
+    PrecomputedTransactionData txdata(tx);
+    std::vector<CScriptCheck> vChecks;
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        vChecks.emplace_back(view.AccessCoin(tx.vin[i].prevout).out, tx, i, scriptVerifyFlags, true, &txdata);
+    }
+    bool fValid = true;
+    if (nScriptCheckThreads && vChecks.size() > 1) {
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        control.Add(vChecks);
+        fValid = control.Wait();
+    } else {
+        for (CScriptCheck& check : vChecks) {
+            if (!check()) {
+                fValid = false;
+                break;
+            }
+        }
+    }
+    if (fValid)
+        return true;
+
+    // Find the input that failed, and report it as AcceptToMemoryPool would
+    auto fScriptsPass = [&](unsigned int flags) {
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            if (!CScriptCheck(view.AccessCoin(tx.vin[i].prevout).out, tx, i, flags, true, &txdata)())
+                return false;
+        }
+        return true;
+    };
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        const CTxOut& txout = view.AccessCoin(tx.vin[i].prevout).out;
+        CScriptCheck check(txout, tx, i, scriptVerifyFlags, true, &txdata);
+        if (check())
+            continue;
+        ScriptCheckFailed(state, check, txout, tx, i, scriptVerifyFlags, true, txdata);
+        if (!tx.HasWitness() && fScriptsPass(scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK)) &&
+                !fScriptsPass(scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK)) {
+            // Only the witness is missing, so the transaction itself may be fine.
+            state.SetCorruptionPossible();
+        }
+        return false;
+    }
+    return true;
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1975,6 +2173,15 @@ bool GetCoinAge(uint64_t& nCoinAge, const CTransaction *tx)
     if (tx->IsCoinBase())
         return true;
 
+    if (fTxIndex) {
+        // Look all inputs up in one pass; GetTransaction then finds them cached
+        std::vector<uint256> vtxid;
+        for (const CTxIn& txin : tx->vin)
+            vtxid.push_back(txin.prevout.hash);
+        std::map<uint256, std::vector<CDiskTxPos> > mapPos;
+        pblocktree->ReadTxIndex(vtxid, mapPos);
+    }
+
     for(const CTxIn& txin : tx->vin)
     {
         // First try finding the previous transaction in database
@@ -1987,12 +2194,11 @@ bool GetCoinAge(uint64_t& nCoinAge, const CTransaction *tx)
         if (tx->nTime < txPrev.get()->nTime)
             return false;  // Transaction timestamp violation
 
-        // Read block header
-        CBlock block;
-        CBlockIndex* pblockindex = mapBlockIndex[hashBlock];
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-            return false; // unable to read block of previous transaction
-        if (block.GetBlockTime() + Params().GetConsensus().nStakeMinAge > tx->nTime)
+        // The block index has the header; no need to read the block
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi == mapBlockIndex.end())
+            return false; // unknown block of previous transaction
+        if (mi->second->GetBlockTime() + Params().GetConsensus().nStakeMinAge > tx->nTime)
             continue; // only count coins meeting min age requirement
 
         int64_t nValueIn = txPrev.get()->vout[txin.prevout.n].nValue;
@@ -2020,11 +2226,50 @@ static int64_t nBlocksTotal = 0;
 
 static std::map<int, CAmount> totalBalanceMap;
 
+bool ScriptChecksRequired(const CBlockIndex* pindex, const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    if (!hashAssumeValid.IsNull()) {
+        // We've been configured with the hash of a block which has been externally verified to have a valid history.
+        // A suitable default value is included with the software and updated from time to time.  Because validity
+        //  relative to a piece of software is an objective fact these defaults can be easily reviewed.
+        // This setting doesn't force the selection of any particular chain but makes validating some faster by
+        //  effectively caching the result of part of the verification.
+        BlockMap::const_iterator  it = mapBlockIndex.find(hashAssumeValid);
+        if (it != mapBlockIndex.end()) {
+            if (it->second->GetAncestor(pindex->nHeight) == pindex &&
+                pindexBestHeader->GetAncestor(pindex->nHeight) == pindex &&
+                pindexBestHeader->nChainWork >= nMinimumChainWork) {
+                // This block is a member of the assumed verified chain and an ancestor of the best header.
+                // The equivalent time check discourages hash power from extorting the network via DOS attack
+                //  into accepting an invalid block through telling users they must manually set assumevalid.
+                //  Requiring a software change or burying the invalid block, regardless of the setting, makes
+                //  it hard to hide the implication of the demand.  This also avoids having release candidates
+                //  that are hardly doing any signature verification at all in testing without having to
+                //  artificially set the default assumed verified block further back.
+                // The test against nMinimumChainWork prevents the skipping when denied access to any chain at
+                //  least as good as the expected chain.
+                return (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, chainparams.GetConsensus()) <= 60 * 60 * 24 * 7 * 2);
+            }
+        }
+    }
+    return true;
+}
+
+bool StakeChecksRequired(const CBlockIndex* pindex, const CChainParams& chainparams)
+{
+    // DeepOnion: blocks whose scripts aren't checked can also skip verifying
+    // the coinstake signature and recomputing the coin age it claims its
+    // reward for. The proof-of-stake hash is still computed, as the stake
+    // modifiers of later blocks and their checkpoints depend on it.
+    return !fAssumeValidStake || ScriptChecksRequired(pindex, chainparams);
+}
+
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
  *  can fail if those validity checks fail (among other reasons). */
 bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, CCoinsStatsDelta* pstatsDelta)
 {
 	LogPrint(BCLog::STAKE, ">> ConnectBlock\n");
     AssertLockHeld(cs_main);
@@ -2064,31 +2309,9 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
 
     nBlocksTotal++;
 
-    bool fScriptChecks = true;
-    if (!hashAssumeValid.IsNull()) {
-        // We've been configured with the hash of a block which has been externally verified to have a valid history.
-        // A suitable default value is included with the software and updated from time to time.  Because validity
-        //  relative to a piece of software is an objective fact these defaults can be easily reviewed.
-        // This setting doesn't force the selection of any particular chain but makes validating some faster by
-        //  effectively caching the result of part of the verification.
-        BlockMap::const_iterator  it = mapBlockIndex.find(hashAssumeValid);
-        if (it != mapBlockIndex.end()) {
-            if (it->second->GetAncestor(pindex->nHeight) == pindex &&
-                pindexBestHeader->GetAncestor(pindex->nHeight) == pindex &&
-                pindexBestHeader->nChainWork >= nMinimumChainWork) {
-                // This block is a member of the assumed verified chain and an ancestor of the best header.
-                // The equivalent time check discourages hash power from extorting the network via DOS attack
-                //  into accepting an invalid block through telling users they must manually set assumevalid.
-                //  Requiring a software change or burying the invalid block, regardless of the setting, makes
-                //  it hard to hide the implication of the demand.  This also avoids having release candidates
-                //  that are hardly doing any signature verification at all in testing without having to
-                //  artificially set the default assumed verified block further back.
-                // The test against nMinimumChainWork prevents the skipping when denied access to any chain at
-                //  least as good as the expected chain.
-                fScriptChecks = (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, chainparams.GetConsensus()) <= 60 * 60 * 24 * 7 * 2);
-            }
-        }
-    }
+    const bool fScriptChecks = ScriptChecksRequired(pindex, chainparams);
+    // As StakeChecksRequired(), without looking up the -assumevalid block again
+    const bool fStakeChecks = fScriptChecks || !fAssumeValidStake;
 
     int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
     LogPrint(BCLog::BENCH, "    - Sanity checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime1 - nTimeStart), nTimeCheck * MICRO, nTimeCheck * MILLI / nBlocksTotal);
@@ -2218,9 +2441,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
         }
-        
-        if(!fJustCheck)
-        	UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+        // Later transactions may spend these outputs, also when just checking
+        UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
     LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", 
@@ -2240,7 +2462,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
 			return state.DoS(100, error("ConnectBlock(): coinbase pays too much (actual=%d vs limit=%d)",
 				block.vtx[0]->GetValueOut(), blockReward), REJECT_INVALID, "bad-cb-amount");
     }
-    else if(block.IsProofOfStake())
+    else if(block.IsProofOfStake() && fStakeChecks)
     {
         // DeepOnion: coin stake tx earns reward instead of paying fee
         uint64_t nCoinAge;
@@ -2263,7 +2485,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         if (pBlock0->IsProofOfStake())
         {
             LogPrint(BCLog::STAKE, ">> To CheckProofOfStake, Block = %s\n", pBlock0->ToString().c_str());
-            if(!CheckProofOfStake(*pblocktree, pindex->pprev, state, block, hashProofOfStake, targetProofOfStake, mapBlockIndex, *pcoinsTip))
+            if(!CheckProofOfStake(*pblocktree, pindex->pprev, state, block, hashProofOfStake, targetProofOfStake, mapBlockIndex, *pcoinsTip, fStakeChecks))
             {
                 return error("ConnectBlock(): check proof-of-stake failed for block %s\n", pBlock0->GetHash().ToString().c_str());
             }
@@ -2287,6 +2509,19 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (!WriteTxIndexDataForBlock(block, state, pindex))
         return false;
 
+    if (pstatsDelta) {
+        for (const CTransactionRef& tx : block.vtx) {
+            for (const CTxOut& out : tx->vout) {
+                if (!out.scriptPubKey.IsUnspendable()) pstatsDelta->AddCoin(out);
+            }
+        }
+        for (const CTxUndo& txundo : blockundo.vtxundo) {
+            for (const Coin& coin : txundo.vprevout) {
+                pstatsDelta->SpendCoin(coin.out);
+            }
+        }
+    }
+
     assert(pindex->phashBlock);
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
@@ -2355,10 +2590,13 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
         int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
         int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
         int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
+        // Coins flushed earlier may still be on their way to disk; the cache
+        // shares the budget with what is left of them.
+        int64_t nFlushingSize = pcoinsflush ? pcoinsflush->DynamicMemoryUsage() : 0;
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now (not in the middle of a block processing).
-        bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
+        bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && nFlushingSize == 0 && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
         // The cache is over the limit, we have to write now.
-        bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize > nTotalSpace;
+        bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize + nFlushingSize > nTotalSpace;
         // It's been a while since we wrote the block index to disk. Do this frequently, so we don't need to redownload after a crash.
         bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
         // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
@@ -2407,6 +2645,10 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             // Flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
                 return AbortNode(state, "Failed to write to coin database");
+            // The coins are written in the background, unless the caller
+            // relies on the database or block files are about to go away.
+            if (pcoinsflush && (mode == FLUSH_STATE_ALWAYS || fFlushForPrune) && !pcoinsflush->Sync())
+                return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
         }
     }
@@ -2434,6 +2676,40 @@ void PruneAndFlush() {
     FlushStateToDisk(chainparams, state, FLUSH_STATE_NONE);
 }
 
+//! Whether mapBlockIndex holds everything in the block index database
+static bool fBlockIndexLoaded = false;
+
+bool WriteBlockIndexSnapshot() {
+    LOCK(cs_main);
+    // The snapshot has to match the database: everything in it must have been written
+    if (!fBlockIndexLoaded || !pblocktree || mapBlockIndex.empty() || !setDirtyBlockIndex.empty())
+        return false;
+
+    // Usually only the entries written this session have to be copied
+    int64_t nStart = GetTimeMillis();
+    size_t nChanged;
+    if (pblocktree->UpdateBlockIndexSnapshot([](const uint256& hash) -> const CBlockIndex* {
+            BlockMap::const_iterator mi = mapBlockIndex.find(hash);
+            return mi == mapBlockIndex.end() ? nullptr : mi->second;
+        }, nChanged)) {
+        if (nChanged > 0)
+            LogPrintf("Updated %u block index entries in the snapshot in %dms\n", nChanged, GetTimeMillis() - nStart);
+        return true;
+    }
+
+    std::vector<const CBlockIndex*> vIndex;
+    vIndex.reserve(mapBlockIndex.size());
+    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
+        vIndex.push_back(item.second);
+    std::sort(vIndex.begin(), vIndex.end(), [](const CBlockIndex* a, const CBlockIndex* b) { return a->nHeight < b->nHeight; });
+
+    nStart = GetTimeMillis();
+    if (!pblocktree->WriteBlockIndexSnapshot(vIndex))
+        return error("%s: failed to write the block index snapshot", __func__);
+    LogPrintf("Wrote %u block index entries to the snapshot in %dms\n", vIndex.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
 static void DoWarning(const std::string& strWarning)
 {
     static bool fWarned = false;
@@ -2520,11 +2796,13 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip.get());
+        CCoinsStatsDelta statsDelta;
         assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
+        if (DisconnectBlock(block, pindexDelete, view, pcoinsstats ? &statsDelta : nullptr) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         bool flushed = view.Flush();
         assert(flushed);
+        if (pcoinsstats) pcoinsstats->Apply(statsDelta, pindexDelete->pprev);
     }
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * MILLI);
     // Write the chain state to disk, if necessary.
@@ -2654,7 +2932,8 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
     {
         CCoinsViewCache view(pcoinsTip.get());
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
+        CCoinsStatsDelta statsDelta;
+        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams, false, pcoinsstats ? &statsDelta : nullptr);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2665,6 +2944,7 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
         LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime3 - nTime2) * MILLI, nTimeConnectTotal * MICRO, nTimeConnectTotal * MILLI / nBlocksTotal);
         bool flushed = view.Flush();
         assert(flushed);
+        if (pcoinsstats) pcoinsstats->Apply(statsDelta, pindexNew);
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint(BCLog::BENCH, "  - Flush: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime4 - nTime3) * MILLI, nTimeFlush * MICRO, nTimeFlush * MILLI / nBlocksTotal);
@@ -2785,6 +3065,7 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
     std::vector<CBlockIndex*> vpindexToConnect;
     bool fContinue = true;
     int nHeight = pindexFork ? pindexFork->nHeight : -1;
+    PrefetchBlocks(pindexMostWork);
     while (fContinue && nHeight != pindexMostWork->nHeight) {
         // Don't iterate the entire list of potential improvements toward the best tip, as we likely only need
         // a few blocks along the way.
@@ -2800,7 +3081,10 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
 
         // Connect new blocks.
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
+            std::shared_ptr<const CBlock> pblockConnect = TakePrefetchedBlock(pindexConnect);
+            if (pindexConnect == pindexMostWork && pblock)
+                pblockConnect = pblock;
+            if (!ConnectTip(state, chainparams, pindexConnect, pblockConnect, connectTrace, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -2843,6 +3127,63 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
     return true;
 }
 
+void CChainState::SetBlockPrefetch(CBlockPipeline* pipeline)
+{
+    AssertLockHeld(cs_main);
+    if (pblockprefetch)
+        pblockprefetch->Clear();
+    pblockprefetch = pipeline;
+    pindexPrefetchLast = nullptr;
+}
+
+/** Have the blocks after the tip towards pindexMostWork read ahead. */
+void CChainState::PrefetchBlocks(const CBlockIndex* pindexMostWork)
+{
+    AssertLockHeld(cs_main);
+    if (!pblockprefetch)
+        return;
+    // Carry on from the last block given, if it's still on the way
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    if (!pindexPrefetchLast || !pindexTip || pindexPrefetchLast->nHeight <= pindexTip->nHeight ||
+        pindexMostWork->GetAncestor(pindexPrefetchLast->nHeight) != pindexPrefetchLast) {
+        pblockprefetch->Clear();
+        pindexPrefetchLast = chainActive.FindFork(pindexMostWork);
+    }
+    if (!pindexPrefetchLast)
+        return;
+
+    size_t nQueued = pblockprefetch->size();
+    while (nQueued < BLOCK_PIPELINE_QUEUE && pindexPrefetchLast->nHeight < pindexMostWork->nHeight) {
+        const CBlockIndex* pindex = pindexMostWork->GetAncestor(pindexPrefetchLast->nHeight + 1);
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !pblockprefetch->Push(pindex->GetBlockPos(), pindex->GetBlockHash(), pindex->IsProofOfStake()))
+            break;
+        pindexPrefetchLast = pindex;
+        nQueued++;
+    }
+}
+
+/** The block read ahead for pindex, if it's the next one. */
+std::shared_ptr<const CBlock> CChainState::TakePrefetchedBlock(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    CBlockPipeline::Result result;
+    if (!pblockprefetch || pblockprefetch->size() == 0 || !pblockprefetch->Pop(result))
+        return nullptr;
+    if (result.hash != pindex->GetBlockHash()) {
+        // Connecting something else; start over
+        pblockprefetch->Clear();
+        pindexPrefetchLast = nullptr;
+        return nullptr;
+    }
+    return result.pblock;
+}
+
+void SetBlockPrefetch(CBlockPipeline* pipeline)
+{
+    LOCK(cs_main);
+    g_chainstate.SetBlockPrefetch(pipeline);
+}
+
 static void NotifyHeaderTip() {
     bool fNotify = false;
     bool fInitialBlockDownload = false;
@@ -3198,6 +3539,7 @@ static bool FindBlockPos(CDiskBlockPos &pos, unsigned int nAddSize, unsigned int
         }
         FlushBlockFile(!fKnown);
         nLastBlockFile = nFile;
+        g_blockfilecache.SetLastFile(nLastBlockFile);
     }
 
     vinfoBlockFile[nFile].AddBlock(nHeight, nTime);
@@ -3260,7 +3602,7 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     return true;
 }
 
-static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW)
 {
 	// Check proof of work matches claimed amount
     if (fCheckPOW && block.IsProofOfWork() && !CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams)) {
@@ -3270,7 +3612,7 @@ static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state,
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSignature)
 {
     // These are checks that are independent of context.
 
@@ -3333,9 +3675,6 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     if (nSigOps * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
         return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, "out-of-bounds SigOpCount");
 
-    if (fCheckPOW && fCheckMerkleRoot)
-        block.fChecked = true;
-
     // special check for pos blocks
     if (block.IsProofOfStake())
     {
@@ -3357,10 +3696,13 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
             return state.DoS(50, false, REJECT_INVALID, "coinstake-time-wrong", false, "coinstake timestamp violation not match block time");
 
         // DeepOnion: check proof-of-stake block signature
-        if (!CheckBlockSignature(block))
+        if (fCheckSignature && !CheckBlockSignature(block))
             return state.DoS(100, false, REJECT_INVALID, "pos-signature-wrong", false, "bad proof-of-stake block signature");
     }
 
+    if (fCheckPOW && fCheckMerkleRoot && (fCheckSignature || !block.IsProofOfStake()))
+        block.fChecked = true;
+
     return true;
 }
 
@@ -3860,7 +4202,17 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
         CValidationState state;
         // Ensure that CheckBlock() passes before calling AcceptBlock, as
         // belt-and-suspenders.
-        bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus());
+        bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus(), true, true, false);
+        if (ret && !pblock->fChecked) {
+            // DeepOnion: only once the block is known to be well formed, verify
+            // the coinstake's input scripts on the script check threads while
+            // checking the block signature here
+            CStakeSignatureCheck stakecheck(*pblock);
+            if (CheckBlockSignature(*pblock))
+                pblock->fChecked = true;
+            else
+                ret = state.DoS(100, false, REJECT_INVALID, "pos-signature-wrong", false, "bad proof-of-stake block signature");
+        }
 
         LOCK(cs_main);
 
@@ -3989,6 +4341,7 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        g_blockfilecache.Close(*it);
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4234,6 +4587,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
+    g_blockfilecache.SetLastFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
     LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
     for (int nFile = 0; nFile <= nLastBlockFile; nFile++) {
@@ -4272,13 +4626,25 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     if (fHavePruned)
         LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
 
+    // Check whether the chain state comes from a UTXO snapshot, and that loading it finished
+    bool fTxOutSnapshotLoading = false;
+    pblocktree->ReadFlag("txoutsnapshotloading", fTxOutSnapshotLoading);
+    if (fTxOutSnapshotLoading)
+        return error("%s: loading a UTXO snapshot did not finish", __func__);
+    pblocktree->ReadFlag("txoutsnapshot", fTxOutSnapshot);
+    if (fTxOutSnapshot)
+        LogPrintf("LoadBlockIndexDB(): Chain state was loaded from a UTXO snapshot\n");
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
     if(fReindexing) fReindex = true;
 
-    // Check whether we have a transaction index
+    // Check whether we have a transaction index, in either format
+    bool fTxIndexCompact = false;
     pblocktree->ReadFlag("txindex", fTxIndex);
+    pblocktree->ReadFlag("txindexcompact", fTxIndexCompact);
+    fTxIndex |= fTxIndexCompact;
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
     return true;
@@ -4313,6 +4679,180 @@ bool LoadChainTip(const CChainParams& chainparams)
     return true;
 }
 
+bool CChainState::LoadTxOutSnapshot(const CChainParams& chainparams, CAutoFile& file, CTxOutSnapshotHeader& header, std::string& strFailReason)
+{
+    AssertLockHeld(cs_main);
+
+    if (chainActive.Height() != 0) {
+        strFailReason = "A snapshot can only be loaded into a node that has no blocks but the genesis block";
+        return false;
+    }
+    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex) {
+        if (item.second->nHeight > 0 && (item.second->nStatus & BLOCK_HAVE_DATA)) {
+            strFailReason = "Blocks have been downloaded already; load the snapshot into a new data directory with the network disabled";
+            return false;
+        }
+    }
+
+    try {
+        file >> header;
+    } catch (const std::exception& e) {
+        strFailReason = strprintf("Failed to read snapshot: %s", e.what());
+        return false;
+    }
+    if (!header.IsValid(chainparams.MessageStart())) {
+        strFailReason = "Not a UTXO snapshot for this network";
+        return false;
+    }
+
+    // Until the coins are complete, refuse to start from this chain state
+    if (!pblocktree->WriteFlag("txoutsnapshotloading", true)) {
+        strFailReason = "Failed to write to block index database";
+        return false;
+    }
+    const std::string strRestart = ". Restart with -reindex.";
+
+    const MapCheckpoints& checkpoints = chainparams.Checkpoints().mapCheckpoints;
+    CBlockIndex* pindexPrev = chainActive.Genesis();
+    try {
+        // The blocks are taken as fully validated but not stored, like those
+        // of a pruned node. Their PoS data lets us check stakes from here on.
+        for (int nHeight = 1; nHeight <= header.nHeight; nHeight++) {
+            CDiskBlockIndex diskindex;
+            file >> diskindex;
+            const uint256 hash = diskindex.GetBlockHash();
+            MapCheckpoints::const_iterator checkpoint = checkpoints.find(nHeight);
+            if (diskindex.nHeight != nHeight || diskindex.hashPrev != pindexPrev->GetBlockHash() || diskindex.nTx == 0 ||
+                (checkpoint != checkpoints.end() && checkpoint->second != hash)) {
+                strFailReason = strprintf("Snapshot block index is inconsistent at height %d", nHeight) + strRestart;
+                return false;
+            }
+
+            CBlockIndex* pindex = InsertBlockIndex(hash);
+            if (pindex->nStatus & BLOCK_FAILED_MASK) {
+                strFailReason = strprintf("Snapshot contains block %s, which is marked invalid", hash.ToString()) + strRestart;
+                return false;
+            }
+            pindex->pprev            = pindexPrev;
+            pindex->nHeight          = nHeight;
+            pindex->nVersion         = diskindex.nVersion;
+            pindex->hashMerkleRoot   = diskindex.hashMerkleRoot;
+            pindex->nTime            = diskindex.nTime;
+            pindex->nBits            = diskindex.nBits;
+            pindex->nNonce           = diskindex.nNonce;
+            pindex->nStatus          = BLOCK_VALID_SCRIPTS;
+            pindex->nTx              = diskindex.nTx;
+            pindex->nFlags           = diskindex.nFlags;
+            pindex->nStakeModifier   = diskindex.nStakeModifier;
+            pindex->prevoutStake     = diskindex.prevoutStake;
+            pindex->nStakeTime       = diskindex.nStakeTime;
+            pindex->hashProofOfStake = diskindex.hashProofOfStake;
+
+            pindex->nChainWork = pindexPrev->nChainWork + GetBlockProof(*pindex);
+            pindex->nTimeMax = std::max(pindexPrev->nTimeMax, pindex->nTime);
+            pindex->nChainTx = pindexPrev->nChainTx + pindex->nTx;
+            pindex->BuildSkip();
+            pindexPrev->pnext = pindex;
+
+            pindex->nStakeModifierChecksum = GetStakeModifierChecksum(pindex);
+            if (!CheckStakeModifierCheckpoints(nHeight, pindex->nStakeModifierChecksum)) {
+                strFailReason = strprintf("Snapshot fails stake modifier checkpoint at height %d", nHeight) + strRestart;
+                return false;
+            }
+
+            setDirtyBlockIndex.insert(pindex);
+            if (pindexBestHeader == nullptr || CBlockIndexWorkComparator()(pindexBestHeader, pindex))
+                pindexBestHeader = pindex;
+            pindexPrev = pindex;
+        }
+        if (pindexPrev->GetBlockHash() != header.hashBlock) {
+            strFailReason = "Snapshot block index does not end at the snapshot block" + strRestart;
+            return false;
+        }
+
+        // Add the coins, flushing them together with the stake data of
+        // their transactions whenever the cache is full
+        CCoinsStats stats;
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << header.hashBlock;
+        std::vector<std::pair<uint256, CStakePrevTx> > vStakePrev;
+        auto flush = [&vStakePrev]() {
+            bool ret = pblocktree->WriteStakePrevTxs(vStakePrev) && pcoinsTip->Flush();
+            vStakePrev.clear();
+            return ret;
+        };
+        pcoinsTip->SetBestBlock(header.hashBlock);
+        for (uint64_t nTx = 0; nTx < header.nTransactions; nTx++) {
+            boost::this_thread::interruption_point();
+            uint256 txid;
+            CStakePrevTx txPrev;
+            unsigned int nOutputs = 0;
+            file >> txid >> txPrev >> VARINT(nOutputs);
+            std::map<uint32_t, Coin> outputs;
+            for (unsigned int i = 0; i < nOutputs; i++) {
+                uint32_t n = 0;
+                Coin coin;
+                file >> VARINT(n) >> coin;
+                if ((int)coin.nHeight > header.nHeight || !outputs.emplace(n, std::move(coin)).second) {
+                    strFailReason = strprintf("Snapshot has an invalid coin %s:%u", txid.ToString(), n) + strRestart;
+                    return false;
+                }
+            }
+            if (outputs.empty()) {
+                strFailReason = strprintf("Snapshot has no coins for %s", txid.ToString()) + strRestart;
+                return false;
+            }
+            ApplyStats(stats, ss, txid, outputs);
+            for (std::pair<const uint32_t, Coin>& output : outputs) {
+                pcoinsTip->AddCoin(COutPoint(txid, output.first), std::move(output.second), false);
+            }
+            vStakePrev.emplace_back(txid, txPrev);
+            if (pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage && !flush()) {
+                strFailReason = "Failed to write to coin database" + strRestart;
+                return false;
+            }
+        }
+
+        uint256 hashSerialized;
+        file >> hashSerialized;
+        if (stats.nTransactionOutputs != header.nTransactionOutputs || ss.GetHash() != hashSerialized) {
+            strFailReason = "Snapshot coins do not match their hash" + strRestart;
+            return false;
+        }
+        if (!flush()) {
+            strFailReason = "Failed to write to coin database" + strRestart;
+            return false;
+        }
+    } catch (const std::exception& e) {
+        strFailReason = strprintf("Failed to read snapshot: %s", e.what()) + strRestart;
+        return false;
+    }
+
+    chainActive.SetTip(pindexPrev);
+    setBlockIndexCandidates.insert(pindexPrev);
+    PruneBlockIndexCandidates();
+
+    fHavePruned = true;
+    fTxOutSnapshot = true;
+    CValidationState state;
+    if (!pblocktree->WriteFlag("prunedblockfiles", true) || !pblocktree->WriteFlag("txoutsnapshot", true) ||
+        !FlushStateToDisk(chainparams, state, FLUSH_STATE_ALWAYS) || !pblocktree->WriteFlag("txoutsnapshotloading", false)) {
+        strFailReason = "Failed to write to block index database" + strRestart;
+        return false;
+    }
+    CheckBlockIndex(chainparams.GetConsensus());
+
+    LogPrintf("%s: loaded %u coins, new tip=%s height=%d\n", __func__, header.nTransactionOutputs,
+        header.hashBlock.ToString(), header.nHeight);
+    return true;
+}
+
+bool LoadTxOutSnapshot(const CChainParams& chainparams, CAutoFile& file, CTxOutSnapshotHeader& header, std::string& strFailReason)
+{
+    LOCK(cs_main);
+    return g_chainstate.LoadTxOutSnapshot(chainparams, file, header, strFailReason);
+}
+
 CVerifyDB::CVerifyDB()
 {
     uiInterface.ShowProgress(_("Verifying blocks..."), 0, false);
@@ -4353,8 +4893,8 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone, false);
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
+        if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruned, only go back as far as we have data.
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
@@ -4525,8 +5065,8 @@ bool CChainState::RewindBlockIndex(const CChainParams& params)
     CValidationState state;
     CBlockIndex* pindex = chainActive.Tip();
     while (chainActive.Height() >= nHeight) {
-        if (fPruneMode && !(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, don't try rewinding past the HAVE_DATA point;
+        if (fHavePruned && !(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruned, don't try rewinding past the HAVE_DATA point;
             // since older blocks can't be served anyway, there's
             // no need to walk further, and trying to DisconnectTip()
             // will fail (and require a needless reindex/redownload
@@ -4615,6 +5155,7 @@ void CChainState::UnloadBlockIndex() {
     nBlockSequenceId = 1;
     g_failed_blocks.clear();
     setBlockIndexCandidates.clear();
+    pindexPrefetchLast = nullptr;
 }
 
 // May NOT be used after any connections are up as much
@@ -4630,6 +5171,8 @@ void UnloadBlockIndex()
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
+    g_blockfilecache.Clear();
+    g_blockfilecache.SetLastFile(0);
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
     versionbitscache.Clear();
@@ -4641,7 +5184,9 @@ void UnloadBlockIndex()
         delete entry.second;
     }
     mapBlockIndex.clear();
+    fBlockIndexLoaded = false;
     fHavePruned = false;
+    fTxOutSnapshot = false;
 
     g_chainstate.UnloadBlockIndex();
 }
@@ -4668,6 +5213,7 @@ bool LoadBlockIndex(const CChainParams& chainparams)
         fTxIndex = gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX);
         pblocktree->WriteFlag("txindex", fTxIndex);
     }
+    fBlockIndexLoaded = true;
     return true;
 }
 
@@ -4708,6 +5254,47 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return g_chainstate.LoadGenesisBlock(chainparams);
 }
 
+/** Find the blocks in blkdat and queue them in pipeline, parsed. */
+static void ReadExternalBlockFile(const CChainParams& chainparams, CBufferedFile& blkdat, int nFile, CBlockPipeline& pipeline)
+{
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof()) {
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
+        try {
+            // read block
+            uint64_t nBlockPos = blkdat.GetPos();
+            blkdat.SetLimit(nBlockPos + nSize);
+            blkdat.SetPos(nBlockPos);
+            CUnhashedBlock block;
+            blkdat >> block;
+            nRewind = blkdat.GetPos();
+            if (!pipeline.Push(std::move(block), CDiskBlockPos(nFile, nBlockPos), nSize))
+                break;
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+    }
+}
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
@@ -4715,52 +5302,39 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
+    // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+    CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+    // Blocks are read by one thread and hashed and checked by a pool, while
+    // this one validates them in file order.
+    CBlockPipeline pipeline(chainparams.GetConsensus(), GetBlockPipelineThreads());
+    std::thread threadRead([&] {
+        ReadExternalBlockFile(chainparams, blkdat, dbp ? dbp->nFile : -1, pipeline);
+        pipeline.Finish();
+    });
+    struct CStopReader {
+        CBlockPipeline& pipeline;
+        std::thread& thread;
+        ~CStopReader() { pipeline.Interrupt(); thread.join(); }
+    } stopReader{pipeline, threadRead};
+
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        CBlockPipeline::Result result;
+        while (pipeline.Pop(result)) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
             try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
+                if (!result.pblock)
+                    throw std::runtime_error("unable to read block at " + result.pos.ToString());
+                std::shared_ptr<CBlock> pblock = result.pblock;
+                const uint256& hash = result.hash;
+                CDiskBlockPos* dbpBlock = dbp ? &result.pos : nullptr;
 
                 // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(pblock->hashPrevBlock) == mapBlockIndex.end()) {
                     LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                            pblock->hashPrevBlock.ToString());
+                    if (dbpBlock)
+                        mapBlocksUnknownParent.insert(std::make_pair(pblock->hashPrevBlock, *dbpBlock));
                     continue;
                 }
 
@@ -4768,7 +5342,7 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
                     LOCK(cs_main);
                     CValidationState state;
-                    if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr))
+                    if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbpBlock, nullptr))
                         nLoaded++;
                     if (state.IsError())
                         break;
@@ -4820,8 +5394,11 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
-    if (nLoaded > 0)
-        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    if (nLoaded > 0) {
+        CBlockPipeline::Stats stats = pipeline.GetStats();
+        LogPrintf("Loaded %i blocks from external file in %dms (%.1f MiB; validation waited %dms for hashing, reading waited %dms for validation)\n",
+            nLoaded, GetTimeMillis() - nStart, stats.nBytes / 1048576.0, stats.nPopWaitMicros / 1000, stats.nPushWaitMicros / 1000);
+    }
     return nLoaded > 0;
 }
 
@@ -5039,12 +5616,24 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
     return VersionBitsStateSinceHeight(chainActive.Tip(), params, pos, versionbitscache);
 }
 
-static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+static const uint64_t MEMPOOL_DUMP_VERSION = 2;
 
-bool LoadMempool(void)
+static CMempoolJournal mempooljournal;
+//! Serializes writing mempool.dat and replacing its journal; taken before cs_main
+static CCriticalSection cs_mempooldump;
+
+static CMempoolScriptFlags GetMempoolScriptFlags(const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    unsigned int nPolicyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!chainparams.RequireStandard()) {
+        nPolicyFlags = gArgs.GetArg("-promiscuousmempoolflags", nPolicyFlags);
+    }
+    return CMempoolScriptFlags(nPolicyFlags, GetBlockScriptFlags(chainActive.Tip(), chainparams.GetConsensus()));
+}
+
+static bool ReadMempoolSnapshot(CMempoolReplay& replay, uint256& nonce)
 {
-    const CChainParams& chainparams = Params();
-    int64_t nExpiryTimeout = gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
     FILE* filestr = fsbridge::fopen(GetDataDir() / "mempool.dat", "rb");
     CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
     if (file.IsNull()) {
@@ -5052,18 +5641,18 @@ bool LoadMempool(void)
         return false;
     }
 
-    int64_t count = 0;
-    int64_t expired = 0;
-    int64_t failed = 0;
-    int64_t already_there = 0;
-    int64_t nNow = GetTime();
-
     try {
         uint64_t version;
         file >> version;
-        if (version != MEMPOOL_DUMP_VERSION) {
+        if (version != 1 && version != MEMPOOL_DUMP_VERSION) {
             return false;
         }
+        // Version 1 dumps have no journal, nor say what they were checked under
+        CMempoolScriptFlags flags;
+        if (version >= 2) {
+            file >> nonce;
+            file >> flags;
+        }
         uint64_t num;
         file >> num;
         while (num--) {
@@ -5074,17 +5663,77 @@ bool LoadMempool(void)
             file >> nTime;
             file >> nFeeDelta;
 
-            CAmount amountdelta = nFeeDelta;
-            if (amountdelta) {
-                mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
+            if (nFeeDelta) {
+                replay.mapDeltas[tx->GetHash()] += nFeeDelta;
             }
+            replay.Add(tx, nTime);
+        }
+        replay.SetFlags(flags);
+
+        std::map<uint256, CAmount> mapDeltas;
+        file >> mapDeltas;
+        for (const auto& i : mapDeltas) {
+            replay.mapDeltas[i.first] += i.second;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
+
+bool LoadMempool(void)
+{
+    const CChainParams& chainparams = Params();
+    int64_t nExpiryTimeout = gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    int64_t nStart = GetTimeMicros();
+
+    CMempoolReplay replay;
+    uint256 nonce;
+    if (!ReadMempoolSnapshot(replay, nonce)) {
+        return false;
+    }
+    if (!nonce.IsNull()) {
+        ReadMempoolJournal(GetDataDir() / "mempool.journal", nonce, replay);
+    }
+
+    int64_t count = 0;
+    int64_t trusted = 0;
+    int64_t expired = 0;
+    int64_t failed = 0;
+    int64_t already_there = 0;
+    int64_t nNow = GetTime();
+
+    for (const auto& i : replay.mapDeltas) {
+        mempool.PrioritiseTransaction(i.first, i.second);
+    }
+
+    // A child re-added before its parent, when a reorg put the parent back
+    // in the mempool, is retried once the others are in
+    std::vector<const CMempoolReplay::Entry*> vEntries;
+    for (const CMempoolReplay::Entry& entry : replay.GetEntries()) {
+        if (entry.nTime + nExpiryTimeout > nNow) {
+            vEntries.push_back(&entry);
+        } else {
+            ++expired;
+        }
+    }
+    while (!vEntries.empty()) {
+        std::vector<const CMempoolReplay::Entry*> vMissingInputs;
+        for (const CMempoolReplay::Entry* entry : vEntries) {
+            const CTransactionRef& tx = entry->tx;
             CValidationState state;
-            if (nTime + nExpiryTimeout > nNow) {
+            bool fMissingInputs = false;
+            {
                 LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, nullptr /* pfMissingInputs */, nTime,
-                                           nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */);
-                if (state.IsValid()) {
+                bool fTrustScripts = !entry->flags.IsNull() && entry->flags == GetMempoolScriptFlags(chainparams);
+                AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, &fMissingInputs, entry->nTime,
+                                           nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */, fTrustScripts);
+                if (state.IsValid() && !fMissingInputs) {
                     ++count;
+                    if (fTrustScripts) ++trusted;
+                } else if (fMissingInputs) {
+                    vMissingInputs.push_back(entry);
                 } else {
                     // mempool may contain the transaction already, e.g. from
                     // wallet(s) having loaded it while we were processing
@@ -5096,40 +5745,46 @@ bool LoadMempool(void)
                         ++failed;
                     }
                 }
-            } else {
-                ++expired;
             }
             if (ShutdownRequested())
                 return false;
         }
-        std::map<uint256, CAmount> mapDeltas;
-        file >> mapDeltas;
-
-        for (const auto& i : mapDeltas) {
-            mempool.PrioritiseTransaction(i.first, i.second);
+        if (vMissingInputs.size() == vEntries.size()) {
+            failed += vMissingInputs.size();
+            break;
         }
-    } catch (const std::exception& e) {
-        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
-        return false;
+        vEntries.swap(vMissingInputs);
     }
 
-    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i expired, %i already there\n", count, failed, expired, already_there);
+    LogPrintf("Imported mempool transactions from disk: %i succeeded (%i with scripts already checked), %i failed, %i expired, %i already there, in %.2fs\n",
+        count, trusted, failed, expired, already_there, (GetTimeMicros() - nStart) * MICRO);
     return true;
 }
 
-bool DumpMempool(void)
+static bool DumpMempool(const CChainParams& chainparams, bool fStartJournal)
 {
+    AssertLockHeld(cs_mempooldump);
     int64_t start = GetTimeMicros();
 
     std::map<uint256, CAmount> mapDeltas;
     std::vector<TxMempoolInfo> vinfo;
+    CMempoolScriptFlags flags;
+    const bool fJournal = fStartJournal || mempooljournal.IsRecording();
+    const uint256 nonce = GetRandHash();
 
     {
-        LOCK(mempool.cs);
+        LOCK2(cs_main, mempool.cs);
         for (const auto &i : mempool.mapDeltas) {
             mapDeltas[i.first] = i.second;
         }
         vinfo = mempool.infoAll();
+        // What the transactions were checked under is only known while
+        // journaling, from the load of the mempool on
+        if (fJournal) {
+            const CMempoolScriptFlags flagsNow = GetMempoolScriptFlags(chainparams);
+            flags = fStartJournal ? flagsNow : mempooljournal.GetFlags(flagsNow);
+            mempooljournal.Restart(mempool, flags, mapDeltas);
+        }
     }
 
     int64_t mid = GetTimeMicros();
@@ -5144,6 +5799,8 @@ bool DumpMempool(void)
 
         uint64_t version = MEMPOOL_DUMP_VERSION;
         file << version;
+        file << nonce;
+        file << flags;
 
         file << (uint64_t)vinfo.size();
         for (const auto& i : vinfo) {
@@ -5155,8 +5812,12 @@ bool DumpMempool(void)
 
         file << mapDeltas;
         FileCommit(file.Get());
+        long nSize = ftell(file.Get());
         file.fclose();
         RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
+        if (fJournal && !mempooljournal.Open(GetDataDir() / "mempool.journal", nonce, std::max(nSize, 0L))) {
+            LogPrintf("Failed to start mempool journal. Continuing anyway.\n");
+        }
         int64_t last = GetTimeMicros();
         LogPrintf("Dumped mempool: %gs to copy, %gs to dump\n", (mid-start)*MICRO, (last-mid)*MICRO);
     } catch (const std::exception& e) {
@@ -5166,6 +5827,44 @@ bool DumpMempool(void)
     return true;
 }
 
+bool DumpMempool(void)
+{
+    LOCK(cs_mempooldump);
+    return DumpMempool(Params(), false);
+}
+
+bool StartMempoolJournal(void)
+{
+    LOCK(cs_mempooldump);
+    return DumpMempool(Params(), true);
+}
+
+void FlushMempoolJournal(void)
+{
+    const CChainParams& chainparams = Params();
+    LOCK(cs_mempooldump);
+    if (!mempooljournal.IsRecording())
+        return;
+    // The file missed changes if writing it failed; start over from a new dump
+    if (!mempooljournal.IsOpen()) {
+        DumpMempool(chainparams, false);
+        return;
+    }
+    {
+        LOCK2(cs_main, mempool.cs);
+        mempooljournal.Checkpoint(GetMempoolScriptFlags(chainparams), mempool.mapDeltas);
+    }
+    if (!mempooljournal.Write() || mempooljournal.NeedsCompaction()) {
+        DumpMempool(chainparams, false);
+    }
+}
+
+void StopMempoolJournal(void)
+{
+    LOCK(cs_mempooldump);
+    mempooljournal.Stop();
+}
+
 //! Guess how far we are in the verification process at the given block index
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pindex) {
     if (pindex == nullptr)
@@ -22,6 +22,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -30,19 +31,27 @@
 
 #include <atomic>
 
+class CAutoFile;
+class CBlockFileCache;
 class CBlockIndex;
+class CBlockPipeline;
 class CBlockTreeDB;
 class CChainParams;
+class CCoinsViewBackgroundFlush;
 class CCoinsViewDB;
 class CInv;
 class CConnman;
+struct CDiskTxPos;
 class CScriptCheck;
+template <typename T> class CCheckQueueControl;
+class CTxOutSnapshotHeader;
 class CBlockPolicyEstimator;
 class CTxMemPool;
 class CValidationState;
 struct ChainTxData;
 
 struct PrecomputedTransactionData;
+struct SigCacheStats;
 struct LockPoints;
 
 /** Default for -whitelistrelay. */
@@ -82,6 +91,9 @@ static const int MAX_SCRIPTCHECK_THREADS = 16;
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Upper bound for the per-peer download window, which grows beyond MAX_BLOCKS_IN_TRANSIT_PER_PEER for
+ *  peers whose round-trip time is long compared to how fast they deliver blocks (e.g. over Tor). */
+static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER_ADAPTIVE = 128;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -129,6 +141,8 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 /** Default for -permitbaremultisig */
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
+/** Default for -assumevalidstake */
+static const bool DEFAULT_ASSUME_VALID_STAKE = true;
 static const bool DEFAULT_TXINDEX = true;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
@@ -192,6 +206,9 @@ extern bool fEnableReplacement;
 /** Block hash whose ancestors we will assume to have valid scripts without checking them. */
 extern uint256 hashAssumeValid;
 
+/** Whether those ancestors are also assumed to have valid coinstake signatures and rewards. */
+extern bool fAssumeValidStake;
+
 /** Minimum work we will assume exists on some valid chain. */
 extern arith_uint256 nMinimumChainWork;
 
@@ -206,6 +223,8 @@ static const uint64_t nMinDiskSpace = 52428800;
 extern bool fHavePruned;
 /** True if we're running in -prune mode. */
 extern bool fPruneMode;
+/** True if the chain state was loaded from a UTXO snapshot; the blocks below it are missing as if pruned. */
+extern bool fTxOutSnapshot;
 /** Number of MiB of block files that we're trying to stay below. */
 extern uint64_t nPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
@@ -273,6 +292,8 @@ FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = nullptr);
+/** Have the blocks ActivateBestChain is about to connect read ahead by pipeline, or stop if it's null. */
+void SetBlockPrefetch(CBlockPipeline* pipeline);
 /** Ensures we have a genesis block in the block tree, possibly writing one to disk. */
 bool LoadGenesisBlock(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk,
@@ -282,12 +303,16 @@ bool LoadBlockIndex(const CChainParams& chainparams);
 bool LoadChainTip(const CChainParams& chainparams);
 /** Unload database information */
 void UnloadBlockIndex();
+/** Load a UTXO set snapshot, and the block index up to its block, into a node that has no blocks but the genesis block. */
+bool LoadTxOutSnapshot(const CChainParams& chainparams, CAutoFile& file, CTxOutSnapshotHeader& header, std::string& strFailReason);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256& hash, CTransactionRef& tx, const Consensus::Params& params, uint256& hashBlock, bool fAllowSlow = false, CBlockIndex* blockIndex = nullptr);
+/** Read a transaction found through the transaction index, with the header of its block and its position */
+bool ReadTxFromIndex(CBlockTreeDB& blocktree, const uint256& hash, CTransactionRef& tx, CBlockHeader& header, CDiskTxPos& postx);
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams, std::shared_ptr<const CBlock> pblock = std::shared_ptr<const CBlock>());
 
@@ -311,6 +336,8 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune);
 void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
+/** Copy the block index to a flat file that loads faster at the next start; see CBlockTreeDB. */
+bool WriteBlockIndexSnapshot();
 /** Prune block files up to a given height */
 void PruneBlockFilesManual(int nManualPruneHeight);
 
@@ -320,6 +347,20 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
                         bool bypass_limits, const CAmount nAbsurdFee);
 
+/**
+ * Verify the input scripts of a transaction about to be given to
+ * AcceptToMemoryPool without holding cs_main, on the script check threads
+ * when it has several inputs, storing its signatures in the signature cache.
+ * AcceptToMemoryPool then finds them there instead of verifying them under
+ * the lock. Only the coins are looked up under cs_main, and transactions
+ * AcceptToMemoryPool would reject before checking their scripts are skipped.
+ *
+ * @return false, with state filled in as AcceptToMemoryPool would, if the
+ *         scripts are invalid; the caller should then reject the transaction
+ *         without handing it to AcceptToMemoryPool to verify again
+ */
+bool PreVerifyTransaction(const CTransactionRef& ptx, CValidationState& state);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -400,8 +441,35 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Verifies the coinstake input scripts of a PoS block extending the tip on
+ * the script check threads while in scope, so that it overlaps with the
+ * check of the block signature. The signatures are stored in the signature
+ * cache, where CheckProofOfStake and ConnectBlock find them. Only meant for
+ * blocks that passed the rest of CheckBlock, so that a malformed block costs
+ * no signature checks.
+ */
+class CStakeSignatureCheck
+{
+private:
+    std::unique_ptr<PrecomputedTransactionData> txdata;
+    std::vector<CScriptCheck> vChecks;
+    std::unique_ptr<CCheckQueueControl<CScriptCheck>> control;
+
+public:
+    explicit CStakeSignatureCheck(const CBlock& block);
+    ~CStakeSignatureCheck();
+
+    //! Whether any check was queued
+    bool IsQueued() const { return control != nullptr; }
+};
+
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
+/** Resize the script-execution cache to about nBytes, keeping the entries that fit */
+size_t ResizeScriptExecutionCache(size_t nBytes);
+/** Size and hit, miss and eviction counts of the script-execution cache */
+SigCacheStats GetScriptExecutionCacheStats();
 
 
 /** Functions for disk access for blocks */
@@ -411,7 +479,9 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
 /** Functions for validating blocks and updating the block tree */
 
 /** Context-independent validity checks */
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true);
+/** Without fCheckSignature, the signature of a PoS block is left to the caller and the block isn't marked checked */
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSignature = true);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fProofOfStake = false);
@@ -419,6 +489,12 @@ bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams,
 /** Check whether witness commitments are required for block. */
 bool IsWitnessEnabled(const CBlockIndex* pindexPrev, const Consensus::Params& params);
 
+/** Whether ConnectBlock verifies the scripts of pindex, or -assumevalid lets it skip them (requires cs_main). */
+bool ScriptChecksRequired(const CBlockIndex* pindex, const CChainParams& chainparams);
+
+/** Whether ConnectBlock verifies the coinstake signature and reward of pindex (see -assumevalidstake, requires cs_main). */
+bool StakeChecksRequired(const CBlockIndex* pindex, const CChainParams& chainparams);
+
 /** When there are blocks in the active chain with missing data, rewind the chainstate and remove them from the block index */
 bool RewindBlockIndex(const CChainParams& params);
 
@@ -460,12 +536,18 @@ extern CChain& chainActive;
 /** Global variable that points to the coins database (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 
+/** Global variable that points to the layer writing flushed coins to pcoinsdbview (protected by cs_main) */
+extern std::unique_ptr<CCoinsViewBackgroundFlush> pcoinsflush;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern std::unique_ptr<CBlockTreeDB> pblocktree;
 
+/** Global variable through which the block and undo files are read */
+extern CBlockFileCache g_blockfilecache;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -497,6 +579,14 @@ bool DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/** Dump the mempool to disk, and keep a journal of its changes from then on. */
+bool StartMempoolJournal();
+
+/** Append the mempool's changes to its journal, compacting it into a new dump once it grew large. */
+void FlushMempoolJournal();
+
+void StopMempoolJournal();
+
 bool GetCoinAge(uint64_t& nCoinAge, const CTransaction *tx);
 
 CAmount GetProofOfStakeReward(int64_t nCoinAge, const CBlockIndex* pindex);
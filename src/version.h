@@ -9,7 +9,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 80015;
+static const int PROTOCOL_VERSION = 80016;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 31402;
@@ -42,4 +42,7 @@ static const int SHORT_IDS_BLOCKS_VERSION = 70014;
 //! not banning for invalid compact blocks starts with this version
 static const int INVALID_CB_NO_BAN_VERSION = 70015;
 
+//! cmpctblocks carrying the PoS block signature and a prefilled coinstake start with this version
+static const int POS_CMPCT_BLOCKS_VERSION = 80016;
+
 #endif // BITCOIN_VERSION_H
@@ -3464,30 +3464,14 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     	CTransactionRef txPrevRef;
         CBlockIndex* pBlockFrom = nullptr;
     	unsigned int nTxPrevOffset = 0;
-    	if (pblocktree->ReadTxIndex(pcoin.first->GetHash(), txindex))
+    	CBlockHeader headerPrev;
+    	if (ReadTxFromIndex(*pblocktree, pcoin.first->GetHash(), txPrevRef, headerPrev, txindex))
     	{
-    		CBlockHeader headerPrev;
     		nTxPrevOffset = txindex.nTxOffset + 80;	// nTxOffset counts after header
-            CAutoFile file(OpenBlockFile(txindex, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-            {
-                LogPrint(BCLog::POS, "CreateCoinStake(): file.IsNull().\n");
-            	return false;
-            }
-            try {
-                file >> headerPrev;
-                fseek(file.Get(), txindex.nTxOffset, SEEK_CUR);
-                CMutableTransaction txPrev0;
-                txPrev0.Unserialize(file);
-                txPrevRef = MakeTransactionRef(std::move(txPrev0));
-
-                uint256 hashPrev = headerPrev.GetHash();
-                BlockMap::iterator mi = mapBlockIndex.find(hashPrev);
-                if (mi != mapBlockIndex.end()) {
-                	pBlockFrom = mi->second;
-                }
-            } catch (const std::exception& e) {
-            	continue;
+            uint256 hashPrev = headerPrev.GetHash();
+            BlockMap::iterator mi = mapBlockIndex.find(hashPrev);
+            if (mi != mapBlockIndex.end()) {
+            	pBlockFrom = mi->second;
             }
     	}
     	else
@@ -3534,7 +3518,7 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             uint256 targetProofOfStake;
             COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
             CValidationState state;
-            if (CheckStakeKernelHash(nBits, pblockindex, state, txPrevRef, nTxPrevOffset, prevoutStake, txNew.nTime - n, hashProofOfStake, targetProofOfStake, LogAcceptCategory(BCLog::POS)))
+            if (CheckStakeKernelHash(nBits, pblockindex, state, txPrevRef->nTime, txPrevRef->vout[pcoin.second].nValue, nTxPrevOffset, prevoutStake, txNew.nTime - n, hashProofOfStake, targetProofOfStake, LogAcceptCategory(BCLog::POS)))
             {
                 // Found a kernel
             	LogPrint(BCLog::POS, "CreateCoinStake : kernel found\n");